@@ -0,0 +1,31 @@
+/**
+ * @file
+ *
+ * \brief  Example client
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "net/client.hpp"
+#include <string>
+#include <chrono>
+#include <thread>
+
+
+int main()
+{
+  const std::string validation_salt = "Blektr!";
+  const int port = 1234;
+  const float timeout = 3.0;
+
+  net::NetClient client(validation_salt);
+  client.init();
+  client.connect("localhost", port, timeout);
+
+  while (true) {
+    client.handle_events();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  }
+
+  return 0;
+}
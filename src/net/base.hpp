@@ -9,60 +9,31 @@
 #ifndef NET__BASE_HPP
 #define NET__BASE_HPP
 
+#include "host.hpp"
+#include "basic_host.hpp"
 #include "packet.hpp"
 #include "enet/enet.h"
-#include <memory>
 #include <string>
 
 
 namespace net
 {
 
-/// Convenience class handling a host
-class NetHost
-{
-  public:
-    NetHost();
-    ~NetHost();
+class NetBase;
 
-    /**
-     * \brief  Creates a host for communicating to peers.
-     *
-     * \param address            The address at which other peers may connect to this host.  If NULL, then no peers may connect to the host.
-     * \param peerCount          The maximum number of peers that should be allocated for the host.
-     * \param channelLimit       The maximum number of channels allowed; if 0, then this is equivalent to ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT
-     * \param incomingBandwidth  Downstream bandwidth of the host in bytes/second; if 0, ENet will assume unlimited bandwidth.
-     * \param outgoingBandwidth  Upstream bandwidth of the host in bytes/second; if 0, ENet will assume unlimited bandwidth.
-     * \return  Whether the host could be created
-     *
-     * \remarks ENet will strategically drop packets on specific sides of a connection between hosts
-     * to ensure the host's bandwidth is not overwhelmed.  The bandwidth parameters also determine
-     * the window size of a connection which limits the amount of reliable packets that may be in transit
-     * at any given time.
-     */
-    bool create(
-      const ENetAddress *address,
-      size_t peerCount,
-      size_t channelLimit,
-      enet_uint32 incomingBandwidth,
-      enet_uint32 outgoingBandwidth
-    );
-
-    /// Destroys the host and all resources associated with it
-    void destroy();
-
-    /// Returns a reference to the ENet host
-    ENetHost* get();
-
-  private:
-    bool is_host_created_;  ///< Whether the host has already been created
-    ENetHost* host_;        ///< Reference to the ENet host object
-};
+/// Host of the virtual classes, whose validation is handled by NetServer and NetClient
+using NetBaseHost = BasicNetHost<NetBase, policy::Recording>;
 
 
-/// Base networking class using ENet library
-class NetBase
+/**
+ * \brief  Base networking class using ENet library
+ *
+ * Thin adapter dispatching the events of BasicNetHost to virtual callbacks.
+ */
+class NetBase: public NetBaseHost
 {
+  friend NetBaseHost;
+
   public:
     /**
      * \param validation_salt  Used to scramble the validation string, should be common to all peers
@@ -72,24 +43,23 @@ class NetBase
     /// Initialises networking and the connection, returns whether it was successful
     virtual bool init();
 
-    /// Handles events
+    /// Handles events, then does the periodic work of the host
     virtual void handle_events();
 
-    /// Returns a pointer to the ENet host
-    ENetHost* get_host();
-
     /**
-     * \brief  Sends a packet to a peer
+     * \brief  Does the periodic work of the host besides handling events (nothing by default)
      *
-     * \param peer        Peer who should be sent the packet
-     * \param packet      Message to send
-     * \param channel_id  ENet channel on which to send
+     * Called by handle_events, and at each tick by the schedulers servicing the
+     * host through service instead (see TickScheduler).
      */
-    void send_packet(ENetPeer *peer, const Packet &packet, int channel_id);
+    virtual void update();
+
+    /// Sets whether information about each event should be printed
+    void set_verbose(bool verbose);
 
   protected:
-    NetHost host_;  ///< Host managing connections
     const std::string validation_salt_;  ///< Used to scramble the validation string
+    bool verbose_;                       ///< Whether to print information about each event
 
     /// Called when a connection has been established
     virtual void connect_cb(ENetEvent &event) = 0;
@@ -0,0 +1,613 @@
+/**
+ * @file
+ *
+ * \brief  Policy-based networking class with statically dispatched callbacks
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * The derived class declares the callbacks it needs, which are called directly
+ * (and can be inlined) by the event loop:
+ *
+ *     class GameServer: public net::BasicNetHost<GameServer,
+ *       net::policy::PuzzleValidation,
+ *       net::policy::Logging<net::policy::LogLevel::NONE>
+ *     >
+ *     {
+ *       friend BasicNetHost;
+ *
+ *       void receive_cb(ENetEvent &event) { ... }
+ *     };
+ *
+ * Available callbacks (all optional): connect_cb(ENetEvent&), disconnect_cb(ENetEvent&),
+ * receive_cb(ENetEvent&), no_event_cb(), validated_cb(ENetPeer*),
+ * shared_memory_cb(ENetPeer*) and clock_sync_cb(ENetPeer*). Received packets are only handed over to receive_cb
+ * once the validation policy let them through.
+ */
+
+#ifndef NET__BASIC_HOST_HPP
+#define NET__BASIC_HOST_HPP
+
+#include "host.hpp"
+#include "policies.hpp"
+#include "packet.hpp"
+#include "buffer_pool.hpp"
+#include "recorder.hpp"
+#include "enet_allocator.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+
+namespace net
+{
+
+/**
+ * \brief  Networking class dispatching events to a derived class at compile time
+ *
+ * \tparam Derived   Class implementing the callbacks
+ * \tparam Policies  Validation, logging, delivery, recording, transport, clock and MTU policies (see policies.hpp)
+ */
+template <typename Derived, typename... Policies>
+class BasicNetHost
+{
+  public:
+    using Validation = typename policy::find<
+      policy::validation_kind, policy::NoValidation, Policies...
+    >::type;
+    using Logging = typename policy::find<
+      policy::logging_kind, policy::Logging<policy::LogLevel::ERROR>, Policies...
+    >::type;
+    using Delivery = typename policy::find<
+      policy::delivery_kind, policy::Delivery<>, Policies...
+    >::type;
+    using Recording = typename policy::find<
+      policy::recording_kind, policy::NoRecording, Policies...
+    >::type;
+    using Transport = typename policy::find<
+      policy::transport_kind, policy::NetworkTransport, Policies...
+    >::type;
+    using Clock = typename policy::find<
+      policy::clock_kind, policy::NoClockSync, Policies...
+    >::type;
+    using Mtu = typename policy::find<
+      policy::mtu_kind, policy::NoMtuDiscovery, Policies...
+    >::type;
+    using LogLevel = policy::LogLevel;
+
+    BasicNetHost():
+      buffer_pool_(Mtu::MAX_MTU, 64),
+      encoding_(Packet::Encoding::PORTABLE_BINARY),
+      listening_(false),
+      offline_(false)
+    {
+
+    }
+
+    /// Initialises ENet with the allocator recycling its blocks (see EnetAllocator), returns whether it was successful
+    bool init()
+    {
+      if (!EnetAllocator::install()) {
+        log<LogLevel::ERROR>("An error occurred while initializing ENet\n");
+        return false;
+      }
+      atexit(enet_deinitialize);
+
+      return true;
+    }
+
+    /**
+     * \brief  Initialises ENet without any host, to dispatch recorded events (see tools/replay.cpp)
+     *
+     * The events are then only given to the validation policy and the callbacks:
+     * the transport, clock and MTU policies are skipped, and the packets sent with
+     * send_raw_packet are dropped. The peers of the events should be left
+     * disconnected, so that the calls to ENet on them do nothing.
+     *
+     * \return  Whether ENet could be initialised
+     */
+    bool init_offline()
+    {
+      if (!BasicNetHost::init())
+        return false;
+
+      offline_ = true;
+
+      return true;
+    }
+
+    /// Returns whether the host only dispatches recorded events (see init_offline)
+    bool is_offline() const
+    {
+      return offline_;
+    }
+
+    /**
+     * \brief  Creates a host accepting connections
+     *
+     * \param port           Port used by the peers to connect
+     * \param peer_count     Maximal number of peers
+     * \param channel_count  Number of channels
+     * \return  Whether the host could be created
+     */
+    bool listen(int port, size_t peer_count, size_t channel_count)
+    {
+      ENetAddress address;
+      address.host = ENET_HOST_ANY;
+      address.port = port;
+
+      listening_ = host_.create(&address, peer_count, channel_count, 0, 0, socket_options_);
+
+      if (!listening_) {
+        log<LogLevel::ERROR>("An error occurred while trying to create an ENet server host.\n");
+        return false;
+      }
+
+      mtu_.attach(host_);
+
+      return true;
+    }
+
+    /**
+     * \brief  Creates a host only initiating connections
+     *
+     * \param peer_count     Maximal number of peers
+     * \param channel_count  Number of channels
+     * \return  Whether the host could be created
+     */
+    bool open(size_t peer_count, size_t channel_count)
+    {
+      listening_ = false;
+
+      if (!host_.create(nullptr, peer_count, channel_count, 0, 0, socket_options_)) {
+        log<LogLevel::ERROR>("An error occurred while trying to create an ENet client host.\n");
+        return false;
+      }
+
+      mtu_.attach(host_);
+
+      return true;
+    }
+
+    /**
+     * \brief  Initiates connection to a given host
+     *
+     * \param host           Hostname or IP address of the host to connect to
+     * \param port           Destination port
+     * \param channel_count  Number of channels to allocate
+     * \return  The peer, or nullptr if the connection could not be initiated
+     */
+    ENetPeer* connect(const std::string &host, int port, size_t channel_count)
+    {
+      ENetAddress address;
+      enet_address_set_host(&address, host.c_str());
+      address.port = port;
+
+      return enet_host_connect(host_.get(), &address, channel_count, 0);
+    }
+
+    /// Sets the socket layer used by the host, to be called before creating it
+    void set_socket_options(const SocketOptions &socket_options)
+    {
+      socket_options_ = socket_options;
+    }
+
+    /// Returns whether the host accepts connections (and thus validates its peers)
+    bool is_listening() const
+    {
+      return listening_;
+    }
+
+    /// Handles events
+    void handle_events()
+    {
+      ENetEvent event;
+
+      while (enet_host_service(host_.get(), &event, 0) > 0)
+      {
+        recording_.record(event);
+        dispatch_event(event);
+      }
+
+      transport_.poll(*this, SIZE_MAX, [this](ENetEvent &message) {
+        recording_.record(message);
+        dispatch_event(message);
+      });
+      clock_.poll(*this);
+      mtu_.poll(*this);
+    }
+
+    /**
+     * \brief  Handles events within a budget
+     *
+     * Stops as soon as either of the limits is reached. The remaining events are
+     * carried over to the next call.
+     *
+     * \param max_events  Maximal number of events to handle
+     * \param budget      Maximal duration to spend handling events
+     * \return  Number of events handled
+     */
+    size_t service(size_t max_events, std::chrono::steady_clock::duration budget)
+    {
+      const auto deadline = std::chrono::steady_clock::now() + budget;
+      size_t event_count = 0;
+      ENetEvent event;
+
+      while (event_count < max_events && enet_host_service(host_.get(), &event, 0) > 0)
+      {
+        recording_.record(event);
+        dispatch_event(event);
+        event_count++;
+
+        if (std::chrono::steady_clock::now() >= deadline)
+          return event_count;
+      }
+
+      if (event_count < max_events) {
+        event_count += transport_.poll(*this, max_events - event_count, [this](ENetEvent &message) {
+          recording_.record(message);
+          dispatch_event(message);
+        });
+      }
+
+      clock_.poll(*this);
+      mtu_.poll(*this);
+
+      return event_count;
+    }
+
+    /**
+     * \brief  Waits until a datagram is received, or a message from shared memory
+     *
+     * Does not handle the events, to be followed by handle_events or service.
+     *
+     * \param timeout  Maximal duration to wait
+     * \return  Whether a datagram or a message is available
+     */
+    bool wait(std::chrono::milliseconds timeout)
+    {
+      return transport_.wait(host_.get(), timeout.count());
+    }
+
+    /// Returns the number of received events still waiting to be dispatched
+    size_t get_backlog()
+    {
+      ENetList *queue = &host_.get()->dispatchQueue;
+      size_t event_count = 0;
+
+      // The dispatch list is the first member of the peers in the queue
+      for (ENetListIterator node = enet_list_begin(queue); node != enet_list_end(queue); node = enet_list_next(node)) {
+        ENetPeer *peer = reinterpret_cast<ENetPeer*>(node);
+
+        // A connection or a disconnection, else one event per packet ready to be received
+        if (peer->state == ENET_PEER_STATE_CONNECTION_SUCCEEDED || peer->state == ENET_PEER_STATE_ZOMBIE)
+          event_count++;
+        else
+          event_count += enet_list_size(&peer->dispatchedCommands);
+      }
+
+      return event_count;
+    }
+
+    /**
+     * \brief  Dispatches an event to the corresponding callback
+     *
+     * Takes ownership of the packet of receive events.
+     */
+    void dispatch_event(ENetEvent &event)
+    {
+      switch (event.type)
+      {
+        case ENET_EVENT_TYPE_CONNECT: {
+          log<LogLevel::INFO>(
+            "Peer connected from %x:%u.\n",
+            event.peer->address.host,
+            (unsigned int)event.peer->address.port
+          );
+
+          if (!offline_) {
+            transport_.reset(event.peer);
+            clock_.reset(event.peer);
+            mtu_.reset(*this, event.peer);
+          }
+
+          bool validated = validation_.connect(*this, event.peer);
+          derived().connect_cb(event);
+
+          if (validated)
+            on_validated(event.peer);
+
+          break;
+        }
+
+        case ENET_EVENT_TYPE_RECEIVE:
+          log<LogLevel::DEBUG>(
+            "New packet (length=%u, channel=%u)\n",
+            (unsigned int)event.packet->dataLength,
+            (unsigned int)event.channelID
+          );
+
+          if ((offline_ || (!transport_.receive(*this, event) && !clock_.receive(*this, event)))
+            && !validation_.receive(*this, event)
+          ) {
+            const int64_t start_time = clock_.now();
+            derived().receive_cb(event);
+            clock_.record_processing(event.peer, start_time);
+          }
+
+          enet_packet_destroy(event.packet);
+          break;
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+          log<LogLevel::INFO>(
+            "Peer %x:%u disconnected.\n",
+            event.peer->address.host,
+            (unsigned int)event.peer->address.port
+          );
+
+          if (!offline_) {
+            transport_.disconnect(*this, event.peer, [this](ENetEvent &message) {
+              recording_.record(message);
+              dispatch_event(message);
+            });
+            clock_.disconnect(event.peer);
+            mtu_.disconnect(event.peer);
+          }
+
+          validation_.disconnect(event.peer);
+          derived().disconnect_cb(event);
+          event.peer->data = nullptr;
+          break;
+
+        case ENET_EVENT_TYPE_NONE:
+          derived().no_event_cb();
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    /**
+     * \brief  Sets the recorder to which all events and sent packets are appended
+     *
+     * Only available with the policy::Recording policy.
+     *
+     * \param recorder  Recorder to use, or nullptr to stop recording
+     */
+    void set_recorder(EventRecorder *recorder)
+    {
+      recording_.set_recorder(recorder);
+    }
+
+    /// Sets the encoding of the packets sent (received packets are always decoded)
+    void set_encoding(Packet::Encoding encoding)
+    {
+      encoding_ = encoding;
+    }
+
+    /// Returns a pointer to the ENet host
+    ENetHost* get_host()
+    {
+      return host_.get();
+    }
+
+    /// Returns the host managing connections
+    NetHost& get_net_host()
+    {
+      return host_;
+    }
+
+    /**
+     * \brief  Sends a packet to a peer
+     *
+     * \param peer        Peer who should be sent the packet
+     * \param packet      Message to send
+     * \param channel_id  ENet channel on which to send
+     */
+    void send_packet(ENetPeer *peer, const Packet &packet, int channel_id)
+    {
+      packet.serialise(send_buffer_, encoding_);
+      send_buffer_.push_back('\0');
+      clock_.stamp(send_buffer_);
+
+      send_raw_packet(peer, create_packet(send_buffer_.data(), send_buffer_.size(), Delivery::flags), channel_id);
+    }
+
+    /// Sends a packet to a peer, on the default channel of the delivery policy
+    void send_packet(ENetPeer *peer, const Packet &packet)
+    {
+      send_packet(peer, packet, Delivery::channel);
+    }
+
+    /**
+     * \brief  Sends raw data to a peer, with the defaults of the delivery policy
+     *
+     * The data is copied into a pooled buffer when it fits.
+     *
+     * \param peer    Peer who should be sent the data
+     * \param data    Data to send
+     * \param length  Length of the data
+     */
+    void send(ENetPeer *peer, const void *data, size_t length)
+    {
+      send_raw_packet(peer, create_packet(data, length, Delivery::flags), Delivery::channel);
+    }
+
+    /**
+     * \brief  Creates an ENet packet holding a copy of some data
+     *
+     * The data is copied into a pooled buffer when it fits.
+     *
+     * \param data    Data of the packet
+     * \param length  Length of the data
+     * \param flags   ENet packet flags
+     * \return  The packet, or nullptr if it could not be created
+     */
+    ENetPacket* create_packet(const void *data, size_t length, enet_uint32 flags)
+    {
+      if (length > buffer_pool_.get_buffer_size())
+        return enet_packet_create(data, length, flags);
+
+      uint8_t *buffer = buffer_pool_.acquire();
+      memcpy(buffer, data, length);
+
+      return buffer_pool_.create_packet(buffer, length, flags);
+    }
+
+    /**
+     * \brief  Sends an already built ENet packet to a peer
+     *
+     * Takes ownership of the packet, unless a reference to it is held (see
+     * ENetPacket::referenceCount), so that a packet can be sent to several peers.
+     *
+     * \param peer        Peer who should be sent the packet
+     * \param packet      Packet to send, for instance built by a schema::Builder
+     * \param channel_id  ENet channel on which to send
+     */
+    void send_raw_packet(ENetPeer *peer, ENetPacket *packet, int channel_id)
+    {
+      if (packet == nullptr)
+        return;
+
+      recording_.record_outbound(peer, channel_id, packet);
+
+      if (offline_) {
+        if (packet->referenceCount == 0)
+          enet_packet_destroy(packet);
+        return;
+      }
+
+      if (transport_.send(peer, channel_id, packet))
+        return;
+
+      mtu_.count_sent(*this, peer, packet->dataLength);
+
+      if (enet_peer_send(peer, channel_id, packet) < 0 && packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+    }
+
+    /// Returns the pool of buffers used to build outbound messages in place
+    BufferPool& get_buffer_pool()
+    {
+      return buffer_pool_;
+    }
+
+    /// Returns the validation policy, for instance to configure it
+    Validation& get_validation()
+    {
+      return validation_;
+    }
+
+    /// Returns whether a peer has been validated
+    bool is_validated(const ENetPeer *peer) const
+    {
+      return validation_.is_validated(peer);
+    }
+
+    /// Returns the transport policy, for instance to configure it
+    Transport& get_transport()
+    {
+      return transport_;
+    }
+
+    /// Returns the clock policy, for instance to read the clock estimates and delays of a peer
+    Clock& get_clock()
+    {
+      return clock_;
+    }
+
+    /// Returns the MTU policy, for instance to read the fragmentation rate
+    Mtu& get_mtu()
+    {
+      return mtu_;
+    }
+
+    /**
+     * \brief  Returns the largest packet sent to a peer in a single datagram
+     *
+     * Larger packets are fragmented by ENet, and lost if any fragment is lost. To
+     * be compared with the length given to send or send_raw_packet; send_packet
+     * adds the encoding of the packet to its data.
+     */
+    size_t get_max_payload(const ENetPeer *peer) const
+    {
+      return PathMtuProber::get_max_payload(host_.get(), peer);
+    }
+
+    /**
+     * \brief  Offers shared memory to a peer, if the transport policy supports it
+     *
+     * The messages to the peer go through shared memory once it accepted, if it
+     * is on the same machine.
+     *
+     * \return  Whether shared memory was offered
+     */
+    bool offer_shared_memory(ENetPeer *peer)
+    {
+      return transport_.offer(*this, peer);
+    }
+
+    /// Called by the transport policy when a peer offers shared memory
+    bool accepts_shared_memory(ENetPeer *peer)
+    {
+      return derived().shared_memory_cb(peer);
+    }
+
+    /// Called by the clock policy to know whether a peer may be probed, and its probes answered
+    bool accepts_clock_sync(ENetPeer *peer)
+    {
+      return derived().clock_sync_cb(peer);
+    }
+
+    /// Prints a message if its level is enabled by the logging policy
+    template <LogLevel Level, typename... Args>
+    static void log(const char *format, Args... args)
+    {
+      Logging::template log<Level>(format, args...);
+    }
+
+    /// Called by the validation policy when a peer has been validated
+    void on_validated(ENetPeer *peer)
+    {
+      log<LogLevel::INFO>("Peer validated!\n");
+      derived().validated_cb(peer);
+    }
+
+  protected:
+    // The pool has to outlive the host: destroying the host frees the packets
+    // still queued, giving their buffers back to the pool
+    BufferPool buffer_pool_;     ///< Buffers used to build outbound messages in place
+    NetHost host_;               ///< Host managing connections
+    Packet::Encoding encoding_;  ///< Encoding of the packets sent
+    std::string send_buffer_;    ///< Serialised data of the last packet sent, reused to avoid allocating
+    Validation validation_;      ///< Validation of the peers
+    Recording recording_;        ///< Recording of the events
+    Transport transport_;        ///< Transport of the messages to the peers
+    Clock clock_;                ///< Clocks of the peers and delays of the messages
+    Mtu mtu_;                    ///< MTU of the peers
+    bool listening_;             ///< Whether the host accepts connections
+    bool offline_;               ///< Whether the host only dispatches recorded events, without any network
+    SocketOptions socket_options_;  ///< Socket layer used by the host
+
+    // Default callbacks, hidden by the ones of the derived class
+    void connect_cb(ENetEvent &) {}
+    void disconnect_cb(ENetEvent &) {}
+    void receive_cb(ENetEvent &) {}
+    void no_event_cb() {}
+    void validated_cb(ENetPeer *) {}
+    bool shared_memory_cb(ENetPeer *peer) { return is_validated(peer); }
+    bool clock_sync_cb(ENetPeer *peer) { return is_validated(peer); }
+
+  private:
+    Derived& derived()
+    {
+      return static_cast<Derived&>(*this);
+    }
+};
+
+}  // namespace net
+
+#endif
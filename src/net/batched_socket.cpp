@@ -0,0 +1,610 @@
+/**
+ * @file
+ *
+ * \brief  Socket backend batching the datagrams of ENet hosts (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "batched_socket.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <shared_mutex>
+#include <mutex>
+
+#include <cstring>
+#include <stdio.h>
+
+#ifdef NET_HAS_BATCHED_SOCKETS
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+
+namespace net
+{
+
+#ifdef NET_HAS_BATCHED_SOCKETS
+
+/// Batched sockets, indexed by file descriptor
+static std::vector<BatchedSocket*> batched_sockets;
+
+/// Guards batched_sockets, as hosts may run on several threads (a socket is only used by the thread of its host)
+static std::shared_mutex batched_sockets_mutex;
+
+/// Maximal size of a UDP payload, and thus of a GRO or GSO buffer
+static const size_t MAX_UDP_PAYLOAD = 65507;
+
+/// Maximal number of segments in a GSO buffer (UDP_MAX_SEGMENTS in the kernel)
+static const size_t MAX_GSO_SEGMENTS = 64;
+
+
+struct BatchedSocket::SystemBuffers
+{
+  /// Size of the control data of each message (in 8-byte words)
+  static constexpr size_t CONTROL_SIZE = (CMSG_SPACE(sizeof(int)) + 7) / 8;
+
+  std::vector<mmsghdr> receive_messages;
+  std::vector<iovec> receive_iovecs;
+  std::vector<sockaddr_in> receive_addresses;
+  std::vector<uint64_t> receive_controls;
+
+  std::vector<mmsghdr> send_messages;
+  std::vector<iovec> send_iovecs;
+  std::vector<sockaddr_in> send_addresses;
+  std::vector<uint64_t> send_controls;
+  std::vector<size_t> send_counts;  ///< Number of datagrams in each sent message
+};
+
+
+BatchedSocket::BatchedSocket(ENetSocket socket, const SocketOptions &options):
+  socket_(socket),
+  options_(options),
+  system_(std::make_unique<SystemBuffers>()),
+  driver_(nullptr),
+  received_position_(0)
+{
+  options_.batch_size = std::max<size_t>(options_.batch_size, 1);
+
+  if (options_.gro) {
+    int enable = 1;
+
+    if (setsockopt(socket_, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) != 0) {
+      fprintf(stderr, "UDP GRO is not supported, receiving datagrams one by one\n");
+      options_.gro = false;
+    }
+  }
+
+  size_t batch_size = options_.batch_size;
+  receive_slot_size_ = options_.gro ? MAX_UDP_PAYLOAD : (size_t)ENET_PROTOCOL_MAXIMUM_MTU;
+  receive_buffers_.reset(new uint8_t[batch_size * receive_slot_size_]);
+  received_.reserve(options_.gro ? batch_size * MAX_GSO_SEGMENTS : batch_size);
+
+  send_buffers_.reset(new uint8_t[batch_size * ENET_PROTOCOL_MAXIMUM_MTU]);
+  queued_.reserve(batch_size);
+
+  // The message headers only depend on the slots, they are set up once
+  SystemBuffers &system = *system_;
+  system.receive_messages.resize(batch_size);
+  system.receive_iovecs.resize(batch_size);
+  system.receive_addresses.resize(batch_size);
+  system.receive_controls.resize(batch_size * SystemBuffers::CONTROL_SIZE);
+
+  for (size_t k = 0; k < batch_size; k++) {
+    system.receive_iovecs[k].iov_base = receive_buffers_.get() + k * receive_slot_size_;
+    system.receive_iovecs[k].iov_len = receive_slot_size_;
+  }
+
+  system.send_messages.resize(batch_size);
+  system.send_iovecs.resize(batch_size);
+  system.send_addresses.resize(batch_size);
+  system.send_controls.resize(batch_size * SystemBuffers::CONTROL_SIZE);
+  system.send_counts.resize(batch_size);
+
+  std::unique_lock lock(batched_sockets_mutex);
+
+  if ((size_t)socket_ >= batched_sockets.size())
+    batched_sockets.resize(socket_ + 1, nullptr);
+
+  batched_sockets[socket_] = this;
+}
+
+
+BatchedSocket::~BatchedSocket()
+{
+  set_driver(nullptr);
+  flush();
+
+  std::unique_lock lock(batched_sockets_mutex);
+
+  if ((size_t)socket_ < batched_sockets.size() && batched_sockets[socket_] == this)
+    batched_sockets[socket_] = nullptr;
+}
+
+
+bool BatchedSocket::is_available()
+{
+  return true;
+}
+
+
+BatchedSocket* BatchedSocket::find(ENetSocket socket)
+{
+  std::shared_lock lock(batched_sockets_mutex);
+
+  if (socket < 0 || (size_t)socket >= batched_sockets.size())
+    return nullptr;
+
+  return batched_sockets[socket];
+}
+
+
+int BatchedSocket::receive(ENetAddress *address, ENetBuffer *buffers, size_t buffer_count)
+{
+  if (received_position_ == received_.size() && !receive_batch())
+    return 0;
+
+  const Datagram &datagram = received_[received_position_++];
+  const uint8_t *data = datagram.data;
+  size_t remaining = datagram.length;
+
+  for (size_t k = 0; k < buffer_count && remaining > 0; k++) {
+    size_t length = std::min(remaining, buffers[k].dataLength);
+    memcpy(buffers[k].data, data, length);
+    data += length;
+    remaining -= length;
+  }
+
+  if (driver_ != nullptr)
+    driver_->release(datagram.buffer_id);
+
+  // Truncated datagrams are reported as errors, as ENet does
+  if (remaining > 0)
+    return -1;
+
+  if (address != nullptr)
+    *address = datagram.address;
+
+  return datagram.length;
+}
+
+
+bool BatchedSocket::receive_batch()
+{
+  SystemBuffers &system = *system_;
+  size_t batch_size = options_.batch_size;
+
+  received_.clear();
+  received_position_ = 0;
+
+  // The driver pushes the datagrams itself
+  if (driver_ != nullptr)
+    return false;
+
+  for (size_t k = 0; k < batch_size; k++) {
+    msghdr &header = system.receive_messages[k].msg_hdr;
+    header.msg_name = &system.receive_addresses[k];
+    header.msg_namelen = sizeof(sockaddr_in);
+    header.msg_iov = &system.receive_iovecs[k];
+    header.msg_iovlen = 1;
+    header.msg_control = options_.gro ? &system.receive_controls[k * SystemBuffers::CONTROL_SIZE] : nullptr;
+    header.msg_controllen = options_.gro ? SystemBuffers::CONTROL_SIZE * 8 : 0;
+    header.msg_flags = 0;
+  }
+
+  int count = recvmmsg(socket_, system.receive_messages.data(), batch_size, MSG_DONTWAIT, nullptr);
+
+  if (count <= 0)
+    return false;
+
+  stats_.receive_calls++;
+
+  for (int k = 0; k < count; k++) {
+    msghdr &header = system.receive_messages[k].msg_hdr;
+    size_t length = system.receive_messages[k].msg_len;
+
+    if (header.msg_flags & MSG_TRUNC)
+      continue;
+
+    ENetAddress address;
+    address.host = system.receive_addresses[k].sin_addr.s_addr;
+    address.port = ENET_NET_TO_HOST_16(system.receive_addresses[k].sin_port);
+
+    // With GRO, a buffer holds several datagrams of the same size (but the last)
+    size_t segment_size = length;
+
+    if (options_.gro) {
+      for (cmsghdr *control = CMSG_FIRSTHDR(&header); control != nullptr; control = CMSG_NXTHDR(&header, control)) {
+        if (control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO) {
+          int size;
+          memcpy(&size, CMSG_DATA(control), sizeof(size));
+          segment_size = size > 0 ? size : length;
+        }
+      }
+    }
+
+    for (size_t offset = 0; offset < length; offset += segment_size) {
+      Datagram datagram;
+      datagram.address = address;
+      datagram.data = receive_buffers_.get() + k * receive_slot_size_ + offset;
+      datagram.length = std::min(segment_size, length - offset);
+      datagram.buffer_id = 0;
+      received_.push_back(datagram);
+      stats_.received++;
+    }
+  }
+
+  return !received_.empty();
+}
+
+
+int BatchedSocket::send(const ENetAddress *address, const ENetBuffer *buffers, size_t buffer_count)
+{
+  size_t length = 0;
+
+  for (size_t k = 0; k < buffer_count; k++)
+    length += buffers[k].dataLength;
+
+  // ENet never builds datagrams larger than its maximal MTU
+  if (length > ENET_PROTOCOL_MAXIMUM_MTU)
+    return -1;
+
+  if (driver_ != nullptr) {
+    if (!driver_->send(socket_, *address, buffers, buffer_count))
+      stats_.send_errors++;
+
+    return length;
+  }
+
+  if (queued_.size() == options_.batch_size)
+    flush();
+
+  uint8_t *data = send_buffers_.get() + queued_.size() * ENET_PROTOCOL_MAXIMUM_MTU;
+
+  Datagram datagram;
+  datagram.address = *address;
+  datagram.data = data;
+  datagram.length = length;
+  datagram.buffer_id = 0;
+
+  for (size_t k = 0; k < buffer_count; k++) {
+    memcpy(data, buffers[k].data, buffers[k].dataLength);
+    data += buffers[k].dataLength;
+  }
+
+  queued_.push_back(datagram);
+
+  return length;
+}
+
+
+void BatchedSocket::flush()
+{
+  if (queued_.empty())
+    return;
+
+  SystemBuffers &system = *system_;
+  size_t message_count = 0;
+  std::vector<size_t> &datagram_counts = system.send_counts;
+
+  for (size_t k = 0; k < queued_.size();) {
+    const Datagram &first = queued_[k];
+    size_t end = k + 1;
+
+    // Runs of datagrams to the same peer, all of the same size but the last one
+    if (options_.gso) {
+      size_t total = first.length;
+
+      while (end < queued_.size()
+        && end - k < MAX_GSO_SEGMENTS
+        && queued_[end].address.host == first.address.host
+        && queued_[end].address.port == first.address.port
+        && queued_[end].length <= first.length
+        && queued_[end - 1].length == first.length
+        && total + queued_[end].length <= MAX_UDP_PAYLOAD
+      ) {
+        total += queued_[end].length;
+        end++;
+      }
+    }
+
+    for (size_t i = k; i < end; i++) {
+      system.send_iovecs[i].iov_base = const_cast<uint8_t*>(queued_[i].data);
+      system.send_iovecs[i].iov_len = queued_[i].length;
+    }
+
+    sockaddr_in &address = system.send_addresses[message_count];
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = first.address.host;
+    address.sin_port = ENET_HOST_TO_NET_16(first.address.port);
+
+    msghdr &header = system.send_messages[message_count].msg_hdr;
+    header.msg_name = &address;
+    header.msg_namelen = sizeof(address);
+    header.msg_iov = &system.send_iovecs[k];
+    header.msg_iovlen = end - k;
+    header.msg_control = nullptr;
+    header.msg_controllen = 0;
+    header.msg_flags = 0;
+
+    if (end - k > 1) {
+      header.msg_control = &system.send_controls[message_count * SystemBuffers::CONTROL_SIZE];
+      header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+      cmsghdr *control = CMSG_FIRSTHDR(&header);
+      control->cmsg_level = SOL_UDP;
+      control->cmsg_type = UDP_SEGMENT;
+      control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t segment_size = first.length;
+      memcpy(CMSG_DATA(control), &segment_size, sizeof(segment_size));
+
+      stats_.gso_buffers++;
+    }
+
+    datagram_counts[message_count] = end - k;
+    message_count++;
+    k = end;
+  }
+
+  size_t sent = 0;
+
+  while (sent < message_count) {
+    int count = sendmmsg(socket_, system.send_messages.data() + sent, message_count - sent, 0);
+
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+
+      // The kernel or the interface does not support GSO, stop using it
+      if (errno == EIO && options_.gso && datagram_counts[sent] > 1) {
+        fprintf(stderr, "UDP GSO is not supported, sending datagrams one by one\n");
+        options_.gso = false;
+      }
+
+      // The failing message is dropped, as a lost datagram would be
+      stats_.send_errors += datagram_counts[sent];
+      sent++;
+      continue;
+    }
+
+    stats_.send_calls++;
+
+    for (int k = 0; k < count; k++)
+      stats_.sent += datagram_counts[sent + k];
+
+    sent += count;
+  }
+
+  queued_.clear();
+}
+
+bool BatchedSocket::has_received() const
+{
+  return received_position_ < received_.size();
+}
+
+
+void BatchedSocket::set_driver(SocketDriver *driver)
+{
+  // Datagrams still queued are given back to the driver which received them
+  if (driver_ != nullptr) {
+    for (size_t k = received_position_; k < received_.size(); k++)
+      driver_->release(received_[k].buffer_id);
+
+    received_.clear();
+    received_position_ = 0;
+  }
+
+  flush();
+  driver_ = driver;
+}
+
+
+void BatchedSocket::push_received(
+  const ENetAddress &address,
+  const uint8_t *data,
+  size_t length,
+  uint32_t buffer_id
+)
+{
+  if (received_position_ == received_.size()) {
+    received_.clear();
+    received_position_ = 0;
+  }
+
+  Datagram datagram;
+  datagram.address = address;
+  datagram.data = data;
+  datagram.length = length;
+  datagram.buffer_id = buffer_id;
+  received_.push_back(datagram);
+  stats_.received++;
+}
+
+#else
+
+struct BatchedSocket::SystemBuffers {};
+
+
+BatchedSocket::BatchedSocket(ENetSocket socket, const SocketOptions &options):
+  socket_(socket),
+  options_(options),
+  driver_(nullptr),
+  receive_slot_size_(0),
+  received_position_(0)
+{
+
+}
+
+
+BatchedSocket::~BatchedSocket()
+{
+
+}
+
+
+bool BatchedSocket::is_available()
+{
+  return false;
+}
+
+
+BatchedSocket* BatchedSocket::find(ENetSocket)
+{
+  return nullptr;
+}
+
+
+int BatchedSocket::receive(ENetAddress *, ENetBuffer *, size_t)
+{
+  return -1;
+}
+
+
+int BatchedSocket::send(const ENetAddress *, const ENetBuffer *, size_t)
+{
+  return -1;
+}
+
+
+void BatchedSocket::flush()
+{
+
+}
+
+
+bool BatchedSocket::has_received() const
+{
+  return false;
+}
+
+
+bool BatchedSocket::receive_batch()
+{
+  return false;
+}
+
+
+void BatchedSocket::set_driver(SocketDriver *)
+{
+
+}
+
+
+void BatchedSocket::push_received(const ENetAddress &, const uint8_t *, size_t, uint32_t)
+{
+
+}
+
+#endif
+
+
+const BatchedSocket::Stats& BatchedSocket::get_stats() const
+{
+  return stats_;
+}
+
+
+}  // namespace net
+
+
+#ifdef NET_HAS_BATCHED_SOCKETS
+// =============================================================================
+// Link-time redirections of the ENet functions (-Wl,--wrap=<function>)
+//
+extern "C"
+{
+
+int __real_enet_socket_send(ENetSocket, const ENetAddress *, const ENetBuffer *, size_t);
+int __real_enet_socket_receive(ENetSocket, ENetAddress *, ENetBuffer *, size_t);
+int __real_enet_socket_wait(ENetSocket, enet_uint32 *, enet_uint32);
+int __real_enet_host_service(ENetHost *, ENetEvent *, enet_uint32);
+void __real_enet_host_flush(ENetHost *);
+
+
+int __wrap_enet_socket_send(
+  ENetSocket socket,
+  const ENetAddress *address,
+  const ENetBuffer *buffers,
+  size_t buffer_count
+)
+{
+  net::BatchedSocket *batched_socket = net::BatchedSocket::find(socket);
+
+  if (batched_socket == nullptr)
+    return __real_enet_socket_send(socket, address, buffers, buffer_count);
+
+  return batched_socket->send(address, buffers, buffer_count);
+}
+
+
+int __wrap_enet_socket_receive(
+  ENetSocket socket,
+  ENetAddress *address,
+  ENetBuffer *buffers,
+  size_t buffer_count
+)
+{
+  net::BatchedSocket *batched_socket = net::BatchedSocket::find(socket);
+
+  if (batched_socket == nullptr)
+    return __real_enet_socket_receive(socket, address, buffers, buffer_count);
+
+  return batched_socket->receive(address, buffers, buffer_count);
+}
+
+
+int __wrap_enet_socket_wait(ENetSocket socket, enet_uint32 *condition, enet_uint32 timeout)
+{
+  // Nothing should stay queued while ENet waits for incoming traffic
+  net::BatchedSocket *batched_socket = net::BatchedSocket::find(socket);
+
+  if (batched_socket != nullptr) {
+    batched_socket->flush();
+
+    // The rest of the current batch is already readable, even if the socket is not
+    if ((*condition & ENET_SOCKET_WAIT_RECEIVE) && batched_socket->has_received()) {
+      *condition = ENET_SOCKET_WAIT_RECEIVE;
+      return 0;
+    }
+  }
+
+  return __real_enet_socket_wait(socket, condition, timeout);
+}
+
+
+int __wrap_enet_host_service(ENetHost *host, ENetEvent *event, enet_uint32 timeout)
+{
+  int result = __real_enet_host_service(host, event, timeout);
+  net::BatchedSocket *batched_socket = net::BatchedSocket::find(host->socket);
+
+  if (batched_socket != nullptr)
+    batched_socket->flush();
+
+  return result;
+}
+
+
+void __wrap_enet_host_flush(ENetHost *host)
+{
+  __real_enet_host_flush(host);
+  net::BatchedSocket *batched_socket = net::BatchedSocket::find(host->socket);
+
+  if (batched_socket != nullptr)
+    batched_socket->flush();
+}
+
+}  // extern "C"
+#endif
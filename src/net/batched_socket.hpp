@@ -0,0 +1,170 @@
+/**
+ * @file
+ *
+ * \brief  Socket backend batching the datagrams of ENet hosts (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * ENet sends and receives one datagram per system call. When the library is
+ * built with NET_HAS_BATCHED_SOCKETS, the calls of ENet to enet_socket_send and
+ * enet_socket_receive are redirected at link time (-Wl,--wrap) to this backend
+ * for the sockets which use it:
+ *   - received datagrams are read in batches with recvmmsg, and optionally
+ *     coalesced by the kernel with UDP GRO
+ *   - sent datagrams are queued during a whole enet_host_service or
+ *     enet_host_flush call, and sent at its end with sendmmsg, runs of
+ *     datagrams to the same peer being optionally sent as one UDP GSO buffer
+ *
+ * The ENet protocol itself is not changed.
+ */
+
+#ifndef NET__BATCHED_SOCKET_HPP
+#define NET__BATCHED_SOCKET_HPP
+
+#include "enet/enet.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/// Socket layer used by a host
+enum class SocketBackend
+{
+  STOCK,   ///< One system call per datagram, as implemented by ENet
+  BATCHED  ///< Batched system calls, see BatchedSocket
+};
+
+
+/// Options of the socket of a host
+struct SocketOptions
+{
+  SocketBackend backend = SocketBackend::STOCK;  ///< Socket layer to use
+  size_t batch_size = 64;  ///< Maximal number of datagrams per system call (batched backend)
+  bool gro = false;        ///< Whether received datagrams are coalesced with UDP GRO (batched backend)
+  bool gso = false;        ///< Whether runs of sent datagrams use UDP GSO (batched backend)
+};
+
+
+/**
+ * \brief  Replaces the system calls of batched sockets
+ *
+ * Used to drive many sockets from a single event loop, for instance an io_uring
+ * (see Reactor). The datagrams received by the driver are pushed to the socket,
+ * and the datagrams sent by ENet are handed over to the driver.
+ */
+class SocketDriver
+{
+  public:
+    virtual ~SocketDriver() = default;
+
+    /// Gives a receive buffer back, once its datagram has been copied by ENet
+    virtual void release(uint32_t buffer_id) = 0;
+
+    /// Sends a datagram, copying its data
+    virtual bool send(ENetSocket socket, const ENetAddress &address, const ENetBuffer *buffers, size_t buffer_count) = 0;
+};
+
+
+/// Batched socket layer of a single ENet socket
+class BatchedSocket
+{
+  public:
+    /// Statistics about the system calls
+    struct Stats
+    {
+      uint64_t receive_calls = 0;      ///< Number of recvmmsg calls
+      uint64_t received = 0;           ///< Number of datagrams received
+      uint64_t send_calls = 0;         ///< Number of sendmmsg calls
+      uint64_t sent = 0;               ///< Number of datagrams sent
+      uint64_t gso_buffers = 0;        ///< Number of GSO buffers sent, each holding several datagrams
+      uint64_t send_errors = 0;        ///< Number of datagrams which could not be sent
+    };
+
+    /**
+     * \param socket   ENet socket, already created and bound
+     * \param options  Batch size, GRO and GSO
+     */
+    BatchedSocket(ENetSocket socket, const SocketOptions &options);
+
+    /// Sends the queued datagrams and stops handling the socket
+    ~BatchedSocket();
+
+    BatchedSocket(const BatchedSocket&) = delete;
+    BatchedSocket& operator=(const BatchedSocket&) = delete;
+
+    /// Returns whether the library was built with the batched backend
+    static bool is_available();
+
+    /// Returns the batched socket handling an ENet socket (nullptr if none), from any thread
+    static BatchedSocket* find(ENetSocket socket);
+
+    /// Same semantics as enet_socket_receive, reading from the current batch
+    int receive(ENetAddress *address, ENetBuffer *buffers, size_t buffer_count);
+
+    /// Same semantics as enet_socket_send, queuing the datagram
+    int send(const ENetAddress *address, const ENetBuffer *buffers, size_t buffer_count);
+
+    /// Sends all the queued datagrams
+    void flush();
+
+    /// Returns whether datagrams of the current batch have not been read by ENet yet
+    bool has_received() const;
+
+    /**
+     * \brief  Sets the driver replacing the system calls of the socket
+     *
+     * \param driver  Driver to use, or nullptr to go back to system calls
+     */
+    void set_driver(SocketDriver *driver);
+
+    /**
+     * \brief  Queues a datagram received by the driver, to be read by ENet
+     *
+     * \param address    Source of the datagram
+     * \param data       Data of the datagram, valid until the buffer is released
+     * \param length     Length of the datagram
+     * \param buffer_id  Buffer released to the driver once the datagram has been read
+     */
+    void push_received(const ENetAddress &address, const uint8_t *data, size_t length, uint32_t buffer_id);
+
+    /// Returns statistics about the system calls
+    const Stats& get_stats() const;
+
+  private:
+    /// Received or queued datagram
+    struct Datagram
+    {
+      ENetAddress address;  ///< Source or destination
+      const uint8_t *data;  ///< Data of the datagram
+      size_t length;        ///< Length of the data
+      uint32_t buffer_id;   ///< Buffer of the driver holding the data (received datagrams only)
+    };
+
+    /// Message headers passed to the system calls
+    struct SystemBuffers;
+
+    ENetSocket socket_;      ///< Handled socket
+    SocketOptions options_;  ///< Batch size, GRO and GSO
+    Stats stats_;            ///< Statistics about the system calls
+    std::unique_ptr<SystemBuffers> system_;  ///< Message headers passed to the system calls
+    SocketDriver *driver_;   ///< Driver replacing the system calls (nullptr if none)
+
+    size_t receive_slot_size_;               ///< Size of each receive slot (64 kB with GRO)
+    std::unique_ptr<uint8_t[]> receive_buffers_;  ///< Data of the received datagrams
+    std::vector<Datagram> received_;         ///< Datagrams of the current batch
+    size_t received_position_;               ///< Next datagram of the batch to hand over to ENet
+
+    std::unique_ptr<uint8_t[]> send_buffers_;  ///< Data of the queued datagrams
+    std::vector<Datagram> queued_;           ///< Datagrams waiting to be sent
+
+    /// Reads the next batch of datagrams, returns whether any was received
+    bool receive_batch();
+};
+
+}  // namespace net
+
+#endif
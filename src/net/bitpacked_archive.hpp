@@ -0,0 +1,617 @@
+/**
+ * @file
+ *
+ * \brief  Cereal archives packing values on as few bits as possible
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Default encodings:
+ *   - bool: 1 bit
+ *   - 8-bit integers: 8 bits
+ *   - other integers: varint (7 bits per byte, zigzag for signed integers)
+ *   - float, double: 32, 64 bits
+ *   - sizes (strings, containers): varint
+ *
+ * The encoding of a value can be narrowed with the wrappers below, which fall
+ * back to the plain value with any other archive:
+ *
+ *     template <class Archive>
+ *     void serialize(Archive &ar)
+ *     {
+ *       ar(
+ *         net::varint(id),
+ *         net::ranged(health, 0, 100),            // 7 bits
+ *         net::bits(flags, 3),                    // 3 bits
+ *         net::quantized(angle, -3.15f, 3.15f, 10),
+ *         net::quantized(position, -4096.0f, 4096.0f, 20)  // each element of an array
+ *       );
+ *     }
+ *
+ * Values are packed without any alignment, least significant bit first.
+ */
+
+#ifndef NET__BITPACKED_ARCHIVE_HPP
+#define NET__BITPACKED_ARCHIVE_HPP
+
+#include "cereal/cereal.hpp"
+#include <istream>
+#include <ostream>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+
+namespace net
+{
+
+// =============================================================================
+// Archives
+//
+/// Output archive packing values on as few bits as possible
+class BitPackedOutputArchive:
+  public cereal::OutputArchive<BitPackedOutputArchive, cereal::AllowEmptyClassElision>
+{
+  public:
+    /// \param stream  Stream to which the data is written
+    BitPackedOutputArchive(std::ostream &stream):
+      OutputArchive<BitPackedOutputArchive, cereal::AllowEmptyClassElision>(this),
+      stream_(stream),
+      accumulator_(0),
+      bit_count_(0),
+      buffer_size_(0)
+    {
+
+    }
+
+    /// Writes the last incomplete byte, padded with zeros
+    ~BitPackedOutputArchive() CEREAL_NOEXCEPT
+    {
+      if (bit_count_ > 0)
+        put_byte(accumulator_ & 0xFF);
+
+      flush_buffer();
+    }
+
+    /// Writes the lowest `count` bits of a value (at most 64)
+    void write_bits(uint64_t value, unsigned int count)
+    {
+      while (count > 0) {
+        unsigned int n = std::min(count, 32u);
+        accumulator_ |= (value & ((uint64_t(1) << n) - 1)) << bit_count_;
+        bit_count_ += n;
+        value >>= n;
+        count -= n;
+
+        while (bit_count_ >= 8) {
+          put_byte(accumulator_ & 0xFF);
+          accumulator_ >>= 8;
+          bit_count_ -= 8;
+        }
+      }
+    }
+
+    /// Writes an unsigned integer on groups of 7 bits
+    void write_varint(uint64_t value)
+    {
+      while (value >= 0x80) {
+        write_bits((value & 0x7F) | 0x80, 8);
+        value >>= 7;
+      }
+
+      write_bits(value, 8);
+    }
+
+    /// Writes raw bytes
+    void write_bytes(const void *data, size_t size)
+    {
+      const uint8_t *bytes = static_cast<const uint8_t*>(data);
+
+      for (size_t k = 0; k < size; k++)
+        write_bits(bytes[k], 8);
+    }
+
+  private:
+    std::ostream &stream_;   ///< Stream to which the data is written
+    uint64_t accumulator_;   ///< Bits not yet written
+    unsigned int bit_count_; ///< Number of bits in the accumulator
+    char buffer_[256];       ///< Bytes not yet written to the stream
+    size_t buffer_size_;     ///< Number of bytes in the buffer
+
+    void put_byte(uint8_t byte)
+    {
+      buffer_[buffer_size_++] = static_cast<char>(byte);
+
+      if (buffer_size_ == sizeof(buffer_))
+        flush_buffer();
+    }
+
+    void flush_buffer()
+    {
+      if (buffer_size_ == 0)
+        return;
+
+      auto written = stream_.rdbuf()->sputn(buffer_, buffer_size_);
+      buffer_size_ = 0;
+
+      if (written < 0)
+        throw cereal::Exception("Failed to write to output stream");
+    }
+};
+
+
+/// Input archive reading values packed by BitPackedOutputArchive
+class BitPackedInputArchive:
+  public cereal::InputArchive<BitPackedInputArchive, cereal::AllowEmptyClassElision>
+{
+  public:
+    /// \param stream  Stream from which the data is read
+    BitPackedInputArchive(std::istream &stream):
+      InputArchive<BitPackedInputArchive, cereal::AllowEmptyClassElision>(this),
+      stream_(stream),
+      accumulator_(0),
+      bit_count_(0),
+      buffer_size_(0),
+      buffer_position_(0)
+    {
+
+    }
+
+    ~BitPackedInputArchive() CEREAL_NOEXCEPT = default;
+
+    /// Reads `count` bits (at most 64)
+    uint64_t read_bits(unsigned int count)
+    {
+      uint64_t value = 0;
+      unsigned int shift = 0;
+
+      while (count > 0) {
+        if (bit_count_ == 0) {
+          accumulator_ = get_byte();
+          bit_count_ = 8;
+        }
+
+        unsigned int n = std::min(count, bit_count_);
+        value |= (accumulator_ & ((uint64_t(1) << n) - 1)) << shift;
+        accumulator_ >>= n;
+        bit_count_ -= n;
+        shift += n;
+        count -= n;
+      }
+
+      return value;
+    }
+
+    /// Reads an unsigned integer written on groups of 7 bits
+    uint64_t read_varint()
+    {
+      uint64_t value = 0;
+
+      for (unsigned int shift = 0; shift < 64; shift += 7) {
+        uint64_t byte = read_bits(8);
+        value |= (byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+          return value;
+      }
+
+      throw cereal::Exception("Invalid varint in input stream");
+    }
+
+    /// Reads raw bytes
+    void read_bytes(void *data, size_t size)
+    {
+      uint8_t *bytes = static_cast<uint8_t*>(data);
+
+      for (size_t k = 0; k < size; k++)
+        bytes[k] = static_cast<uint8_t>(read_bits(8));
+    }
+
+  private:
+    std::istream &stream_;       ///< Stream from which the data is read
+    uint64_t accumulator_;       ///< Bits read but not consumed yet
+    unsigned int bit_count_;     ///< Number of bits in the accumulator
+    char buffer_[256];           ///< Bytes read from the stream
+    size_t buffer_size_;         ///< Number of bytes in the buffer
+    size_t buffer_position_;     ///< Position of the next byte in the buffer
+
+    uint8_t get_byte()
+    {
+      if (buffer_position_ == buffer_size_) {
+        auto read = stream_.rdbuf()->sgetn(buffer_, sizeof(buffer_));
+
+        if (read <= 0)
+          throw cereal::Exception("Failed to read from input stream");
+
+        buffer_size_ = read;
+        buffer_position_ = 0;
+      }
+
+      return static_cast<uint8_t>(buffer_[buffer_position_++]);
+    }
+};
+
+
+// =============================================================================
+// Wrappers
+//
+/// Integer always encoded as a varint
+template <class T>
+struct Varint
+{
+  T value;
+};
+
+/// Integer encoded on a fixed number of bits
+template <class T>
+struct Bits
+{
+  T value;
+  unsigned int bits;
+};
+
+/// Integer within a range, encoded on the number of bits needed by the range
+template <class T>
+struct Ranged
+{
+  T value;
+  int64_t min;
+  int64_t max;
+};
+
+/// Floating point value within a range, quantized on a number of bits
+template <class T>
+struct Quantized
+{
+  T value;
+  double min;
+  double max;
+  unsigned int bits;
+};
+
+/// Floating point values within a range, each quantized on a number of bits
+template <class T>
+struct QuantizedArray
+{
+  T *values;
+  size_t size;
+  double min;
+  double max;
+  unsigned int bits;
+};
+
+
+/// Encodes an integer as a varint
+template <class T>
+inline Varint<T&> varint(T &value)
+{
+  return {value};
+}
+
+/// Encodes an integer on a fixed number of bits (sign-extended when read back if signed)
+template <class T>
+inline Bits<T&> bits(T &value, unsigned int bits)
+{
+  return {value, bits};
+}
+
+/// Encodes an integer within [min, max] on the number of bits needed by the range
+template <class T>
+inline Ranged<T&> ranged(T &value, int64_t min, int64_t max)
+{
+  return {value, min, max};
+}
+
+/// Quantizes a floating point value within [min, max] on a number of bits
+template <class T>
+inline Quantized<T&> quantized(T &value, double min, double max, unsigned int bits)
+{
+  return {value, min, max, bits};
+}
+
+/// Quantizes each element of an array within [min, max] on a number of bits
+template <class T, size_t N>
+inline QuantizedArray<T> quantized(T (&values)[N], double min, double max, unsigned int bits)
+{
+  return {values, N, min, max, bits};
+}
+
+/// Quantizes each element of an array within [min, max] on a number of bits
+template <class T, size_t N>
+inline QuantizedArray<T> quantized(std::array<T, N> &values, double min, double max, unsigned int bits)
+{
+  return {values.data(), N, min, max, bits};
+}
+
+/// Quantizes each element of an array within [min, max] on a number of bits
+template <class T, size_t N>
+inline QuantizedArray<const T> quantized(const std::array<T, N> &values, double min, double max, unsigned int bits)
+{
+  return {values.data(), N, min, max, bits};
+}
+
+
+namespace bitpacked_detail
+{
+
+template <class Archive>
+constexpr bool is_bitpacked = std::is_same_v<Archive, BitPackedOutputArchive>
+  || std::is_same_v<Archive, BitPackedInputArchive>;
+
+/// Number of bits needed to encode the range [min, max]
+inline unsigned int range_bits(int64_t min, int64_t max)
+{
+  return std::bit_width(static_cast<uint64_t>(max - min));
+}
+
+/// Maximal value of an unsigned integer on a number of bits
+inline uint64_t max_value(unsigned int bits)
+{
+  return bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+}
+
+inline uint64_t quantize(double value, double min, double max, unsigned int bits)
+{
+  double steps = static_cast<double>(max_value(bits));
+  double ratio = (std::clamp(value, min, max) - min) / (max - min);
+  return static_cast<uint64_t>(std::llround(ratio * steps));
+}
+
+inline double dequantize(uint64_t quantized, double min, double max, unsigned int bits)
+{
+  return min + (max - min) * static_cast<double>(quantized) / static_cast<double>(max_value(bits));
+}
+
+template <class T>
+inline uint64_t zigzag_encode(T value)
+{
+  using S = std::make_signed_t<T>;
+  int64_t v = static_cast<S>(value);
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+template <class T>
+inline T zigzag_decode(uint64_t value)
+{
+  return static_cast<T>(static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1));
+}
+
+}  // namespace bitpacked_detail
+
+
+// =============================================================================
+// Arithmetic types
+//
+template <class T>
+inline std::enable_if_t<std::is_arithmetic_v<T>>
+CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const T &value)
+{
+  if constexpr (std::is_same_v<T, bool>) {
+    ar.write_bits(value ? 1 : 0, 1);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8, "Unsupported floating point type");
+    using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+    U bits;
+    memcpy(&bits, &value, sizeof(T));
+    ar.write_bits(bits, 8 * sizeof(T));
+  } else if constexpr (sizeof(T) == 1) {
+    ar.write_bits(static_cast<uint8_t>(value), 8);
+  } else if constexpr (std::is_signed_v<T>) {
+    ar.write_varint(bitpacked_detail::zigzag_encode(value));
+  } else {
+    ar.write_varint(value);
+  }
+}
+
+template <class T>
+inline std::enable_if_t<std::is_arithmetic_v<T>>
+CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, T &value)
+{
+  if constexpr (std::is_same_v<T, bool>) {
+    value = ar.read_bits(1) != 0;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8, "Unsupported floating point type");
+    using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+    U bits = static_cast<U>(ar.read_bits(8 * sizeof(T)));
+    memcpy(&value, &bits, sizeof(T));
+  } else if constexpr (sizeof(T) == 1) {
+    value = static_cast<T>(ar.read_bits(8));
+  } else if constexpr (std::is_signed_v<T>) {
+    value = bitpacked_detail::zigzag_decode<T>(ar.read_varint());
+  } else {
+    value = static_cast<T>(ar.read_varint());
+  }
+}
+
+
+// =============================================================================
+// Cereal special types
+//
+template <class Archive, class T>
+inline CEREAL_ARCHIVE_RESTRICT(BitPackedInputArchive, BitPackedOutputArchive)
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive &ar, cereal::NameValuePair<T> &nvp)
+{
+  ar(nvp.value);
+}
+
+template <class T>
+inline void CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const cereal::SizeTag<T> &tag)
+{
+  ar.write_varint(tag.size);
+}
+
+template <class T>
+inline void CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, cereal::SizeTag<T> &tag)
+{
+  tag.size = ar.read_varint();
+}
+
+template <class T>
+inline void CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const cereal::BinaryData<T> &data)
+{
+  ar.write_bytes(data.data, static_cast<size_t>(data.size));
+}
+
+template <class T>
+inline void CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, cereal::BinaryData<T> &data)
+{
+  ar.read_bytes(data.data, static_cast<size_t>(data.size));
+}
+
+
+// =============================================================================
+// Wrappers
+//
+template <class T>
+inline void CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const Varint<T> &wrapper)
+{
+  using U = std::remove_cv_t<std::remove_reference_t<T>>;
+
+  if constexpr (std::is_signed_v<U>)
+    ar.write_varint(bitpacked_detail::zigzag_encode(wrapper.value));
+  else
+    ar.write_varint(wrapper.value);
+}
+
+template <class T>
+inline void CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, Varint<T> &wrapper)
+{
+  using U = std::remove_cv_t<std::remove_reference_t<T>>;
+
+  if constexpr (std::is_signed_v<U>)
+    wrapper.value = bitpacked_detail::zigzag_decode<U>(ar.read_varint());
+  else
+    wrapper.value = static_cast<U>(ar.read_varint());
+}
+
+template <class T>
+inline void CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const Bits<T> &wrapper)
+{
+  ar.write_bits(static_cast<uint64_t>(wrapper.value), wrapper.bits);
+}
+
+template <class T>
+inline void CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, Bits<T> &wrapper)
+{
+  using U = std::remove_cv_t<std::remove_reference_t<T>>;
+  uint64_t value = ar.read_bits(wrapper.bits);
+
+  // Sign extension
+  if constexpr (std::is_signed_v<U>) {
+    if (wrapper.bits > 0 && wrapper.bits < 64 && (value >> (wrapper.bits - 1)) & 1)
+      value |= ~uint64_t(0) << wrapper.bits;
+  }
+
+  wrapper.value = static_cast<U>(value);
+}
+
+template <class T>
+inline void CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const Ranged<T> &wrapper)
+{
+  int64_t value = std::clamp<int64_t>(wrapper.value, wrapper.min, wrapper.max);
+  ar.write_bits(
+    static_cast<uint64_t>(value - wrapper.min),
+    bitpacked_detail::range_bits(wrapper.min, wrapper.max)
+  );
+}
+
+template <class T>
+inline void CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, Ranged<T> &wrapper)
+{
+  using U = std::remove_cv_t<std::remove_reference_t<T>>;
+  uint64_t offset = ar.read_bits(bitpacked_detail::range_bits(wrapper.min, wrapper.max));
+  wrapper.value = static_cast<U>(wrapper.min + static_cast<int64_t>(offset));
+}
+
+template <class T>
+inline void CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const Quantized<T> &wrapper)
+{
+  ar.write_bits(
+    bitpacked_detail::quantize(wrapper.value, wrapper.min, wrapper.max, wrapper.bits),
+    wrapper.bits
+  );
+}
+
+template <class T>
+inline void CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, Quantized<T> &wrapper)
+{
+  using U = std::remove_cv_t<std::remove_reference_t<T>>;
+  wrapper.value = static_cast<U>(bitpacked_detail::dequantize(
+    ar.read_bits(wrapper.bits), wrapper.min, wrapper.max, wrapper.bits
+  ));
+}
+
+template <class T>
+inline void CEREAL_SAVE_FUNCTION_NAME(BitPackedOutputArchive &ar, const QuantizedArray<T> &wrapper)
+{
+  for (size_t k = 0; k < wrapper.size; k++) {
+    ar.write_bits(
+      bitpacked_detail::quantize(wrapper.values[k], wrapper.min, wrapper.max, wrapper.bits),
+      wrapper.bits
+    );
+  }
+}
+
+template <class T>
+inline void CEREAL_LOAD_FUNCTION_NAME(BitPackedInputArchive &ar, QuantizedArray<T> &wrapper)
+{
+  for (size_t k = 0; k < wrapper.size; k++) {
+    wrapper.values[k] = static_cast<T>(bitpacked_detail::dequantize(
+      ar.read_bits(wrapper.bits), wrapper.min, wrapper.max, wrapper.bits
+    ));
+  }
+}
+
+
+// Other archives serialise the wrapped values as they are
+template <class Archive, class T>
+inline std::enable_if_t<!bitpacked_detail::is_bitpacked<Archive>>
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive &ar, Varint<T> &wrapper)
+{
+  ar(wrapper.value);
+}
+
+template <class Archive, class T>
+inline std::enable_if_t<!bitpacked_detail::is_bitpacked<Archive>>
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive &ar, Bits<T> &wrapper)
+{
+  ar(wrapper.value);
+}
+
+template <class Archive, class T>
+inline std::enable_if_t<!bitpacked_detail::is_bitpacked<Archive>>
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive &ar, Ranged<T> &wrapper)
+{
+  ar(wrapper.value);
+}
+
+template <class Archive, class T>
+inline std::enable_if_t<!bitpacked_detail::is_bitpacked<Archive>>
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive &ar, Quantized<T> &wrapper)
+{
+  ar(wrapper.value);
+}
+
+template <class Archive, class T>
+inline std::enable_if_t<!bitpacked_detail::is_bitpacked<Archive>>
+CEREAL_SERIALIZE_FUNCTION_NAME(Archive &ar, QuantizedArray<T> &wrapper)
+{
+  for (size_t k = 0; k < wrapper.size; k++)
+    ar(wrapper.values[k]);
+}
+
+}  // namespace net
+
+
+// Register the archives for polymorphic support
+CEREAL_REGISTER_ARCHIVE(net::BitPackedOutputArchive)
+CEREAL_REGISTER_ARCHIVE(net::BitPackedInputArchive)
+
+// Tie the input and output archives together
+CEREAL_SETUP_ARCHIVE_TRAITS(net::BitPackedInputArchive, net::BitPackedOutputArchive)
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * @file
+ *
+ * \brief  Pool of fixed-size buffers backing outbound ENet packets
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "buffer_pool.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+
+namespace net
+{
+
+BufferPool::BufferPool(size_t buffer_size, size_t buffer_count):
+  buffer_size_(buffer_size),
+  chunk_count_(std::max<size_t>(buffer_count, 1))
+{
+  grow(chunk_count_);
+}
+
+
+uint8_t* BufferPool::acquire()
+{
+  if (free_buffers_.empty())
+    grow(chunk_count_);
+
+  uint8_t *buffer = free_buffers_.back();
+  free_buffers_.pop_back();
+
+  return buffer;
+}
+
+
+void BufferPool::release(uint8_t *buffer)
+{
+  free_buffers_.push_back(buffer);
+}
+
+
+ENetPacket* BufferPool::create_packet(uint8_t *buffer, size_t length, enet_uint32 flags)
+{
+  ENetPacket *packet = enet_packet_create(buffer, length, flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+
+  if (packet == nullptr) {
+    release(buffer);
+    return nullptr;
+  }
+
+  packet->freeCallback = &BufferPool::free_cb;
+  packet->userData = this;
+
+  return packet;
+}
+
+
+size_t BufferPool::get_buffer_size() const
+{
+  return buffer_size_;
+}
+
+
+size_t BufferPool::get_available_count() const
+{
+  return free_buffers_.size();
+}
+
+
+void BufferPool::grow(size_t buffer_count)
+{
+  chunks_.emplace_back(new uint8_t[buffer_size_ * buffer_count]);
+  uint8_t *chunk = chunks_.back().get();
+
+  free_buffers_.reserve(free_buffers_.size() + buffer_count);
+
+  for (size_t k = 0; k < buffer_count; k++)
+    free_buffers_.push_back(chunk + k * buffer_size_);
+
+  // Grow geometrically so that a busy pool quickly stops allocating
+  chunk_count_ *= 2;
+}
+
+
+void BufferPool::free_cb(ENetPacket *packet)
+{
+  static_cast<BufferPool*>(packet->userData)->release(packet->data);
+}
+
+
+}  // namespace net
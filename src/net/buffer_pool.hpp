@@ -0,0 +1,80 @@
+/**
+ * @file
+ *
+ * \brief  Pool of fixed-size buffers backing outbound ENet packets
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__BUFFER_POOL_HPP
+#define NET__BUFFER_POOL_HPP
+
+#include "enet/enet.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/**
+ * \brief  Pool of fixed-size buffers backing outbound ENet packets
+ *
+ * Packets created from the pool point directly to the buffers, and give them back
+ * to the pool when ENet destroys them. The pool must therefore outlive the host
+ * through which the packets are sent.
+ */
+class BufferPool
+{
+  public:
+    /**
+     * \param buffer_size   Size of each buffer (in bytes)
+     * \param buffer_count  Number of buffers allocated upfront
+     */
+    BufferPool(size_t buffer_size, size_t buffer_count);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /// Takes a buffer from the pool, allocating more buffers if the pool is exhausted
+    uint8_t* acquire();
+
+    /// Gives a buffer back to the pool
+    void release(uint8_t *buffer);
+
+    /**
+     * \brief  Creates an ENet packet pointing to a buffer of the pool
+     *
+     * The packet owns the buffer, which is released when the packet is destroyed.
+     *
+     * \param buffer  Buffer acquired from the pool
+     * \param length  Length of the data in the buffer
+     * \param flags   ENet packet flags
+     * \return  The packet, or nullptr if it could not be created (the buffer is then released)
+     */
+    ENetPacket* create_packet(uint8_t *buffer, size_t length, enet_uint32 flags);
+
+    /// Returns the size of each buffer (in bytes)
+    size_t get_buffer_size() const;
+
+    /// Returns the number of buffers currently available
+    size_t get_available_count() const;
+
+  private:
+    const size_t buffer_size_;  ///< Size of each buffer (in bytes)
+    size_t chunk_count_;        ///< Number of buffers allocated in the next chunk
+    std::vector<std::unique_ptr<uint8_t[]>> chunks_;  ///< Memory of all the buffers
+    std::vector<uint8_t*> free_buffers_;              ///< Buffers available
+
+    /// Allocates a new chunk of buffers
+    void grow(size_t buffer_count);
+
+    /// ENet callback giving the buffer of a destroyed packet back to the pool
+    static void free_cb(ENetPacket *packet);
+};
+
+}  // namespace net
+
+#endif
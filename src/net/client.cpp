@@ -13,7 +13,6 @@
 #include <string>
 
 #include <chrono>
-#include <thread>
 
 #include <cstring>
 #include <stdio.h>
@@ -25,7 +24,8 @@ namespace net
 NetClient::NetClient(const std::string &validation_salt):
   NetBase(validation_salt),
   status_(NetClient::Status::DISCONNECTED),
-  peer_(nullptr)
+  peer_(nullptr),
+  validated_(false)
 {
 
 }
@@ -41,7 +41,8 @@ bool NetClient::init()
     1,         // only allow 1 outgoing connection
     2,         // allow up 2 channels to be used, 0 and 1
     0,         // assume any amount of incoming bandwidth
-    0          // assume any amount of outgoing bandwidth
+    0,         // assume any amount of outgoing bandwidth
+    socket_options_
   );
 
   if (!success) {
@@ -73,7 +74,7 @@ bool NetClient::connect(const std::string &host, int port, float timeout)
 }
 
 
-void NetClient::handle_events()
+void NetClient::update()
 {
   if (status_ == Status::CONNECTING) {
     auto t = std::chrono::steady_clock::now();
@@ -86,8 +87,6 @@ void NetClient::handle_events()
       printf("Connection to localhost:1234 failed.\n");
     }
   }
-
-  NetBase::handle_events();
 }
 
 
@@ -98,41 +97,73 @@ void NetClient::send_packet(const Packet &packet, int channel_id)
 }
 
 
+bool NetClient::is_validated() const
+{
+  return status_ == Status::CONNECTED && validated_;
+}
+
+
+ENetPeer* NetClient::get_peer() const
+{
+  return peer_;
+}
+
+
 void NetClient::connect_cb(ENetEvent &event)
 {
   status_ = Status::CONNECTED;
+  validated_ = false;
 
-  printf(
-    "A new client connected from %x:%u.\n",
-    event.peer->address.host,
-    (unsigned int)event.peer->address.port
-  );
-
-  /* Store any relevant client information here. */
-  event.peer->data = (char*)"Client information";
+  if (verbose_) {
+    printf(
+      "A new client connected from %x:%u.\n",
+      event.peer->address.host,
+      (unsigned int)event.peer->address.port
+    );
+  }
 }
 
 
 void NetClient::disconnect_cb(ENetEvent &event)
 {
   status_ = Status::DISCONNECTED;
+  validated_ = false;
 
-  printf("%s disconnected.\n", (char*)event.peer->data);
+  if (verbose_) {
+    printf(
+      "Server %x:%u disconnected.\n",
+      event.peer->address.host,
+      (unsigned int)event.peer->address.port
+    );
+  }
 }
 
 
 void NetClient::receive_cb(ENetEvent &event)
 {
-  Packet packet;
+  // Schema messages are handed over without being decoded
+  Packet::Type type;
+
+  if (Packet::peek_type(event.packet->data, event.packet->dataLength, type)
+    && type == Packet::Type::SCHEMA
+  ) {
+    schema_cb(schema::RawMessage{event.packet->data, event.packet->dataLength});
+    return;
+  }
+
+  Packet &packet = received_packet_;
   packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
 
-  printf(
-    "New packet (length=%u, source=%s, channel=%u): %s\n",
-    (unsigned int)event.packet->dataLength,
-    (char*)event.peer->data,
-    (unsigned int)event.channelID,
-    (char*)packet.get_data().c_str()
-  );
+  if (verbose_) {
+    printf(
+      "New packet (length=%u, source=%x:%u, channel=%u): %s\n",
+      (unsigned int)event.packet->dataLength,
+      event.peer->address.host,
+      (unsigned int)event.peer->address.port,
+      (unsigned int)event.channelID,
+      (char*)packet.get_data().c_str()
+    );
+  }
 
   // Solve puzzle to validate new connection
   if (packet.get_type() == Packet::Type::VALIDATION_STR) {
@@ -141,33 +172,32 @@ void NetClient::receive_cb(ENetEvent &event)
       solve_validation_puzzle(packet.get_data())
     );
     send_packet(answer, 0);
+    validated_ = true;
+
+    return;
   }
+
+  if (packet.get_type() == Packet::Type::DATA)
+    message_cb(packet);
 }
 
 
-void NetClient::no_event_cb()
+void NetClient::message_cb(const Packet &)
 {
 
 }
 
 
-}  // namespace enet
+void NetClient::schema_cb(const schema::RawMessage &)
+{
+
+}
 
 
-int main()
+void NetClient::no_event_cb()
 {
-  const std::string validation_salt = "Blektr!";
-  const int port = 1234;
-  const float timeout = 3.0;
 
-  net::NetClient client(validation_salt);
-  client.init();
-  client.connect("localhost", port, timeout);
+}
 
-  while (true) {
-    client.handle_events();
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-  }
 
-  return 0;
-}
+}  // namespace enet
@@ -10,6 +10,7 @@
 #define NET__CLIENT_HPP
 
 #include "base.hpp"
+#include "schema.hpp"
 #include "enet/enet.h"
 #include <string>
 #include <chrono>
@@ -45,8 +46,8 @@ class NetClient: public NetBase
      */
     bool connect(const std::string &host, int port, float timeout);
 
-    /// Handles events
-    void handle_events() override;
+    /// Times the connection attempt out
+    void update() override;
 
     /**
      * \brief  Sends a packet to the connected peer
@@ -56,6 +57,32 @@ class NetClient: public NetBase
      */
     void send_packet(const Packet &packet, int channel_id);
 
+    /// Returns whether the validation answer has been sent to the connected peer
+    bool is_validated() const;
+
+    /// Returns the peer the client connects to (nullptr if none)
+    ENetPeer* get_peer() const;
+
+  protected:
+    /**
+     * \brief  Called when a data packet has been received from the connected peer
+     *
+     * \param packet  Received message
+     */
+    virtual void message_cb(const Packet &packet);
+
+    /**
+     * \brief  Called when a schema message has been received from the connected peer
+     *
+     * The message is not decoded, and is only valid during the call.
+     *
+     * \param message  Received message, to be read through a schema::View
+     */
+    virtual void schema_cb(const schema::RawMessage &message);
+
+    /// Called when a packet has been received, handles validation and decodes the packet
+    void receive_cb(ENetEvent &event) override;
+
   private:
     /// Connection status
     enum class Status
@@ -69,6 +96,8 @@ class NetClient: public NetBase
     float timeout_;  ///< Duration before timing out the connection attempt (in s)
     std::chrono::steady_clock::time_point connection_start_time_;  ///< When the connection was initiated
     ENetPeer *peer_;   ///< Connected peer
+    bool validated_;   ///< Whether the validation answer has been sent
+    Packet received_packet_;  ///< Last packet received, reused to avoid allocating
 
     /// Called when a connection has been established
     void connect_cb(ENetEvent &event) override;
@@ -76,9 +105,6 @@ class NetClient: public NetBase
     /// Called when a connection has been ended or has timed out
     void disconnect_cb(ENetEvent &event) override;
 
-    /// Called when a packet has been received
-    void receive_cb(ENetEvent &event) override;
-
     /// Called when no event has occured within the time limit
     void no_event_cb() override;
 };
@@ -0,0 +1,373 @@
+/**
+ * @file
+ *
+ * \brief  Clock synchronisation policies of BasicNetHost
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Clock policies estimate the clock of the peers, and measure how long messages
+ * take to reach the derived class and to be handled by it. `receive` returns
+ * whether the packet was one of their probes.
+ */
+
+#ifndef NET__CLOCK_POLICY_HPP
+#define NET__CLOCK_POLICY_HPP
+
+#include "policy.hpp"
+#include "packet.hpp"
+#include "clock_sync.hpp"
+#include "histogram.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <stdio.h>
+#include <inttypes.h>
+
+
+namespace net
+{
+
+namespace policy
+{
+
+/// Clocks are not estimated, and nothing is measured
+struct NoClockSync
+{
+  using kind = clock_kind;
+
+  static int64_t now()
+  {
+    return 0;
+  }
+
+  template <typename Host>
+  void poll(Host &)
+  {
+
+  }
+
+  template <typename Host>
+  bool receive(Host &, ENetEvent &)
+  {
+    return false;
+  }
+
+  void stamp(std::string &)
+  {
+
+  }
+
+  static size_t strip_timestamp(const uint8_t *, size_t length)
+  {
+    return length;
+  }
+
+  void record_processing(const ENetPeer *, int64_t)
+  {
+
+  }
+
+  void disconnect(ENetPeer *)
+  {
+
+  }
+
+  void reset(ENetPeer *)
+  {
+
+  }
+};
+
+
+/**
+ * \brief  Estimates the clock of each peer with NTP-style probes (see clock_sync.hpp)
+ *
+ * Once the host accepts to synchronise with a peer (see clock_sync_cb, validated
+ * peers by default), a CLOCK_PROBE is sent to it at a low rate (a few probes in
+ * quick succession first), unsequenced so that a lost probe is neither resent nor
+ * delays the other messages. The peer answers it with a CLOCK_REPLY, once it
+ * accepts the host as well: probes of peers which are not validated are dropped.
+ *
+ * The packets sent by send_packet can also carry their send time, in a trailer
+ * after their serialised data, ignored by the deserialisation:
+ *
+ *     | serialised packet | 0 | send time (8 bytes, little endian, µs) | TIMESTAMP_TAG |
+ *
+ * The one-way delay of the DATA packets received with a send time is recorded
+ * once the clock of their sender is known, as well as the time taken by
+ * receive_cb to handle each packet.
+ */
+class ClockSync
+{
+  public:
+    using kind = clock_kind;
+
+    /// Last byte of the packets carrying their send time
+    static constexpr uint8_t TIMESTAMP_TAG = 0xC5;
+
+    /// Size of the trailer holding the send time, including the NUL byte ending the packet
+    static constexpr size_t TIMESTAMP_SIZE = 10;
+
+    ClockSync():
+      probe_interval_(1000000),
+      timestamps_(false)
+    {
+
+    }
+
+    static int64_t now()
+    {
+      return ClockEstimator::now();
+    }
+
+    /// Sets the interval between two probes sent to each peer (0 to stop probing)
+    void set_probe_interval(std::chrono::microseconds interval)
+    {
+      probe_interval_ = interval.count();
+    }
+
+    /// Sets whether the packets sent by send_packet carry their send time
+    void set_timestamps(bool timestamps)
+    {
+      timestamps_ = timestamps;
+    }
+
+    /// Sends the probes which are due
+    template <typename Host>
+    void poll(Host &host)
+    {
+      if (probe_interval_ <= 0)
+        return;
+
+      const int64_t time = now();
+
+      for (State &state: states_) {
+        if (state.peer == nullptr || time < state.next_probe)
+          continue;
+
+        // The first probe leaves time to the validation answer to be handled on its own
+        if (!host.accepts_clock_sync(state.peer)) {
+          state.next_probe = time + probe_interval_ / 8;
+          continue;
+        }
+
+        char data[24];
+        snprintf(data, sizeof(data), "%" PRId64, now());
+        send_control(host, state.peer, Packet::Type::CLOCK_PROBE, data);
+
+        // Faster until synchronised
+        state.next_probe = time + (state.estimator.is_synchronised() ? probe_interval_ : probe_interval_ / 8);
+      }
+    }
+
+    /// Answers the probes and measures the delay of timestamped packets, returns whether the packet was a probe
+    template <typename Host>
+    bool receive(Host &host, ENetEvent &event)
+    {
+      const int64_t receive_time = now();
+      const uint8_t *data = event.packet->data;
+      const size_t length = event.packet->dataLength;
+      Packet::Type type;
+
+      if (!Packet::peek_type(data, length, type))
+        return false;
+
+      if (type == Packet::Type::DATA) {
+        State *state = get_state(event.peer);
+
+        if (state != nullptr && state->estimator.is_synchronised() && has_timestamp(data, length)) {
+          uint64_t send_time = 0;
+
+          for (size_t k = 0; k < 8; k++)
+            send_time |= (uint64_t)data[length - TIMESTAMP_SIZE + 1 + k] << (8 * k);
+
+          state->one_way_delays.record(receive_time - state->estimator.to_local(send_time));
+        }
+
+        return false;
+      }
+
+      if (type != Packet::Type::CLOCK_PROBE && type != Packet::Type::CLOCK_REPLY)
+        return false;
+
+      if (!host.accepts_clock_sync(event.peer))
+        return true;
+
+      Packet &packet = received_;
+      packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
+      int64_t t0, t1, t2;
+
+      if (type == Packet::Type::CLOCK_PROBE) {
+        if (sscanf(packet.get_data().c_str(), "%" SCNd64, &t0) != 1)
+          return true;
+
+        char reply[72];
+        snprintf(reply, sizeof(reply), "%" PRId64 " %" PRId64 " %" PRId64, t0, receive_time, now());
+        send_control(host, event.peer, Packet::Type::CLOCK_REPLY, reply);
+
+        return true;
+      }
+
+      State *state = get_state(event.peer);
+
+      if (state != nullptr
+        && sscanf(packet.get_data().c_str(), "%" SCNd64 " %" SCNd64 " %" SCNd64, &t0, &t1, &t2) == 3
+      ) {
+        state->estimator.add_sample(t0, t1, t2, receive_time);
+      }
+
+      return true;
+    }
+
+    /// Appends the send time to the serialised data of a packet, already ending with a NUL byte
+    void stamp(std::string &data)
+    {
+      if (!timestamps_)
+        return;
+
+      uint64_t send_time = now();
+
+      for (size_t k = 0; k < 8; k++)
+        data.push_back(static_cast<char>(send_time >> (8 * k)));
+
+      data.push_back(static_cast<char>(TIMESTAMP_TAG));
+    }
+
+    /// Returns the length of the data of a received DATA packet without its send time, if it carries one
+    static size_t strip_timestamp(const uint8_t *data, size_t length)
+    {
+      // The NUL byte ending the serialised packet is kept
+      return has_timestamp(data, length) ? length - TIMESTAMP_SIZE + 1 : length;
+    }
+
+    /// Records the time taken to handle a packet received from a peer, since start_time
+    void record_processing(const ENetPeer *peer, int64_t start_time)
+    {
+      State *state = get_state(peer);
+
+      if (state != nullptr)
+        state->processing_times.record(now() - start_time);
+    }
+
+    /// Stops probing a disconnected peer (its measures are kept until its slot is reused)
+    void disconnect(ENetPeer *peer)
+    {
+      State *state = get_state(peer);
+
+      if (state != nullptr)
+        state->peer = nullptr;
+    }
+
+    /// Starts estimating the clock of a newly connected peer
+    void reset(ENetPeer *peer)
+    {
+      if (peer->incomingPeerID >= states_.size())
+        states_.resize(peer->incomingPeerID + 1);
+
+      State &state = states_[peer->incomingPeerID];
+      state.peer = peer;
+      state.next_probe = now();
+      state.estimator.clear();
+      state.one_way_delays.clear();
+      state.processing_times.clear();
+    }
+
+    /// Returns whether the clock of a peer is known
+    bool is_synchronised(const ENetPeer *peer) const
+    {
+      const State *state = get_state(peer);
+      return state != nullptr && state->estimator.is_synchronised();
+    }
+
+    /// Returns the current offset of the clock of a peer (clock of the peer minus local clock, in µs)
+    int64_t get_offset(const ENetPeer *peer) const
+    {
+      const State *state = get_state(peer);
+      return state != nullptr ? state->estimator.get_offset(now()) : 0;
+    }
+
+    /// Returns the drift of the clock of a peer relative to the local one
+    double get_drift(const ENetPeer *peer) const
+    {
+      const State *state = get_state(peer);
+      return state != nullptr ? state->estimator.get_drift() : 0.0;
+    }
+
+    /// Returns the smallest round-trip delay of the last probes to a peer (in µs)
+    int64_t get_round_trip(const ENetPeer *peer) const
+    {
+      const State *state = get_state(peer);
+      return state != nullptr ? state->estimator.get_round_trip() : 0;
+    }
+
+    /// Returns the one-way delays of the timestamped packets received from a peer (in µs)
+    const LatencyHistogram& get_one_way_delays(const ENetPeer *peer) const
+    {
+      const State *state = get_state(peer);
+      return state != nullptr ? state->one_way_delays : empty_histogram_;
+    }
+
+    /// Returns the durations of receive_cb for the packets received from a peer (in µs)
+    const LatencyHistogram& get_processing_times(const ENetPeer *peer) const
+    {
+      const State *state = get_state(peer);
+      return state != nullptr ? state->processing_times : empty_histogram_;
+    }
+
+  private:
+    /// Clock and measures of a peer
+    struct State
+    {
+      ENetPeer *peer = nullptr;  ///< Peer probed (nullptr once disconnected)
+      int64_t next_probe = 0;    ///< Time of the next probe (in µs)
+      ClockEstimator estimator;  ///< Clock of the peer
+      LatencyHistogram one_way_delays;    ///< One-way delays of the timestamped packets
+      LatencyHistogram processing_times;  ///< Durations of receive_cb
+    };
+
+    int64_t probe_interval_;    ///< Interval between two probes to a peer (in µs)
+    bool timestamps_;           ///< Whether the sent packets carry their send time
+    std::vector<State> states_; ///< State of each peer, indexed by incomingPeerID
+    LatencyHistogram empty_histogram_;  ///< Returned for unknown peers
+    Packet received_;           ///< Last probe or answer received, reused to avoid allocating
+    Packet sent_;               ///< Last probe or answer sent, reused to avoid allocating
+    std::string buffer_;        ///< Serialised data of sent_
+
+    /// Returns whether the data of a received DATA packet ends with a send time
+    static bool has_timestamp(const uint8_t *data, size_t length)
+    {
+      return length >= TIMESTAMP_SIZE + 2 && data[length - 1] == TIMESTAMP_TAG
+        && data[length - TIMESTAMP_SIZE] == '\0';
+    }
+
+    const State* get_state(const ENetPeer *peer) const
+    {
+      return peer->incomingPeerID < states_.size() ? &states_[peer->incomingPeerID] : nullptr;
+    }
+
+    State* get_state(const ENetPeer *peer)
+    {
+      return peer->incomingPeerID < states_.size() ? &states_[peer->incomingPeerID] : nullptr;
+    }
+
+    /// Sends a probe or its answer, unsequenced
+    template <typename Host>
+    void send_control(Host &host, ENetPeer *peer, Packet::Type type, const char *data)
+    {
+      sent_.set(type, data, strlen(data));
+      sent_.serialise(buffer_);
+      host.send_raw_packet(peer, host.create_packet(
+        buffer_.c_str(), buffer_.size() + 1, ENET_PACKET_FLAG_UNSEQUENCED
+      ), 0);
+    }
+};
+
+}  // namespace policy
+}  // namespace net
+
+#endif
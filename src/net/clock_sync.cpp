@@ -0,0 +1,165 @@
+/**
+ * @file
+ *
+ * \brief  Estimation of the clock of a peer, from NTP-style probes
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "clock_sync.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+
+namespace net
+{
+
+namespace
+{
+  /// Number of probes to answer before the estimates are used
+  constexpr uint64_t MIN_SAMPLE_COUNT = 4;
+}
+
+
+ClockEstimator::ClockEstimator(size_t window_size, size_t point_count):
+  window_(std::max<size_t>(window_size, 1)),
+  points_(std::max<size_t>(point_count, 2))
+{
+  clear();
+}
+
+
+int64_t ClockEstimator::now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+
+bool ClockEstimator::add_sample(int64_t t0, int64_t t1, int64_t t2, int64_t t3)
+{
+  if (t3 < t0 || t2 < t1)
+    return false;
+
+  Sample sample;
+  sample.time = t0 + (t3 - t0) / 2;
+  sample.offset = ((t1 - t0) + (t2 - t3)) / 2;
+  sample.delay = std::max<int64_t>((t3 - t0) - (t2 - t1), 0);
+  window_[sample_count_ % window_.size()] = sample;
+  sample_count_++;
+
+  // Keeps the probe with the smallest delay of the window, once
+  const Sample &best = *std::min_element(window_.begin(), window_.begin() + get_window_size(),
+    [](const Sample &a, const Sample &b) { return a.delay < b.delay; }
+  );
+
+  if (point_count_ == 0 || best.time > points_[(point_count_ - 1) % points_.size()].time) {
+    points_[point_count_ % points_.size()] = best;
+    point_count_++;
+    fit();
+  }
+
+  return true;
+}
+
+
+void ClockEstimator::clear()
+{
+  sample_count_ = 0;
+  point_count_ = 0;
+  time_origin_ = 0.0;
+  offset_origin_ = 0.0;
+  drift_ = 0.0;
+}
+
+
+bool ClockEstimator::is_synchronised() const
+{
+  return sample_count_ >= MIN_SAMPLE_COUNT;
+}
+
+
+uint64_t ClockEstimator::get_sample_count() const
+{
+  return sample_count_;
+}
+
+
+int64_t ClockEstimator::get_offset(int64_t local_time) const
+{
+  return std::llround(offset_origin_ + drift_ * (local_time - time_origin_));
+}
+
+
+double ClockEstimator::get_drift() const
+{
+  return drift_;
+}
+
+
+int64_t ClockEstimator::get_round_trip() const
+{
+  if (sample_count_ == 0)
+    return 0;
+
+  return std::min_element(window_.begin(), window_.begin() + get_window_size(),
+    [](const Sample &a, const Sample &b) { return a.delay < b.delay; }
+  )->delay;
+}
+
+
+int64_t ClockEstimator::to_local(int64_t remote_time) const
+{
+  // The offset hardly changes during the few µs of difference between both times
+  return remote_time - get_offset(remote_time - std::llround(offset_origin_));
+}
+
+
+size_t ClockEstimator::get_window_size() const
+{
+  return std::min<uint64_t>(sample_count_, window_.size());
+}
+
+
+void ClockEstimator::fit()
+{
+  const size_t n = std::min<uint64_t>(point_count_, points_.size());
+  const uint64_t first = point_count_ - n;
+  const Sample &oldest = points_[first % points_.size()];
+  const Sample &newest = points_[(point_count_ - 1) % points_.size()];
+  double mean_time = 0.0;
+  double mean_offset = 0.0;
+
+  // Centred on the oldest point, as the times are too large for the squares to be exact
+  const double origin = oldest.time;
+
+  for (uint64_t k = first; k < point_count_; k++) {
+    const Sample &point = points_[k % points_.size()];
+    mean_time += point.time - origin;
+    mean_offset += point.offset;
+  }
+
+  mean_time /= n;
+  mean_offset /= n;
+
+  double covariance = 0.0;
+  double variance = 0.0;
+
+  for (uint64_t k = first; k < point_count_; k++) {
+    const Sample &point = points_[k % points_.size()];
+    double dt = point.time - origin - mean_time;
+    covariance += dt * (point.offset - mean_offset);
+    variance += dt * dt;
+  }
+
+  time_origin_ = origin + mean_time;
+  offset_origin_ = mean_offset;
+
+  // The drift is only estimated once the points span at least a second
+  drift_ = variance > 0.0 && newest.time - oldest.time >= 1000000 ? covariance / variance : 0.0;
+}
+
+
+}  // namespace net
@@ -0,0 +1,108 @@
+/**
+ * @file
+ *
+ * \brief  Estimation of the clock of a peer, from NTP-style probes
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * A probe carries its local send time t0. The peer answers with t0, its receive
+ * time t1 and its send time t2, and the answer is received at local time t3.
+ * Each probe gives the offset of the clock of the peer and the round-trip delay:
+ *
+ *     offset = ((t1 - t0) + (t2 - t3)) / 2
+ *     delay  = (t3 - t0) - (t2 - t1)
+ *
+ * The error on the offset is at most half of the delay, so that the probes which
+ * waited in a queue are the least accurate. Only the probe with the smallest
+ * delay among the last few ones is kept, and the drift of the clocks is the slope
+ * of a regression of the kept offsets over time.
+ */
+
+#ifndef NET__CLOCK_SYNC_HPP
+#define NET__CLOCK_SYNC_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/// Estimates the offset and drift of the clock of a peer
+class ClockEstimator
+{
+  public:
+    /**
+     * \param window_size  Number of probes among which the one with the smallest delay is kept
+     * \param point_count  Number of kept probes used to estimate the drift
+     */
+    ClockEstimator(size_t window_size = 8, size_t point_count = 32);
+
+    /// Returns the time of the local monotonic clock (in µs)
+    static int64_t now();
+
+    /**
+     * \brief  Adds the times of an answered probe (in µs)
+     *
+     * \param t0  Local send time of the probe
+     * \param t1  Receive time of the probe, on the clock of the peer
+     * \param t2  Send time of the answer, on the clock of the peer
+     * \param t3  Local receive time of the answer
+     * \return  Whether the times were consistent
+     */
+    bool add_sample(int64_t t0, int64_t t1, int64_t t2, int64_t t3);
+
+    /// Forgets all the samples
+    void clear();
+
+    /// Returns whether enough probes were answered for the estimates to be used
+    bool is_synchronised() const;
+
+    /// Returns the number of answered probes
+    uint64_t get_sample_count() const;
+
+    /**
+     * \brief  Returns the offset of the clock of the peer at a given time
+     *
+     * \param local_time  Local time (in µs)
+     * \return  Clock of the peer minus local clock (in µs)
+     */
+    int64_t get_offset(int64_t local_time) const;
+
+    /// Returns the drift of the clock of the peer relative to the local one (e.g. 1e-5 for 10 ppm)
+    double get_drift() const;
+
+    /// Returns the smallest round-trip delay of the last probes (in µs)
+    int64_t get_round_trip() const;
+
+    /// Converts a time of the peer to the local clock (in µs)
+    int64_t to_local(int64_t remote_time) const;
+
+  private:
+    /// Offset measured by a probe
+    struct Sample
+    {
+      int64_t time;    ///< Local time of the measure (middle of t0 and t3)
+      int64_t offset;  ///< Offset of the clock of the peer
+      int64_t delay;   ///< Round-trip delay
+    };
+
+    uint64_t sample_count_;      ///< Number of answered probes
+    std::vector<Sample> window_; ///< Last probes, in a ring indexed by sample_count_
+    std::vector<Sample> points_; ///< Kept probes, in a ring indexed by point_count_
+    uint64_t point_count_;       ///< Number of probes kept so far
+    double time_origin_;        ///< Mean time of the kept probes (in µs)
+    double offset_origin_;      ///< Offset at time_origin_ (in µs)
+    double drift_;              ///< Slope of the offset over time
+
+    /// Returns the number of probes in the window
+    size_t get_window_size() const;
+
+    /// Fits the offset and the drift to the kept probes
+    void fit();
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * @file
+ *
+ * \brief  Memory allocator of ENet recycling its blocks
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "enet_allocator.hpp"
+#include "enet/enet.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+
+
+namespace net
+{
+
+namespace
+{
+  /// Size of the smallest blocks (log2), including their header
+  constexpr size_t MIN_BLOCK_BITS = 6;
+
+  /// Number of block sizes, from 64 B to 64 KiB
+  constexpr size_t CLASS_COUNT = 11;
+
+  /// Class of the blocks too large for the free lists
+  constexpr size_t LARGE_CLASS = CLASS_COUNT;
+
+  /// Size of the header holding the class of a block, keeping the alignment of malloc
+  constexpr size_t HEADER_SIZE = 16;
+
+  /// Freed block, linked in a free list
+  struct FreeBlock
+  {
+    FreeBlock *next;  ///< Next block of the list
+  };
+
+  /// Free lists of a thread
+  struct FreeLists
+  {
+    FreeBlock *heads[CLASS_COUNT] = {};  ///< First block of each list
+    size_t sizes[CLASS_COUNT] = {};      ///< Number of blocks in each list
+    bool alive = true;                   ///< Whether the lists can still be used by the thread
+
+    ~FreeLists()
+    {
+      for (size_t k = 0; k < CLASS_COUNT; k++) {
+        while (heads[k] != nullptr) {
+          FreeBlock *block = heads[k];
+          heads[k] = block->next;
+          free(block);
+        }
+      }
+
+      // Blocks freed by the destructors which run later go back to malloc
+      alive = false;
+    }
+  };
+
+  thread_local FreeLists free_lists;
+  std::atomic<bool> installed(false);
+
+  /// Returns the class of a block of a given size (header included)
+  size_t get_class(size_t size)
+  {
+    size_t block_class = 0;
+
+    while (block_class < CLASS_COUNT && ((size_t)1 << (MIN_BLOCK_BITS + block_class)) < size)
+      block_class++;
+
+    return block_class;
+  }
+
+  void* ENET_CALLBACK allocate_cb(size_t size)
+  {
+    return EnetAllocator::allocate(size);
+  }
+
+  void ENET_CALLBACK release_cb(void *memory)
+  {
+    EnetAllocator::release(memory);
+  }
+}
+
+
+bool EnetAllocator::install()
+{
+  if (installed.load())
+    return true;
+
+  ENetCallbacks callbacks;
+  callbacks.malloc = &allocate_cb;
+  callbacks.free = &release_cb;
+  callbacks.no_memory = nullptr;
+
+  if (enet_initialize_with_callbacks(ENET_VERSION, &callbacks) != 0)
+    return false;
+
+  installed.store(true);
+
+  return true;
+}
+
+
+bool EnetAllocator::is_installed()
+{
+  return installed.load();
+}
+
+
+void* EnetAllocator::allocate(size_t size)
+{
+  size_t block_class = get_class(size + HEADER_SIZE);
+  void *block;
+
+  if (block_class < CLASS_COUNT && free_lists.alive && free_lists.heads[block_class] != nullptr) {
+    FreeBlock *head = free_lists.heads[block_class];
+    free_lists.heads[block_class] = head->next;
+    free_lists.sizes[block_class]--;
+    block = head;
+  } else {
+    block = malloc(block_class < CLASS_COUNT
+      ? (size_t)1 << (MIN_BLOCK_BITS + block_class)
+      : size + HEADER_SIZE
+    );
+
+    if (block == nullptr)
+      return nullptr;
+  }
+
+  *static_cast<size_t*>(block) = block_class;
+
+  return static_cast<uint8_t*>(block) + HEADER_SIZE;
+}
+
+
+void EnetAllocator::release(void *memory)
+{
+  if (memory == nullptr)
+    return;
+
+  void *block = static_cast<uint8_t*>(memory) - HEADER_SIZE;
+  size_t block_class = *static_cast<size_t*>(block);
+
+  if (block_class == LARGE_CLASS || !free_lists.alive
+    || free_lists.sizes[block_class] >= MAX_CACHED_BLOCKS
+  ) {
+    free(block);
+    return;
+  }
+
+  FreeBlock *head = static_cast<FreeBlock*>(block);
+  head->next = free_lists.heads[block_class];
+  free_lists.heads[block_class] = head;
+  free_lists.sizes[block_class]++;
+}
+
+
+}  // namespace net
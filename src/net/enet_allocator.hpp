@@ -0,0 +1,59 @@
+/**
+ * @file
+ *
+ * \brief  Memory allocator of ENet recycling its blocks
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__ENET_ALLOCATOR_HPP
+#define NET__ENET_ALLOCATOR_HPP
+
+#include <cstddef>
+
+
+namespace net
+{
+
+/**
+ * \brief  Memory allocator of ENet recycling its blocks
+ *
+ * ENet allocates a packet, a command and often an acknowledgement for each message
+ * sent or received, and frees them once handled. Once installed, the freed blocks
+ * are kept in free lists of the thread freeing them, by power-of-two size (up to
+ * 64 KiB), so that a steady flow of messages no longer reaches malloc.
+ *
+ * Installed by BasicNetHost::init (and thus by NetServer and NetClient), which
+ * initialises ENet. It must be installed before any ENet host or packet is
+ * created, since the blocks allocated by malloc beforehand cannot be freed by
+ * the allocator: a program using ENet directly before initialising its hosts
+ * installs it first instead of calling enet_initialize:
+ *
+ *     net::EnetAllocator::install();
+ */
+class EnetAllocator
+{
+  public:
+    /// Number of freed blocks kept in each free list, beyond which they are freed
+    static constexpr size_t MAX_CACHED_BLOCKS = 1024;
+
+    /**
+     * \brief  Makes ENet allocate through the free lists
+     *
+     * \return  Whether the allocator is installed
+     */
+    static bool install();
+
+    /// Returns whether the allocator is installed
+    static bool is_installed();
+
+    /// Allocates a block, from the free lists if possible
+    static void* allocate(size_t size);
+
+    /// Gives a block back to the free list of the calling thread
+    static void release(void *memory);
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,590 @@
+/**
+ * @file
+ *
+ * \brief  Hand-over of a host and of its peers to another process (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Messages of the Unix connection, from the predecessor to the successor:
+ *   - header: MAGIC and the size of the snapshot (two uint64_t), along with the
+ *     UDP socket (SCM_RIGHTS)
+ *   - snapshot
+ */
+
+#include "handover.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include <cstring>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stddef.h>
+#endif
+
+
+namespace net
+{
+
+namespace
+{
+
+/// Identifies the header of a hand-over
+constexpr uint64_t MAGIC = 0x73696d706c65686fULL;
+
+/// Prefix of the names in the abstract namespace
+const char NAME_PREFIX[] = "simple_enet.handover.";
+
+using Clock = std::chrono::steady_clock;
+
+#ifdef __linux__
+
+/// Builds the abstract address of a name, returns whether it fits
+bool make_address(const std::string &name, sockaddr_un &address, socklen_t &address_length)
+{
+  std::string path = NAME_PREFIX + name;
+
+  if (name.empty() || path.size() > sizeof(address.sun_path) - 1)
+    return false;
+
+  address = {};
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path + 1, path.data(), path.size());
+  address_length = offsetof(sockaddr_un, sun_path) + 1 + path.size();
+
+  return true;
+}
+
+
+/// Returns whether the process at the other end of a connection belongs to the same user
+bool is_same_user(int fd)
+{
+  ucred credentials;
+  socklen_t length = sizeof(credentials);
+
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0
+    && credentials.uid == getuid();
+}
+
+
+/// Waits for a descriptor to be ready, returns false once the deadline is reached
+bool wait_for(int fd, short events, Clock::time_point deadline)
+{
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+
+    if (remaining.count() <= 0)
+      return false;
+
+    pollfd entry = {fd, events, 0};
+    int result = poll(&entry, 1, remaining.count());
+
+    if (result > 0)
+      return true;
+
+    if (result < 0 && errno != EINTR)
+      return false;
+  }
+}
+
+
+/// Writes all the data to a non-blocking connection, returns whether successful
+bool write_all(int fd, const char *data, size_t size, Clock::time_point deadline)
+{
+  while (size > 0) {
+    ssize_t length = ::send(fd, data, size, MSG_NOSIGNAL);
+
+    if (length > 0) {
+      data += length;
+      size -= length;
+    } else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      if (!wait_for(fd, POLLOUT, deadline))
+        return false;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+/// Reads exactly `size` bytes from a non-blocking connection, returns whether successful
+bool read_all(int fd, char *data, size_t size, Clock::time_point deadline)
+{
+  while (size > 0) {
+    ssize_t length = ::recv(fd, data, size, 0);
+
+    if (length > 0) {
+      data += length;
+      size -= length;
+    } else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      if (!wait_for(fd, POLLIN, deadline))
+        return false;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+#endif
+
+}  // namespace
+
+
+Handover::Handover():
+  listener_(-1),
+  connection_(-1),
+  received_(-1)
+{
+
+}
+
+
+Handover::~Handover()
+{
+  close_fd(listener_);
+  close_fd(connection_);
+  close_fd(received_);
+}
+
+
+bool Handover::is_drained(ENetPeer *peer)
+{
+  if (peer->state != ENET_PEER_STATE_CONNECTED
+    || !enet_list_empty(&peer->sentReliableCommands)
+    || !enet_list_empty(&peer->outgoingCommands)
+    || !enet_list_empty(&peer->outgoingSendReliableCommands)
+    || !enet_list_empty(&peer->acknowledgements)
+    || !enet_list_empty(&peer->dispatchedCommands)
+  ) {
+    return false;
+  }
+
+  for (size_t k = 0; k < peer->channelCount; k++) {
+    ENetChannel *channel = &peer->channels[k];
+
+    if (!enet_list_empty(&channel->incomingReliableCommands)
+      || !enet_list_empty(&channel->incomingUnreliableCommands)
+    ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void Handover::save_peer(const ENetPeer *peer, PeerSnapshot &snapshot)
+{
+  snapshot.incoming_peer_id = peer->incomingPeerID;
+  snapshot.outgoing_peer_id = peer->outgoingPeerID;
+  snapshot.connect_id = peer->connectID;
+  snapshot.incoming_session_id = peer->incomingSessionID;
+  snapshot.outgoing_session_id = peer->outgoingSessionID;
+  snapshot.address_host = peer->address.host;
+  snapshot.address_port = peer->address.port;
+  snapshot.incoming_bandwidth = peer->incomingBandwidth;
+  snapshot.outgoing_bandwidth = peer->outgoingBandwidth;
+  snapshot.mtu = peer->mtu;
+  snapshot.window_size = peer->windowSize;
+  snapshot.packet_throttle = peer->packetThrottle;
+  snapshot.packet_throttle_limit = peer->packetThrottleLimit;
+  snapshot.packet_throttle_acceleration = peer->packetThrottleAcceleration;
+  snapshot.packet_throttle_deceleration = peer->packetThrottleDeceleration;
+  snapshot.packet_throttle_interval = peer->packetThrottleInterval;
+  snapshot.ping_interval = peer->pingInterval;
+  snapshot.timeout_limit = peer->timeoutLimit;
+  snapshot.timeout_minimum = peer->timeoutMinimum;
+  snapshot.timeout_maximum = peer->timeoutMaximum;
+  snapshot.round_trip_time = peer->roundTripTime;
+  snapshot.round_trip_time_variance = peer->roundTripTimeVariance;
+  snapshot.lowest_round_trip_time = peer->lowestRoundTripTime;
+  snapshot.packet_loss = peer->packetLoss;
+  snapshot.packet_loss_variance = peer->packetLossVariance;
+  snapshot.outgoing_reliable_sequence = peer->outgoingReliableSequenceNumber;
+  snapshot.incoming_unsequenced_group = peer->incomingUnsequencedGroup;
+  snapshot.outgoing_unsequenced_group = peer->outgoingUnsequencedGroup;
+  memcpy(snapshot.unsequenced_window, peer->unsequencedWindow, sizeof(snapshot.unsequenced_window));
+
+  snapshot.channels.resize(peer->channelCount);
+
+  for (size_t k = 0; k < peer->channelCount; k++) {
+    const ENetChannel &channel = peer->channels[k];
+    ChannelSnapshot &channel_snapshot = snapshot.channels[k];
+    channel_snapshot.outgoing_reliable_sequence = channel.outgoingReliableSequenceNumber;
+    channel_snapshot.outgoing_unreliable_sequence = channel.outgoingUnreliableSequenceNumber;
+    channel_snapshot.incoming_reliable_sequence = channel.incomingReliableSequenceNumber;
+    channel_snapshot.incoming_unreliable_sequence = channel.incomingUnreliableSequenceNumber;
+  }
+}
+
+
+ENetPeer* Handover::restore_peer(ENetHost *host, const PeerSnapshot &snapshot)
+{
+  if (snapshot.incoming_peer_id >= host->peerCount || snapshot.channels.empty()
+    || snapshot.channels.size() > std::min<size_t>(host->channelLimit, ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT)
+  ) {
+    return nullptr;
+  }
+
+  ENetPeer *peer = &host->peers[snapshot.incoming_peer_id];
+
+  if (peer->state != ENET_PEER_STATE_DISCONNECTED)
+    return nullptr;
+
+  // Channels as set up by a connection, then carried on where the predecessor stopped
+  peer->channels = static_cast<ENetChannel*>(enet_malloc(snapshot.channels.size() * sizeof(ENetChannel)));
+
+  if (peer->channels == nullptr)
+    return nullptr;
+
+  peer->channelCount = snapshot.channels.size();
+
+  for (size_t k = 0; k < peer->channelCount; k++) {
+    ENetChannel *channel = &peer->channels[k];
+    const ChannelSnapshot &channel_snapshot = snapshot.channels[k];
+    channel->outgoingReliableSequenceNumber = channel_snapshot.outgoing_reliable_sequence;
+    channel->outgoingUnreliableSequenceNumber = channel_snapshot.outgoing_unreliable_sequence;
+    channel->incomingReliableSequenceNumber = channel_snapshot.incoming_reliable_sequence;
+    channel->incomingUnreliableSequenceNumber = channel_snapshot.incoming_unreliable_sequence;
+    channel->usedReliableWindows = 0;
+    memset(channel->reliableWindows, 0, sizeof(channel->reliableWindows));
+    enet_list_clear(&channel->incomingReliableCommands);
+    enet_list_clear(&channel->incomingUnreliableCommands);
+  }
+
+  peer->outgoingPeerID = snapshot.outgoing_peer_id;
+  peer->connectID = snapshot.connect_id;
+  peer->incomingSessionID = snapshot.incoming_session_id;
+  peer->outgoingSessionID = snapshot.outgoing_session_id;
+  peer->address.host = snapshot.address_host;
+  peer->address.port = snapshot.address_port;
+  peer->incomingBandwidth = snapshot.incoming_bandwidth;
+  peer->outgoingBandwidth = snapshot.outgoing_bandwidth;
+  peer->mtu = snapshot.mtu;
+  peer->windowSize = snapshot.window_size;
+  peer->packetThrottle = snapshot.packet_throttle;
+  peer->packetThrottleLimit = snapshot.packet_throttle_limit;
+  peer->packetThrottleAcceleration = snapshot.packet_throttle_acceleration;
+  peer->packetThrottleDeceleration = snapshot.packet_throttle_deceleration;
+  peer->packetThrottleInterval = snapshot.packet_throttle_interval;
+  peer->pingInterval = snapshot.ping_interval;
+  peer->timeoutLimit = snapshot.timeout_limit;
+  peer->timeoutMinimum = snapshot.timeout_minimum;
+  peer->timeoutMaximum = snapshot.timeout_maximum;
+  peer->roundTripTime = snapshot.round_trip_time;
+  peer->roundTripTimeVariance = snapshot.round_trip_time_variance;
+  peer->lastRoundTripTime = snapshot.round_trip_time;
+  peer->lastRoundTripTimeVariance = snapshot.round_trip_time_variance;
+  peer->lowestRoundTripTime = snapshot.lowest_round_trip_time;
+  peer->highestRoundTripTimeVariance = snapshot.round_trip_time_variance;
+  peer->packetLoss = snapshot.packet_loss;
+  peer->packetLossVariance = snapshot.packet_loss_variance;
+  peer->outgoingReliableSequenceNumber = snapshot.outgoing_reliable_sequence;
+  peer->incomingUnsequencedGroup = snapshot.incoming_unsequenced_group;
+  peer->outgoingUnsequencedGroup = snapshot.outgoing_unsequenced_group;
+  memcpy(peer->unsequencedWindow, snapshot.unsequenced_window, sizeof(snapshot.unsequenced_window));
+
+  // Times of the predecessor mean nothing to this process
+  const enet_uint32 time = enet_time_get();
+  peer->lastSendTime = time;
+  peer->lastReceiveTime = time;
+  peer->packetLossEpoch = time;
+  peer->packetThrottleEpoch = time;
+  peer->incomingBandwidthThrottleEpoch = time;
+  peer->outgoingBandwidthThrottleEpoch = time;
+  peer->nextTimeout = 0;
+  peer->earliestTimeout = 0;
+  peer->data = nullptr;
+
+  // Counts the peer as connected, as ENet does once the handshake succeeds
+  enet_peer_on_connect(peer);
+  peer->state = ENET_PEER_STATE_CONNECTED;
+
+  return peer;
+}
+
+
+#ifdef __linux__
+
+bool Handover::listen(const std::string &name)
+{
+  sockaddr_un address;
+  socklen_t address_length;
+  close_fd(listener_);
+
+  if (!make_address(name, address, address_length)) {
+    fprintf(stderr, "[Handover] Invalid name: %s\n", name.c_str());
+    return false;
+  }
+
+  listener_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (listener_ < 0
+    || bind(listener_, (sockaddr*)&address, address_length) != 0
+    || ::listen(listener_, 1) != 0
+  ) {
+    fprintf(stderr, "[Handover] Could not listen for a successor: %s\n", strerror(errno));
+    close_fd(listener_);
+    return false;
+  }
+
+  name_ = name;
+
+  return true;
+}
+
+
+bool Handover::accept()
+{
+  if (connection_ >= 0)
+    return true;
+
+  if (listener_ < 0)
+    return false;
+
+  int connection = accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (connection < 0)
+    return false;
+
+  if (!is_same_user(connection)) {
+    close(connection);
+    return false;
+  }
+
+  // Frees the name, so that the successor can listen for its own successor
+  connection_ = connection;
+  close_fd(listener_);
+
+  return true;
+}
+
+
+bool Handover::send(ENetSocket socket, const std::string &snapshot, std::chrono::milliseconds timeout)
+{
+  if (connection_ < 0)
+    return false;
+
+  const auto deadline = Clock::now() + timeout;
+  uint64_t header[2] = {MAGIC, snapshot.size()};
+  int fd = socket;
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fd))] = {};
+  iovec iov = {header, sizeof(header)};
+
+  msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  cmsghdr *control_header = CMSG_FIRSTHDR(&message);
+  control_header->cmsg_level = SOL_SOCKET;
+  control_header->cmsg_type = SCM_RIGHTS;
+  control_header->cmsg_len = CMSG_LEN(sizeof(fd));
+  memcpy(CMSG_DATA(control_header), &fd, sizeof(fd));
+
+  bool success = sendmsg(connection_, &message, MSG_NOSIGNAL) == sizeof(header)
+    && write_all(connection_, snapshot.data(), snapshot.size(), deadline);
+
+  // Waits for the successor to close its end, so that it holds the socket before returning
+  char byte;
+  success = success && wait_for(connection_, POLLIN, deadline) && ::recv(connection_, &byte, 1, 0) == 0;
+  close_fd(connection_);
+
+  if (!success) {
+    fprintf(stderr, "[Handover] Could not hand over to the successor: %s\n", strerror(errno));
+
+    if (!name_.empty())
+      listen(name_);
+  }
+
+  return success;
+}
+
+
+bool Handover::receive(const std::string &name, std::chrono::milliseconds timeout, std::string &snapshot)
+{
+  sockaddr_un address;
+  socklen_t address_length;
+
+  if (!make_address(name, address, address_length)) {
+    fprintf(stderr, "[Handover] Invalid name: %s\n", name.c_str());
+    return false;
+  }
+
+  // The predecessor may not listen yet
+  const auto deadline = Clock::now() + timeout;
+  close_fd(connection_);
+
+  while (true) {
+    connection_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (connection_ < 0)
+      return false;
+
+    if (connect(connection_, (sockaddr*)&address, address_length) == 0)
+      break;
+
+    close_fd(connection_);
+
+    if (Clock::now() >= deadline) {
+      fprintf(stderr, "[Handover] No predecessor is listening\n");
+      return false;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  if (!is_same_user(connection_)) {
+    fprintf(stderr, "[Handover] The predecessor belongs to another user\n");
+    close_fd(connection_);
+    return false;
+  }
+
+  uint64_t header[2] = {0, 0};
+  int fd = -1;
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fd))] = {};
+  iovec iov = {header, sizeof(header)};
+
+  msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  ssize_t length = -1;
+
+  while (length < 0 && wait_for(connection_, POLLIN, deadline)) {
+    length = recvmsg(connection_, &message, MSG_CMSG_CLOEXEC);
+
+    if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      break;
+  }
+
+  cmsghdr *control_header = CMSG_FIRSTHDR(&message);
+
+  if (control_header != nullptr && control_header->cmsg_level == SOL_SOCKET
+    && control_header->cmsg_type == SCM_RIGHTS && control_header->cmsg_len == CMSG_LEN(sizeof(fd))
+  ) {
+    memcpy(&fd, CMSG_DATA(control_header), sizeof(fd));
+  }
+
+  close_fd(received_);
+  received_ = fd;
+
+  if (length != sizeof(header) || header[0] != MAGIC || received_ < 0) {
+    fprintf(stderr, "[Handover] Invalid hand-over from the predecessor\n");
+    close_fd(connection_);
+    close_fd(received_);
+    return false;
+  }
+
+  snapshot.resize(header[1]);
+  bool success = read_all(connection_, snapshot.data(), snapshot.size(), deadline);
+  close_fd(connection_);
+
+  if (!success) {
+    fprintf(stderr, "[Handover] Could not read the snapshot of the predecessor\n");
+    close_fd(received_);
+  }
+
+  return success;
+}
+
+
+bool Handover::adopt(ENetHost *host)
+{
+  if (received_ < 0 || host == nullptr)
+    return false;
+
+  bool success = dup2(received_, host->socket) >= 0;
+  close_fd(received_);
+
+  return success;
+}
+
+
+bool Handover::detach(ENetHost *host)
+{
+  ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+
+  if (socket == ENET_SOCKET_NULL)
+    return false;
+
+  enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+  bool success = dup2(socket, host->socket) >= 0;
+  enet_socket_destroy(socket);
+
+  return success;
+}
+
+
+void Handover::close_fd(int &fd)
+{
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+#else
+
+bool Handover::listen(const std::string &)
+{
+  fprintf(stderr, "[Handover] Only available on Linux\n");
+  return false;
+}
+
+
+bool Handover::accept()
+{
+  return false;
+}
+
+
+bool Handover::send(ENetSocket, const std::string &, std::chrono::milliseconds)
+{
+  return false;
+}
+
+
+bool Handover::receive(const std::string &, std::chrono::milliseconds, std::string &)
+{
+  fprintf(stderr, "[Handover] Only available on Linux\n");
+  return false;
+}
+
+
+bool Handover::adopt(ENetHost *)
+{
+  return false;
+}
+
+
+bool Handover::detach(ENetHost *)
+{
+  return false;
+}
+
+
+void Handover::close_fd(int &fd)
+{
+  fd = -1;
+}
+
+#endif
+
+
+}  // namespace net
@@ -0,0 +1,220 @@
+/**
+ * @file
+ *
+ * \brief  Hand-over of a host and of its peers to another process (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * A process about to be replaced (the predecessor) listens on a Unix socket of
+ * the abstract namespace. Its successor, started on the same machine by the same
+ * user, connects to it and receives:
+ *   - the UDP socket of the host (SCM_RIGHTS), still bound to the same port, with
+ *     the datagrams not read by the predecessor still queued in it
+ *   - a snapshot of the protocol state of the peers, so that the successor carries
+ *     on their connections where the predecessor stopped, without a new handshake
+ *
+ * The snapshot only holds the state needed when nothing is in flight: the peers
+ * are handed over once all the data they were sent has been acknowledged, and all
+ * the data they sent has been dispatched (see is_drained).
+ */
+
+#ifndef NET__HANDOVER_HPP
+#define NET__HANDOVER_HPP
+
+#include "enet/enet.h"
+#include "cereal/cereal.hpp"
+#include "cereal/types/vector.hpp"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/// Sequence numbers of a channel of a peer
+struct ChannelSnapshot
+{
+  uint16_t outgoing_reliable_sequence = 0;    ///< Last reliable command sent
+  uint16_t outgoing_unreliable_sequence = 0;  ///< Last unreliable command sent
+  uint16_t incoming_reliable_sequence = 0;    ///< Last reliable command received
+  uint16_t incoming_unreliable_sequence = 0;  ///< Last unreliable command received
+
+  template <class Archive>
+  void serialize(Archive &ar)
+  {
+    ar(
+      outgoing_reliable_sequence,
+      outgoing_unreliable_sequence,
+      incoming_reliable_sequence,
+      incoming_unreliable_sequence
+    );
+  }
+};
+
+
+/// Protocol state of a drained ENet peer, from which the connection can be carried on
+struct PeerSnapshot
+{
+  static constexpr size_t UNSEQUENCED_WORDS = ENET_PEER_UNSEQUENCED_WINDOW_SIZE / 32;
+
+  uint16_t incoming_peer_id = 0;      ///< Slot of the peer in the host, given by the peer in its datagrams
+  uint16_t outgoing_peer_id = 0;      ///< Slot of the host in the peer
+  uint32_t connect_id = 0;            ///< Identifier of the connection, chosen by the connecting side
+  uint8_t incoming_session_id = 0;    ///< Session expected in the datagrams of the peer
+  uint8_t outgoing_session_id = 0;    ///< Session of the datagrams sent to the peer
+  uint32_t address_host = 0;          ///< Address of the peer
+  uint16_t address_port = 0;          ///< Port of the peer
+  uint32_t incoming_bandwidth = 0;    ///< Downstream bandwidth of the peer (in bytes/s)
+  uint32_t outgoing_bandwidth = 0;    ///< Upstream bandwidth of the peer (in bytes/s)
+  uint32_t mtu = 0;                   ///< Negotiated (or probed) MTU
+  uint32_t window_size = 0;           ///< Reliable data in transit allowed
+  uint32_t packet_throttle = 0;       ///< Unreliable throttle and its parameters
+  uint32_t packet_throttle_limit = 0;
+  uint32_t packet_throttle_acceleration = 0;
+  uint32_t packet_throttle_deceleration = 0;
+  uint32_t packet_throttle_interval = 0;
+  uint32_t ping_interval = 0;         ///< Timeouts set on the peer (in ms)
+  uint32_t timeout_limit = 0;
+  uint32_t timeout_minimum = 0;
+  uint32_t timeout_maximum = 0;
+  uint32_t round_trip_time = 0;       ///< Round-trip time estimates (in ms)
+  uint32_t round_trip_time_variance = 0;
+  uint32_t lowest_round_trip_time = 0;
+  uint32_t packet_loss = 0;           ///< Packet loss estimates (scaled by ENET_PEER_PACKET_LOSS_SCALE)
+  uint32_t packet_loss_variance = 0;
+  uint16_t outgoing_reliable_sequence = 0;   ///< Last reliable command sent outside the channels
+  uint16_t incoming_unsequenced_group = 0;   ///< Window of the unsequenced commands received
+  uint16_t outgoing_unsequenced_group = 0;   ///< Last unsequenced group sent
+  uint32_t unsequenced_window[UNSEQUENCED_WORDS] = {};  ///< Unsequenced commands received in the window
+  std::vector<ChannelSnapshot> channels;     ///< State of each channel
+
+  template <class Archive>
+  void serialize(Archive &ar)
+  {
+    ar(
+      incoming_peer_id, outgoing_peer_id, connect_id, incoming_session_id, outgoing_session_id,
+      address_host, address_port, incoming_bandwidth, outgoing_bandwidth, mtu, window_size,
+      packet_throttle, packet_throttle_limit, packet_throttle_acceleration,
+      packet_throttle_deceleration, packet_throttle_interval,
+      ping_interval, timeout_limit, timeout_minimum, timeout_maximum,
+      round_trip_time, round_trip_time_variance, lowest_round_trip_time,
+      packet_loss, packet_loss_variance,
+      outgoing_reliable_sequence, incoming_unsequenced_group, outgoing_unsequenced_group
+    );
+
+    for (uint32_t &word: unsequenced_window)
+      ar(word);
+
+    ar(channels);
+  }
+};
+
+
+/**
+ * \brief  Passes the socket of a host and a snapshot of its peers to a successor process
+ *
+ * Predecessor side: listen, accept (polled without blocking), send, detach.
+ * Successor side: receive, then adopt once its own host is created.
+ *
+ * Only processes of the same user are accepted at either end.
+ */
+class Handover
+{
+  public:
+    /// Duration of the last hand-over, and what it carried
+    struct Stats
+    {
+      uint64_t drain_time = 0;     ///< Time taken by the predecessor to drain its peers (in µs)
+      uint64_t gap = 0;            ///< From the predecessor stopping to the first service of the successor (in µs, successor only)
+      size_t peers_handed_over = 0;  ///< Peers carried on by the successor
+      size_t peers_dropped = 0;    ///< Peers disconnected instead, which have to connect again
+      size_t snapshot_size = 0;    ///< Size of the snapshot (in bytes)
+    };
+
+    Handover();
+    ~Handover();
+
+    Handover(const Handover&) = delete;
+    Handover& operator=(const Handover&) = delete;
+
+    /**
+     * \brief  Starts listening for a successor
+     *
+     * \param name  Name shared by the predecessor and the successor, unique on the machine
+     * \return  Whether the name could be bound
+     */
+    bool listen(const std::string &name);
+
+    /// Returns whether a successor is connected, accepting it without blocking
+    bool accept();
+
+    /**
+     * \brief  Passes a socket and a snapshot to the accepted successor
+     *
+     * The connection is closed afterwards. On failure, the predecessor listens
+     * again for another successor.
+     *
+     * \param socket    Socket of the host, still used by the predecessor until detached
+     * \param snapshot  Serialised state of the peers
+     * \param timeout   Maximal duration to wait for the successor to read the snapshot
+     * \return  Whether the successor received everything
+     */
+    bool send(ENetSocket socket, const std::string &snapshot, std::chrono::milliseconds timeout);
+
+    /**
+     * \brief  Receives the socket and the snapshot of a predecessor
+     *
+     * Blocks until the predecessor listens and hands over, or until the timeout.
+     *
+     * \param name      Name given to listen by the predecessor
+     * \param timeout   Maximal duration to wait
+     * \param[out] snapshot  Serialised state of the peers
+     * \return  Whether the socket and the snapshot were received
+     */
+    bool receive(const std::string &name, std::chrono::milliseconds timeout, std::string &snapshot);
+
+    /**
+     * \brief  Replaces the socket of a host by the received one
+     *
+     * The descriptor of the host keeps its number, so that anything registered
+     * with it (such as the batched socket layer) keeps working.
+     */
+    bool adopt(ENetHost *host);
+
+    /// Replaces the socket of a host by an unbound one, so that it stops receiving the datagrams of its port
+    static bool detach(ENetHost *host);
+
+    /**
+     * \brief  Returns whether a connected peer can be handed over
+     *
+     * Nothing is waiting for an acknowledgement or to be sent, and every command
+     * received has been dispatched.
+     */
+    static bool is_drained(ENetPeer *peer);
+
+    /// Saves the protocol state of a drained peer
+    static void save_peer(const ENetPeer *peer, PeerSnapshot &snapshot);
+
+    /**
+     * \brief  Connects the peer of a snapshot in its original slot of a host
+     *
+     * \return  The connected peer, or nullptr if its slot is used or out of range
+     */
+    static ENetPeer* restore_peer(ENetHost *host, const PeerSnapshot &snapshot);
+
+  private:
+    std::string name_;  ///< Name bound by the predecessor
+    int listener_;      ///< Socket listening for a successor (-1 if none)
+    int connection_;    ///< Connection to the successor or to the predecessor (-1 if none)
+    int received_;      ///< Socket received from the predecessor, until adopted (-1 if none)
+
+    /// Closes a descriptor, if open
+    static void close_fd(int &fd);
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * @file
+ *
+ * \brief  Histogram of durations with logarithmic buckets
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "histogram.hpp"
+#include <algorithm>
+#include <limits>
+
+
+namespace net
+{
+
+LatencyHistogram::LatencyHistogram()
+{
+  clear();
+}
+
+
+void LatencyHistogram::record(int64_t value)
+{
+  value = std::max<int64_t>(value, 0);
+  buckets_[get_bucket(value)]++;
+  count_++;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  sum_ += value;
+}
+
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+  for (size_t k = 0; k < BUCKET_COUNT; k++)
+    buckets_[k] += other.buckets_[k];
+
+  count_ += other.count_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  sum_ += other.sum_;
+}
+
+
+void LatencyHistogram::clear()
+{
+  buckets_.fill(0);
+  count_ = 0;
+  min_ = std::numeric_limits<int64_t>::max();
+  max_ = 0;
+  sum_ = 0.0;
+}
+
+
+uint64_t LatencyHistogram::get_count() const
+{
+  return count_;
+}
+
+
+int64_t LatencyHistogram::get_min() const
+{
+  return count_ > 0 ? min_ : 0;
+}
+
+
+int64_t LatencyHistogram::get_max() const
+{
+  return max_;
+}
+
+
+double LatencyHistogram::get_mean() const
+{
+  return count_ > 0 ? sum_ / count_ : 0.0;
+}
+
+
+double LatencyHistogram::get_percentile(double p) const
+{
+  if (count_ == 0)
+    return 0.0;
+
+  const uint64_t rank = std::min<uint64_t>(p * count_, count_ - 1);
+  uint64_t seen = 0;
+
+  for (size_t k = 0; k < BUCKET_COUNT; k++) {
+    seen += buckets_[k];
+
+    if (seen > rank) {
+      double lower = get_lower_bound(k);
+      double upper = k + 1 < BUCKET_COUNT ? get_lower_bound(k + 1) : lower;
+      double middle = (lower + upper) / 2;
+
+      return std::clamp<double>(middle, min_, max_);
+    }
+  }
+
+  return max_;
+}
+
+
+size_t LatencyHistogram::get_bucket(uint64_t value)
+{
+  constexpr uint64_t sub_bucket_count = 1 << SUB_BUCKET_BITS;
+
+  if (value < sub_bucket_count)
+    return value;
+
+  // Position of the highest bit, and the next bits as index within the power of two
+  int exponent = 63 - __builtin_clzll(value);
+  size_t bucket = ((exponent - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS)
+    + ((value >> (exponent - SUB_BUCKET_BITS)) & (sub_bucket_count - 1));
+
+  return std::min(bucket, BUCKET_COUNT - 1);
+}
+
+
+uint64_t LatencyHistogram::get_lower_bound(size_t bucket)
+{
+  constexpr uint64_t sub_bucket_count = 1 << SUB_BUCKET_BITS;
+
+  if (bucket < sub_bucket_count)
+    return bucket;
+
+  int exponent = (bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+
+  return (sub_bucket_count + (bucket & (sub_bucket_count - 1))) << (exponent - SUB_BUCKET_BITS);
+}
+
+
+}  // namespace net
@@ -0,0 +1,83 @@
+/**
+ * @file
+ *
+ * \brief  Histogram of durations with logarithmic buckets
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__HISTOGRAM_HPP
+#define NET__HISTOGRAM_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/**
+ * \brief  Histogram of durations (in µs), with a constant relative precision
+ *
+ * Each power of two is split in 16 buckets, so that percentiles are known within
+ * about 3%, from 1 µs up to several days. Recording is a few arithmetic
+ * operations, without allocation.
+ */
+class LatencyHistogram
+{
+  public:
+    LatencyHistogram();
+
+    /// Records a duration (in µs), negative ones being recorded as zero
+    void record(int64_t value);
+
+    /// Adds the samples of another histogram
+    void merge(const LatencyHistogram &other);
+
+    /// Removes all the samples
+    void clear();
+
+    /// Returns the number of samples
+    uint64_t get_count() const;
+
+    /// Returns the smallest sample (in µs)
+    int64_t get_min() const;
+
+    /// Returns the largest sample (in µs)
+    int64_t get_max() const;
+
+    /// Returns the mean of the samples (in µs)
+    double get_mean() const;
+
+    /**
+     * \brief  Returns a percentile of the samples
+     *
+     * \param p  Percentile, between 0 and 1
+     * \return  Middle of the bucket holding the percentile (in µs)
+     */
+    double get_percentile(double p) const;
+
+  private:
+    /// Number of buckets per power of two (log2)
+    static constexpr int SUB_BUCKET_BITS = 4;
+
+    /// Number of buckets, covering durations up to 2^40 µs
+    static constexpr size_t BUCKET_COUNT = (40 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    std::array<uint64_t, BUCKET_COUNT> buckets_;  ///< Number of samples in each bucket
+    uint64_t count_;  ///< Number of samples
+    int64_t min_;     ///< Smallest sample
+    int64_t max_;     ///< Largest sample
+    double sum_;      ///< Sum of the samples
+
+    /// Returns the bucket of a duration
+    static size_t get_bucket(uint64_t value);
+
+    /// Returns the smallest duration of a bucket
+    static uint64_t get_lower_bound(size_t bucket);
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,167 @@
+/**
+ * @file
+ *
+ * \brief  Convenience class handling an ENet host
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "host.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <shared_mutex>
+#include <mutex>
+
+#include <stdio.h>
+
+
+namespace net
+{
+
+/// All created hosts, to find them back from ENet callbacks
+static std::unordered_map<ENetHost*, NetHost*> net_hosts;
+
+/// Guards net_hosts, as hosts may be created and serviced on several threads
+static std::shared_mutex net_hosts_mutex;
+
+
+NetHost::NetHost():
+  is_host_created_(false),
+  host_(nullptr)
+{
+
+}
+
+NetHost::~NetHost()
+{
+  if (is_host_created_)
+    destroy();
+}
+
+
+bool NetHost::create(
+  const ENetAddress *address,
+  size_t peerCount,
+  size_t channelLimit,
+  enet_uint32 incomingBandwidth,
+  enet_uint32 outgoingBandwidth,
+  const SocketOptions &socket_options
+)
+{
+  if (is_host_created_)
+    destroy();
+
+  host_ = enet_host_create(
+    address, peerCount, channelLimit, incomingBandwidth, outgoingBandwidth
+  );
+
+  if (host_ != nullptr) {
+    is_host_created_ = true;
+
+    {
+      std::unique_lock lock(net_hosts_mutex);
+      net_hosts[host_] = this;
+    }
+
+    update_intercept();
+
+    if (socket_options.backend == SocketBackend::BATCHED) {
+      if (BatchedSocket::is_available())
+        batched_socket_ = std::make_unique<BatchedSocket>(host_->socket, socket_options);
+      else
+        fprintf(stderr, "Batched sockets are not available, using the stock socket layer\n");
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+
+void NetHost::destroy()
+{
+  if (is_host_created_) {
+    batched_socket_.reset();
+
+    {
+      std::unique_lock lock(net_hosts_mutex);
+      net_hosts.erase(host_);
+    }
+
+    enet_host_destroy(host_);
+    host_ = nullptr;
+    is_host_created_ = false;
+  }
+}
+
+
+ENetHost* NetHost::get()
+{
+  return host_;
+}
+
+
+const ENetHost* NetHost::get() const
+{
+  return host_;
+}
+
+
+BatchedSocket* NetHost::get_batched_socket()
+{
+  return batched_socket_.get();
+}
+
+
+void NetHost::add_interceptor(Interceptor *interceptor)
+{
+  interceptors_.push_back(interceptor);
+  update_intercept();
+}
+
+
+void NetHost::remove_interceptor(Interceptor *interceptor)
+{
+  interceptors_.erase(
+    std::remove(interceptors_.begin(), interceptors_.end(), interceptor),
+    interceptors_.end()
+  );
+  update_intercept();
+}
+
+
+void NetHost::update_intercept()
+{
+  if (is_host_created_)
+    host_->intercept = interceptors_.empty() ? nullptr : &NetHost::intercept_cb;
+}
+
+
+int NetHost::intercept_cb(ENetHost *host, ENetEvent *)
+{
+  NetHost *net_host = nullptr;
+
+  {
+    std::shared_lock lock(net_hosts_mutex);
+    auto it = net_hosts.find(host);
+
+    if (it != net_hosts.end())
+      net_host = it->second;
+  }
+
+  if (net_host == nullptr)
+    return 0;
+
+  for (Interceptor *interceptor: net_host->interceptors_) {
+    if (interceptor->intercept(host))
+      return 1;  // the datagram is ignored by ENet
+  }
+
+  return 0;
+}
+
+
+}  // namespace net
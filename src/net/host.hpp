@@ -0,0 +1,107 @@
+/**
+ * @file
+ *
+ * \brief  Convenience class handling an ENet host
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__HOST_HPP
+#define NET__HOST_HPP
+
+#include "batched_socket.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <memory>
+
+
+namespace net
+{
+
+/// Inspects the raw datagrams received by a host, before ENet processes them
+class Interceptor
+{
+  public:
+    virtual ~Interceptor() = default;
+
+    /**
+     * \brief  Called for each datagram received by the host
+     *
+     * The datagram is available in `host->receivedData`, `host->receivedDataLength`
+     * and `host->receivedAddress`.
+     *
+     * \return  Whether the datagram should be dropped
+     */
+    virtual bool intercept(ENetHost *host) = 0;
+};
+
+
+/// Convenience class handling a host
+class NetHost
+{
+  public:
+    NetHost();
+    ~NetHost();
+
+    /**
+     * \brief  Creates a host for communicating to peers.
+     *
+     * \param address            The address at which other peers may connect to this host.  If NULL, then no peers may connect to the host.
+     * \param peerCount          The maximum number of peers that should be allocated for the host.
+     * \param channelLimit       The maximum number of channels allowed; if 0, then this is equivalent to ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT
+     * \param incomingBandwidth  Downstream bandwidth of the host in bytes/second; if 0, ENet will assume unlimited bandwidth.
+     * \param outgoingBandwidth  Upstream bandwidth of the host in bytes/second; if 0, ENet will assume unlimited bandwidth.
+     * \param socket_options     Socket layer to use, falls back to the stock one if the batched one is not available
+     * \return  Whether the host could be created
+     *
+     * \remarks ENet will strategically drop packets on specific sides of a connection between hosts
+     * to ensure the host's bandwidth is not overwhelmed.  The bandwidth parameters also determine
+     * the window size of a connection which limits the amount of reliable packets that may be in transit
+     * at any given time.
+     */
+    bool create(
+      const ENetAddress *address,
+      size_t peerCount,
+      size_t channelLimit,
+      enet_uint32 incomingBandwidth,
+      enet_uint32 outgoingBandwidth,
+      const SocketOptions &socket_options = SocketOptions()
+    );
+
+    /// Destroys the host and all resources associated with it
+    void destroy();
+
+    /// Returns a reference to the ENet host
+    ENetHost* get();
+    const ENetHost* get() const;
+
+    /**
+     * \brief  Adds an interceptor called for each received datagram
+     *
+     * Interceptors are called in the order in which they were added, until one of
+     * them drops the datagram.
+     */
+    void add_interceptor(Interceptor *interceptor);
+
+    /// Removes an interceptor
+    void remove_interceptor(Interceptor *interceptor);
+
+    /// Returns the batched socket layer of the host (nullptr if it uses the stock one)
+    BatchedSocket* get_batched_socket();
+
+  private:
+    bool is_host_created_;  ///< Whether the host has already been created
+    ENetHost* host_;        ///< Reference to the ENet host object
+    std::vector<Interceptor*> interceptors_;  ///< Called for each received datagram
+    std::unique_ptr<BatchedSocket> batched_socket_;  ///< Batched socket layer (nullptr if stock)
+
+    /// Installs or removes the ENet intercept callback depending on the interceptors
+    void update_intercept();
+
+    /// ENet intercept callback, forwarding the datagrams to the interceptors
+    static int intercept_cb(ENetHost *host, ENetEvent *event);
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,356 @@
+/**
+ * @file
+ *
+ * \brief  Early filtering of the datagrams received by a host
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "ingress_filter.hpp"
+#include "packet.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <algorithm>
+
+#include <cstring>
+#include <cstddef>
+
+
+namespace net
+{
+
+IngressFilter::IngressFilter():
+  address_buckets_(ADDRESS_BUCKET_COUNT)
+{
+
+}
+
+
+void IngressFilter::set_config(const Config &config)
+{
+  config_ = config;
+}
+
+
+const IngressFilter::Config& IngressFilter::get_config() const
+{
+  return config_;
+}
+
+
+void IngressFilter::set_validated(const ENetPeer *peer, bool validated)
+{
+  get_peer_state(peer->incomingPeerID).validated = validated;
+}
+
+
+void IngressFilter::reset_peer(const ENetPeer *peer)
+{
+  get_peer_state(peer->incomingPeerID) = PeerState();
+}
+
+
+void IngressFilter::block_address(uint32_t address)
+{
+  blocked_addresses_.insert(address);
+}
+
+
+void IngressFilter::unblock_address(uint32_t address)
+{
+  blocked_addresses_.erase(address);
+}
+
+
+const IngressFilter::Stats& IngressFilter::get_stats() const
+{
+  return stats_;
+}
+
+
+bool IngressFilter::intercept(ENetHost *host)
+{
+  const uint8_t *data = host->receivedData;
+  const size_t length = host->receivedDataLength;
+  const uint32_t address = host->receivedAddress.host;
+  const enet_uint32 time = host->serviceTime;
+
+  // Drop list
+  if (!blocked_addresses_.empty() && blocked_addresses_.count(address) > 0) {
+    stats_.dropped_blocked++;
+    return true;
+  }
+
+  // Rate limit per address
+  TokenBucket &address_bucket = address_buckets_[(address * 2654435761u) % ADDRESS_BUCKET_COUNT];
+
+  if (!take_token(address_bucket, config_.address_rate, config_.address_burst, time)) {
+    stats_.dropped_rate++;
+    add_violation(address, address_bucket);
+    return true;
+  }
+
+  // Protocol header
+  if (length < offsetof(ENetProtocolHeader, sentTime)) {
+    stats_.dropped_malformed++;
+    add_violation(address, address_bucket);
+    return true;
+  }
+
+  // Path-MTU probes look compressed and exceed the size limits, they are left to
+  // the prober (installed after the filter) once charged to their peer
+  enet_uint16 probed_id;
+
+  if (PathMtuProber::is_probe_datagram(data, length, probed_id)) {
+    if (probed_id >= host->peerCount || !is_sent_by(&host->peers[probed_id], host->receivedAddress)) {
+      stats_.dropped_malformed++;
+      add_violation(address, address_bucket);
+      return true;
+    }
+
+    PeerState &peer_state = get_peer_state(probed_id);
+
+    if (!take_token(peer_state.bucket, config_.peer_rate, config_.peer_burst, time)) {
+      stats_.dropped_rate++;
+      add_violation(address, address_bucket);
+      return true;
+    }
+
+    stats_.accepted++;
+
+    return false;
+  }
+
+  ENetProtocolHeader header;
+  memcpy(&header, data, std::min(length, sizeof(header)));
+  enet_uint16 peer_id = ENET_NET_TO_HOST_16(header.peerID);
+  enet_uint16 flags = peer_id & ENET_PROTOCOL_HEADER_FLAG_MASK;
+  enet_uint8 session_id = (peer_id & ENET_PROTOCOL_HEADER_SESSION_MASK) >> ENET_PROTOCOL_HEADER_SESSION_SHIFT;
+  peer_id &= ~(ENET_PROTOCOL_HEADER_FLAG_MASK | ENET_PROTOCOL_HEADER_SESSION_MASK);
+
+  size_t header_size = (flags & ENET_PROTOCOL_HEADER_FLAG_SENT_TIME)
+    ? sizeof(ENetProtocolHeader)
+    : offsetof(ENetProtocolHeader, sentTime);
+
+  if (length < header_size) {
+    stats_.dropped_malformed++;
+    add_violation(address, address_bucket);
+    return true;
+  }
+
+  // Rate limit per peer, connection requests are only limited per address
+  bool validated = false;
+
+  if (peer_id != ENET_PROTOCOL_MAXIMUM_PEER_ID) {
+    if (peer_id >= host->peerCount) {
+      stats_.dropped_malformed++;
+      add_violation(address, address_bucket);
+      return true;
+    }
+
+    // Any host can claim the ID of a peer: the slot is only trusted for datagrams
+    // of its peer, the others get the limits of unvalidated peers (and ENet drops them)
+    if (is_sent_by(&host->peers[peer_id], host->receivedAddress, session_id)) {
+      PeerState &peer_state = get_peer_state(peer_id);
+      validated = peer_state.validated;
+
+      if (!take_token(peer_state.bucket, config_.peer_rate, config_.peer_burst, time)) {
+        stats_.dropped_rate++;
+        add_violation(address, address_bucket);
+        return true;
+      }
+    }
+  }
+
+  // Size limit
+  if (length > (validated ? config_.max_validated_size : config_.max_unvalidated_size)) {
+    stats_.dropped_size++;
+    add_violation(address, address_bucket);
+    return true;
+  }
+
+  // Packet types, compressed datagrams cannot be inspected
+  if (flags & ENET_PROTOCOL_HEADER_FLAG_COMPRESSED) {
+    if (!validated) {
+      stats_.dropped_type++;
+      add_violation(address, address_bucket);
+      return true;
+    }
+  } else {
+    bool malformed = false;
+
+    if (!check_commands(data + header_size, length - header_size, validated, malformed)) {
+      if (malformed)
+        stats_.dropped_malformed++;
+      else
+        stats_.dropped_type++;
+
+      add_violation(address, address_bucket);
+      return true;
+    }
+  }
+
+  stats_.accepted++;
+
+  return false;
+}
+
+
+IngressFilter::PeerState& IngressFilter::get_peer_state(size_t peer_id)
+{
+  if (peer_id >= peers_.size())
+    peers_.resize(std::max<size_t>(peer_id + 1, 2 * peers_.size()));
+
+  return peers_[peer_id];
+}
+
+
+bool IngressFilter::is_sent_by(const ENetPeer *peer, const ENetAddress &address, enet_uint8 session_id)
+{
+  // Same checks as ENet before handling the commands of a datagram
+  if (!is_sent_by(peer, address))
+    return false;
+
+  return peer->outgoingPeerID >= ENET_PROTOCOL_MAXIMUM_PEER_ID || session_id == peer->incomingSessionID;
+}
+
+
+bool IngressFilter::is_sent_by(const ENetPeer *peer, const ENetAddress &address)
+{
+  return peer->state != ENET_PEER_STATE_DISCONNECTED && peer->state != ENET_PEER_STATE_ZOMBIE
+    && peer->address.host == address.host && peer->address.port == address.port;
+}
+
+
+bool IngressFilter::take_token(TokenBucket &bucket, double rate, double burst, enet_uint32 time)
+{
+  if (bucket.tokens < 0.0f) {
+    bucket.tokens = burst;
+  } else {
+    enet_uint32 elapsed = time - bucket.last_time;
+    bucket.tokens = std::min<double>(burst, bucket.tokens + rate * elapsed * 1e-3);
+  }
+
+  bucket.last_time = time;
+
+  if (bucket.tokens < 1.0f)
+    return false;
+
+  bucket.tokens -= 1.0f;
+
+  return true;
+}
+
+
+bool IngressFilter::check_commands(
+  const uint8_t *data,
+  size_t length,
+  bool validated,
+  bool &malformed
+) const
+{
+  const uint32_t allowed_types = validated ? config_.validated_types : config_.unvalidated_types;
+  const uint8_t *current = data;
+  const uint8_t *end = data + length;
+
+  while (current < end) {
+    if (current + sizeof(ENetProtocolCommandHeader) > end) {
+      malformed = true;
+      return false;
+    }
+
+    enet_uint8 command_number = current[0] & ENET_PROTOCOL_COMMAND_MASK;
+    size_t command_size = enet_protocol_command_size(current[0]);
+
+    if (command_number >= ENET_PROTOCOL_COMMAND_COUNT
+      || command_size == 0
+      || current + command_size > end
+    ) {
+      malformed = true;
+      return false;
+    }
+
+    // Find the payload of the commands carrying packets
+    enet_uint16 data_length = 0;
+    bool is_first_fragment = true;
+
+    switch (command_number)
+    {
+      case ENET_PROTOCOL_COMMAND_SEND_RELIABLE: {
+        ENetProtocolSendReliable command;
+        memcpy(&command, current, sizeof(command));
+        data_length = ENET_NET_TO_HOST_16(command.dataLength);
+        break;
+      }
+
+      case ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE: {
+        ENetProtocolSendUnreliable command;
+        memcpy(&command, current, sizeof(command));
+        data_length = ENET_NET_TO_HOST_16(command.dataLength);
+        break;
+      }
+
+      case ENET_PROTOCOL_COMMAND_SEND_UNSEQUENCED: {
+        ENetProtocolSendUnsequenced command;
+        memcpy(&command, current, sizeof(command));
+        data_length = ENET_NET_TO_HOST_16(command.dataLength);
+        break;
+      }
+
+      case ENET_PROTOCOL_COMMAND_SEND_FRAGMENT:
+      case ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE_FRAGMENT: {
+        // Peers which are not validated never need to send large packets
+        if (!validated)
+          return false;
+
+        ENetProtocolSendFragment command;
+        memcpy(&command, current, sizeof(command));
+        data_length = ENET_NET_TO_HOST_16(command.dataLength);
+        is_first_fragment = ENET_NET_TO_HOST_32(command.fragmentNumber) == 0;
+        break;
+      }
+
+      default:
+        current += command_size;
+        continue;
+    }
+
+    const uint8_t *payload = current + command_size;
+
+    if (payload + data_length > end) {
+      malformed = true;
+      return false;
+    }
+
+    // Only the first fragment of a packet contains its type
+    Packet::Type type;
+
+    if (is_first_fragment) {
+      if (!Packet::peek_type(payload, data_length, type)) {
+        malformed = true;
+        return false;
+      }
+
+      unsigned int type_index = static_cast<unsigned int>(type);
+
+      if (type_index >= 32 || !(allowed_types & (1u << type_index)))
+        return false;
+    }
+
+    current = payload + data_length;
+  }
+
+  return true;
+}
+
+
+void IngressFilter::add_violation(uint32_t address, TokenBucket &bucket)
+{
+  bucket.violations++;
+
+  if (config_.max_violations > 0 && bucket.violations >= config_.max_violations)
+    blocked_addresses_.insert(address);
+}
+
+
+}  // namespace net
@@ -0,0 +1,142 @@
+/**
+ * @file
+ *
+ * \brief  Early filtering of the datagrams received by a host
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__INGRESS_FILTER_HPP
+#define NET__INGRESS_FILTER_HPP
+
+#include "base.hpp"
+#include "packet.hpp"
+#include "path_mtu.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <unordered_set>
+#include <cstdint>
+
+
+namespace net
+{
+
+/**
+ * \brief  Drops abusive traffic before ENet allocates or decodes anything
+ *
+ * Installed as an interceptor on a host. Each datagram is checked against a drop
+ * list, against token-bucket rate limits per source address and per peer, and
+ * against size and packet type limits depending on whether the peer is validated.
+ * The slot of a peer is only used if the address and session of the datagram match
+ * those of the peer. The ENet commands of the datagram are walked in place to find
+ * the packet types. Path-MTU probes (see PathMtuProber) are only rate limited, and
+ * passed on to the prober.
+ */
+class IngressFilter: public Interceptor
+{
+  public:
+    /// Limits enforced by the filter
+    struct Config
+    {
+      double address_rate = 500.0;   ///< Datagrams per second allowed per source address
+      double address_burst = 1000.0; ///< Datagrams allowed in a burst per source address
+      double peer_rate = 250.0;      ///< Datagrams per second allowed per peer
+      double peer_burst = 500.0;     ///< Datagrams allowed in a burst per peer
+      size_t max_unvalidated_size = 512;  ///< Maximal datagram size from peers not yet validated
+      size_t max_validated_size = ENET_PROTOCOL_MAXIMUM_MTU;  ///< Maximal datagram size from validated peers
+      uint32_t unvalidated_types = 1u << static_cast<int>(Packet::Type::VALIDATIION_ANSWER);  ///< Mask of packet types accepted from peers not yet validated
+      uint32_t validated_types = ~0u;  ///< Mask of packet types accepted from validated peers
+      unsigned int max_violations = 0; ///< Violations after which an address is blocked (0 to never block)
+    };
+
+    /// Number of datagrams accepted and dropped, by reason
+    struct Stats
+    {
+      uint64_t accepted = 0;           ///< Datagrams passed on to ENet
+      uint64_t dropped_blocked = 0;    ///< Datagrams from blocked addresses
+      uint64_t dropped_rate = 0;       ///< Datagrams over the rate limits
+      uint64_t dropped_size = 0;       ///< Datagrams over the size limits
+      uint64_t dropped_type = 0;       ///< Datagrams containing a forbidden packet type
+      uint64_t dropped_malformed = 0;  ///< Datagrams which could not be parsed
+    };
+
+    IngressFilter();
+
+    /// Sets the limits enforced by the filter
+    void set_config(const Config &config);
+
+    /// Returns the limits enforced by the filter
+    const Config& get_config() const;
+
+    /// Sets whether a peer has been validated, which relaxes the limits applied to it
+    void set_validated(const ENetPeer *peer, bool validated);
+
+    /// Resets the state of a peer slot, to be called when a peer connects or disconnects
+    void reset_peer(const ENetPeer *peer);
+
+    /// Drops all the datagrams coming from an IPv4 address (network byte order)
+    void block_address(uint32_t address);
+
+    /// Stops dropping the datagrams coming from an IPv4 address (network byte order)
+    void unblock_address(uint32_t address);
+
+    /// Returns the number of datagrams accepted and dropped
+    const Stats& get_stats() const;
+
+    /// Filters the datagram received by the host, returns whether it should be dropped
+    bool intercept(ENetHost *host) override;
+
+  private:
+    /// Token bucket used for rate limiting
+    struct TokenBucket
+    {
+      float tokens = -1.0f;       ///< Available tokens, negative if not initialised
+      enet_uint32 last_time = 0;  ///< Last time the bucket was refilled (in ms)
+      uint32_t violations = 0;    ///< Number of datagrams dropped
+    };
+
+    /// State of a peer slot of the host
+    struct PeerState
+    {
+      TokenBucket bucket;       ///< Rate limit of the peer
+      bool validated = false;   ///< Whether the peer has been validated
+    };
+
+    static const size_t ADDRESS_BUCKET_COUNT = 4096;  ///< Size of the table of address buckets
+
+    Config config_;  ///< Limits enforced by the filter
+    Stats stats_;    ///< Number of datagrams accepted and dropped
+    std::vector<PeerState> peers_;           ///< State of each peer slot, indexed by peer ID
+    std::vector<TokenBucket> address_buckets_;  ///< Rate limits per address, indexed by address hash
+    std::unordered_set<uint32_t> blocked_addresses_;  ///< Addresses of which all datagrams are dropped
+
+    /// Returns the state of a peer slot, growing the table if needed
+    PeerState& get_peer_state(size_t peer_id);
+
+    /// Returns whether a datagram comes from the peer occupying the slot it claims
+    static bool is_sent_by(const ENetPeer *peer, const ENetAddress &address, enet_uint8 session_id);
+
+    /// Returns whether a datagram without session comes from the peer occupying a slot
+    static bool is_sent_by(const ENetPeer *peer, const ENetAddress &address);
+
+    /// Takes a token from a bucket, returns whether there was one
+    static bool take_token(TokenBucket &bucket, double rate, double burst, enet_uint32 time);
+
+    /**
+     * \brief  Walks the ENet commands of a datagram and checks the packet types
+     *
+     * \param data       Commands of the datagram, after the protocol header
+     * \param length     Length of the commands
+     * \param validated  Whether the sending peer is validated
+     * \param[out] malformed  Whether the datagram could not be parsed
+     * \return  Whether all the packets contained in the datagram are allowed
+     */
+    bool check_commands(const uint8_t *data, size_t length, bool validated, bool &malformed) const;
+
+    /// Counts a violation for an address, blocking it if there were too many
+    void add_violation(uint32_t address, TokenBucket &bucket);
+};
+
+}  // namespace net
+
+#endif
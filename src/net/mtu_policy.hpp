@@ -0,0 +1,113 @@
+/**
+ * @file
+ *
+ * \brief  Path MTU policies of BasicNetHost
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * MTU policies size the datagrams sent to each peer. `attach` is called when the
+ * host is created, after the interceptors added so far (filters for instance),
+ * and `count_sent` for each packet handed over to ENet.
+ */
+
+#ifndef NET__MTU_POLICY_HPP
+#define NET__MTU_POLICY_HPP
+
+#include "policy.hpp"
+#include "path_mtu.hpp"
+#include "enet/enet.h"
+#include <cstddef>
+
+
+namespace net
+{
+
+namespace policy
+{
+
+/// The MTU negotiated by ENet is kept
+struct NoMtuDiscovery
+{
+  using kind = mtu_kind;
+
+  /// Largest MTU of the peers (in bytes)
+  static constexpr size_t MAX_MTU = ENET_HOST_DEFAULT_MTU;
+
+  void attach(NetHost &)
+  {
+
+  }
+
+  template <typename Host>
+  void poll(Host &)
+  {
+
+  }
+
+  template <typename Host>
+  void count_sent(Host &, const ENetPeer *, size_t)
+  {
+
+  }
+
+  void disconnect(ENetPeer *)
+  {
+
+  }
+
+  template <typename Host>
+  void reset(Host &, ENetPeer *)
+  {
+
+  }
+};
+
+
+/**
+ * \brief  Probes the path to each peer, and sizes its MTU to the largest datagram going through
+ *
+ * See PathMtuProber, whose configuration and statistics are available directly.
+ * Both sides of a connection should use this policy, since the probes are
+ * acknowledged by the prober of the peer.
+ */
+class MtuDiscovery: public PathMtuProber
+{
+  public:
+    using kind = mtu_kind;
+
+    /// Largest MTU of the peers with the default configuration (in bytes)
+    static constexpr size_t MAX_MTU = PathMtuProber::DEFAULT_MAXIMUM;
+
+    /// Intercepts the probes and acknowledgements received by the host, after its other interceptors
+    void attach(NetHost &host)
+    {
+      host.remove_interceptor(this);
+      host.add_interceptor(this);
+    }
+
+    /// Sends the probes which are due
+    template <typename Host>
+    void poll(Host &host)
+    {
+      update(host.get_host());
+    }
+
+    /// Counts a packet given to ENet for a peer
+    template <typename Host>
+    void count_sent(Host &host, const ENetPeer *peer, size_t length)
+    {
+      PathMtuProber::count_sent(host.get_host(), peer, length);
+    }
+
+    /// Starts probing a newly connected peer
+    template <typename Host>
+    void reset(Host &host, ENetPeer *peer)
+    {
+      connect(host.get_host(), peer);
+    }
+};
+
+}  // namespace policy
+}  // namespace net
+
+#endif
@@ -7,15 +7,63 @@
  */
 
 #include "packet.hpp"
+#include "bitpacked_archive.hpp"
 #include "cereal/archives/portable_binary.hpp"
 #include <cereal/types/string.hpp>
-#include <sstream>
+#include <streambuf>
+#include <istream>
+#include <ostream>
 #include <string>
 
 
 namespace net
 {
 
+namespace
+{
+  /// Stream buffer reading serialised data in place
+  class ReadBuffer: public std::streambuf
+  {
+    public:
+      ReadBuffer(const char *data, size_t length)
+      {
+        char *begin = const_cast<char*>(data);
+        setg(begin, begin, begin + length);
+      }
+  };
+
+
+  /// Stream buffer appending to a string, without the allocations of std::ostringstream
+  class WriteBuffer: public std::streambuf
+  {
+    public:
+      WriteBuffer(std::string &buffer):
+        buffer_(buffer)
+      {
+
+      }
+
+    protected:
+      int_type overflow(int_type c) override
+      {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+          buffer_.push_back(traits_type::to_char_type(c));
+
+        return traits_type::not_eof(c);
+      }
+
+      std::streamsize xsputn(const char *data, std::streamsize count) override
+      {
+        buffer_.append(data, count);
+        return count;
+      }
+
+    private:
+      std::string &buffer_;  ///< String to which the data is appended
+  };
+}
+
+
 Packet::Packet()
 {
 
@@ -30,12 +78,30 @@ Packet::Packet(Packet::Type type, const std::string &data):
 }
 
 
+void Packet::set(Type type, const char *data, size_t length)
+{
+  type_ = type;
+  data_.assign(data, length);
+}
+
+
 void Packet::load_serialised(const std::string &raw_data)
 {
-  std::istringstream is(raw_data);
+  load_serialised(raw_data.data(), raw_data.size());
+}
+
+
+void Packet::load_serialised(const char *raw_data, int length)
+{
+  ReadBuffer buffer(raw_data, length);
+  std::istream is(&buffer);
   uint8_t _type;
 
-  {
+  if (length > 0 && static_cast<uint8_t>(raw_data[0]) == BIT_PACKED_TAG) {
+    is.ignore(1);
+    BitPackedInputArchive iarchive(is);
+    iarchive(_type, data_);
+  } else {
     cereal::PortableBinaryInputArchive iarchive(is);
     iarchive(_type, data_);
   }
@@ -44,26 +110,33 @@ void Packet::load_serialised(const std::string &raw_data)
 }
 
 
-void Packet::load_serialised(const char *raw_data, int length)
+std::string Packet::serialise(Encoding encoding) const
 {
-  load_serialised(std::string(raw_data, length));
+  std::string buffer;
+  serialise(buffer, encoding);
+
+  return buffer;
 }
 
 
-std::string Packet::serialise() const
+void Packet::serialise(std::string &buffer, Encoding encoding) const
 {
-  std::ostringstream os;
+  buffer.clear();
+  WriteBuffer write_buffer(buffer);
+  std::ostream os(&write_buffer);
 
-  {
+  if (encoding == Encoding::BIT_PACKED) {
+    os.put(static_cast<char>(BIT_PACKED_TAG));
+    BitPackedOutputArchive oarchive(os);
+    oarchive(static_cast<uint8_t>(type_), data_);
+  } else {
     cereal::PortableBinaryOutputArchive oarchive(os); // Create an output archive
     oarchive(static_cast<uint8_t>(type_), data_);
   }
-
-  return os.str();
 }
 
 
-std::string Packet::get_data() const
+const std::string& Packet::get_data() const
 {
   return data_;
 }
@@ -75,4 +148,17 @@ Packet::Type Packet::get_type() const
 }
 
 
+bool Packet::peek_type(const uint8_t *raw_data, size_t length, Type &type)
+{
+  // All encodings start with one byte (endianness for the portable binary archive,
+  // tag for the others), and the type is always written on the following 8 bits
+  if (length < 2)
+    return false;
+
+  type = static_cast<Type>(raw_data[1]);
+
+  return true;
+}
+
+
 }  // namespace net
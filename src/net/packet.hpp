@@ -10,6 +10,8 @@
 #define NET__PACKET_HPP
 
 #include <string>
+#include <cstdint>
+#include <cstddef>
 
 
 namespace net
@@ -24,9 +26,26 @@ class Packet
     {
       DATA,               ///< Generic data packet
       VALIDATION_STR,     ///< String sent by the server to a newly connected peer for validation
-      VALIDATIION_ANSWER  ///< Validation answer of a newly connected peer to the server for validation
+      VALIDATIION_ANSWER, ///< Validation answer of a newly connected peer to the server for validation
+      SCHEMA,             ///< Message in the zero-copy schema format (see schema.hpp), not deserialised
+      SHM_OFFER,          ///< Offer of a shared-memory channel to a peer of the same machine (see shm_channel.hpp)
+      SHM_SWITCH,         ///< Marks the end of the messages sent through ENet on a channel, before the shared memory
+      RELAY_HELLO,        ///< Sent periodically by a validated relay with the port of its own peers and the size of its subtree
+      RELAY_ASSIGN,       ///< Answer to RELAY_HELLO: empty if the relay is attached, else the address of its parent
+      CLOCK_PROBE,        ///< Probe of the clock of a peer, with its send time (see policy::ClockSync)
+      CLOCK_REPLY         ///< Answer to CLOCK_PROBE: send time of the probe, receive time and send time of the answer
     };
 
+    /// Encoding of the serialised packet
+    enum class Encoding: uint8_t
+    {
+      PORTABLE_BINARY,  ///< Cereal portable binary archive
+      BIT_PACKED        ///< Bit-packed archive (see bitpacked_archive.hpp)
+    };
+
+    /// First byte of the bit-packed packets, never written by the portable binary archive
+    static constexpr uint8_t BIT_PACKED_TAG = 0xB7;
+
     Packet();
 
     /**
@@ -35,9 +54,20 @@ class Packet
      */
     Packet(Type type, const std::string &data);
 
+    /**
+     * \brief  Sets the type and the data of the packet, reusing its memory
+     *
+     * \param type    Description of the packet
+     * \param data    Data contained in the packet
+     * \param length  Length of the data
+     */
+    void set(Type type, const char *data, size_t length);
+
     /**
      * \brief  Loads serialised data in the packet
      *
+     * The encoding is detected from the first byte of the data.
+     *
      * \param raw_data  Serialised data of the packet
      */
     void load_serialised(const std::string &raw_data);
@@ -45,20 +75,45 @@ class Packet
     /**
      * \brief  Loads serialised data in the packet
      *
+     * The data is read in place, and the memory of the packet is reused, so that
+     * loading into the same packet does not allocate once its data is large enough.
+     *
      * \param raw_data  Serialised data of the packet
      * \param length    Length of the data
      */
     void load_serialised(const char *raw_data, int length);
 
-    /// Get the raw serialised data of the packet
-    std::string serialise() const;
+    /**
+     * \brief  Get the raw serialised data of the packet
+     *
+     * \param encoding  Encoding of the serialised data
+     */
+    std::string serialise(Encoding encoding = Encoding::PORTABLE_BINARY) const;
+
+    /**
+     * \brief  Serialises the packet into a buffer, reusing its memory
+     *
+     * \param[out] buffer  Replaced by the serialised data
+     * \param encoding     Encoding of the serialised data
+     */
+    void serialise(std::string &buffer, Encoding encoding = Encoding::PORTABLE_BINARY) const;
 
     /// Returns the data contained in the packet
-    std::string get_data() const;
+    const std::string& get_data() const;
 
     /// Returns the packet type
     Type get_type() const;
 
+    /**
+     * \brief  Reads the type of a serialised packet without deserialising it
+     *
+     * \param raw_data    Serialised data of the packet
+     * \param length      Length of the data
+     * \param[out] type   Type of the packet
+     * \return  Whether the data is long enough to contain a type
+     */
+    static bool peek_type(const uint8_t *raw_data, size_t length, Type &type);
+
     /// Appends some data to the packet
     // TODO
     void append(const std::string &new_data) = delete;
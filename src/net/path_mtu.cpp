@@ -0,0 +1,358 @@
+/**
+ * @file
+ *
+ * \brief  Path-MTU discovery for the peers of a host
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "path_mtu.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <algorithm>
+
+#include <cstring>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+
+namespace net
+{
+
+/// First bytes of the probes and acknowledgements
+static const uint8_t MAGIC[5] = {0xFF, 0xFF, 'M', 'T', 'U'};
+
+
+PathMtuProber::PathMtuProber():
+  enabled_(true),
+  buffer_(ENET_PROTOCOL_MAXIMUM_MTU, 0),
+  configured_socket_(ENET_SOCKET_NULL)
+{
+
+}
+
+
+void PathMtuProber::set_config(const Config &config)
+{
+  config_ = config;
+  config_.maximum = std::min<uint32_t>(config_.maximum, ENET_PROTOCOL_MAXIMUM_MTU);
+  config_.minimum = std::min<uint32_t>(std::max<uint32_t>(config_.minimum, HEADER_SIZE), config_.maximum);
+  config_.initial = std::clamp(config_.initial, config_.minimum, config_.maximum);
+  config_.precision = std::max<uint32_t>(config_.precision, 1);
+  config_.probe_attempts = std::max<uint32_t>(config_.probe_attempts, 1);
+}
+
+
+const PathMtuProber::Config& PathMtuProber::get_config() const
+{
+  return config_;
+}
+
+
+void PathMtuProber::set_enabled(bool enabled)
+{
+  enabled_ = enabled;
+}
+
+
+bool PathMtuProber::is_enabled() const
+{
+  return enabled_;
+}
+
+
+void PathMtuProber::connect(ENetHost *host, ENetPeer *peer)
+{
+  if (peer->incomingPeerID >= peers_.size())
+    peers_.resize(peer->incomingPeerID + 1);
+
+  PeerState &state = peers_[peer->incomingPeerID];
+  state = PeerState();
+  state.peer = peer;
+
+  if (!enabled_ || host == nullptr)
+    return;
+
+  configure(host);
+  peer->mtu = std::min<enet_uint32>(peer->mtu, config_.initial);
+  start_search(state, enet_time_get());
+}
+
+
+void PathMtuProber::disconnect(ENetPeer *peer)
+{
+  PeerState *state = get_state(peer);
+
+  if (state != nullptr && state->peer == peer) {
+    state->peer = nullptr;
+    state->searching = false;
+    state->probe_size = 0;
+  }
+}
+
+
+void PathMtuProber::update(ENetHost *host)
+{
+  if (!enabled_)
+    return;
+
+  configure(host);
+
+  const enet_uint32 time = enet_time_get();
+  bool sent = false;
+
+  for (PeerState &state: peers_) {
+    if (state.peer == nullptr || state.peer->state != ENET_PEER_STATE_CONNECTED
+      || ENET_TIME_LESS(time, state.deadline)
+    ) {
+      continue;
+    }
+
+    if (state.probe_size != 0) {
+      // Lost probe
+      stats_.probes_lost++;
+      state.attempts++;
+
+      if (state.attempts >= config_.probe_attempts) {
+        state.failed = state.probe_size;
+        state.attempts = 0;
+
+        if (state.peer->mtu >= state.failed)
+          state.peer->mtu = state.confirmed;
+      }
+
+      state.probe_size = 0;
+    } else if (!state.searching) {
+      if (config_.reprobe_interval == 0)
+        continue;
+
+      start_search(state, time);
+    }
+
+    send_probe(host, state, time);
+    sent = sent || state.probe_size != 0;
+  }
+
+  // Sends the probes right away, even if the socket layer queues the datagrams
+  if (sent)
+    enet_host_flush(host);
+}
+
+
+bool PathMtuProber::is_searching(const ENetPeer *peer) const
+{
+  const PeerState *state = get_state(peer);
+  return state != nullptr && state->peer == peer && state->searching;
+}
+
+
+const PathMtuProber::Stats& PathMtuProber::get_stats() const
+{
+  return stats_;
+}
+
+
+double PathMtuProber::get_fragmentation_rate() const
+{
+  if (stats_.packets_sent == 0)
+    return 0.0;
+
+  return static_cast<double>(stats_.packets_fragmented) / stats_.packets_sent;
+}
+
+
+bool PathMtuProber::is_probe_datagram(const uint8_t *data, size_t length, enet_uint16 &peer_id)
+{
+  if (length < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+    return false;
+
+  peer_id = data[6] | (data[7] << 8);
+
+  return true;
+}
+
+
+bool PathMtuProber::intercept(ENetHost *host)
+{
+  const uint8_t *data = host->receivedData;
+  const size_t length = host->receivedDataLength;
+  enet_uint16 peer_id;
+
+  if (!is_probe_datagram(data, length, peer_id))
+    return false;
+
+  const Kind kind = static_cast<Kind>(data[5]);
+  const uint32_t sequence = data[8] | (data[9] << 8) | (data[10] << 16) | ((uint32_t)data[11] << 24);
+  const uint32_t size = data[12] | (data[13] << 8);
+
+  // Only from connected peers, which cannot forge their address
+  if (peer_id >= host->peerCount)
+    return true;
+
+  ENetPeer *peer = &host->peers[peer_id];
+
+  if ((peer->state != ENET_PEER_STATE_CONNECTED && peer->state != ENET_PEER_STATE_CONNECTION_SUCCEEDED)
+    || peer->address.host != host->receivedAddress.host
+    || peer->address.port != host->receivedAddress.port
+  ) {
+    return true;
+  }
+
+  // The peer may probe before its connection is acknowledged
+  if (peer_id >= peers_.size())
+    peers_.resize(peer_id + 1);
+
+  PeerState &state = peers_[peer_id];
+
+  if (kind == PROBE) {
+    if (size != length)
+      return true;
+
+    if (ENET_TIME_DIFFERENCE(host->serviceTime, state.answer_epoch) >= 1000) {
+      state.answer_epoch = host->serviceTime;
+      state.answer_count = 0;
+    }
+
+    if (state.answer_count >= MAX_ANSWERS_PER_SECOND)
+      return true;
+
+    state.answer_count++;
+
+    if (send_datagram(host, peer->address, ACKNOWLEDGEMENT, peer->outgoingPeerID, sequence, size))
+      stats_.probes_answered++;
+  } else if (kind == ACKNOWLEDGEMENT) {
+    if (state.peer != peer || state.probe_size == 0 || sequence != state.sequence || size != state.probe_size)
+      return true;
+
+    stats_.probes_acknowledged++;
+    state.confirmed = std::max(state.confirmed, size);
+    state.probe_size = 0;
+    state.attempts = 0;
+    state.deadline = host->serviceTime;  // next probe at the next update
+
+    if (peer->mtu < state.confirmed)
+      peer->mtu = state.confirmed;
+  }
+
+  return true;
+}
+
+
+PathMtuProber::PeerState* PathMtuProber::get_state(const ENetPeer *peer)
+{
+  return peer->incomingPeerID < peers_.size() ? &peers_[peer->incomingPeerID] : nullptr;
+}
+
+
+const PathMtuProber::PeerState* PathMtuProber::get_state(const ENetPeer *peer) const
+{
+  return peer->incomingPeerID < peers_.size() ? &peers_[peer->incomingPeerID] : nullptr;
+}
+
+
+void PathMtuProber::configure(ENetHost *host)
+{
+  // MTU proposed to the peers connecting next
+  host->mtu = config_.initial;
+
+  if (host->socket == configured_socket_)
+    return;
+
+  configured_socket_ = host->socket;
+
+#ifdef __linux__
+  // Don't Fragment bit on all datagrams, whatever the route cache says
+  int discovery = IP_PMTUDISC_PROBE;
+
+  if (setsockopt(host->socket, IPPROTO_IP, IP_MTU_DISCOVER, &discovery, sizeof(discovery)) != 0)
+    fprintf(stderr, "Could not forbid IP fragmentation, probes may be fragmented\n");
+#endif
+}
+
+
+void PathMtuProber::start_search(PeerState &state, enet_uint32 time)
+{
+  state.confirmed = config_.minimum;
+  state.failed = config_.maximum + 1;
+  state.probe_size = 0;
+  state.attempts = 0;
+  state.deadline = time;
+  state.searching = true;
+}
+
+
+void PathMtuProber::send_probe(ENetHost *host, PeerState &state, enet_uint32 time)
+{
+  ENetPeer *peer = state.peer;
+
+  if (state.failed - state.confirmed <= config_.precision) {
+    state.searching = false;
+    state.deadline = time + config_.reprobe_interval;
+    stats_.searches++;
+
+    return;
+  }
+
+  // Checks the MTU in use first, then the largest size, then halves the interval
+  uint32_t size;
+
+  if (peer->mtu > state.confirmed && peer->mtu < state.failed)
+    size = peer->mtu;
+  else if (state.failed > config_.maximum)
+    size = config_.maximum;
+  else
+    size = (state.confirmed + state.failed) / 2;
+
+  state.sequence++;
+  state.probe_size = size;
+  state.deadline = time + std::max<enet_uint32>(config_.probe_timeout, 2 * peer->roundTripTime);
+
+  if (send_datagram(host, peer->address, PROBE, peer->outgoingPeerID, state.sequence, size)) {
+    stats_.probes_sent++;
+  } else {
+    // Larger than the interface of this host
+    state.failed = size;
+    state.probe_size = 0;
+    state.deadline = time;
+
+    if (peer->mtu >= state.failed)
+      peer->mtu = state.confirmed;
+  }
+}
+
+
+bool PathMtuProber::send_datagram(
+  ENetHost *host,
+  const ENetAddress &address,
+  Kind kind,
+  enet_uint16 peer_id,
+  uint32_t sequence,
+  uint32_t size
+)
+{
+  uint8_t *data = buffer_.data();
+  memcpy(data, MAGIC, sizeof(MAGIC));
+  data[5] = kind;
+  data[6] = peer_id & 0xFF;
+  data[7] = peer_id >> 8;
+
+  for (size_t k = 0; k < 4; k++)
+    data[8 + k] = (sequence >> (8 * k)) & 0xFF;
+
+  data[12] = size & 0xFF;
+  data[13] = size >> 8;
+
+  // The padding of the probes is left to zero
+  ENetBuffer buffer;
+  buffer.data = data;
+  buffer.dataLength = kind == PROBE ? size : HEADER_SIZE;
+
+  return enet_socket_send(host->socket, &address, &buffer, 1) >= 0;
+}
+
+
+}  // namespace net
@@ -0,0 +1,219 @@
+/**
+ * @file
+ *
+ * \brief  Path-MTU discovery for the peers of a host
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__PATH_MTU_HPP
+#define NET__PATH_MTU_HPP
+
+#include "host.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/**
+ * \brief  Finds the largest datagram reaching each peer, and sizes its ENet MTU to it
+ *
+ * ENet splits the packets larger than the MTU of a peer into fragments, which
+ * are reassembled by the receiver: losing any of them loses the whole packet.
+ * With its default MTU, a datagram may also be larger than what the path to the
+ * peer carries, and be fragmented by IP or dropped altogether.
+ *
+ * Probes of a given size are sent to each connected peer, bypassing ENet so that
+ * their size is exact, and are acknowledged by the prober of the peer. The size
+ * is searched by dichotomy between `minimum` and `maximum`, the MTU in use being
+ * checked first, and a size is deemed too large once `probe_attempts` probes of
+ * that size were lost. The MTU of the peer (`ENetPeer::mtu`) is raised as soon as
+ * a larger size is acknowledged, and lowered as soon as a size it exceeds is lost.
+ * The search starts again every `reprobe_interval`, in case the path changed.
+ *
+ * Probes and acknowledgements are raw datagrams, which ENet ignores (they look
+ * compressed, and are dropped before being decompressed):
+ *
+ *     | 0xFF 0xFF | 'M' 'T' 'U' | kind | peer ID (2) | sequence (4) | size (2) | padding |
+ *
+ * The peer ID is the one of the receiving host, and the integers are little endian.
+ * On Linux, the Don't Fragment bit is set on all the datagrams of the host, so that
+ * IP does not fragment the probes either.
+ *
+ * Installed as an interceptor on the host, after the filters: these should let
+ * the probes through (see is_probe_datagram), IngressFilter does.
+ */
+class PathMtuProber: public Interceptor
+{
+  public:
+    /// Largest size probed by default, UDP payload of an Ethernet frame (in bytes)
+    static constexpr uint32_t DEFAULT_MAXIMUM = 1472;
+
+    /// Search parameters
+    struct Config
+    {
+      uint32_t minimum = ENET_PROTOCOL_MINIMUM_MTU;  ///< Size assumed to reach any peer (in bytes)
+      uint32_t maximum = DEFAULT_MAXIMUM;  ///< Largest size probed (in bytes, at most ENET_PROTOCOL_MAXIMUM_MTU)
+      uint32_t initial = ENET_HOST_DEFAULT_MTU;  ///< MTU of the peers until probed (in bytes)
+      uint32_t precision = 16;   ///< Search stops once the largest size is known within this (in bytes)
+      uint32_t probe_timeout = 250;   ///< Minimal duration after which a probe is lost (in ms, at least twice the round-trip time)
+      uint32_t probe_attempts = 3;    ///< Probes of a size lost before deciding it is too large
+      uint32_t reprobe_interval = 600000;  ///< Interval between two searches (in ms, 0 to search once)
+    };
+
+    /// Number of probes, and of packets fragmented by ENet
+    struct Stats
+    {
+      uint64_t probes_sent = 0;          ///< Probes sent
+      uint64_t probes_acknowledged = 0;  ///< Probes acknowledged by the peers
+      uint64_t probes_lost = 0;          ///< Probes not acknowledged in time
+      uint64_t probes_answered = 0;      ///< Probes of the peers acknowledged
+      uint64_t searches = 0;             ///< Searches completed
+      uint64_t packets_sent = 0;         ///< Packets given to ENet
+      uint64_t packets_fragmented = 0;   ///< Packets larger than the payload of a datagram
+      uint64_t fragments_sent = 0;       ///< Fragments of these packets
+    };
+
+    PathMtuProber();
+
+    /// Sets the search parameters, for the next searches
+    void set_config(const Config &config);
+
+    /// Returns the search parameters
+    const Config& get_config() const;
+
+    /// Sets whether peers are probed (probes of the peers are always acknowledged)
+    void set_enabled(bool enabled);
+
+    /// Returns whether peers are probed
+    bool is_enabled() const;
+
+    /**
+     * \brief  Starts probing a newly connected peer, and applies the initial MTU to it
+     *
+     * \param host  Host of the peer, nullptr if it has none (the peer is then not probed)
+     * \param peer  Connected peer
+     */
+    void connect(ENetHost *host, ENetPeer *peer);
+
+    /// Stops probing a disconnected peer
+    void disconnect(ENetPeer *peer);
+
+    /// Sends the probes which are due, and handles the lost ones
+    void update(ENetHost *host);
+
+    /// Counts a packet given to ENet for a peer of a host, and whether ENet fragments it
+    inline void count_sent(const ENetHost *host, const ENetPeer *peer, size_t length)
+    {
+      const size_t max_payload = get_max_payload(host, peer);
+
+      stats_.packets_sent++;
+
+      if (length > max_payload) {
+        stats_.packets_fragmented++;
+        stats_.fragments_sent += (length + max_payload - 1) / max_payload;
+      }
+    }
+
+    /// Returns whether the MTU of a peer is being searched
+    bool is_searching(const ENetPeer *peer) const;
+
+    /// Returns the number of probes, and of packets fragmented by ENet
+    const Stats& get_stats() const;
+
+    /// Returns the fraction of the packets sent which were fragmented
+    double get_fragmentation_rate() const;
+
+    /**
+     * \brief  Returns the largest packet which ENet sends to a peer of a host in a single datagram
+     *
+     * Larger packets are split into fragments, each of which must be received
+     * for the packet to be delivered. The host is passed rather than read from
+     * the peer, which may not have one (replayed peers for instance).
+     */
+    static inline size_t get_max_payload(const ENetHost *host, const ENetPeer *peer)
+    {
+      size_t overhead = sizeof(ENetProtocolHeader) + sizeof(ENetProtocolSendFragment);
+
+      if (host != nullptr && host->checksum != nullptr)
+        overhead += sizeof(enet_uint32);
+
+      return peer->mtu > overhead ? peer->mtu - overhead : 0;
+    }
+
+    /**
+     * \brief  Returns whether a datagram is a probe or an acknowledgement
+     *
+     * \param data          Datagram
+     * \param length        Length of the datagram
+     * \param[out] peer_id  ID of the receiving peer given by the datagram
+     */
+    static bool is_probe_datagram(const uint8_t *data, size_t length, enet_uint16 &peer_id);
+
+    /// Acknowledges the probes and handles the acknowledgements, returns whether the datagram was one
+    bool intercept(ENetHost *host) override;
+
+  private:
+    /// Kind of raw datagram
+    enum Kind: uint8_t
+    {
+      PROBE = 1,
+      ACKNOWLEDGEMENT = 2
+    };
+
+    /// Search of a peer
+    struct PeerState
+    {
+      ENetPeer *peer = nullptr;     ///< Probed peer (nullptr if none)
+      uint32_t confirmed = 0;       ///< Largest size known to reach the peer
+      uint32_t failed = 0;          ///< Smallest size known not to reach the peer
+      uint32_t probe_size = 0;      ///< Size of the probe in flight (0 if none)
+      uint32_t sequence = 0;        ///< Sequence number of the last probe
+      uint32_t attempts = 0;        ///< Probes of probe_size lost so far
+      enet_uint32 deadline = 0;     ///< When the probe is lost, or when the next search starts (in ms)
+      bool searching = false;       ///< Whether a search is in progress
+      enet_uint32 answer_epoch = 0; ///< Start of the current second of acknowledgements (in ms)
+      uint32_t answer_count = 0;    ///< Probes of the peer acknowledged during that second
+    };
+
+    static const size_t HEADER_SIZE = 14;             ///< Size of a probe without padding
+    static const uint32_t MAX_ANSWERS_PER_SECOND = 64;  ///< Probes acknowledged per peer and second
+
+    Config config_;    ///< Search parameters
+    Stats stats_;      ///< Number of probes, and of fragmented packets
+    bool enabled_;     ///< Whether peers are probed
+    std::vector<PeerState> peers_;  ///< Search of each peer, indexed by incomingPeerID
+    std::vector<uint8_t> buffer_;   ///< Probe being sent
+    ENetSocket configured_socket_;  ///< Last socket on which IP fragmentation was forbidden
+
+    /// Returns the search of a peer (nullptr if unknown)
+    PeerState* get_state(const ENetPeer *peer);
+    const PeerState* get_state(const ENetPeer *peer) const;
+
+    /// Applies the initial MTU to a host, and forbids IP fragmentation on its socket
+    void configure(ENetHost *host);
+
+    /// Starts a search from scratch
+    void start_search(PeerState &state, enet_uint32 time);
+
+    /// Sends the next probe of a search from a host, or ends it
+    void send_probe(ENetHost *host, PeerState &state, enet_uint32 time);
+
+    /// Sends a probe or an acknowledgement, returns whether it could be sent
+    bool send_datagram(
+      ENetHost *host,
+      const ENetAddress &address,
+      Kind kind,
+      enet_uint16 peer_id,
+      uint32_t sequence,
+      uint32_t size
+    );
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @file
+ *
+ * \brief  Typed per-peer state, split between hot and cold storage
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * The application declares the fields it reads for every packet (hot fields)
+ * and a struct for everything else (cold context):
+ *
+ *     struct PlayerInfo { std::string name; uint64_t account_id; };
+ *     enum PlayerField { STATUS, LAST_SEQUENCE, TOKENS };
+ *
+ *     net::PeerContexts<PlayerInfo, uint8_t, uint32_t, float> players(max_peer_count);
+ *
+ *     players.hot<LAST_SEQUENCE>(peer) = sequence;
+ *     players.cold(peer).name = "player";
+ *
+ * Each hot field is stored in its own array (structure of arrays), so that the
+ * same field of 64 peers of one byte shares a single cache line, and a handler
+ * touching two fields of a peer reads two cache lines whatever the size of the
+ * cold context. All the storage is allocated once, in an arena sized for the
+ * maximal number of peers. Peers are indexed by their ENet slot (incomingPeerID).
+ */
+
+#ifndef NET__PEER_CONTEXTS_HPP
+#define NET__PEER_CONTEXTS_HPP
+
+#include "enet/enet.h"
+#include <array>
+#include <tuple>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/**
+ * \brief  Per-peer storage with hot fields in arrays and a cold context per peer
+ *
+ * \tparam Cold  Context rarely accessed, default constructible
+ * \tparam Hot   Types of the fields accessed for every packet, trivially copyable
+ */
+template <typename Cold, typename... Hot>
+class PeerContexts
+{
+  public:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+    static constexpr size_t HOT_FIELD_COUNT = sizeof...(Hot);
+
+    /// Type of the I-th hot field
+    template <size_t I>
+    using hot_type = std::tuple_element_t<I, std::tuple<Hot...>>;
+
+    static_assert(
+      (std::is_trivially_copyable_v<Hot> && ...),
+      "Hot fields must be trivially copyable"
+    );
+    static_assert(std::is_default_constructible_v<Cold>, "Cold context must be default constructible");
+
+    /// \param capacity  Maximal number of peers, usually the peer count of the host
+    PeerContexts(size_t capacity):
+      capacity_(capacity)
+    {
+      constexpr std::array<size_t, HOT_FIELD_COUNT> sizes = {sizeof(Hot)...};
+      size_t offset = 0;
+
+      for (size_t k = 0; k < HOT_FIELD_COUNT; k++) {
+        offsets_[k] = offset;
+        offset = align(offset + sizes[k] * capacity_);
+      }
+
+      cold_offset_ = offset;
+      arena_size_ = align(cold_offset_ + sizeof(Cold) * capacity_);
+      arena_ = static_cast<uint8_t*>(
+        ::operator new(arena_size_, std::align_val_t(CACHE_LINE_SIZE))
+      );
+
+      for (size_t k = 0; k < capacity_; k++) {
+        new (cold_ptr() + k) Cold();
+        reset_hot(k);
+      }
+    }
+
+    ~PeerContexts()
+    {
+      for (size_t k = 0; k < capacity_; k++)
+        cold_ptr()[k].~Cold();
+
+      ::operator delete(arena_, std::align_val_t(CACHE_LINE_SIZE));
+    }
+
+    PeerContexts(const PeerContexts&) = delete;
+    PeerContexts& operator=(const PeerContexts&) = delete;
+
+    /// Returns the maximal number of peers
+    size_t get_capacity() const
+    {
+      return capacity_;
+    }
+
+    /// Returns whether the slot of a peer fits in the storage
+    bool contains(const ENetPeer *peer) const
+    {
+      return peer->incomingPeerID < capacity_;
+    }
+
+    /// Returns the I-th hot field of a peer (the peer must be contained)
+    template <size_t I>
+    hot_type<I>& hot(const ENetPeer *peer)
+    {
+      return hot_column<I>()[peer->incomingPeerID];
+    }
+
+    template <size_t I>
+    const hot_type<I>& hot(const ENetPeer *peer) const
+    {
+      return hot_column<I>()[peer->incomingPeerID];
+    }
+
+    /// Returns the I-th hot field of all the slots, to scan them all at once
+    template <size_t I>
+    hot_type<I>* hot_column()
+    {
+      return std::launder(reinterpret_cast<hot_type<I>*>(arena_ + offsets_[I]));
+    }
+
+    template <size_t I>
+    const hot_type<I>* hot_column() const
+    {
+      return std::launder(reinterpret_cast<const hot_type<I>*>(arena_ + offsets_[I]));
+    }
+
+    /// Returns the cold context of a peer (the peer must be contained)
+    Cold& cold(const ENetPeer *peer)
+    {
+      return cold_ptr()[peer->incomingPeerID];
+    }
+
+    const Cold& cold(const ENetPeer *peer) const
+    {
+      return cold_ptr()[peer->incomingPeerID];
+    }
+
+    /// Resets the hot fields and the cold context of a peer to their default values
+    void reset(const ENetPeer *peer)
+    {
+      reset_hot(peer->incomingPeerID);
+      cold_ptr()[peer->incomingPeerID] = Cold();
+    }
+
+  private:
+    size_t capacity_;     ///< Maximal number of peers
+    uint8_t *arena_;      ///< Memory of all the fields
+    size_t arena_size_;   ///< Size of the arena (in bytes)
+    std::array<size_t, HOT_FIELD_COUNT> offsets_;  ///< Offset of each hot column in the arena
+    size_t cold_offset_;  ///< Offset of the cold contexts in the arena
+
+    /// Rounds an offset up to the next cache line
+    static constexpr size_t align(size_t offset)
+    {
+      return (offset + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+
+    Cold* cold_ptr()
+    {
+      return std::launder(reinterpret_cast<Cold*>(arena_ + cold_offset_));
+    }
+
+    const Cold* cold_ptr() const
+    {
+      return std::launder(reinterpret_cast<const Cold*>(arena_ + cold_offset_));
+    }
+
+    /// Value-initialises the hot fields of a slot
+    void reset_hot(size_t index)
+    {
+      reset_hot(index, std::index_sequence_for<Hot...>());
+    }
+
+    template <size_t... I>
+    void reset_hot(size_t index, std::index_sequence<I...>)
+    {
+      ((new (arena_ + offsets_[I] + index * sizeof(hot_type<I>)) hot_type<I>()), ...);
+    }
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * @file
+ *
+ * \brief  Timeouts of the peers of a server, and reclamation of their slots
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "peer_lifecycle.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <algorithm>
+
+
+namespace net
+{
+
+PeerLifecycle::PeerLifecycle():
+  last_check_(0)
+{
+
+}
+
+
+void PeerLifecycle::set_config(const Config &config)
+{
+  config_ = config;
+}
+
+
+const PeerLifecycle::Config& PeerLifecycle::get_config() const
+{
+  return config_;
+}
+
+
+void PeerLifecycle::connect(ENetPeer *peer)
+{
+  Slot &slot = get_slot(peer);
+  slot = Slot();
+  slot.connected = true;
+  slot.connect_time = enet_time_get();
+  slot.last_activity = slot.connect_time;
+
+  apply(peer, config_.validating);
+}
+
+
+void PeerLifecycle::validate(ENetPeer *peer)
+{
+  Slot &slot = get_slot(peer);
+  slot.validated = true;
+  slot.last_activity = enet_time_get();
+
+  apply(peer, config_.validated);
+}
+
+
+void PeerLifecycle::disconnect(const ENetPeer *peer)
+{
+  Slot &slot = get_slot(peer);
+
+  if (slot.connected)
+    stats_.disconnected++;
+
+  slot = Slot();
+}
+
+
+void PeerLifecycle::update(ENetHost *host)
+{
+  const uint32_t now = enet_time_get();
+
+  if (ENET_TIME_DIFFERENCE(now, last_check_) < config_.check_interval)
+    return;
+
+  last_check_ = now;
+  idle_peers_.clear();
+  size_t validated_count = 0;
+
+  for (size_t k = 0; k < host->peerCount; k++) {
+    ENetPeer *peer = &host->peers[k];
+
+    if (peer->state != ENET_PEER_STATE_CONNECTED)
+      continue;
+
+    Slot &slot = get_slot(peer);
+
+    if (!slot.connected || slot.closing)
+      continue;
+
+    // Pinged but silent: the ENet timeouts are shortened, so that the peer times
+    // out at the next service as if its pings had not been acknowledged for long
+    if (config_.silence_timeout > 0
+      && ENET_TIME_DIFFERENCE(now, peer->lastReceiveTime) >= config_.silence_timeout
+    ) {
+      enet_peer_timeout(peer, 1, 1, 1);
+      slot.closing = true;
+      stats_.half_open++;
+      continue;
+    }
+
+    if (!slot.validated) {
+      if (config_.validation_timeout > 0
+        && ENET_TIME_DIFFERENCE(now, slot.connect_time) >= config_.validation_timeout
+      ) {
+        enet_peer_disconnect(peer, 0);
+        slot.closing = true;
+        stats_.unvalidated++;
+      }
+
+      continue;
+    }
+
+    if (slot.active) {
+      slot.active = false;
+      slot.last_activity = now;
+    } else if (ENET_TIME_DIFFERENCE(now, slot.last_activity) >= config_.idle_timeout) {
+      idle_peers_.push_back(peer);
+    }
+
+    validated_count++;
+  }
+
+  if (validated_count <= config_.capacity_target || idle_peers_.empty())
+    return;
+
+  // Longest idle first
+  std::sort(idle_peers_.begin(), idle_peers_.end(), [&](const ENetPeer *a, const ENetPeer *b) {
+    return ENET_TIME_DIFFERENCE(now, get_slot(a).last_activity)
+      > ENET_TIME_DIFFERENCE(now, get_slot(b).last_activity);
+  });
+
+  size_t eviction_count = std::min(validated_count - config_.capacity_target, idle_peers_.size());
+
+  for (size_t k = 0; k < eviction_count; k++) {
+    enet_peer_disconnect(idle_peers_[k], 0);
+    get_slot(idle_peers_[k]).closing = true;
+    stats_.evicted++;
+  }
+}
+
+
+const PeerLifecycle::Stats& PeerLifecycle::get_stats() const
+{
+  return stats_;
+}
+
+
+PeerLifecycle::Slot& PeerLifecycle::get_slot(const ENetPeer *peer)
+{
+  if (peer->incomingPeerID >= slots_.size())
+    slots_.resize(peer->incomingPeerID + 1);
+
+  return slots_[peer->incomingPeerID];
+}
+
+
+void PeerLifecycle::apply(ENetPeer *peer, const Timeouts &timeouts)
+{
+  enet_peer_ping_interval(peer, timeouts.ping_interval);
+  enet_peer_timeout(peer, timeouts.limit, timeouts.minimum, timeouts.maximum);
+}
+
+
+}  // namespace net
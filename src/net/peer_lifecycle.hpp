@@ -0,0 +1,128 @@
+/**
+ * @file
+ *
+ * \brief  Timeouts of the peers of a server, and reclamation of their slots
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__PEER_LIFECYCLE_HPP
+#define NET__PEER_LIFECYCLE_HPP
+
+#include "enet/enet.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/**
+ * \brief  Frees the slots of the peers of a server as fast as they come and go
+ *
+ * ENet keeps the slot of a vanished peer until its reliable commands time out,
+ * by default after up to 30 s. The lifecycle applies shorter ENet timeouts and
+ * ping intervals, first while the peer is validating and then once it is
+ * validated, and checks the peers periodically:
+ *   - a peer from which no datagram at all was received for `silence_timeout`,
+ *     although it is pinged, is half-open: it is timed out by ENet right away
+ *   - a peer not validated within `validation_timeout` is disconnected
+ *   - while more validated peers than `capacity_target` are connected, those which
+ *     sent no message for `idle_timeout` are disconnected, the longest idle first
+ *
+ * Each of them then goes through the usual disconnection event.
+ */
+class PeerLifecycle
+{
+  public:
+    /// Timeouts applied by ENet to a peer (see enet_peer_timeout and enet_peer_ping_interval)
+    struct Timeouts
+    {
+      uint32_t ping_interval;  ///< Interval between two pings of a peer sending nothing (in ms)
+      uint32_t limit;          ///< Number of round-trip times after which a reliable command may time out
+      uint32_t minimum;        ///< Duration after which a reliable command may time out (in ms)
+      uint32_t maximum;        ///< Duration after which a reliable command always times out (in ms)
+    };
+
+    /// Policies applied to the peers
+    struct Config
+    {
+      Timeouts validating = {250, 8, 2000, 5000};  ///< Timeouts of the peers being validated
+      Timeouts validated = {500, 16, 3000, 10000}; ///< Timeouts of the validated peers
+      uint32_t silence_timeout = 3000;    ///< Duration without any datagram after which a peer is half-open (in ms, 0 to disable)
+      uint32_t validation_timeout = 5000; ///< Duration allowed to be validated (in ms, 0 to disable)
+      uint32_t idle_timeout = 60000;      ///< Duration without any message after which a validated peer can be evicted (in ms)
+      size_t capacity_target = SIZE_MAX;  ///< Number of validated peers above which idle ones are evicted
+      uint32_t check_interval = 100;      ///< Interval between two checks of the peers (in ms)
+    };
+
+    /// Number of peers whose slot was reclaimed, by reason
+    struct Stats
+    {
+      uint64_t disconnected = 0;  ///< Peers which disconnected or timed out
+      uint64_t half_open = 0;     ///< Peers timed out after being silent
+      uint64_t unvalidated = 0;   ///< Peers disconnected for not being validated in time
+      uint64_t evicted = 0;       ///< Idle peers disconnected to reach the capacity target
+    };
+
+    PeerLifecycle();
+
+    /// Sets the policies applied to the peers, from the next connection or check
+    void set_config(const Config &config);
+
+    /// Returns the policies applied to the peers
+    const Config& get_config() const;
+
+    /// Applies the timeouts of the peers being validated to a new peer
+    void connect(ENetPeer *peer);
+
+    /// Applies the timeouts of the validated peers to a peer
+    void validate(ENetPeer *peer);
+
+    /// Marks a validated peer as active, to be called for each of its messages
+    void mark_active(const ENetPeer *peer)
+    {
+      if (peer->incomingPeerID < slots_.size())
+        slots_[peer->incomingPeerID].active = true;
+    }
+
+    /// Forgets a disconnected peer
+    void disconnect(const ENetPeer *peer);
+
+    /**
+     * \brief  Checks the peers of a host, at most once per check interval
+     *
+     * \param host  Host whose peers to check
+     */
+    void update(ENetHost *host);
+
+    /// Returns the number of reclaimed slots
+    const Stats& get_stats() const;
+
+  private:
+    /// Lifecycle of a peer slot
+    struct Slot
+    {
+      bool connected = false;      ///< Whether a peer is connected in the slot
+      bool validated = false;      ///< Whether the peer is validated
+      bool active = false;         ///< Whether the peer sent a message since the last check
+      bool closing = false;        ///< Whether the peer is being disconnected by the lifecycle
+      uint32_t connect_time = 0;   ///< When the peer connected (ENet time, in ms)
+      uint32_t last_activity = 0;  ///< When the peer was last seen active (ENet time, in ms)
+    };
+
+    Config config_;            ///< Policies applied to the peers
+    Stats stats_;              ///< Number of reclaimed slots
+    std::vector<Slot> slots_;  ///< Lifecycle of each slot, indexed by incomingPeerID
+    std::vector<ENetPeer*> idle_peers_;  ///< Peers which can be evicted, reused by update
+    uint32_t last_check_;      ///< When the peers were last checked (ENet time, in ms)
+
+    Slot& get_slot(const ENetPeer *peer);
+
+    static void apply(ENetPeer *peer, const Timeouts &timeouts);
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,30 @@
+/**
+ * @file
+ *
+ * \brief  Compile-time policies of BasicNetHost
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Each policy has a `kind` identifying what it configures, so that policies can
+ * be given to BasicNetHost in any order. Kinds which are not given use the
+ * default policy. Each kind has its own header, all included by this one:
+ *   - validation: NoValidation, PuzzleValidation or CookieValidation (validation_policy.hpp)
+ *   - logging:    Logging<LogLevel> (default: Logging<LogLevel::ERROR>, policy.hpp)
+ *   - delivery:   Delivery<flags, channel> (default: reliable, on channel 0, policy.hpp)
+ *   - recording:  NoRecording or Recording (recording_policy.hpp)
+ *   - transport:  NetworkTransport or SharedMemoryTransport (transport_policy.hpp)
+ *   - clock:      NoClockSync or ClockSync (clock_policy.hpp)
+ *   - MTU:        NoMtuDiscovery or MtuDiscovery (mtu_policy.hpp)
+ */
+
+#ifndef NET__POLICIES_HPP
+#define NET__POLICIES_HPP
+
+#include "policy.hpp"
+#include "validation_policy.hpp"
+#include "recording_policy.hpp"
+#include "transport_policy.hpp"
+#include "clock_policy.hpp"
+#include "mtu_policy.hpp"
+
+#endif
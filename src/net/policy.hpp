@@ -0,0 +1,99 @@
+/**
+ * @file
+ *
+ * \brief  Kinds of the policies of BasicNetHost, logging and delivery policies
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Each policy has a `kind` identifying what it configures, so that policies can
+ * be given to BasicNetHost in any order (see policies.hpp).
+ */
+
+#ifndef NET__POLICY_HPP
+#define NET__POLICY_HPP
+
+#include "enet/enet.h"
+#include <type_traits>
+
+#include <stdio.h>
+
+
+namespace net
+{
+
+namespace policy
+{
+
+/// Kinds of policies
+struct validation_kind {};
+struct logging_kind {};
+struct delivery_kind {};
+struct recording_kind {};
+struct transport_kind {};
+struct clock_kind {};
+struct mtu_kind {};
+
+
+/// Finds the policy of a given kind in a list, or falls back to a default policy
+template <typename Kind, typename Default, typename... Policies>
+struct find
+{
+  using type = Default;
+};
+
+template <typename Kind, typename Default, typename Policy, typename... Policies>
+struct find<Kind, Default, Policy, Policies...>
+{
+  using type = std::conditional_t<
+    std::is_same_v<typename Policy::kind, Kind>,
+    Policy,
+    typename find<Kind, Default, Policies...>::type
+  >;
+};
+
+
+/// Verbosity of the messages printed by a host
+enum class LogLevel
+{
+  NONE,   ///< Nothing is printed
+  ERROR,  ///< Only errors are printed
+  INFO,   ///< Connections, disconnections and validations are printed as well
+  DEBUG   ///< Every received packet is printed as well
+};
+
+
+/// Prints the messages up to a given level, the others are compiled out
+template <LogLevel Level>
+struct Logging
+{
+  using kind = logging_kind;
+  static constexpr LogLevel level = Level;
+
+  template <LogLevel MessageLevel, typename... Args>
+  static void log(const char *format, Args... args)
+  {
+    if constexpr (MessageLevel != LogLevel::NONE && MessageLevel <= Level) {
+      FILE *stream = MessageLevel == LogLevel::ERROR ? stderr : stdout;
+
+      if constexpr (sizeof...(Args) == 0)
+        fputs(format, stream);
+      else
+        fprintf(stream, format, args...);
+    }
+  }
+};
+
+
+/// Defaults used to send packets when no channel is specified
+template <enet_uint32 Flags = ENET_PACKET_FLAG_RELIABLE, int Channel = 0>
+struct Delivery
+{
+  using kind = delivery_kind;
+  static constexpr enet_uint32 flags = Flags;
+  static constexpr int channel = Channel;
+};
+
+}  // namespace policy
+}  // namespace net
+
+#endif
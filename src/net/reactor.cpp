@@ -0,0 +1,1025 @@
+/**
+ * @file
+ *
+ * \brief  Event loop servicing many hosts from a single thread (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * The io_uring is driven with its raw system calls, so that no library is needed.
+ */
+
+#include "reactor.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef NET_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#endif
+
+
+namespace net
+{
+
+#ifdef NET_HAS_IO_URING
+namespace
+{
+
+/// Number of entries of the submission queue
+const unsigned SUBMISSION_QUEUE_SIZE = 256;
+
+/// Group of the provided receive buffers
+const uint16_t BUFFER_GROUP = 0;
+
+/// Requests submitted to the io_uring, stored in the high half of their user data
+enum Request: uint32_t
+{
+  RECEIVE = 1,  ///< Multishot receive of a batched socket
+  POLL,         ///< Multishot poll of a stock socket
+  SEND,         ///< Datagram sent from a send slot
+  TIMER,        ///< Timer at the next service deadline
+  CANCEL,       ///< Cancellation of a multishot request
+  PROVIDE,      ///< Buffers given back without ring (older kernels)
+  PROBE         ///< Receive checking that the buffer ring is used
+};
+
+
+uint64_t make_user_data(Request request, uint32_t index)
+{
+  return ((uint64_t)request << 32) | index;
+}
+
+
+int io_uring_setup(unsigned entries, io_uring_params *params)
+{
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned arg_count)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, arg_count);
+}
+
+}  // anonymous namespace
+#endif
+
+
+struct Reactor::System
+{
+#ifdef __linux__
+  int epoll_fd = -1;                 ///< epoll set (epoll backend)
+  std::vector<epoll_event> events;   ///< Events returned by epoll_wait
+#endif
+
+#ifdef NET_HAS_IO_URING
+  /// Datagram being sent
+  struct SendSlot
+  {
+    msghdr header;
+    iovec iov;
+    sockaddr_in address;
+    uint8_t data[ENET_PROTOCOL_MAXIMUM_MTU];
+  };
+
+  int ring_fd = -1;                   ///< io_uring
+  uint8_t *rings = nullptr;           ///< Submission and completion rings, mapped together
+  size_t rings_size = 0;              ///< Size of the mapped rings
+  io_uring_sqe *sqes = nullptr;       ///< Submission entries
+  size_t sqes_size = 0;               ///< Size of the mapped submission entries
+
+  unsigned *sq_head = nullptr;        ///< Head of the submission ring, moved by the kernel
+  unsigned *sq_tail = nullptr;        ///< Tail of the submission ring
+  unsigned *sq_array = nullptr;       ///< Indices of the submission entries
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+  unsigned sq_local_tail = 0;         ///< Tail including the entries not published yet
+
+  unsigned *cq_head = nullptr;        ///< Head of the completion ring
+  unsigned *cq_tail = nullptr;        ///< Tail of the completion ring, moved by the kernel
+  unsigned cq_mask = 0;
+  io_uring_cqe *cqes = nullptr;       ///< Completion entries
+
+  io_uring_buf_ring *buffer_ring = nullptr;  ///< Ring of buffers provided to the kernel
+  size_t buffer_ring_size = 0;        ///< Size of the mapped buffer ring
+  uint16_t buffer_ring_tail = 0;      ///< Tail of the buffer ring
+  unsigned buffer_mask = 0;
+  bool legacy_buffers = false;        ///< Whether buffers are given back by requests instead of the ring
+  std::vector<uint32_t> released_buffers;  ///< Buffers to give back by requests (legacy)
+  size_t buffer_size = 0;             ///< Size of each receive buffer
+  std::unique_ptr<uint8_t[]> buffers; ///< Receive buffers
+  msghdr receive_header;              ///< Template of the multishot receives
+
+  std::unique_ptr<SendSlot[]> send_slots;   ///< Datagrams being sent
+  std::vector<uint32_t> free_send_slots;    ///< Indices of the free send slots
+
+  __kernel_timespec timer;            ///< Deadline of the last armed timer
+  Clock::time_point timer_deadline = Clock::time_point::max();  ///< Earliest armed timer
+
+  /// Returns a cleared submission entry (nullptr if the queue is full)
+  io_uring_sqe* get_sqe()
+  {
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries) {
+      submit(0);
+
+      if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries)
+        return nullptr;
+    }
+
+    unsigned index = sq_local_tail & sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    sq_array[index] = index;
+    sq_local_tail++;
+
+    return sqe;
+  }
+
+  /// Returns the number of submission entries not consumed by the kernel yet
+  unsigned get_pending() const
+  {
+    return sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  /// Submits the prepared entries and waits for completions, returns -1 on error
+  int submit(unsigned min_complete)
+  {
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    return io_uring_enter(ring_fd, get_pending(), min_complete, flags);
+  }
+
+  /// Returns whether completions are waiting to be handled
+  bool has_completions() const
+  {
+    return *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  }
+
+  /// Gives a buffer to the kernel
+  void provide_buffer(uint32_t buffer_id)
+  {
+    if (legacy_buffers) {
+      released_buffers.push_back(buffer_id);
+      return;
+    }
+
+    io_uring_buf &buffer = buffer_ring->bufs[buffer_ring_tail & buffer_mask];
+    buffer.addr = (uint64_t)(buffers.get() + buffer_id * buffer_size);
+    buffer.len = buffer_size;
+    buffer.bid = buffer_id;
+
+    buffer_ring_tail++;
+    __atomic_store_n(&buffer_ring->tail, buffer_ring_tail, __ATOMIC_RELEASE);
+  }
+
+  /// Queues the requests giving the released buffers back (legacy), one per run of identifiers
+  void queue_released_buffers()
+  {
+    if (released_buffers.empty())
+      return;
+
+    std::sort(released_buffers.begin(), released_buffers.end());
+    size_t start = 0;
+
+    while (start < released_buffers.size()) {
+      size_t end = start + 1;
+
+      while (end < released_buffers.size() && released_buffers[end] == released_buffers[end - 1] + 1)
+        end++;
+
+      io_uring_sqe *sqe = get_sqe();
+
+      if (sqe == nullptr)
+        break;
+
+      sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+      sqe->fd = end - start;
+      sqe->addr = (uint64_t)(buffers.get() + released_buffers[start] * buffer_size);
+      sqe->len = buffer_size;
+      sqe->off = released_buffers[start];
+      sqe->buf_group = BUFFER_GROUP;
+      sqe->user_data = make_user_data(PROVIDE, 0);
+      start = end;
+    }
+
+    released_buffers.erase(released_buffers.begin(), released_buffers.begin() + start);
+  }
+
+  /**
+   * \brief  Returns whether the kernel selects the buffers from the ring
+   *
+   * Some kernels accept the registration of the ring but never select buffers
+   * from it. A datagram sent to a probe socket is received to check it.
+   */
+  bool probe_buffer_ring()
+  {
+    int probe = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    bool sent = probe >= 0
+      && bind(probe, (sockaddr*)&address, sizeof(address)) == 0
+      && getsockname(probe, (sockaddr*)&address, &address_length) == 0
+      && sendto(probe, "", 1, 0, (sockaddr*)&address, sizeof(address)) == 1;
+    io_uring_sqe *sqe = sent ? get_sqe() : nullptr;
+
+    // Without loopback, the ring is assumed to work
+    if (sqe == nullptr) {
+      if (probe >= 0)
+        close(probe);
+
+      return true;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = probe;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = make_user_data(PROBE, 0);
+    submit(1);
+
+    bool selected = false;
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+      const io_uring_cqe &cqe = cqes[head & cq_mask];
+
+      if (cqe.user_data == make_user_data(PROBE, 0) && cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        selected = true;
+        provide_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      }
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    close(probe);
+
+    return selected;
+  }
+#endif
+
+  ~System()
+  {
+#ifdef NET_HAS_IO_URING
+    if (ring_fd >= 0)
+      close(ring_fd);
+    if (buffer_ring != nullptr)
+      munmap(buffer_ring, buffer_ring_size);
+    if (sqes != nullptr)
+      munmap(sqes, sqes_size);
+    if (rings != nullptr)
+      munmap(rings, rings_size);
+#endif
+#ifdef __linux__
+    if (epoll_fd >= 0)
+      close(epoll_fd);
+#endif
+  }
+};
+
+
+Reactor::Reactor(size_t buffer_count, size_t send_slot_count):
+  backend_(Backend::NONE),
+  buffer_count_(buffer_count),
+  send_slot_count_(send_slot_count),
+  system_(std::make_unique<System>()),
+  running_(false)
+{
+  // The ring of provided buffers holds a power of two of them
+  buffer_count_ = std::clamp<size_t>(buffer_count_, 1, 32768);
+  size_t power = 1;
+
+  while (power < buffer_count_)
+    power *= 2;
+
+  buffer_count_ = power;
+  send_slot_count_ = std::max<size_t>(send_slot_count_, 1);
+}
+
+
+Reactor::~Reactor()
+{
+  for (auto &entry: entries_) {
+    if (entry->host != nullptr)
+      remove(*entry->host);
+  }
+
+#ifdef NET_HAS_IO_URING
+  // The kernel must be done with the buffers before they are freed
+  if (backend_ == Backend::IO_URING) {
+    const auto deadline = Clock::now() + std::chrono::seconds(1);
+
+    while (is_busy() && Clock::now() < deadline)
+      run_once_io_uring(Clock::now() + std::chrono::milliseconds(10));
+  }
+#endif
+}
+
+
+bool Reactor::init(Backend backend)
+{
+  if (backend_ != Backend::NONE)
+    return true;
+
+  if (backend == Backend::IO_URING && init_io_uring()) {
+    backend_ = Backend::IO_URING;
+    return true;
+  }
+
+  system_ = std::make_unique<System>();
+
+  if (init_epoll()) {
+    backend_ = Backend::EPOLL;
+    return true;
+  }
+
+  fprintf(stderr, "[Reactor] Could not create the event loop\n");
+  return false;
+}
+
+
+Reactor::Backend Reactor::get_backend() const
+{
+  return backend_;
+}
+
+
+bool Reactor::add(NetHost &host, std::function<void()> service, std::chrono::milliseconds interval)
+{
+  if (backend_ == Backend::NONE) {
+    fprintf(stderr, "[Reactor] Hosts can only be added once the reactor is initialised\n");
+    return false;
+  }
+
+  if (host.get() == nullptr || find(host) != nullptr) {
+    fprintf(stderr, "[Reactor] The host is not created or already added\n");
+    return false;
+  }
+
+  auto entry = std::make_unique<Entry>();
+  entry->host = &host;
+  entry->socket = host.get()->socket;
+  entry->batched_socket = nullptr;
+  entry->service = std::move(service);
+  entry->interval = interval;
+  entry->next_service = Clock::now();
+  entry->ready = true;
+  entry->armed = false;
+
+  size_t index = entries_.size();
+
+#ifdef __linux__
+  if (backend_ == Backend::EPOLL) {
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = index;
+
+    if (epoll_ctl(system_->epoll_fd, EPOLL_CTL_ADD, entry->socket, &event) != 0) {
+      fprintf(stderr, "[Reactor] Could not add the socket to the epoll set: %s\n", strerror(errno));
+      return false;
+    }
+  }
+#endif
+
+  // Batched sockets are fed by the reactor, the other ones are only polled
+  if (backend_ == Backend::IO_URING) {
+    entry->batched_socket = host.get_batched_socket();
+
+    if (entry->batched_socket != nullptr)
+      entry->batched_socket->set_driver(this);
+  }
+
+  entries_.push_back(std::move(entry));
+  arm(index);
+
+  return true;
+}
+
+
+void Reactor::remove(NetHost &host)
+{
+  Entry *entry = find(host);
+
+  if (entry == nullptr)
+    return;
+
+  if (entry->batched_socket != nullptr)
+    entry->batched_socket->set_driver(nullptr);
+
+#ifdef __linux__
+  if (backend_ == Backend::EPOLL)
+    epoll_ctl(system_->epoll_fd, EPOLL_CTL_DEL, entry->socket, nullptr);
+#endif
+
+#ifdef NET_HAS_IO_URING
+  // The socket may be closed right after, the multishot request is cancelled at once
+  if (backend_ == Backend::IO_URING && entry->armed) {
+    size_t index = std::find_if(entries_.begin(), entries_.end(),
+      [entry](const auto &other) { return other.get() == entry; }
+    ) - entries_.begin();
+    io_uring_sqe *sqe = system_->get_sqe();
+
+    if (sqe != nullptr) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = make_user_data(entry->batched_socket != nullptr ? RECEIVE : POLL, index);
+      sqe->user_data = make_user_data(CANCEL, index);
+      system_->submit(0);
+      stats_.system_calls++;
+    }
+  }
+#endif
+
+  entry->host = nullptr;
+  entry->batched_socket = nullptr;
+  entry->service = nullptr;
+}
+
+
+void Reactor::run_once(std::chrono::milliseconds max_wait)
+{
+  stats_.iterations++;
+  const auto deadline = Clock::now() + max_wait;
+
+  switch (backend_) {
+    case Backend::IO_URING:
+      run_once_io_uring(deadline);
+      break;
+
+    case Backend::EPOLL:
+      run_once_epoll(deadline);
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+void Reactor::run()
+{
+  running_ = true;
+
+  while (running_)
+    run_once(std::chrono::milliseconds(100));
+}
+
+
+void Reactor::stop()
+{
+  running_ = false;
+}
+
+
+const Reactor::Stats& Reactor::get_stats() const
+{
+  return stats_;
+}
+
+
+Reactor::Entry* Reactor::find(const NetHost &host)
+{
+  for (auto &entry: entries_) {
+    if (entry->host == &host)
+      return entry.get();
+  }
+
+  return nullptr;
+}
+
+
+void Reactor::service_hosts()
+{
+  const auto now = Clock::now();
+
+  // Indices are used since a service may add hosts
+  for (size_t k = 0; k < entries_.size(); k++) {
+    Entry &entry = *entries_[k];
+
+    if (entry.host == nullptr || (!entry.ready && now < entry.next_service))
+      continue;
+
+    entry.ready = false;
+    entry.next_service = now + entry.interval;
+    stats_.services++;
+    entry.service();
+  }
+}
+
+
+Reactor::Clock::time_point Reactor::get_next_deadline() const
+{
+  auto deadline = Clock::time_point::max();
+
+  for (const auto &entry: entries_) {
+    if (entry->host != nullptr)
+      deadline = std::min(deadline, entry->ready ? Clock::time_point::min() : entry->next_service);
+  }
+
+  return deadline;
+}
+
+
+// =============================================================================
+// epoll backend
+//
+#ifdef __linux__
+
+bool Reactor::init_epoll()
+{
+  system_->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (system_->epoll_fd < 0) {
+    fprintf(stderr, "[Reactor] Could not create the epoll set: %s\n", strerror(errno));
+    return false;
+  }
+
+  system_->events.resize(64);
+
+  return true;
+}
+
+
+void Reactor::run_once_epoll(Clock::time_point deadline)
+{
+  deadline = std::min(deadline, get_next_deadline());
+  const auto now = Clock::now();
+  int timeout = 0;
+
+  if (deadline > now)
+    timeout = std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+
+  System &system = *system_;
+  int event_count = epoll_wait(system.epoll_fd, system.events.data(), system.events.size(), timeout);
+  stats_.system_calls++;
+
+  for (int k = 0; k < event_count; k++)
+    entries_[system.events[k].data.u64]->ready = true;
+
+  if (event_count == 0)
+    stats_.timer_completions++;
+
+  service_hosts();
+}
+
+#else
+
+bool Reactor::init_epoll()
+{
+  return false;
+}
+
+
+void Reactor::run_once_epoll(Clock::time_point)
+{
+
+}
+
+#endif
+
+
+// =============================================================================
+// io_uring backend
+//
+#ifdef NET_HAS_IO_URING
+
+bool Reactor::init_io_uring()
+{
+  System &system = *system_;
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = std::max<unsigned>(2 * SUBMISSION_QUEUE_SIZE, 2 * buffer_count_);
+
+  system.ring_fd = io_uring_setup(SUBMISSION_QUEUE_SIZE, &params);
+
+  // Older kernels do not know the optimisation flags
+  if (system.ring_fd < 0 && errno == EINVAL) {
+    params.flags = IORING_SETUP_CQSIZE;
+    system.ring_fd = io_uring_setup(SUBMISSION_QUEUE_SIZE, &params);
+  }
+
+  if (system.ring_fd < 0) {
+    fprintf(stderr, "[Reactor] io_uring not available (%s), falling back to epoll\n", strerror(errno));
+    return false;
+  }
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    fprintf(stderr, "[Reactor] io_uring too old, falling back to epoll\n");
+    return false;
+  }
+
+  // Rings shared with the kernel
+  system.rings_size = std::max(
+    params.sq_off.array + params.sq_entries * sizeof(unsigned),
+    params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe)
+  );
+  void *rings = mmap(nullptr, system.rings_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, system.ring_fd, IORING_OFF_SQ_RING
+  );
+  system.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, system.sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, system.ring_fd, IORING_OFF_SQES
+  );
+
+  if (rings == MAP_FAILED || sqes == MAP_FAILED) {
+    fprintf(stderr, "[Reactor] Could not map the io_uring: %s\n", strerror(errno));
+
+    if (rings != MAP_FAILED)
+      munmap(rings, system.rings_size);
+    if (sqes != MAP_FAILED)
+      munmap(sqes, system.sqes_size);
+
+    return false;
+  }
+
+  system.rings = static_cast<uint8_t*>(rings);
+  system.sqes = static_cast<io_uring_sqe*>(sqes);
+  system.sq_head = reinterpret_cast<unsigned*>(system.rings + params.sq_off.head);
+  system.sq_tail = reinterpret_cast<unsigned*>(system.rings + params.sq_off.tail);
+  system.sq_array = reinterpret_cast<unsigned*>(system.rings + params.sq_off.array);
+  system.sq_mask = *reinterpret_cast<unsigned*>(system.rings + params.sq_off.ring_mask);
+  system.sq_entries = params.sq_entries;
+  system.sq_local_tail = *system.sq_tail;
+  system.cq_head = reinterpret_cast<unsigned*>(system.rings + params.cq_off.head);
+  system.cq_tail = reinterpret_cast<unsigned*>(system.rings + params.cq_off.tail);
+  system.cq_mask = *reinterpret_cast<unsigned*>(system.rings + params.cq_off.ring_mask);
+  system.cqes = reinterpret_cast<io_uring_cqe*>(system.rings + params.cq_off.cqes);
+
+  // Ring of provided buffers (Linux 5.19 and later)
+  system.buffer_ring_size = buffer_count_ * sizeof(io_uring_buf);
+  void *buffer_ring = mmap(nullptr, system.buffer_ring_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+  );
+
+  if (buffer_ring == MAP_FAILED) {
+    fprintf(stderr, "[Reactor] Could not allocate the buffer ring: %s\n", strerror(errno));
+    return false;
+  }
+
+  system.buffer_ring = static_cast<io_uring_buf_ring*>(buffer_ring);
+
+  io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = (uint64_t)buffer_ring;
+  registration.ring_entries = buffer_count_;
+  registration.bgid = BUFFER_GROUP;
+
+  if (io_uring_register(system.ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0) {
+    fprintf(stderr, "[Reactor] Provided buffer rings not available (%s), falling back to epoll\n", strerror(errno));
+    return false;
+  }
+
+  // Each buffer holds the header of the multishot receive, the source and the datagram
+  memset(&system.receive_header, 0, sizeof(system.receive_header));
+  system.receive_header.msg_namelen = sizeof(sockaddr_in);
+  system.buffer_size = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + ENET_PROTOCOL_MAXIMUM_MTU;
+  system.buffers = std::make_unique<uint8_t[]>(buffer_count_ * system.buffer_size);
+  system.buffer_mask = buffer_count_ - 1;
+
+  for (size_t k = 0; k < buffer_count_; k++)
+    system.provide_buffer(k);
+
+  // Otherwise, the buffers are given back by requests (Linux 5.7 and later)
+  if (!system.probe_buffer_ring()) {
+    io_uring_register(system.ring_fd, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+    system.legacy_buffers = true;
+
+    for (size_t k = 0; k < buffer_count_; k++)
+      system.provide_buffer(k);
+
+    system.queue_released_buffers();
+  }
+
+  system.send_slots = std::make_unique<System::SendSlot[]>(send_slot_count_);
+  system.free_send_slots.resize(send_slot_count_);
+
+  for (size_t k = 0; k < send_slot_count_; k++)
+    system.free_send_slots[k] = send_slot_count_ - 1 - k;
+
+  return true;
+}
+
+
+void Reactor::run_once_io_uring(Clock::time_point deadline)
+{
+  System &system = *system_;
+
+  system.queue_released_buffers();
+
+  // Multishot requests end when no buffer is left, or on errors
+  for (size_t k = 0; k < entries_.size(); k++) {
+    if (entries_[k]->host != nullptr && !entries_[k]->armed)
+      arm(k);
+  }
+
+  deadline = std::min(deadline, get_next_deadline());
+  bool wait = deadline > Clock::now() && !system.has_completions();
+
+  if (wait && deadline < system.timer_deadline) {
+    io_uring_sqe *sqe = system.get_sqe();
+
+    if (sqe != nullptr) {
+      auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+      system.timer.tv_sec = time / 1000000000;
+      system.timer.tv_nsec = time % 1000000000;
+      system.timer_deadline = deadline;
+
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->addr = (uint64_t)&system.timer;
+      sqe->len = 1;
+      sqe->timeout_flags = IORING_TIMEOUT_ABS;
+      sqe->user_data = make_user_data(TIMER, 0);
+    }
+  }
+
+  // The queued datagrams are submitted along with the wait
+  if (wait || system.get_pending() > 0) {
+    if (system.submit(wait ? 1 : 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      fprintf(stderr, "[Reactor] io_uring_enter failed: %s\n", strerror(errno));
+
+    stats_.system_calls++;
+  }
+
+  handle_completions();
+  service_hosts();
+}
+
+
+bool Reactor::arm(size_t index)
+{
+  if (backend_ != Backend::IO_URING)
+    return true;
+
+  Entry &entry = *entries_[index];
+  io_uring_sqe *sqe = system_->get_sqe();
+
+  if (sqe == nullptr)
+    return false;
+
+  sqe->fd = entry.socket;
+
+  if (entry.batched_socket != nullptr) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->addr = (uint64_t)&system_->receive_header;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = make_user_data(RECEIVE, index);
+  } else {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = make_user_data(POLL, index);
+  }
+
+  entry.armed = true;
+
+  return true;
+}
+
+
+bool Reactor::is_busy() const
+{
+  if (backend_ != Backend::IO_URING)
+    return false;
+
+  if (system_->free_send_slots.size() < send_slot_count_)
+    return true;
+
+  for (const auto &entry: entries_) {
+    if (entry->armed)
+      return true;
+  }
+
+  return false;
+}
+
+
+void Reactor::handle_completions()
+{
+  System &system = *system_;
+  unsigned head = *system.cq_head;
+  unsigned tail = __atomic_load_n(system.cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    const io_uring_cqe &cqe = system.cqes[head & system.cq_mask];
+    uint32_t index = cqe.user_data & 0xFFFFFFFF;
+
+    switch (cqe.user_data >> 32) {
+      case RECEIVE: {
+        Entry &entry = *entries_[index];
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+          entry.armed = false;
+
+        // Kernels without multishot receives (before 6.0): the socket is polled instead
+        if (cqe.res == -EINVAL && entry.batched_socket != nullptr) {
+          fprintf(stderr, "[Reactor] Multishot receives not available, polling the socket instead\n");
+          entry.batched_socket->set_driver(nullptr);
+          entry.batched_socket = nullptr;
+        }
+
+        // Errors such as ENOBUFS (all the buffers are held) carry no buffer
+        if (cqe.res < 0 || !(cqe.flags & IORING_CQE_F_BUFFER))
+          break;
+
+        uint32_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        const uint8_t *buffer = system.buffers.get() + buffer_id * system.buffer_size;
+        io_uring_recvmsg_out out;
+        memcpy(&out, buffer, sizeof(out));
+
+        size_t header_size = sizeof(io_uring_recvmsg_out) + system.receive_header.msg_namelen;
+        bool valid = cqe.res >= (int)header_size
+          && !(out.flags & MSG_TRUNC)
+          && out.namelen >= sizeof(sockaddr_in);
+
+        if (entry.batched_socket == nullptr || !valid) {
+          system.provide_buffer(buffer_id);
+          break;
+        }
+
+        sockaddr_in source;
+        memcpy(&source, buffer + sizeof(io_uring_recvmsg_out), sizeof(source));
+
+        ENetAddress address;
+        address.host = source.sin_addr.s_addr;
+        address.port = ENET_NET_TO_HOST_16(source.sin_port);
+
+        size_t length = std::min<size_t>(out.payloadlen, cqe.res - header_size);
+        entry.batched_socket->push_received(address, buffer + header_size, length, buffer_id);
+        entry.ready = true;
+        stats_.received++;
+        break;
+      }
+
+      case POLL: {
+        Entry &entry = *entries_[index];
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+          entry.armed = false;
+
+        entry.ready = entry.host != nullptr;
+        break;
+      }
+
+      case SEND:
+        if (cqe.res < 0)
+          stats_.send_errors++;
+        else
+          stats_.sent++;
+
+        system.free_send_slots.push_back(index);
+        break;
+
+      case TIMER:
+        stats_.timer_completions++;
+        system.timer_deadline = Clock::time_point::max();
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  __atomic_store_n(system.cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+void Reactor::release(uint32_t buffer_id)
+{
+  system_->provide_buffer(buffer_id);
+}
+
+
+bool Reactor::send(
+  ENetSocket socket,
+  const ENetAddress &address,
+  const ENetBuffer *buffers,
+  size_t buffer_count
+)
+{
+  System &system = *system_;
+
+  // All the slots are in flight: their completions are collected first
+  if (system.free_send_slots.empty()) {
+    system.queue_released_buffers();
+    system.submit(0);
+    stats_.system_calls++;
+    handle_completions();
+
+    if (system.free_send_slots.empty())
+      return false;
+  }
+
+  uint32_t index = system.free_send_slots.back();
+  System::SendSlot &slot = system.send_slots[index];
+  size_t length = 0;
+
+  for (size_t k = 0; k < buffer_count; k++) {
+    if (length + buffers[k].dataLength > ENET_PROTOCOL_MAXIMUM_MTU)
+      return false;
+
+    memcpy(slot.data + length, buffers[k].data, buffers[k].dataLength);
+    length += buffers[k].dataLength;
+  }
+
+  io_uring_sqe *sqe = system.get_sqe();
+
+  if (sqe == nullptr)
+    return false;
+
+  system.free_send_slots.pop_back();
+
+  memset(&slot.address, 0, sizeof(slot.address));
+  slot.address.sin_family = AF_INET;
+  slot.address.sin_addr.s_addr = address.host;
+  slot.address.sin_port = ENET_HOST_TO_NET_16(address.port);
+
+  slot.iov.iov_base = slot.data;
+  slot.iov.iov_len = length;
+
+  memset(&slot.header, 0, sizeof(slot.header));
+  slot.header.msg_name = &slot.address;
+  slot.header.msg_namelen = sizeof(slot.address);
+  slot.header.msg_iov = &slot.iov;
+  slot.header.msg_iovlen = 1;
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = socket;
+  sqe->addr = (uint64_t)&slot.header;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = make_user_data(SEND, index);
+
+  return true;
+}
+
+#else
+
+bool Reactor::init_io_uring()
+{
+  return false;
+}
+
+
+void Reactor::run_once_io_uring(Clock::time_point)
+{
+
+}
+
+
+bool Reactor::arm(size_t)
+{
+  return true;
+}
+
+
+bool Reactor::is_busy() const
+{
+  return false;
+}
+
+
+void Reactor::handle_completions()
+{
+
+}
+
+
+void Reactor::release(uint32_t)
+{
+
+}
+
+
+bool Reactor::send(ENetSocket, const ENetAddress &, const ENetBuffer *, size_t)
+{
+  return false;
+}
+
+#endif
+
+}  // namespace net
@@ -0,0 +1,199 @@
+/**
+ * @file
+ *
+ * \brief  Event loop servicing many hosts from a single thread (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Each host is serviced when datagrams are received on its socket, and at least
+ * once per service interval so that ENet can resend and ping:
+ *
+ *     net::Reactor reactor;
+ *     reactor.init();
+ *
+ *     for (auto &server: servers)
+ *       reactor.add(*server, std::chrono::milliseconds(10));
+ *
+ *     reactor.run();
+ *
+ * With io_uring (Linux 6.0 and later, no privilege needed), a multishot receive
+ * is armed on each batched socket (see BatchedSocket). The datagrams are received
+ * into a ring of buffers provided to the kernel, and handed over to ENet without
+ * any system call. The datagrams sent by all the hosts are queued as submission
+ * entries, and submitted together with the wait for the next completions. The
+ * wait itself ends on a timer completion at the next service deadline. A loop
+ * iteration thus takes a single system call whatever the number of hosts.
+ * Hosts using the stock socket layer are woken up by multishot polls instead.
+ *
+ * When io_uring is not available (older kernel, disabled by the administrator or
+ * library built without NET_HAS_IO_URING), the reactor waits on an epoll set
+ * with a timeout at the next service deadline.
+ *
+ * The hosts must be removed from the reactor before being destroyed.
+ */
+
+#ifndef NET__REACTOR_HPP
+#define NET__REACTOR_HPP
+
+#include "host.hpp"
+#include "batched_socket.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/// Services many hosts from a single thread
+class Reactor: public SocketDriver
+{
+  public:
+    /// Mechanism used to wait for the sockets
+    enum class Backend
+    {
+      NONE,      ///< Not initialised
+      IO_URING,  ///< io_uring with multishot receives and timer completions
+      EPOLL      ///< epoll, with the timeout of the wait as timer
+    };
+
+    /// Statistics about the event loop
+    struct Stats
+    {
+      uint64_t iterations = 0;         ///< Number of loop iterations
+      uint64_t system_calls = 0;       ///< Number of system calls made by the loop itself
+      uint64_t received = 0;           ///< Number of datagrams received into the provided buffers
+      uint64_t sent = 0;               ///< Number of datagrams sent through the submission queue
+      uint64_t send_errors = 0;        ///< Number of datagrams which could not be sent
+      uint64_t timer_completions = 0;  ///< Number of wake-ups by the timer
+      uint64_t services = 0;           ///< Number of times a host was serviced
+    };
+
+    /**
+     * \param buffer_count     Number of buffers provided to the kernel for receiving (io_uring)
+     * \param send_slot_count  Maximal number of datagrams being sent at once (io_uring)
+     */
+    Reactor(size_t buffer_count = 1024, size_t send_slot_count = 512);
+
+    /// Detaches the hosts and releases the kernel resources
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    /**
+     * \brief  Creates the kernel resources of the loop
+     *
+     * \param backend  Preferred backend, falls back to epoll if io_uring is not available
+     * \return  Whether the loop could be created
+     */
+    bool init(Backend backend = Backend::IO_URING);
+
+    /// Returns the backend in use
+    Backend get_backend() const;
+
+    /**
+     * \brief  Adds a host to service
+     *
+     * \param host      Host, already created
+     * \param service   Services the host, typically by calling enet_host_service with no timeout
+     * \param interval  Maximal duration between two services of the host
+     * \return  Whether the host could be added
+     */
+    bool add(
+      NetHost &host,
+      std::function<void()> service,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(10)
+    );
+
+    /// Adds a NetBase or BasicNetHost, serviced by its handle_events method
+    template <typename Host>
+    bool add(Host &host, std::chrono::milliseconds interval = std::chrono::milliseconds(10))
+    {
+      return add(host.get_net_host(), [&host]() { host.handle_events(); }, interval);
+    }
+
+    /// Stops servicing a host
+    void remove(NetHost &host);
+
+    /**
+     * \brief  Waits for received datagrams or service deadlines, and services the hosts
+     *
+     * \param max_wait  Maximal duration to wait
+     */
+    void run_once(std::chrono::milliseconds max_wait);
+
+    /// Runs the loop until stop is called
+    void run();
+
+    /// Makes run return, at the latest after the next service deadline
+    void stop();
+
+    /// Returns statistics about the event loop
+    const Stats& get_stats() const;
+
+    /// Gives a receive buffer back to the kernel (see SocketDriver)
+    void release(uint32_t buffer_id) override;
+
+    /// Queues a datagram to be submitted with the next wait (see SocketDriver)
+    bool send(ENetSocket socket, const ENetAddress &address, const ENetBuffer *buffers, size_t buffer_count) override;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    /// Host serviced by the reactor
+    struct Entry
+    {
+      NetHost *host;                   ///< Serviced host (nullptr once removed)
+      ENetSocket socket;               ///< Socket of the host
+      BatchedSocket *batched_socket;   ///< Batched socket fed by the reactor (nullptr if polled)
+      std::function<void()> service;   ///< Services the host
+      Clock::duration interval;        ///< Maximal duration between two services
+      Clock::time_point next_service;  ///< Deadline of the next service
+      bool ready;                      ///< Whether datagrams were received since the last service
+      bool armed;                      ///< Whether a multishot receive or poll is pending
+    };
+
+    /// Kernel resources of the loop
+    struct System;
+
+    Backend backend_;             ///< Backend in use
+    size_t buffer_count_;         ///< Number of receive buffers
+    size_t send_slot_count_;      ///< Number of send slots
+    std::vector<std::unique_ptr<Entry>> entries_;  ///< Hosts, indexed by the user data of their requests
+    std::unique_ptr<System> system_;  ///< Kernel resources of the loop
+    std::atomic<bool> running_;   ///< Whether run should keep looping
+    Stats stats_;                 ///< Statistics about the event loop
+
+    /// Returns the entry of a host (nullptr if not serviced)
+    Entry* find(const NetHost &host);
+
+    /// Services the hosts which are ready or whose deadline has passed
+    void service_hosts();
+
+    /// Returns the earliest service deadline
+    Clock::time_point get_next_deadline() const;
+
+    bool init_io_uring();
+    bool init_epoll();
+    void run_once_io_uring(Clock::time_point deadline);
+    void run_once_epoll(Clock::time_point deadline);
+
+    /// Arms the multishot receive (or poll) of a host
+    bool arm(size_t index);
+
+    /// Returns whether the kernel still uses buffers of the reactor
+    bool is_busy() const;
+
+    /// Handles the completions of the io_uring
+    void handle_completions();
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,324 @@
+/**
+ * @file
+ *
+ * \brief  Recording of network events to a binary log, and reading them back
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "recorder.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include <cstring>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace net
+{
+
+static const char LOG_MAGIC[8] = {'S', 'E', 'N', 'E', 'T', 'L', 'O', 'G'};
+static const uint32_t LOG_VERSION = 1;
+
+
+/// Rounds a size up to the alignment of the records
+static size_t align_record(size_t size)
+{
+  return (size + 7) & ~size_t(7);
+}
+
+
+// =============================================================================
+// EventRecorder
+//
+EventRecorder::EventRecorder():
+  fd_(-1),
+  map_(nullptr),
+  capacity_(0)
+{
+
+}
+
+
+EventRecorder::~EventRecorder()
+{
+  close();
+}
+
+
+bool EventRecorder::open(const std::string &path, size_t capacity)
+{
+  close();
+
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd_ < 0) {
+    perror("Could not create event log");
+    return false;
+  }
+
+  if (!reserve(std::max(capacity, sizeof(EventLogHeader)))) {
+    close();
+    return false;
+  }
+
+  EventLogHeader *header = reinterpret_cast<EventLogHeader*>(map_);
+  memcpy(header->magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+  header->version = LOG_VERSION;
+  header->reserved = 0;
+  header->start_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+  header->end = sizeof(EventLogHeader);
+
+  start_time_ = std::chrono::steady_clock::now();
+
+  return true;
+}
+
+
+void EventRecorder::close()
+{
+  if (map_ != nullptr) {
+    size_t end = reinterpret_cast<EventLogHeader*>(map_)->end;
+    munmap(map_, capacity_);
+    map_ = nullptr;
+
+    if (ftruncate(fd_, end) != 0)
+      perror("Could not truncate event log");
+  }
+
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+  capacity_ = 0;
+}
+
+
+bool EventRecorder::is_open() const
+{
+  return map_ != nullptr;
+}
+
+
+void EventRecorder::record(const ENetEvent &event)
+{
+  EventRecord record = {};
+  record.type = static_cast<uint8_t>(event.type);
+  record.channel_id = event.channelID;
+  record.data = event.data;
+
+  if (event.peer != nullptr) {
+    record.peer_id = event.peer->incomingPeerID;
+    record.peer_host = event.peer->address.host;
+    record.peer_port = event.peer->address.port;
+  }
+
+  const uint8_t *payload = nullptr;
+
+  if (event.type == ENET_EVENT_TYPE_RECEIVE && event.packet != nullptr) {
+    record.flags = event.packet->flags;
+    record.length = event.packet->dataLength;
+    payload = event.packet->data;
+  }
+
+  append(record, payload);
+}
+
+
+void EventRecorder::record_outbound(const ENetPeer *peer, int channel_id, const ENetPacket *packet)
+{
+  EventRecord record = {};
+  record.type = static_cast<uint8_t>(ENET_EVENT_TYPE_RECEIVE);
+  record.channel_id = channel_id;
+  record.flags = packet->flags | EventRecord::FLAG_OUTBOUND;
+  record.length = packet->dataLength;
+  record.peer_id = peer->incomingPeerID;
+  record.peer_host = peer->address.host;
+  record.peer_port = peer->address.port;
+
+  append(record, packet->data);
+}
+
+
+void EventRecorder::append(EventRecord &record, const uint8_t *payload)
+{
+  if (map_ == nullptr)
+    return;
+
+  record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start_time_
+  ).count();
+
+  size_t offset = reinterpret_cast<EventLogHeader*>(map_)->end;
+  size_t size = align_record(sizeof(EventRecord) + record.length);
+
+  if (!reserve(offset + size))
+    return;
+
+  memcpy(map_ + offset, &record, sizeof(EventRecord));
+
+  if (record.length > 0)
+    memcpy(map_ + offset + sizeof(EventRecord), payload, record.length);
+
+  // Only publish the record once it is complete
+  reinterpret_cast<EventLogHeader*>(map_)->end = offset + size;
+}
+
+
+bool EventRecorder::reserve(size_t size)
+{
+  if (size <= capacity_)
+    return true;
+
+  size_t new_capacity = std::max(size, 2 * capacity_);
+
+  if (ftruncate(fd_, new_capacity) != 0) {
+    perror("Could not grow event log");
+    return false;
+  }
+
+  void *new_map;
+
+  if (map_ == nullptr)
+    new_map = mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  else
+    new_map = mremap(map_, capacity_, new_capacity, MREMAP_MAYMOVE);
+
+  if (new_map == MAP_FAILED) {
+    perror("Could not map event log");
+    return false;
+  }
+
+  map_ = static_cast<uint8_t*>(new_map);
+  capacity_ = new_capacity;
+
+  return true;
+}
+
+
+// =============================================================================
+// EventLogReader
+//
+EventLogReader::EventLogReader():
+  fd_(-1),
+  map_(nullptr),
+  size_(0),
+  offset_(0)
+{
+
+}
+
+
+EventLogReader::~EventLogReader()
+{
+  close();
+}
+
+
+bool EventLogReader::open(const std::string &path)
+{
+  close();
+
+  fd_ = ::open(path.c_str(), O_RDONLY);
+
+  if (fd_ < 0) {
+    perror("Could not open event log");
+    return false;
+  }
+
+  struct stat file_stat;
+
+  if (fstat(fd_, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(EventLogHeader)) {
+    fprintf(stderr, "Invalid event log: %s\n", path.c_str());
+    close();
+    return false;
+  }
+
+  size_ = file_stat.st_size;
+  void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+
+  if (map == MAP_FAILED) {
+    perror("Could not map event log");
+    close();
+    return false;
+  }
+
+  map_ = static_cast<uint8_t*>(map);
+  const EventLogHeader &header = get_header();
+
+  if (memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0
+    || header.version != LOG_VERSION
+    || header.end > size_
+  ) {
+    fprintf(stderr, "Invalid event log: %s\n", path.c_str());
+    close();
+    return false;
+  }
+
+  rewind();
+
+  return true;
+}
+
+
+void EventLogReader::close()
+{
+  if (map_ != nullptr) {
+    munmap(map_, size_);
+    map_ = nullptr;
+  }
+
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+  size_ = 0;
+}
+
+
+bool EventLogReader::next(EventRecord &record, const uint8_t *&payload)
+{
+  if (map_ == nullptr)
+    return false;
+
+  size_t end = get_header().end;
+
+  if (offset_ + sizeof(EventRecord) > end)
+    return false;
+
+  memcpy(&record, map_ + offset_, sizeof(EventRecord));
+  size_t size = align_record(sizeof(EventRecord) + record.length);
+
+  if (offset_ + size > end)
+    return false;
+
+  payload = map_ + offset_ + sizeof(EventRecord);
+  offset_ += size;
+
+  return true;
+}
+
+
+void EventLogReader::rewind()
+{
+  offset_ = sizeof(EventLogHeader);
+}
+
+
+const EventLogHeader& EventLogReader::get_header() const
+{
+  return *reinterpret_cast<const EventLogHeader*>(map_);
+}
+
+
+}  // namespace net
@@ -0,0 +1,154 @@
+/**
+ * @file
+ *
+ * \brief  Recording of network events to a binary log, and reading them back
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__RECORDER_HPP
+#define NET__RECORDER_HPP
+
+#include "enet/enet.h"
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+
+namespace net
+{
+
+/**
+ * \brief  Header of an event log file
+ *
+ * Followed by a sequence of records (EventRecord + payload), each padded to 8 bytes.
+ */
+struct EventLogHeader
+{
+  char magic[8];        ///< Identifies the file format ("SENETLOG")
+  uint32_t version;     ///< Version of the file format
+  uint32_t reserved;    ///< Unused, kept for alignment
+  uint64_t start_time;  ///< Wall-clock time at which the recording started (in ns since epoch)
+  uint64_t end;         ///< Offset of the end of the last complete record
+};
+
+
+/// Header of a single recorded event, followed by `length` bytes of payload
+struct EventRecord
+{
+  /// Set in `flags` for packets sent by the host (as opposed to received)
+  static constexpr uint32_t FLAG_OUTBOUND = 1u << 31;
+
+  uint64_t timestamp;   ///< Time since the start of the recording (in ns)
+  uint32_t peer_id;     ///< Index of the peer in the host (ENetPeer::incomingPeerID)
+  uint32_t peer_host;   ///< IPv4 address of the peer (network byte order)
+  uint16_t peer_port;   ///< Port of the peer
+  uint8_t type;         ///< Type of the event (ENetEventType)
+  uint8_t channel_id;   ///< Channel on which the packet was received or sent
+  uint32_t flags;       ///< ENet packet flags, and FLAG_OUTBOUND
+  uint32_t data;        ///< Data associated with the event (ENetEvent::data)
+  uint32_t length;      ///< Length of the payload
+};
+
+static_assert(sizeof(EventLogHeader) == 32, "Unexpected padding in EventLogHeader");
+static_assert(sizeof(EventRecord) == 32, "Unexpected padding in EventRecord");
+
+
+/**
+ * \brief  Appends network events to an mmap-backed binary log
+ *
+ * The log is only ever appended to. The end offset stored in the header is updated
+ * after each complete record, so that a crash leaves a readable log behind.
+ */
+class EventRecorder
+{
+  public:
+    EventRecorder();
+    ~EventRecorder();
+
+    EventRecorder(const EventRecorder&) = delete;
+    EventRecorder& operator=(const EventRecorder&) = delete;
+
+    /**
+     * \brief  Creates the log file, overwriting any existing one
+     *
+     * \param path      Path of the log file
+     * \param capacity  Initial size of the mapping (in bytes), grown when needed
+     * \return  Whether the file could be created and mapped
+     */
+    bool open(const std::string &path, size_t capacity = 64 << 20);
+
+    /// Truncates the file to its actual content and unmaps it
+    void close();
+
+    /// Returns whether a log is currently open
+    bool is_open() const;
+
+    /// Appends an event received from the ENet host
+    void record(const ENetEvent &event);
+
+    /**
+     * \brief  Appends a packet sent by the host
+     *
+     * \param peer        Peer to which the packet is sent
+     * \param channel_id  ENet channel on which the packet is sent
+     * \param packet      Sent packet
+     */
+    void record_outbound(const ENetPeer *peer, int channel_id, const ENetPacket *packet);
+
+  private:
+    int fd_;             ///< File descriptor of the log
+    uint8_t *map_;       ///< Start of the mapping
+    size_t capacity_;    ///< Size of the mapping (in bytes)
+    std::chrono::steady_clock::time_point start_time_;  ///< When the recording started
+
+    /// Appends a record and its payload, growing the mapping if needed
+    void append(EventRecord &record, const uint8_t *payload);
+
+    /// Grows the file and the mapping so that they can hold at least `size` bytes
+    bool reserve(size_t size);
+};
+
+
+/// Reads back a log written by EventRecorder
+class EventLogReader
+{
+  public:
+    EventLogReader();
+    ~EventLogReader();
+
+    EventLogReader(const EventLogReader&) = delete;
+    EventLogReader& operator=(const EventLogReader&) = delete;
+
+    /// Maps a log file, returns whether it is a valid log
+    bool open(const std::string &path);
+
+    /// Unmaps the log
+    void close();
+
+    /**
+     * \brief  Reads the next record
+     *
+     * \param[out] record   Header of the record
+     * \param[out] payload  Pointer to the payload of the record, valid until the log is closed
+     * \return  Whether a record could be read, false at the end of the log
+     */
+    bool next(EventRecord &record, const uint8_t *&payload);
+
+    /// Goes back to the first record
+    void rewind();
+
+    /// Returns the header of the log
+    const EventLogHeader& get_header() const;
+
+  private:
+    int fd_;          ///< File descriptor of the log
+    uint8_t *map_;    ///< Start of the mapping
+    size_t size_;     ///< Size of the mapping (in bytes)
+    size_t offset_;   ///< Offset of the next record to read
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @file
+ *
+ * \brief  Recording policies of BasicNetHost, appending events to an EventRecorder
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__RECORDING_POLICY_HPP
+#define NET__RECORDING_POLICY_HPP
+
+#include "policy.hpp"
+#include "recorder.hpp"
+#include "enet/enet.h"
+
+
+namespace net
+{
+
+namespace policy
+{
+
+/// Events are never recorded
+struct NoRecording
+{
+  using kind = recording_kind;
+
+  void record(const ENetEvent &)
+  {
+
+  }
+
+  void record_outbound(const ENetPeer *, int, const ENetPacket *)
+  {
+
+  }
+};
+
+
+/// Events and sent packets can be appended to an EventRecorder
+class Recording
+{
+  public:
+    using kind = recording_kind;
+
+    Recording():
+      recorder_(nullptr)
+    {
+
+    }
+
+    /// Sets the recorder to use, or nullptr to stop recording
+    void set_recorder(EventRecorder *recorder)
+    {
+      recorder_ = recorder;
+    }
+
+    void record(const ENetEvent &event)
+    {
+      if (recorder_ != nullptr)
+        recorder_->record(event);
+    }
+
+    void record_outbound(const ENetPeer *peer, int channel_id, const ENetPacket *packet)
+    {
+      if (recorder_ != nullptr)
+        recorder_->record_outbound(peer, channel_id, packet);
+    }
+
+  private:
+    EventRecorder *recorder_;  ///< Optional recorder of all events (nullptr if not recording)
+};
+
+}  // namespace policy
+}  // namespace net
+
+#endif
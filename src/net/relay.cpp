@@ -0,0 +1,239 @@
+/**
+ * @file
+ *
+ * \brief  Relay re-broadcasting the messages of an upstream server to its own peers
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "relay.hpp"
+#include "server.hpp"
+#include "client.hpp"
+#include "packet.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <chrono>
+
+#include <cstdlib>
+#include <stdio.h>
+
+
+namespace net
+{
+
+// =============================================================================
+// Upstream
+//
+NetRelay::Upstream::Upstream(NetRelay &relay, const std::string &validation_salt):
+  NetClient(validation_salt),
+  hello_sent(false),
+  attached(false),
+  relay_(relay)
+{
+
+}
+
+
+void NetRelay::Upstream::receive_cb(ENetEvent &event)
+{
+  Packet::Type type;
+
+  if (!Packet::peek_type(event.packet->data, event.packet->dataLength, type))
+    return;
+
+  // Broadcast messages are forwarded without being decoded
+  if (type == Packet::Type::DATA || type == Packet::Type::SCHEMA) {
+    relay_.forward(event, type);
+    return;
+  }
+
+  if (type == Packet::Type::RELAY_ASSIGN) {
+    Packet packet;
+    packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
+    const std::string &parent = packet.get_data();
+    size_t separator = parent.find(' ');
+
+    if (parent.empty()) {
+      attached = true;
+    } else if (separator != std::string::npos) {
+      // Connecting from within the callback would reset the peer of the event
+      relay_.redirected_ = true;
+      relay_.parent_host_ = parent.substr(0, separator);
+      relay_.parent_port_ = atoi(parent.c_str() + separator + 1);
+    }
+
+    return;
+  }
+
+  NetClient::receive_cb(event);
+
+  // Announce the relay once validated
+  if (is_validated() && !hello_sent) {
+    send_packet(relay_.get_hello(), 0);
+    hello_sent = true;
+    relay_.next_report_ = std::chrono::steady_clock::now() + REPORT_INTERVAL;
+  }
+}
+
+
+// =============================================================================
+// NetRelay
+//
+NetRelay::NetRelay(
+  int port,
+  int validation_str_size,
+  const std::string &validation_salt,
+  size_t max_peer_count
+):
+  NetServer(port, validation_str_size, validation_salt, max_peer_count),
+  upstream_(*this, validation_salt),
+  port_(port),
+  origin_port_(0),
+  timeout_(5.0),
+  redirected_(false),
+  parent_port_(0)
+{
+
+}
+
+
+bool NetRelay::init()
+{
+  if (!NetServer::init())
+    return false;
+
+  upstream_.set_verbose(verbose_);
+
+  return upstream_.init();
+}
+
+
+bool NetRelay::connect(const std::string &host, int port, float timeout)
+{
+  origin_host_ = host;
+  origin_port_ = port;
+  timeout_ = timeout;
+
+  return connect_upstream(host, port);
+}
+
+
+void NetRelay::update()
+{
+  upstream_.handle_events();
+
+  if (redirected_) {
+    redirected_ = false;
+    stats_.redirections++;
+
+    if (verbose_)
+      printf("Relay redirected to %s:%d\n", parent_host_.c_str(), parent_port_);
+
+    connect_upstream(parent_host_, parent_port_);
+  } else if (!upstream_.is_validated() && !origin_host_.empty()
+    && std::chrono::steady_clock::now() >= connection_deadline_
+  ) {
+    // Parent lost or unreachable, be placed anew by the origin
+    stats_.reconnections++;
+    connect_upstream(origin_host_, origin_port_);
+  } else if (is_attached() && std::chrono::steady_clock::now() >= next_report_) {
+    // Relays may have joined or left the subtree
+    upstream_.send_packet(get_hello(), 0);
+    next_report_ = std::chrono::steady_clock::now() + REPORT_INTERVAL;
+  }
+
+  NetServer::update();
+}
+
+
+bool NetRelay::is_attached() const
+{
+  return upstream_.is_validated() && upstream_.attached;
+}
+
+
+NetClient& NetRelay::get_upstream()
+{
+  return upstream_;
+}
+
+
+const NetRelay::Stats& NetRelay::get_stats() const
+{
+  return stats_;
+}
+
+
+void NetRelay::message_cb(ENetPeer *, const Packet &)
+{
+
+}
+
+
+void NetRelay::forward(const ENetEvent &event, Packet::Type type)
+{
+  stats_.received++;
+
+  const enet_uint32 flags = event.packet->flags & (ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_UNSEQUENCED);
+  ENetPacket *packet;
+
+  if (type == Packet::Type::DATA) {
+    // The send time of the upstream server is replaced by the one of the relay
+    const size_t length = Clock::strip_timestamp(event.packet->data, event.packet->dataLength);
+    forward_buffer_.assign(reinterpret_cast<const char*>(event.packet->data), length);
+
+    if (!forward_buffer_.empty() && forward_buffer_.back() == '\0')
+      get_clock().stamp(forward_buffer_);
+
+    packet = create_packet(forward_buffer_.data(), forward_buffer_.size(), flags);
+  } else {
+    packet = create_packet(event.packet->data, event.packet->dataLength, flags);
+  }
+
+  if (packet == nullptr)
+    return;
+
+  // Keep the packet alive while it is queued for all the peers
+  packet->referenceCount++;
+
+  get_peers().for_each_connected([&](ENetPeer *peer) {
+    send_raw_packet(peer, packet, event.channelID);
+    stats_.forwarded++;
+    stats_.forwarded_bytes += packet->dataLength;
+  });
+
+  if (--packet->referenceCount == 0)
+    enet_packet_destroy(packet);
+}
+
+
+Packet NetRelay::get_hello()
+{
+  const size_t subtree_size = 1 + get_relay_tree().get_relay_count();
+
+  return Packet(Packet::Type::RELAY_HELLO, std::to_string(port_) + " " + std::to_string(subtree_size));
+}
+
+
+bool NetRelay::connect_upstream(const std::string &host, int port)
+{
+  // The upstream host only has one peer
+  ENetHost *host_handle = upstream_.get_host();
+
+  for (size_t k = 0; k < host_handle->peerCount; k++) {
+    if (host_handle->peers[k].state != ENET_PEER_STATE_DISCONNECTED)
+      enet_peer_disconnect_now(&host_handle->peers[k], 0);
+  }
+
+  upstream_.hello_sent = false;
+  upstream_.attached = false;
+  connection_deadline_ = std::chrono::steady_clock::now()
+    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<float>(timeout_)
+    );
+
+  return upstream_.connect(host, port, timeout_);
+}
+
+
+}  // namespace net
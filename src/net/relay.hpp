@@ -0,0 +1,147 @@
+/**
+ * @file
+ *
+ * \brief  Relay re-broadcasting the messages of an upstream server to its own peers
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * A relay is a NetServer for its downstream peers, and connects upstream as a
+ * validated client. Once validated, it announces the port of its own peers with
+ * a RELAY_HELLO. The upstream server either attaches it, or redirects it to one
+ * of its relays (see RelayTree), so that relays connecting to the origin are
+ * assembled into a tree. Once attached, the relay repeats its RELAY_HELLO every
+ * second with the size of its subtree, for its parent to place new relays:
+ *
+ *     net::NetRelay relay(1240, 128, salt, 256);
+ *     relay.init();
+ *     relay.connect("origin.example.com", 1234, 5.0);
+ *
+ *     while (running)
+ *       relay.handle_events();
+ *
+ * The data and schema messages received from upstream are forwarded as they are
+ * to all the validated downstream peers, without being decoded. A single copy of
+ * the message is sent to all of them. Only the send time of the data messages
+ * would be replaced by the one of the relay, if the clock policy of NetBase
+ * stamped them (see policy::ClockSync, which it does not use). When the upstream
+ * connection is lost, the relay connects to the origin again to be placed anew.
+ */
+
+#ifndef NET__RELAY_HPP
+#define NET__RELAY_HPP
+
+#include "server.hpp"
+#include "client.hpp"
+#include "packet.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+
+namespace net
+{
+
+/// Server re-broadcasting the messages received from an upstream server
+class NetRelay: public NetServer
+{
+  public:
+    /// Interval between the reports of the subtree size to the parent
+    static constexpr std::chrono::seconds REPORT_INTERVAL{1};
+
+    /// Statistics about the forwarded messages
+    struct Stats
+    {
+      uint64_t received = 0;        ///< Messages received from upstream
+      uint64_t forwarded = 0;       ///< Messages sent to downstream peers (one per peer)
+      uint64_t forwarded_bytes = 0; ///< Bytes of the messages sent to downstream peers
+      uint64_t redirections = 0;    ///< Number of times the relay was redirected deeper in the tree
+      uint64_t reconnections = 0;   ///< Number of times the relay connected to the origin again
+    };
+
+    /**
+     * \param port                 Port used by the downstream peers to connect to the relay
+     * \param validation_str_size  Length of the validation string to generate
+     * \param validation_salt      Used to scramble the validation string, common to the whole tree
+     * \param max_peer_count       Maximal number of downstream peers connected at the same time
+     */
+    NetRelay(
+      int port,
+      int validation_str_size,
+      const std::string &validation_salt,
+      size_t max_peer_count = 32
+    );
+
+    /// Initialises networking, the downstream and the upstream hosts, returns whether it was successful
+    bool init() override;
+
+    /**
+     * \brief  Connects to the origin, which places the relay in the tree
+     *
+     * \param host     Hostname or IP address of the origin
+     * \param port     Port of the origin
+     * \param timeout  Duration before timing out a connection attempt (in s)
+     * \return  Whether the connection could be initiated
+     */
+    bool connect(const std::string &host, int port, float timeout);
+
+    /// Handles the events of the upstream connection, and the lifecycle of the downstream peers
+    void update() override;
+
+    /// Returns whether the relay is validated by its parent and attached to it
+    bool is_attached() const;
+
+    /// Returns the client connected to the parent of the relay
+    NetClient& get_upstream();
+
+    /// Returns statistics about the forwarded messages
+    const Stats& get_stats() const;
+
+  protected:
+    /// Called when a message has been received from a downstream peer, ignored by default
+    void message_cb(ENetPeer *peer, const Packet &packet) override;
+
+  private:
+    /// Client connected to the parent of the relay
+    class Upstream: public NetClient
+    {
+      public:
+        Upstream(NetRelay &relay, const std::string &validation_salt);
+
+        bool hello_sent;  ///< Whether the relay has announced itself to its parent
+        bool attached;    ///< Whether the parent attached the relay
+
+      protected:
+        /// Forwards the data and schema messages, and handles the placement of the relay
+        void receive_cb(ENetEvent &event) override;
+
+      private:
+        NetRelay &relay_;  ///< Relay owning the client
+    };
+
+    Upstream upstream_;          ///< Client connected to the parent
+    const int port_;             ///< Port used by the downstream peers
+    std::string origin_host_;    ///< Hostname or IP address of the origin
+    int origin_port_;            ///< Port of the origin
+    float timeout_;              ///< Duration before timing out a connection attempt (in s)
+    std::chrono::steady_clock::time_point connection_deadline_;  ///< When the pending connection times out
+    bool redirected_;            ///< Whether the parent redirected the relay
+    std::string parent_host_;    ///< IP address of the parent to connect to
+    int parent_port_;            ///< Port of the parent to connect to
+    std::chrono::steady_clock::time_point next_report_;  ///< When to report the subtree size to the parent
+    Stats stats_;                ///< Statistics about the forwarded messages
+    std::string forward_buffer_; ///< Data of the last message forwarded, reused to avoid allocating
+
+    /// Sends a message received from upstream to all the validated downstream peers
+    void forward(const ENetEvent &event, Packet::Type type);
+
+    /// Returns the RELAY_HELLO announcing the relay and the size of its subtree
+    Packet get_hello();
+
+    /// Connects to a new parent, dropping the current connection
+    bool connect_upstream(const std::string &host, int port);
+};
+
+}  // namespace net
+
+#endif
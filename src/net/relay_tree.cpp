@@ -0,0 +1,101 @@
+/**
+ * @file
+ *
+ * \brief  Placement of the relays connecting to a server into a tree
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "relay_tree.hpp"
+#include "enet/enet.h"
+#include <vector>
+#include <algorithm>
+
+
+namespace net
+{
+
+RelayTree::RelayTree(size_t fanout):
+  fanout_(fanout)
+{
+
+}
+
+
+void RelayTree::set_fanout(size_t fanout)
+{
+  fanout_ = fanout;
+}
+
+
+const RelayTree::Child* RelayTree::place(ENetPeer *peer, uint16_t port, size_t subtree_size)
+{
+  remove(peer);
+  subtree_size = std::max<size_t>(subtree_size, 1);
+
+  if (children_.size() < std::max<size_t>(fanout_, 1)) {
+    Child child;
+    child.peer = peer;
+    child.address.host = peer->address.host;
+    child.address.port = port;
+    child.subtree_size = subtree_size;
+    children_.push_back(child);
+
+    return nullptr;
+  }
+
+  auto smallest = std::min_element(
+    children_.begin(),
+    children_.end(),
+    [](const Child &a, const Child &b) { return a.subtree_size < b.subtree_size; }
+  );
+  smallest->subtree_size += subtree_size;
+
+  return &*smallest;
+}
+
+
+bool RelayTree::update(const ENetPeer *peer, size_t subtree_size)
+{
+  for (Child &child: children_) {
+    if (child.peer == peer) {
+      child.subtree_size = std::max<size_t>(subtree_size, 1);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+void RelayTree::remove(const ENetPeer *peer)
+{
+  children_.erase(
+    std::remove_if(
+      children_.begin(),
+      children_.end(),
+      [peer](const Child &child) { return child.peer == peer; }
+    ),
+    children_.end()
+  );
+}
+
+
+const std::vector<RelayTree::Child>& RelayTree::get_children() const
+{
+  return children_;
+}
+
+
+size_t RelayTree::get_relay_count() const
+{
+  size_t count = 0;
+
+  for (const Child &child: children_)
+    count += child.subtree_size;
+
+  return count;
+}
+
+
+}  // namespace net
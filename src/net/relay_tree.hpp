@@ -0,0 +1,80 @@
+/**
+ * @file
+ *
+ * \brief  Placement of the relays connecting to a server into a tree
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__RELAY_TREE_HPP
+#define NET__RELAY_TREE_HPP
+
+#include "enet/enet.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/**
+ * \brief  Relays directly attached to a server, and placement of the new ones
+ *
+ * A server keeps up to `fanout` relays as direct children. Further relays are
+ * redirected to the child with the smallest subtree, which applies the same rule
+ * with its own children. The origin thus assembles the relays into a balanced
+ * tree, each node only knowing its direct children. The subtree size of a child
+ * is counted up when a relay is redirected to it, and replaced by the size the
+ * child reports periodically, so that relays leaving deeper in the tree are
+ * eventually accounted for.
+ */
+class RelayTree
+{
+  public:
+    /// Relay directly attached to the server
+    struct Child
+    {
+      ENetPeer *peer;        ///< Connection to the relay
+      ENetAddress address;   ///< Address on which the relay accepts its own peers
+      size_t subtree_size;   ///< Number of relays placed in its subtree, itself included
+    };
+
+    /**
+     * \param fanout  Maximal number of relays directly attached to the server (at least 1)
+     */
+    RelayTree(size_t fanout = 8);
+
+    /// Sets the maximal number of relays directly attached to the server
+    void set_fanout(size_t fanout);
+
+    /**
+     * \brief  Places a new relay
+     *
+     * \param peer          Connection to the relay
+     * \param port          Port on which the relay accepts its own peers
+     * \param subtree_size  Number of relays in the subtree of the relay, itself included
+     * \return  Child to which the relay should connect instead, or nullptr if it is attached to the server
+     */
+    const Child* place(ENetPeer *peer, uint16_t port, size_t subtree_size = 1);
+
+    /// Sets the subtree size reported by a relay, returns whether it is a direct child
+    bool update(const ENetPeer *peer, size_t subtree_size);
+
+    /// Forgets a relay, once disconnected
+    void remove(const ENetPeer *peer);
+
+    /// Returns the relays directly attached to the server
+    const std::vector<Child>& get_children() const;
+
+    /// Returns the number of relays placed by the server, in its whole subtree
+    size_t get_relay_count() const;
+
+  private:
+    size_t fanout_;                ///< Maximal number of direct children
+    std::vector<Child> children_;  ///< Relays directly attached to the server
+};
+
+}  // namespace net
+
+#endif
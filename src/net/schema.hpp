@@ -0,0 +1,431 @@
+/**
+ * @file
+ *
+ * \brief  Schema-defined messages readable in place, without decoding
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * A message type is declared as a list of required and optional fields:
+ *
+ *     using PlayerState = net::schema::Message<1,
+ *       net::schema::Required<uint32_t>,       // 0: id
+ *       net::schema::Required<float>,          // 1: x
+ *       net::schema::Required<float>,          // 2: y
+ *       net::schema::Optional<uint8_t>,        // 3: health
+ *       net::schema::Optional<net::schema::String>  // 4: name
+ *     >;
+ *
+ * Its layout is computed at compile time. Required fields have fixed offsets,
+ * optional fields are found through a table of offsets (0 when absent). Strings
+ * are stored as an offset and a length pointing to the end of the message.
+ *
+ * Wire format (little endian):
+ *
+ *     | tag | Packet::Type::SCHEMA | message id (u16) | optional offsets (u16 each) | required fields | optional values and strings |
+ */
+
+#ifndef NET__SCHEMA_HPP
+#define NET__SCHEMA_HPP
+
+#include "packet.hpp"
+#include "buffer_pool.hpp"
+#include "enet/enet.h"
+#include <array>
+#include <tuple>
+#include <string_view>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+namespace schema
+{
+
+/// First byte of all schema messages, never written by the portable binary archive
+constexpr uint8_t TAG = 0xA5;
+
+/// Size of the header common to all schema messages
+constexpr size_t HEADER_SIZE = 4;
+
+
+/// Field type for strings, read as std::string_view
+struct String {};
+
+
+/// Field always present in the message, at a fixed offset
+template <typename T>
+struct Required
+{
+  using type = T;
+  static constexpr bool optional = false;
+};
+
+
+/// Field which may be absent from the message, found through the table of offsets
+template <typename T>
+struct Optional
+{
+  using type = T;
+  static constexpr bool optional = true;
+};
+
+
+/// Size of a field value on the wire
+template <typename T>
+constexpr size_t wire_size()
+{
+  if constexpr (std::is_same_v<T, String>) {
+    return 2 * sizeof(uint16_t);  // offset and length
+  } else {
+    static_assert(
+      std::is_arithmetic_v<T> || std::is_enum_v<T>,
+      "Schema fields must be arithmetic types, enums or strings"
+    );
+    return sizeof(T);
+  }
+}
+
+
+/// Type under which a field is read
+template <typename T>
+using value_type = std::conditional_t<std::is_same_v<T, String>, std::string_view, T>;
+
+
+/// Reads a little endian value
+template <typename T>
+inline T load(const uint8_t *data)
+{
+  if constexpr (std::is_same_v<T, bool>) {
+    return data[0] != 0;
+  } else {
+    using Bits = std::conditional_t<sizeof(T) == 1, uint8_t,
+      std::conditional_t<sizeof(T) == 2, uint16_t,
+      std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+    static_assert(sizeof(Bits) == sizeof(T), "Unsupported field size");
+
+    Bits bits = 0;
+
+    for (size_t k = 0; k < sizeof(T); k++)
+      bits |= static_cast<Bits>(data[k]) << (8 * k);
+
+    T value;
+    memcpy(&value, &bits, sizeof(T));
+
+    return value;
+  }
+}
+
+
+/// Writes a little endian value
+template <typename T>
+inline void store(uint8_t *data, T value)
+{
+  if constexpr (std::is_same_v<T, bool>) {
+    data[0] = value ? 1 : 0;
+  } else {
+    using Bits = std::conditional_t<sizeof(T) == 1, uint8_t,
+      std::conditional_t<sizeof(T) == 2, uint16_t,
+      std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+    static_assert(sizeof(Bits) == sizeof(T), "Unsupported field size");
+
+    Bits bits;
+    memcpy(&bits, &value, sizeof(T));
+
+    for (size_t k = 0; k < sizeof(T); k++)
+      data[k] = static_cast<uint8_t>(bits >> (8 * k));
+  }
+}
+
+
+/**
+ * \brief  Declaration of a message type
+ *
+ * \tparam Id      Identifier of the message type, sent on the wire
+ * \tparam Fields  Required<T> or Optional<T> for each field
+ */
+template <uint16_t Id, typename... Fields>
+struct Message
+{
+  static constexpr uint16_t id = Id;
+  static constexpr size_t field_count = sizeof...(Fields);
+
+  /// Declaration of the I-th field
+  template <size_t I>
+  using field = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+  static constexpr std::array<bool, field_count> optionals = {Fields::optional...};
+  static constexpr std::array<size_t, field_count> sizes = {wire_size<typename Fields::type>()...};
+
+  static constexpr size_t optional_count = (size_t(0) + ... + size_t(Fields::optional));
+  static constexpr size_t table_offset = HEADER_SIZE;
+  static constexpr size_t fixed_offset = table_offset + 2 * optional_count;
+
+  /**
+   * \brief  Offset of the I-th field
+   *
+   * For required fields, offset of the value. For optional fields, offset of the
+   * entry of the table of offsets.
+   */
+  static constexpr size_t offset(size_t i)
+  {
+    size_t table_entry = table_offset;
+    size_t fixed = fixed_offset;
+
+    for (size_t k = 0; k < i; k++) {
+      if (optionals[k])
+        table_entry += 2;
+      else
+        fixed += sizes[k];
+    }
+
+    return optionals[i] ? table_entry : fixed;
+  }
+
+  /// Size of the fixed part of the message (header, table of offsets and required fields)
+  static constexpr size_t fixed_size()
+  {
+    size_t size = fixed_offset;
+
+    for (size_t k = 0; k < field_count; k++) {
+      if (!optionals[k])
+        size += sizes[k];
+    }
+
+    return size;
+  }
+};
+
+
+/// Received message of any schema type, not decoded
+struct RawMessage
+{
+  const uint8_t *data;  ///< Start of the message
+  size_t length;        ///< Length of the message
+
+  /// Returns whether the data holds a schema message
+  bool valid() const
+  {
+    return length >= HEADER_SIZE && data[0] == TAG
+      && data[1] == static_cast<uint8_t>(Packet::Type::SCHEMA);
+  }
+
+  /// Returns the identifier of the message type (0 if not valid)
+  uint16_t id() const
+  {
+    return valid() ? load<uint16_t>(data + 2) : 0;
+  }
+};
+
+
+/**
+ * \brief  Typed accessor reading the fields of a message in place
+ *
+ * All reads are bounds-checked: fields lying outside the message read as
+ * default values.
+ */
+template <typename M>
+class View
+{
+  public:
+    View(const uint8_t *data, size_t length):
+      data_(data),
+      length_(length)
+    {
+
+    }
+
+    View(const RawMessage &message):
+      View(message.data, message.length)
+    {
+
+    }
+
+    /// Returns whether the data holds a message of this type, with all required fields
+    bool valid() const
+    {
+      RawMessage message = {data_, length_};
+      return message.id() == M::id && length_ >= M::fixed_size();
+    }
+
+    /// Returns whether the I-th field is present
+    template <size_t I>
+    bool has() const
+    {
+      return value_offset<I>() != 0;
+    }
+
+    /// Returns the value of the I-th field, or a default value if it is absent
+    template <size_t I>
+    value_type<typename M::template field<I>::type> get() const
+    {
+      using T = typename M::template field<I>::type;
+      size_t offset = value_offset<I>();
+
+      if (offset == 0)
+        return {};
+
+      if constexpr (std::is_same_v<T, String>) {
+        size_t string_offset = load<uint16_t>(data_ + offset);
+        size_t string_length = load<uint16_t>(data_ + offset + 2);
+
+        if (string_offset + string_length > length_)
+          return {};
+
+        return std::string_view(
+          reinterpret_cast<const char*>(data_ + string_offset),
+          string_length
+        );
+      } else {
+        return load<T>(data_ + offset);
+      }
+    }
+
+  private:
+    const uint8_t *data_;  ///< Start of the message
+    size_t length_;        ///< Length of the message
+
+    /// Returns the offset of the value of the I-th field, 0 if absent or out of bounds
+    template <size_t I>
+    size_t value_offset() const
+    {
+      constexpr size_t offset = M::offset(I);
+      constexpr size_t size = M::sizes[I];
+      size_t value = offset;
+
+      if constexpr (M::optionals[I]) {
+        if (offset + 2 > length_)
+          return 0;
+
+        value = load<uint16_t>(data_ + offset);
+
+        if (value == 0)
+          return 0;
+      }
+
+      return value + size <= length_ ? value : 0;
+    }
+};
+
+
+/**
+ * \brief  Writes a message directly into a buffer of a pool
+ *
+ * Each field should be set at most once. Required fields which are not set are
+ * sent as zero.
+ */
+template <typename M>
+class Builder
+{
+  public:
+    Builder(BufferPool &pool):
+      pool_(pool),
+      buffer_(pool.acquire()),
+      size_(M::fixed_size()),
+      overflow_(M::fixed_size() > pool.get_buffer_size())
+    {
+      if (!overflow_) {
+        memset(buffer_, 0, M::fixed_size());
+        buffer_[0] = TAG;
+        buffer_[1] = static_cast<uint8_t>(Packet::Type::SCHEMA);
+        store<uint16_t>(buffer_ + 2, M::id);
+      }
+    }
+
+    ~Builder()
+    {
+      if (buffer_ != nullptr)
+        pool_.release(buffer_);
+    }
+
+    Builder(const Builder&) = delete;
+    Builder& operator=(const Builder&) = delete;
+
+    /// Sets the value of the I-th field
+    template <size_t I>
+    Builder& set(value_type<typename M::template field<I>::type> value)
+    {
+      using T = typename M::template field<I>::type;
+
+      if (overflow_)
+        return *this;
+
+      size_t offset = M::offset(I);
+
+      // Optional values are appended, and referenced from the table of offsets
+      if constexpr (M::optionals[I]) {
+        size_t value_offset = append(M::sizes[I]);
+
+        if (overflow_)
+          return *this;
+
+        store<uint16_t>(buffer_ + offset, value_offset);
+        offset = value_offset;
+      }
+
+      if constexpr (std::is_same_v<T, String>) {
+        size_t string_offset = append(value.size());
+
+        if (overflow_)
+          return *this;
+
+        memcpy(buffer_ + string_offset, value.data(), value.size());
+        store<uint16_t>(buffer_ + offset, string_offset);
+        store<uint16_t>(buffer_ + offset + 2, value.size());
+      } else {
+        store<T>(buffer_ + offset, value);
+      }
+
+      return *this;
+    }
+
+    /// Returns whether the message did not fit in the buffer
+    bool overflowed() const
+    {
+      return overflow_;
+    }
+
+    /**
+     * \brief  Creates an ENet packet owning the buffer of the message
+     *
+     * \param flags  ENet packet flags
+     * \return  The packet, or nullptr if the message did not fit in the buffer
+     */
+    ENetPacket* finish(enet_uint32 flags = ENET_PACKET_FLAG_RELIABLE)
+    {
+      if (overflow_ || buffer_ == nullptr)
+        return nullptr;
+
+      uint8_t *buffer = buffer_;
+      buffer_ = nullptr;
+
+      return pool_.create_packet(buffer, size_, flags);
+    }
+
+  private:
+    BufferPool &pool_;  ///< Pool owning the buffer
+    uint8_t *buffer_;   ///< Buffer in which the message is written
+    size_t size_;       ///< Current size of the message
+    bool overflow_;     ///< Whether the message did not fit in the buffer
+
+    /// Reserves space at the end of the message, returns its offset (0 on overflow)
+    size_t append(size_t size)
+    {
+      if (size_ + size > pool_.get_buffer_size() || size_ + size > UINT16_MAX) {
+        overflow_ = true;
+        return 0;
+      }
+
+      size_t offset = size_;
+      size_ += size;
+
+      return offset;
+    }
+};
+
+}  // namespace schema
+}  // namespace net
+
+#endif
@@ -7,90 +7,195 @@
  */
 
 #include "server.hpp"
+#include "validation_policy.hpp"
+#include "bitpacked_archive.hpp"
 #include "enet/enet.h"
-#include <random>
+#include "cereal/types/string.hpp"
+#include "cereal/types/vector.hpp"
 #include <string>
 #include <memory>
+#include <vector>
 #include <chrono>
-#include <thread>
+#include <sstream>
+#include <algorithm>
 
 #include <stdio.h>
+#include <cstdlib>
 #include <cstring>
 
 
 namespace net
 {
 
+namespace
+{
+
+/// Version of the snapshot handed over to a successor
+constexpr uint32_t HANDOVER_VERSION = 2;
+
+
+/// State of a peer handed over to a successor
+struct HandedOverPeer
+{
+  PeerSnapshot protocol;       ///< Protocol state of the ENet peer
+  uint8_t status = 0;          ///< ServerPeers::Status of the peer
+  uint32_t received = 0;       ///< Number of packets received from the peer
+  std::string validation_str;  ///< String used for peer validation
+  uint64_t connected_for = 0;  ///< Time since the peer connected (in ms)
+  uint16_t relay_port = 0;     ///< Port on which the peer accepts its own peers, if it is a relay (0 otherwise)
+  uint64_t subtree_size = 0;   ///< Number of relays in the subtree of the peer, if it is a relay
+
+  template <class Archive>
+  void serialize(Archive &ar)
+  {
+    ar(protocol, status, received, validation_str, connected_for, relay_port, subtree_size);
+  }
+};
+
+
+/// Returns the time of the steady clock, common to all the processes of the machine (in µs)
+int64_t steady_time()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+}  // namespace
+
+
 // =============================================================================
 // ServerPeers
 //
-void ServerPeers::add_peer(ENetPeer *peer, ServerPeers::Peer::Status new_status)
+ServerPeers::ServerPeers(size_t capacity):
+  contexts_(capacity)
 {
-  if (get_peer(peer) == nullptr) {
-    Peer new_peer = {
-      .peer = peer,
-      .status = new_status,
-      .validation_str = ""
-    };
 
-    peers_.push_back(new_peer);
-  }
 }
 
 
-ServerPeers::Peer* ServerPeers::get_peer(ENetPeer *peer)
+void ServerPeers::add_peer(ENetPeer *peer, ServerPeers::Status new_status)
 {
-  for (Peer& handled_peer: peers_) {
-    if (handled_peer.peer == peer)
-      return &handled_peer;
-  }
+  if (!contexts_.contains(peer))
+    return;
 
-  return nullptr;
+  // A connection always starts a new session, even in a slot already used by the peer
+  contexts_.reset(peer);
+  contexts_.hot<STATUS>(peer) = new_status;
+  contexts_.hot<PEER>(peer) = peer;
+  contexts_.cold(peer).connection_time = std::chrono::steady_clock::now();
 }
 
 
-std::vector<ENetPeer*> ServerPeers::get_connected_peers() const
+void ServerPeers::restore_peer(
+  ENetPeer *peer,
+  ServerPeers::Status status,
+  uint32_t received_count,
+  const ServerPeers::Context &context
+)
 {
-  std::vector<ENetPeer*> peers;
-  peers.reserve(peers_.size());
+  if (!contexts_.contains(peer))
+    return;
 
-  for (auto &peer: peers_) {
-    if (peer.status == Peer::Status::CONNECTED)
-      peers.emplace_back(peer.peer);
-  }
+  contexts_.reset(peer);
+  contexts_.hot<STATUS>(peer) = status;
+  contexts_.hot<RECEIVED>(peer) = received_count;
+  contexts_.hot<PEER>(peer) = peer;
+  contexts_.cold(peer) = context;
+}
 
-  return peers;
+
+ServerPeers::Status ServerPeers::get_status(const ENetPeer *peer) const
+{
+  if (!contexts_.contains(peer) || contexts_.hot<PEER>(peer) != peer)
+    return Status::NONE;
+
+  return contexts_.hot<STATUS>(peer);
 }
 
 
-void ServerPeers::remove_peer(ENetPeer *peer)
+void ServerPeers::set_status(const ENetPeer *peer, ServerPeers::Status status)
 {
-  for (unsigned int k = 0; k < peers_.size(); k++) {
-    if (peers_[k].peer == peer) {
-      peers_.erase(peers_.begin() + k);
-      break;
-    }
+  if (contexts_.contains(peer) && contexts_.hot<PEER>(peer) == peer)
+    contexts_.hot<STATUS>(peer) = status;
+}
+
+
+uint32_t ServerPeers::count_received(const ENetPeer *peer)
+{
+  if (!contexts_.contains(peer) || contexts_.hot<PEER>(peer) != peer)
+    return 0;
+
+  return ++contexts_.hot<RECEIVED>(peer);
+}
+
+
+uint32_t ServerPeers::get_received(const ENetPeer *peer) const
+{
+  if (!contexts_.contains(peer) || contexts_.hot<PEER>(peer) != peer)
+    return 0;
+
+  return contexts_.hot<RECEIVED>(peer);
+}
+
+
+ServerPeers::Context* ServerPeers::get_context(const ENetPeer *peer)
+{
+  if (!contexts_.contains(peer) || contexts_.hot<PEER>(peer) != peer)
+    return nullptr;
+
+  return &contexts_.cold(peer);
+}
+
+
+std::vector<ENetPeer*> ServerPeers::get_connected_peers() const
+{
+  std::vector<ENetPeer*> connected_peers;
+  get_connected_peers(connected_peers);
+
+  return connected_peers;
+}
+
+
+void ServerPeers::get_connected_peers(std::vector<ENetPeer*> &connected_peers) const
+{
+  const Status *statuses = contexts_.hot_column<STATUS>();
+  ENetPeer *const *peers = contexts_.hot_column<PEER>();
+  connected_peers.clear();
+
+  for (size_t k = 0; k < contexts_.get_capacity(); k++) {
+    if (statuses[k] == Status::CONNECTED)
+      connected_peers.emplace_back(peers[k]);
   }
 }
 
 
-std::string ServerPeers::generate_validation_str(ENetPeer *peer, int length)
+size_t ServerPeers::count_connected() const
 {
-  static auto& chrs = "0123456789"
-        "abcdefghijklmnopqrstuvwxyz"
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  const Status *statuses = contexts_.hot_column<STATUS>();
+  size_t count = 0;
 
-  thread_local static std::mt19937 rg{std::random_device{}()};
-  thread_local static std::uniform_int_distribution<int> pick(0, sizeof(chrs) - 2);
+  for (size_t k = 0; k < contexts_.get_capacity(); k++)
+    count += statuses[k] == Status::CONNECTED;
+
+  return count;
+}
 
-  std::string validation_str;
-  validation_str.reserve(length);
 
-  while (length--)
-    validation_str += chrs[pick(rg)];
+void ServerPeers::remove_peer(ENetPeer *peer)
+{
+  if (contexts_.contains(peer) && contexts_.hot<PEER>(peer) == peer)
+    contexts_.reset(peer);
+}
+
+
+std::string ServerPeers::generate_validation_str(ENetPeer *peer, int length)
+{
+  std::string validation_str = net::generate_validation_str(length);
+  Context *context = get_context(peer);
 
-  Peer* handled_peer = get_peer(peer);
-  handled_peer->validation_str = validation_str;
+  if (context != nullptr)
+    context->validation_str = validation_str;
 
   return validation_str;
 }
@@ -99,12 +204,28 @@ std::string ServerPeers::generate_validation_str(ENetPeer *peer, int length)
 // =============================================================================
 // NetServer
 //
-NetServer::NetServer(int port, int validation_str_size, const std::string &validation_salt):
+NetServer::NetServer(
+  int port,
+  int validation_str_size,
+  const std::string &validation_salt,
+  size_t max_peer_count
+):
   NetBase(validation_salt),
+  peers_(max_peer_count),
+  drain_timeout_(500),
+  draining_(false),
+  predecessor_stop_time_(0),
+  handed_over_(false),
   port_(port),
-  validation_str_size_(validation_str_size)
+  validation_str_size_(validation_str_size),
+  max_peer_count_(max_peer_count)
 {
+  // Leave room for the validation answer and the protocol overhead
+  IngressFilter::Config config;
+  config.max_unvalidated_size = std::max<size_t>(config.max_unvalidated_size, 256 + validation_str_size);
+  ingress_filter_.set_config(config);
 
+  host_.add_interceptor(&ingress_filter_);
 }
 
 
@@ -118,11 +239,12 @@ bool NetServer::init()
   address.port = port_;
 
   bool success = host_.create(
-    &address,  // the address to bind the server host to
-    32,        // allow up to 32 clients and/or outgoing connections
+    &address,         // the address to bind the server host to
+    max_peer_count_,  // allow up to max_peer_count_ clients and/or outgoing connections
     2,         // allow up to 2 channels to be used, 0 and 1
     0,         // assume any amount of incoming bandwidth
-    0          // assume any amount of outgoing bandwidth
+    0,         // assume any amount of outgoing bandwidth
+    socket_options_
   );
 
   if (!success) {
@@ -134,70 +256,227 @@ bool NetServer::init()
 }
 
 
+bool NetServer::take_over(const std::string &name, std::chrono::milliseconds timeout)
+{
+  if (!NetBase::init())
+    return false;
+
+  std::string snapshot;
+
+  if (!handover_.receive(name, timeout, snapshot)) {
+    printf("Could not take over from the previous server.\n");
+    return false;
+  }
+
+  // Unbound, the socket of the predecessor replacing its own
+  bool success = host_.create(
+    nullptr,
+    max_peer_count_,
+    2,
+    0,
+    0,
+    socket_options_
+  );
+
+  if (!success || !handover_.adopt(get_host())) {
+    printf("An error occurred while trying to create an ENet server host.\n");
+    return false;
+  }
+
+  handover_stats_ = Handover::Stats();
+  handover_stats_.snapshot_size = snapshot.size();
+
+  if (!restore_peers(snapshot)) {
+    printf("Could not read the peers of the previous server.\n");
+    return false;
+  }
+
+  if (verbose_) {
+    printf(
+      "Took over from the previous server: %zu peers, %zu dropped.\n",
+      handover_stats_.peers_handed_over,
+      handover_stats_.peers_dropped
+    );
+  }
+
+  return true;
+}
+
+
+bool NetServer::listen_for_successor(const std::string &name, std::chrono::milliseconds drain_timeout)
+{
+  drain_timeout_ = drain_timeout;
+
+  return handover_.listen(name);
+}
+
+
+bool NetServer::is_handed_over() const
+{
+  return handed_over_;
+}
+
+
+const Handover::Stats& NetServer::get_handover_stats() const
+{
+  return handover_stats_;
+}
+
+
+void NetServer::update()
+{
+  if (get_host() == nullptr || handed_over_)
+    return;
+
+  lifecycle_.update(get_host());
+
+  // First service since taking over
+  if (predecessor_stop_time_ != 0) {
+    handover_stats_.gap = std::max<int64_t>(steady_time() - predecessor_stop_time_, 0);
+    predecessor_stop_time_ = 0;
+  }
+
+  if (!draining_ && handover_.accept()) {
+    draining_ = true;
+    drain_start_ = std::chrono::steady_clock::now();
+  }
+
+  // Serves the peers until nothing is in flight, so that the snapshot is complete
+  if (draining_
+    && (are_peers_drained() || std::chrono::steady_clock::now() - drain_start_ >= drain_timeout_)
+  ) {
+    hand_over();
+  }
+}
+
+
 void NetServer::send_packet_to_all(const Packet &packet, int channel_id)
 {
-  std::vector<ENetPeer*> connected_peers = peers_.get_connected_peers();
+  peers_.for_each_connected([&](ENetPeer *peer) {
+    send_packet(peer, packet, channel_id);
+  });
+}
 
-  for (ENetPeer *peer: connected_peers)
-    send_packet(peer,  packet, channel_id);
+
+ServerPeers& NetServer::get_peers()
+{
+  return peers_;
+}
+
+
+IngressFilter& NetServer::get_ingress_filter()
+{
+  return ingress_filter_;
+}
+
+
+RelayTree& NetServer::get_relay_tree()
+{
+  return relay_tree_;
+}
+
+
+PeerLifecycle& NetServer::get_peer_lifecycle()
+{
+  return lifecycle_;
 }
 
 
 void NetServer::connect_cb(ENetEvent &event)
 {
-  printf(
-    "Client attempting to connect %x:%u.\n",
-    event.peer->address.host,
-    (unsigned int)event.peer->address.port
-  );
+  if (verbose_) {
+    printf(
+      "Client attempting to connect %x:%u.\n",
+      event.peer->address.host,
+      (unsigned int)event.peer->address.port
+    );
+  }
 
   // Validate the client
-  peers_.add_peer(event.peer, ServerPeers::Peer::Status::VALIDATING);
+  peers_.add_peer(event.peer, ServerPeers::Status::VALIDATING);
+  ingress_filter_.reset_peer(event.peer);
+  lifecycle_.connect(event.peer);
 
   std::string validation_str = peers_.generate_validation_str(
     event.peer, validation_str_size_
   );
   Packet packet(Packet::Type::VALIDATION_STR, validation_str);
   send_packet(event.peer, packet, 0);
-
-  // TODO: store any relevant client information here.
-  event.peer->data = (char*)"Client information";
 }
 
 
 void NetServer::disconnect_cb(ENetEvent &event)
 {
-  printf("%s disconnected.\n", (char*)event.peer->data);
+  ingress_filter_.reset_peer(event.peer);
+  relay_tree_.remove(event.peer);
+  peers_.remove_peer(event.peer);
+  lifecycle_.disconnect(event.peer);
+
+  if (verbose_) {
+    printf(
+      "Client %x:%u disconnected.\n",
+      event.peer->address.host,
+      (unsigned int)event.peer->address.port
+    );
+  }
 }
 
 
 void NetServer::receive_cb(ENetEvent &event)
 {
-  Packet packet;
+  // Schema messages are handed over without being decoded
+  Packet::Type type;
+
+  if (Packet::peek_type(event.packet->data, event.packet->dataLength, type)
+    && type == Packet::Type::SCHEMA
+  ) {
+    if (peers_.get_status(event.peer) != ServerPeers::Status::CONNECTED) {
+      printf("Received message from unauthorised peer! Disconnecting\n");
+      enet_peer_disconnect(event.peer, 0/*TODO*/);
+      return;
+    }
+
+    lifecycle_.mark_active(event.peer);
+    schema_cb(event.peer, schema::RawMessage{event.packet->data, event.packet->dataLength});
+    return;
+  }
+
+  Packet &packet = received_packet_;
   packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
 
-  printf(
-    "New packet (length=%u, source=%s, channel=%u): %s\n",
-    (unsigned int)event.packet->dataLength,
-    (char*)event.peer->data,
-    (unsigned int)event.channelID,
-    (char*)packet.get_data().c_str()
-  );
+  if (verbose_) {
+    printf(
+      "New packet (length=%u, source=%x:%u, channel=%u): %s\n",
+      (unsigned int)event.packet->dataLength,
+      event.peer->address.host,
+      (unsigned int)event.peer->address.port,
+      (unsigned int)event.channelID,
+      (char*)packet.get_data().c_str()
+    );
+  }
 
-  ServerPeers::Peer* peer = peers_.get_peer(event.peer);
+  ServerPeers::Status status = peers_.get_status(event.peer);
 
-  if (peer == nullptr) {
+  if (status == ServerPeers::Status::NONE) {
     printf("ERROR: received message from unknown peer\n");
     return;
   }
 
+  peers_.count_received(event.peer);
+
   // Handle validation answer from newly connected peers
   if (packet.get_type() == Packet::Type::VALIDATIION_ANSWER) {
-    std::string expected_answer = solve_validation_puzzle(peer->validation_str);
+    std::string expected_answer = solve_validation_puzzle(
+      peers_.get_context(event.peer)->validation_str
+    );
 
     if (packet.get_data() == expected_answer) {
-      peer->status = ServerPeers::Peer::Status::CONNECTED;
-      printf("Peer validated!\n");
+      peers_.set_status(event.peer, ServerPeers::Status::CONNECTED);
+      ingress_filter_.set_validated(event.peer, true);
+      lifecycle_.validate(event.peer);
+
+      if (verbose_)
+        printf("Peer validated!\n");
 
       send_packet_to_all(
         Packet(Packet::Type::DATA, "A new peer has successfully connected"),
@@ -212,14 +491,35 @@ void NetServer::receive_cb(ENetEvent &event)
   }
 
   // Disconnect unauthorised peers
-  if (peer->status != ServerPeers::Peer::Status::CONNECTED) {
+  if (status != ServerPeers::Status::CONNECTED) {
     printf("Received message from unauthorised peer! Disconnecting\n");
     enet_peer_disconnect(event.peer, 0/*TODO*/);
+
+    return;
+  }
+
+  lifecycle_.mark_active(event.peer);
+
+  // Place relays in the tree
+  if (packet.get_type() == Packet::Type::RELAY_HELLO) {
+    place_relay(event.peer, packet);
+    return;
   }
 
   // Handle messages from authorised peers
-  // TODO
-  send_packet(event.peer, Packet(Packet::Type::DATA, "I received your packet"), 0);
+  message_cb(event.peer, packet);
+}
+
+
+void NetServer::message_cb(ENetPeer *peer, const Packet &)
+{
+  send_packet(peer, Packet(Packet::Type::DATA, "I received your packet"), 0);
+}
+
+
+void NetServer::schema_cb(ENetPeer *, const schema::RawMessage &)
+{
+
 }
 
 
@@ -229,26 +529,246 @@ void NetServer::no_event_cb()
 }
 
 
-}  // namespace enet
+void NetServer::place_relay(ENetPeer *peer, const Packet &hello)
+{
+  // Port of the relay, followed by the size of its subtree
+  const std::string &data = hello.get_data();
+  int port = atoi(data.c_str());
+  size_t separator = data.find(' ');
+  size_t subtree_size = separator != std::string::npos ? strtoul(data.c_str() + separator + 1, nullptr, 10) : 1;
+
+  if (port <= 0 || port > 65535) {
+    printf("Received invalid relay announcement, ignoring it\n");
+    return;
+  }
 
+  if (relay_tree_.update(peer, subtree_size))
+    return;
 
+  const RelayTree::Child *parent = relay_tree_.place(peer, port, subtree_size);
 
-// =============================================================================
-// Main
-//
-int main()
+  if (parent == nullptr) {
+    if (verbose_)
+      printf("Relay %x:%d attached\n", peer->address.host, port);
+
+    send_packet(peer, Packet(Packet::Type::RELAY_ASSIGN, ""), 0);
+    return;
+  }
+
+  char host[64];
+
+  if (enet_address_get_host_ip(&parent->address, host, sizeof(host)) != 0)
+    return;
+
+  if (verbose_)
+    printf("Relay %x:%d redirected to %s:%u\n", peer->address.host, port, host, (unsigned int)parent->address.port);
+
+  send_packet(
+    peer,
+    Packet(Packet::Type::RELAY_ASSIGN, std::string(host) + " " + std::to_string(parent->address.port)),
+    0
+  );
+}
+
+
+void NetServer::hand_over()
+{
+  ENetHost *host = get_host();
+  draining_ = false;
+
+  handover_stats_ = Handover::Stats();
+  handover_stats_.drain_time = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - drain_start_
+  ).count();
+
+  std::vector<ENetPeer*> handed_over;
+  std::vector<ENetPeer*> dropped;
+  std::string snapshot = save_peers(handed_over, dropped);
+  handover_stats_.snapshot_size = snapshot.size();
+
+  if (!handover_.send(host->socket, snapshot, std::chrono::seconds(1))) {
+    printf("Could not hand the server over, still serving the peers.\n");
+    return;
+  }
+
+  // The peers which could not be handed over connect again, to the successor
+  for (ENetPeer *peer: dropped) {
+    forget_peer(peer);
+    enet_peer_disconnect_now(peer, 0);
+  }
+
+  // The successor alone reads the datagrams of the port from now on
+  if (!Handover::detach(host))
+    printf("Could not detach the server from its socket.\n");
+
+  for (ENetPeer *peer: handed_over) {
+    forget_peer(peer);
+    enet_peer_reset(peer);
+  }
+
+  handover_stats_.peers_handed_over = handed_over.size();
+  handover_stats_.peers_dropped = dropped.size();
+  handed_over_ = true;
+
+  if (verbose_) {
+    printf(
+      "Handed over to the next server: %zu peers, %zu dropped.\n",
+      handed_over.size(),
+      dropped.size()
+    );
+  }
+}
+
+
+bool NetServer::are_peers_drained()
+{
+  ENetHost *host = get_host();
+
+  for (size_t k = 0; k < host->peerCount; k++) {
+    ENetPeer *peer = &host->peers[k];
+
+    if (peer->state == ENET_PEER_STATE_CONNECTED && peers_.get_status(peer) != ServerPeers::Status::NONE
+      && !Handover::is_drained(peer)
+    ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void NetServer::forget_peer(ENetPeer *peer)
+{
+  transport_.reset(peer);
+  validation_.disconnect(peer);
+  clock_.disconnect(peer);
+  mtu_.disconnect(peer);
+  ingress_filter_.reset_peer(peer);
+  relay_tree_.remove(peer);
+  peers_.remove_peer(peer);
+  lifecycle_.disconnect(peer);
+  peer->data = nullptr;
+}
+
+
+std::string NetServer::save_peers(std::vector<ENetPeer*> &handed_over, std::vector<ENetPeer*> &dropped)
+{
+  ENetHost *host = get_host();
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<HandedOverPeer> records;
+
+  for (size_t k = 0; k < host->peerCount; k++) {
+    ENetPeer *peer = &host->peers[k];
+
+    if (peer->state == ENET_PEER_STATE_DISCONNECTED)
+      continue;
+
+    // Connecting peers have no state worth keeping
+    ServerPeers::Status status = peers_.get_status(peer);
+    const ServerPeers::Context *context = peers_.get_context(peer);
+
+    if (status == ServerPeers::Status::NONE || context == nullptr || !Handover::is_drained(peer)) {
+      dropped.push_back(peer);
+      continue;
+    }
+
+    HandedOverPeer &record = records.emplace_back();
+    Handover::save_peer(peer, record.protocol);
+    record.status = static_cast<uint8_t>(status);
+    record.received = peers_.get_received(peer);
+    record.validation_str = context->validation_str;
+    record.connected_for = std::chrono::duration_cast<std::chrono::milliseconds>(
+      now - context->connection_time
+    ).count();
+
+    for (const RelayTree::Child &child: relay_tree_.get_children()) {
+      if (child.peer == peer) {
+        record.relay_port = child.address.port;
+        record.subtree_size = child.subtree_size;
+      }
+    }
+
+    handed_over.push_back(peer);
+  }
+
+  std::ostringstream stream;
+
+  {
+    BitPackedOutputArchive archive(stream);
+    uint32_t version = HANDOVER_VERSION;
+    int64_t stop_time = steady_time();
+    archive(version, stop_time, records);
+  }
+
+  return stream.str();
+}
+
+
+bool NetServer::restore_peers(const std::string &snapshot)
 {
-  const int port = 1234;
-  const int validation_str_size = 128;
-  const std::string validation_salt = "Blektr!";
+  uint32_t version = 0;
+  int64_t stop_time = 0;
+  std::vector<HandedOverPeer> records;
+
+  try {
+    std::istringstream stream(snapshot);
+    BitPackedInputArchive archive(stream);
+    archive(version);
+
+    if (version == HANDOVER_VERSION)
+      archive(stop_time, records);
+  } catch (const cereal::Exception &) {
+    return false;
+  }
+
+  if (version != HANDOVER_VERSION)
+    return false;
 
-  net::NetServer server(port, validation_str_size, validation_salt);
-  server.init();
+  const auto now = std::chrono::steady_clock::now();
 
-  while (true) {
-    server.handle_events();
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  for (const HandedOverPeer &record: records) {
+    const auto status = static_cast<ServerPeers::Status>(record.status);
+    ENetPeer *peer = nullptr;
+
+    if (status == ServerPeers::Status::VALIDATING || status == ServerPeers::Status::CONNECTED)
+      peer = Handover::restore_peer(get_host(), record.protocol);
+
+    // Left to time out on its side, and to connect again
+    if (peer == nullptr) {
+      handover_stats_.peers_dropped++;
+      continue;
+    }
+
+    transport_.reset(peer);
+    clock_.reset(peer);
+    mtu_.reset(*this, peer);
+    peer->mtu = record.protocol.mtu;  // kept rather than probed again from the initial MTU
+
+    ServerPeers::Context context;
+    context.validation_str = record.validation_str;
+    context.connection_time = now - std::chrono::milliseconds(record.connected_for);
+    peers_.restore_peer(peer, status, record.received, context);
+
+    const bool validated = status == ServerPeers::Status::CONNECTED;
+    ingress_filter_.reset_peer(peer);
+    ingress_filter_.set_validated(peer, validated);
+    lifecycle_.connect(peer);
+
+    if (validated)
+      lifecycle_.validate(peer);
+
+    if (record.relay_port != 0)
+      relay_tree_.place(peer, record.relay_port, std::max<size_t>(record.subtree_size, 1));
+
+    handover_stats_.peers_handed_over++;
   }
 
-  return 0;
+  predecessor_stop_time_ = stop_time;
+
+  return true;
 }
+
+
+}  // namespace enet
+
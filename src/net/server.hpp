@@ -10,54 +10,103 @@
 #define NET__SERVER_HPP
 
 #include "base.hpp"
+#include "ingress_filter.hpp"
+#include "schema.hpp"
+#include "peer_contexts.hpp"
+#include "relay_tree.hpp"
+#include "peer_lifecycle.hpp"
+#include "handover.hpp"
 #include "enet/enet.h"
 #include <vector>
 #include <string>
+#include <chrono>
+#include <cstdint>
 
 
 namespace net
 {
 
-/// List of all peers handled by the server
+/// State of all peers handled by the server
 class ServerPeers
 {
   public:
-    /// Internally handles a peer connection
-    struct Peer
+    /// Status of the connection to a peer
+    enum class Status: uint8_t
+    {
+      NONE,        ///< The slot is not used by any peer
+      VALIDATING,  ///< Waiting to be approved
+      CONNECTED    ///< The peer has successfully connected
+    };
+
+    /// Information about a peer which is not needed for every packet
+    struct Context
     {
-      /// Status of the connection to the peer
-      enum class Status
-      {
-        VALIDATING,  ///< Waiting to be approved
-        CONNECTED    ///< The peer has successfully connected
-      };
-
-      ENetPeer *peer;  ///< Signature of the client
-      Status status;   ///< Status of the connection
       std::string validation_str;  ///< String used for peer validation
+      std::chrono::steady_clock::time_point connection_time;  ///< When the peer connected
     };
 
+    /// \param capacity  Maximal number of peers, the peer count of the host
+    ServerPeers(size_t capacity);
+
     /// Adds a peer to the list of handled peers and sets its status
-    void add_peer(ENetPeer *peer, Peer::Status new_status);
+    void add_peer(ENetPeer *peer, Status new_status);
+
+    /// Adds a peer handed over by another process, with its status and context there
+    void restore_peer(ENetPeer *peer, Status status, uint32_t received_count, const Context &context);
+
+    /// Returns the status of a peer (NONE if not handled)
+    Status get_status(const ENetPeer *peer) const;
+
+    /// Sets the status of a handled peer
+    void set_status(const ENetPeer *peer, Status status);
 
-    /// Returns a reference to the handled peer (nullptr if not found)
-    Peer* get_peer(ENetPeer *peer);
+    /// Counts a packet received from a handled peer, returns the number of packets received so far
+    uint32_t count_received(const ENetPeer *peer);
+
+    /// Returns the number of packets received from a handled peer
+    uint32_t get_received(const ENetPeer *peer) const;
+
+    /// Returns the context of a handled peer (nullptr if not found)
+    Context* get_context(const ENetPeer *peer);
 
     /// Returns a reference to all connected peers
     std::vector<ENetPeer*> get_connected_peers() const;
 
+    /// Replaces the content of a vector by all connected peers, reusing its memory
+    void get_connected_peers(std::vector<ENetPeer*> &connected_peers) const;
+
+    /// Returns the number of connected peers
+    size_t count_connected() const;
+
+    /// Calls a function for each connected peer
+    template <typename Function>
+    void for_each_connected(Function function)
+    {
+      const Status *statuses = contexts_.hot_column<STATUS>();
+      ENetPeer *const *peers = contexts_.hot_column<PEER>();
+
+      for (size_t k = 0; k < contexts_.get_capacity(); k++) {
+        if (statuses[k] == Status::CONNECTED)
+          function(peers[k]);
+      }
+    }
+
     /// Removes a peer from the list of handled peers
     void remove_peer(ENetPeer *peer);
 
-    /**
-     * \brief  Generates a random string used for validation of the peer
-     *
-     * Based on https://stackoverflow.com/a/24586587
-     */
+    /// Generates a random string used for validation of the peer
     std::string generate_validation_str(ENetPeer *peer, int size);
 
   private:
-    std::vector<Peer> peers_;  ///< Reference to all peers currently handled
+    /// Indices of the hot fields
+    enum HotField
+    {
+      STATUS,    ///< Status of the connection
+      RECEIVED,  ///< Number of packets received
+      PEER       ///< ENet peer occupying the slot
+    };
+
+    PeerContexts<Context, Status, uint32_t, ENetPeer*> contexts_;  ///< State of each peer slot
 };
 
 
@@ -69,12 +118,65 @@ class NetServer: public NetBase
      * \param port                 Port used by the clients to connect to the server
      * \param validation_str_size  Length of the validation string to generate
      * \param validation_salt      Used to scramble the validation string, should be common to all peers
+     * \param max_peer_count       Maximal number of peers connected at the same time
      */
-    NetServer(int port, int validation_str_size, const std::string &validation_salt);
+    NetServer(
+      int port,
+      int validation_str_size,
+      const std::string &validation_salt,
+      size_t max_peer_count = 32
+    );
 
     /// Initialises networking and the connection, returns whether it was successful
     bool init() override;
 
+    /**
+     * \brief  Initialises networking and carries on the connections of a predecessor, instead of init
+     *
+     * Receives the socket and the peers of a server which called
+     * listen_for_successor with the same name (see Handover). The peers keep
+     * their connection, without a new handshake, and validated peers stay
+     * validated. The server must be constructed with the same maximal number
+     * of peers as its predecessor.
+     *
+     * \param name     Name given to listen_for_successor by the predecessor
+     * \param timeout  Maximal duration to wait for the predecessor
+     * \return  Whether the server took over
+     */
+    bool take_over(const std::string &name, std::chrono::milliseconds timeout);
+
+    /**
+     * \brief  Hands the server over to the next process calling take_over with the same name
+     *
+     * Once a successor connects, the peers keep being served as usual until
+     * they are drained (see Handover::is_drained) or until drain_timeout, the
+     * call to update noticing it passes the socket and the peers to the
+     * successor, and the server stops serving them:
+     * the process can then exit (see is_handed_over). Peers which are not
+     * drained in time, or not yet connected, are disconnected and have to
+     * connect again.
+     *
+     * Not supported for hosts serviced by a Reactor using io_uring, whose
+     * pending receives would keep reading from the socket.
+     *
+     * \param name           Name unique on the machine, shared with the successor
+     * \param drain_timeout  Maximal duration to wait for the peers to be drained
+     * \return  Whether the name could be bound
+     */
+    bool listen_for_successor(
+      const std::string &name,
+      std::chrono::milliseconds drain_timeout = std::chrono::milliseconds(500)
+    );
+
+    /// Returns whether the server has been handed over, and does not serve any peer anymore
+    bool is_handed_over() const;
+
+    /// Returns the duration of the last hand-over, and what it carried
+    const Handover::Stats& get_handover_stats() const;
+
+    /// Applies the lifecycle policies of the peers (see PeerLifecycle), and hands over
+    void update() override;
+
     /**
      * \brief  Sends a packet to all connected peers
      *
@@ -83,10 +185,55 @@ class NetServer: public NetBase
      */
     void send_packet_to_all(const Packet &packet, int channel_id);
 
+    /// Returns a reference to all peers currently handled
+    ServerPeers& get_peers();
+
+    /// Returns a reference to the filter applied to all received datagrams
+    IngressFilter& get_ingress_filter();
+
+    /// Returns the relays attached to the server, and the placement of new ones (see NetRelay)
+    RelayTree& get_relay_tree();
+
+    /// Returns the timeouts and slot reclamation policies of the peers
+    PeerLifecycle& get_peer_lifecycle();
+
+  protected:
+    /**
+     * \brief  Called when a packet has been received from a validated peer
+     *
+     * By default, acknowledges the packet to the peer.
+     *
+     * \param peer    Peer who sent the packet
+     * \param packet  Received message
+     */
+    virtual void message_cb(ENetPeer *peer, const Packet &packet);
+
+    /**
+     * \brief  Called when a schema message has been received from a validated peer
+     *
+     * The message is not decoded, and is only valid during the call.
+     *
+     * \param peer     Peer who sent the message
+     * \param message  Received message, to be read through a schema::View
+     */
+    virtual void schema_cb(ENetPeer *peer, const schema::RawMessage &message);
+
   private:
     ServerPeers peers_;  ///< Reference to all peers currently handled
+    IngressFilter ingress_filter_;  ///< Filter applied to all received datagrams
+    RelayTree relay_tree_;          ///< Relays attached to the server
+    PeerLifecycle lifecycle_;       ///< Timeouts and slot reclamation of the peers
+    Handover handover_;             ///< Hand-over to a successor, or from a predecessor
+    Handover::Stats handover_stats_;  ///< Duration of the last hand-over, and what it carried
+    std::chrono::milliseconds drain_timeout_;  ///< Maximal duration to drain the peers before handing over
+    std::chrono::steady_clock::time_point drain_start_;  ///< When the successor connected
+    bool draining_;                  ///< Whether the peers are drained before handing over
+    int64_t predecessor_stop_time_;  ///< When the predecessor stopped serving (in µs of steady clock, 0 once serviced)
+    bool handed_over_;               ///< Whether the server has been handed over
     const int port_;     ///< Port used by the clients to connect to the server
     const int validation_str_size_;      ///< Length of the validation string to generate
+    const size_t max_peer_count_;        ///< Maximal number of peers connected at the same time
+    Packet received_packet_;             ///< Last packet received, reused to avoid allocating
 
     /// Called when a connection has been established
     void connect_cb(ENetEvent &event) override;
@@ -99,6 +246,24 @@ class NetServer: public NetBase
 
     /// Called when no event has occured within the time limit
     void no_event_cb() override;
+
+    /// Attaches a relay or redirects it deeper in the tree, or updates the subtree size of an attached one
+    void place_relay(ENetPeer *peer, const Packet &hello);
+
+    /// Hands the drained peers over to the connected successor
+    void hand_over();
+
+    /// Returns whether all the peers which can be handed over are drained
+    bool are_peers_drained();
+
+    /// Forgets a peer which is not served anymore, without any event
+    void forget_peer(ENetPeer *peer);
+
+    /// Serialises the state of the drained peers, and lists the others
+    std::string save_peers(std::vector<ENetPeer*> &handed_over, std::vector<ENetPeer*> &dropped);
+
+    /// Carries on the connections of a snapshot, returns whether it could be read
+    bool restore_peers(const std::string &snapshot);
 };
 
 }  // namespace net
@@ -0,0 +1,712 @@
+/**
+ * @file
+ *
+ * \brief  Shared-memory channel between two processes of the same machine (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Layout of the shared memory:
+ *   - Header (one cache line)
+ *   - RingControl of ring 0, then of ring 1
+ *   - data of ring 0, then of ring 1
+ *
+ * Ring 0 is written by the creator, ring 1 by the other side. The head and tail
+ * of a ring are byte counters which only increase, and each message is a record
+ * made of a RecordHeader followed by the data padded to 8 bytes. When a record
+ * does not fit before the end of the ring, a WRAP record fills the rest.
+ */
+
+#include "shm_channel.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <new>
+
+#include <cstring>
+#include <cstdlib>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stddef.h>
+#endif
+
+
+namespace net
+{
+
+namespace
+{
+
+/// Identifies the shared memory of a channel
+constexpr uint64_t MAGIC = 0x73696d706c65736dULL;
+
+/// Size of a cache line
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/// Smallest size of a ring
+constexpr size_t MIN_RING_SIZE = 4096;
+
+/// Kind of a record
+enum RecordKind: uint8_t
+{
+  DATA_RECORD,  ///< Message
+  WRAP_RECORD   ///< Padding up to the end of the ring
+};
+
+/// Header of each record
+struct RecordHeader
+{
+  uint32_t length;     ///< Length of the message
+  uint16_t flags;      ///< ENet flags of the message
+  uint8_t channel_id;  ///< ENet channel of the message
+  uint8_t kind;        ///< See RecordKind
+};
+
+static_assert(sizeof(RecordHeader) == 8, "Records must stay aligned on 8 bytes");
+
+
+/// Returns the size of the record of a message
+size_t get_record_size(size_t length)
+{
+  return sizeof(RecordHeader) + ((length + 7) & ~size_t(7));
+}
+
+
+/// Returns a random 64-bit value
+uint64_t generate_random()
+{
+  std::random_device device;
+  return (uint64_t(device()) << 32) | device();
+}
+
+}  // namespace
+
+
+struct SharedMemoryChannel::Header
+{
+  alignas(CACHE_LINE_SIZE) uint64_t magic;  ///< Always MAGIC
+  uint64_t nonce;      ///< Random value sent with the offer
+  uint64_t ring_size;  ///< Size of each ring (in bytes)
+};
+
+
+struct SharedMemoryChannel::RingControl
+{
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;  ///< Written by the reader
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;  ///< Written by the writer
+  alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> reader_waiting;  ///< Whether the writer should signal the eventfd
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The rings need lock-free atomics");
+
+
+#ifdef __linux__
+
+namespace
+{
+
+/// Offset of the RingControl of each ring
+constexpr size_t CONTROL_OFFSET = CACHE_LINE_SIZE;
+
+/// Seals of the shared memory, so that no side can resize it under the mapping of the other
+constexpr int MEMORY_SEALS = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+}  // namespace
+
+
+SharedMemoryChannel::SharedMemoryChannel():
+  state_(State::FAILED),
+  creator_(false),
+  nonce_(0),
+  socket_(-1),
+  connection_(-1),
+  memory_fd_(-1),
+  event_fds_{-1, -1},
+  memory_(nullptr),
+  memory_size_(0),
+  outgoing_{},
+  incoming_{}
+{
+
+}
+
+
+SharedMemoryChannel::~SharedMemoryChannel()
+{
+  if (memory_ != nullptr)
+    munmap(memory_, memory_size_);
+
+  for (int fd: {socket_, connection_, memory_fd_, event_fds_[0], event_fds_[1]}) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+
+bool SharedMemoryChannel::is_local(const ENetAddress &address)
+{
+  if ((ntohl(address.host) >> 24) == 127)
+    return true;
+
+  // Only the addresses of this machine can be bound
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+    return false;
+
+  sockaddr_in socket_address = {};
+  socket_address.sin_family = AF_INET;
+  socket_address.sin_addr.s_addr = address.host;
+  bool local = bind(fd, (sockaddr*)&socket_address, sizeof(socket_address)) == 0;
+  close(fd);
+
+  return local;
+}
+
+
+std::unique_ptr<SharedMemoryChannel> SharedMemoryChannel::create(size_t ring_size)
+{
+  size_t size = MIN_RING_SIZE;
+
+  while (size < ring_size)
+    size *= 2;
+
+  std::unique_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel());
+  channel->creator_ = true;
+  channel->nonce_ = generate_random();
+
+  // Shared memory
+  const size_t memory_size = CONTROL_OFFSET + 2 * sizeof(RingControl) + 2 * size;
+  channel->memory_fd_ = memfd_create("simple_enet", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  if (channel->memory_fd_ < 0 || ftruncate(channel->memory_fd_, memory_size) != 0
+    || fcntl(channel->memory_fd_, F_ADD_SEALS, MEMORY_SEALS) != 0
+  ) {
+    fprintf(stderr, "[SharedMemoryChannel] Could not create the shared memory: %s\n", strerror(errno));
+    return nullptr;
+  }
+
+  if (!channel->map(memory_size))
+    return nullptr;
+
+  Header *header = new (channel->memory_) Header();
+  header->magic = MAGIC;
+  header->nonce = channel->nonce_;
+  header->ring_size = size;
+
+  for (int k = 0; k < 2; k++)
+    new (channel->memory_ + CONTROL_OFFSET + k * sizeof(RingControl)) RingControl();
+
+  // Signalling of each ring
+  for (int k = 0; k < 2; k++) {
+    channel->event_fds_[k] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (channel->event_fds_[k] < 0) {
+      fprintf(stderr, "[SharedMemoryChannel] Could not create an eventfd: %s\n", strerror(errno));
+      return nullptr;
+    }
+  }
+
+  channel->outgoing_.event_fd = channel->event_fds_[0];
+  channel->incoming_.event_fd = channel->event_fds_[1];
+
+  // Socket through which the file descriptors are passed, in the abstract namespace
+  char name[64];
+  snprintf(name, sizeof(name), "simple_enet.%d.%016llx", (int)getpid(), (unsigned long long)generate_random());
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path + 1, name, strlen(name));
+  socklen_t address_length = offsetof(sockaddr_un, sun_path) + 1 + strlen(name);
+
+  channel->socket_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (channel->socket_ < 0
+    || bind(channel->socket_, (sockaddr*)&address, address_length) != 0
+    || listen(channel->socket_, 1) != 0
+  ) {
+    fprintf(stderr, "[SharedMemoryChannel] Could not create the socket: %s\n", strerror(errno));
+    return nullptr;
+  }
+
+  char nonce[17];
+  snprintf(nonce, sizeof(nonce), "%016llx", (unsigned long long)channel->nonce_);
+  channel->offer_ = std::string(name) + " " + nonce;
+  channel->state_ = State::NEGOTIATING;
+
+  return channel;
+}
+
+
+std::unique_ptr<SharedMemoryChannel> SharedMemoryChannel::attach(const std::string &offer)
+{
+  size_t separator = offer.find(' ');
+
+  if (separator == std::string::npos || separator + 1 > sizeof(sockaddr_un::sun_path) - 1)
+    return nullptr;
+
+  std::string name = offer.substr(0, separator);
+  std::unique_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel());
+  channel->nonce_ = strtoull(offer.c_str() + separator + 1, nullptr, 16);
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path + 1, name.data(), name.size());
+  socklen_t address_length = offsetof(sockaddr_un, sun_path) + 1 + name.size();
+
+  // Fails if the creator is not on this machine (or not in this network namespace)
+  channel->socket_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (channel->socket_ < 0
+    || connect(channel->socket_, (sockaddr*)&address, address_length) != 0
+  ) {
+    return nullptr;
+  }
+
+  // The creator only passes the file descriptors to the holder of the nonce
+  if (send(channel->socket_, &channel->nonce_, sizeof(channel->nonce_), MSG_NOSIGNAL) != sizeof(channel->nonce_))
+    return nullptr;
+
+  channel->state_ = State::NEGOTIATING;
+
+  return channel;
+}
+
+
+SharedMemoryChannel::State SharedMemoryChannel::update()
+{
+  if (state_ != State::NEGOTIATING)
+    return state_;
+
+  if (creator_) {
+    if (connection_ < 0) {
+      connection_ = accept4(socket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (connection_ < 0)
+        return state_;
+    }
+
+    uint64_t nonce;
+    ssize_t length = recv(connection_, &nonce, sizeof(nonce), 0);
+
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return state_;
+
+    if (length != sizeof(nonce) || nonce != nonce_) {
+      // Not the expected peer, keep on waiting for it
+      close(connection_);
+      connection_ = -1;
+      return state_;
+    }
+
+    // Pass the shared memory and the eventfds
+    int fds[3] = {memory_fd_, event_fds_[0], event_fds_[1]};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    iovec iov = {&nonce_, sizeof(nonce_)};
+
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    if (sendmsg(connection_, &message, MSG_NOSIGNAL) != sizeof(nonce_)) {
+      fprintf(stderr, "[SharedMemoryChannel] Could not pass the shared memory: %s\n", strerror(errno));
+      state_ = State::FAILED;
+      return state_;
+    }
+  } else {
+    uint64_t nonce;
+    int fds[3] = {-1, -1, -1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    iovec iov = {&nonce, sizeof(nonce)};
+
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t length = recvmsg(socket_, &message, MSG_CMSG_CLOEXEC);
+
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return state_;
+
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+
+    if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS
+      && header->cmsg_len == CMSG_LEN(sizeof(fds))
+    ) {
+      memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    }
+
+    memory_fd_ = fds[0];
+    event_fds_[0] = fds[1];
+    event_fds_[1] = fds[2];
+
+    struct stat memory_stat;
+
+    if (length != sizeof(nonce) || nonce != nonce_ || fds[0] < 0 || fds[1] < 0 || fds[2] < 0
+      || (fcntl(memory_fd_, F_GET_SEALS) & MEMORY_SEALS) != MEMORY_SEALS
+      || fstat(memory_fd_, &memory_stat) != 0
+      || (size_t)memory_stat.st_size < CONTROL_OFFSET + 2 * sizeof(RingControl) + 2 * MIN_RING_SIZE
+      || !map(memory_stat.st_size)
+    ) {
+      state_ = State::FAILED;
+      return state_;
+    }
+
+    const Header *memory_header = reinterpret_cast<const Header*>(memory_);
+
+    if (memory_header->magic != MAGIC || memory_header->nonce != nonce_
+      || memory_header->ring_size != outgoing_.size
+    ) {
+      state_ = State::FAILED;
+      return state_;
+    }
+
+    outgoing_.event_fd = event_fds_[1];
+    incoming_.event_fd = event_fds_[0];
+  }
+
+  // The sockets are not needed anymore
+  for (int *fd: {&socket_, &connection_}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+
+  state_ = State::READY;
+
+  return state_;
+}
+
+
+bool SharedMemoryChannel::map(size_t memory_size)
+{
+  const size_t data_offset = CONTROL_OFFSET + 2 * sizeof(RingControl);
+  const size_t ring_size = (memory_size - data_offset) / 2;
+
+  if (data_offset + 2 * ring_size != memory_size || (ring_size & (ring_size - 1)) != 0)
+    return false;
+
+  void *memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd_, 0);
+
+  if (memory == MAP_FAILED) {
+    fprintf(stderr, "[SharedMemoryChannel] Could not map the shared memory: %s\n", strerror(errno));
+    return false;
+  }
+
+  memory_ = static_cast<uint8_t*>(memory);
+  memory_size_ = memory_size;
+
+  Ring rings[2];
+
+  for (int k = 0; k < 2; k++) {
+    rings[k].control = reinterpret_cast<RingControl*>(memory_ + CONTROL_OFFSET + k * sizeof(RingControl));
+    rings[k].data = memory_ + data_offset + k * ring_size;
+    rings[k].size = ring_size;
+    rings[k].cached_index = 0;
+    rings[k].event_fd = -1;
+  }
+
+  outgoing_ = rings[creator_ ? 0 : 1];
+  incoming_ = rings[creator_ ? 1 : 0];
+
+  return true;
+}
+
+
+bool SharedMemoryChannel::write(const void *data, size_t length, uint8_t channel_id, uint16_t flags)
+{
+  if (state_ != State::READY || length > get_max_message_size())
+    return false;
+
+  Ring &ring = outgoing_;
+  const uint64_t tail = ring.control->tail.load(std::memory_order_relaxed);
+  const size_t record_size = get_record_size(length);
+  size_t offset = tail & (ring.size - 1);
+  const size_t padding = ring.size - offset < record_size ? ring.size - offset : 0;
+  const uint64_t new_tail = tail + padding + record_size;
+
+  // Only read the index of the reader when the cached one shows no room
+  if (new_tail - ring.cached_index > ring.size) {
+    ring.cached_index = ring.control->head.load(std::memory_order_acquire);
+
+    if (new_tail - ring.cached_index > ring.size)
+      return false;
+  }
+
+  if (padding > 0) {
+    RecordHeader wrap = {0, 0, 0, WRAP_RECORD};
+    memcpy(ring.data + offset, &wrap, sizeof(wrap));
+    offset = 0;
+  }
+
+  RecordHeader header = {(uint32_t)length, flags, channel_id, DATA_RECORD};
+  memcpy(ring.data + offset, &header, sizeof(header));
+  memcpy(ring.data + offset + sizeof(header), data, length);
+
+  ring.control->tail.store(new_tail, std::memory_order_release);
+
+  // Pairs with the fence of begin_wait, so that a waiting reader is always woken up
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (ring.control->reader_waiting.load(std::memory_order_relaxed)) {
+    uint64_t value = 1;
+    ssize_t result = ::write(ring.event_fd, &value, sizeof(value));
+    (void)result;
+  }
+
+  return true;
+}
+
+
+const uint8_t* SharedMemoryChannel::peek(size_t &length, uint8_t &channel_id, uint16_t &flags)
+{
+  if (state_ != State::READY)
+    return nullptr;
+
+  Ring &ring = incoming_;
+  uint64_t head = ring.control->head.load(std::memory_order_relaxed);
+
+  while (true) {
+    if (head == ring.cached_index) {
+      ring.cached_index = ring.control->tail.load(std::memory_order_acquire);
+
+      if (head == ring.cached_index)
+        return nullptr;
+    }
+
+    const size_t offset = head & (ring.size - 1);
+    RecordHeader header;
+    memcpy(&header, ring.data + offset, sizeof(header));
+
+    if (header.kind == WRAP_RECORD) {
+      head += ring.size - offset;
+      ring.control->head.store(head, std::memory_order_release);
+      continue;
+    }
+
+    // The other process is not trusted to write valid records
+    if (header.kind != DATA_RECORD || header.length > get_max_message_size()
+      || offset + get_record_size(header.length) > ring.size
+    ) {
+      fprintf(stderr, "[SharedMemoryChannel] Invalid record, closing the channel\n");
+      state_ = State::FAILED;
+      return nullptr;
+    }
+
+    length = header.length;
+    channel_id = header.channel_id;
+    flags = header.flags;
+
+    return ring.data + offset + sizeof(header);
+  }
+}
+
+
+void SharedMemoryChannel::pop()
+{
+  if (state_ != State::READY)
+    return;
+
+  Ring &ring = incoming_;
+  const uint64_t head = ring.control->head.load(std::memory_order_relaxed);
+
+  if (head == ring.cached_index)
+    return;
+
+  RecordHeader header;
+  memcpy(&header, ring.data + (head & (ring.size - 1)), sizeof(header));
+  ring.control->head.store(head + get_record_size(header.length), std::memory_order_release);
+}
+
+
+bool SharedMemoryChannel::wait(const std::vector<SharedMemoryChannel*> &channels, ENetSocket socket, int timeout)
+{
+  bool available = false;
+
+  for (SharedMemoryChannel *channel: channels)
+    available = channel->begin_wait() || available;
+
+  if (!available) {
+    std::vector<pollfd> fds;
+    fds.reserve(channels.size() + 1);
+    fds.push_back({socket, POLLIN, 0});
+
+    for (SharedMemoryChannel *channel: channels)
+      fds.push_back({channel->incoming_.event_fd, POLLIN, 0});
+
+    available = poll(fds.data(), fds.size(), timeout) > 0;
+  }
+
+  for (SharedMemoryChannel *channel: channels)
+    channel->end_wait();
+
+  return available;
+}
+
+
+bool SharedMemoryChannel::begin_wait()
+{
+  if (state_ != State::READY)
+    return false;
+
+  incoming_.control->reader_waiting.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  return incoming_.control->tail.load(std::memory_order_relaxed)
+    != incoming_.control->head.load(std::memory_order_relaxed);
+}
+
+
+void SharedMemoryChannel::end_wait()
+{
+  if (state_ != State::READY)
+    return;
+
+  incoming_.control->reader_waiting.store(0, std::memory_order_relaxed);
+
+  uint64_t value;
+  ssize_t result = read(incoming_.event_fd, &value, sizeof(value));
+  (void)result;
+}
+
+#else
+
+SharedMemoryChannel::SharedMemoryChannel():
+  state_(State::FAILED),
+  creator_(false),
+  nonce_(0),
+  socket_(-1),
+  connection_(-1),
+  memory_fd_(-1),
+  event_fds_{-1, -1},
+  memory_(nullptr),
+  memory_size_(0),
+  outgoing_{},
+  incoming_{}
+{
+
+}
+
+
+SharedMemoryChannel::~SharedMemoryChannel()
+{
+
+}
+
+
+bool SharedMemoryChannel::is_local(const ENetAddress &)
+{
+  return false;
+}
+
+
+std::unique_ptr<SharedMemoryChannel> SharedMemoryChannel::create(size_t)
+{
+  return nullptr;
+}
+
+
+std::unique_ptr<SharedMemoryChannel> SharedMemoryChannel::attach(const std::string &)
+{
+  return nullptr;
+}
+
+
+SharedMemoryChannel::State SharedMemoryChannel::update()
+{
+  return state_;
+}
+
+
+bool SharedMemoryChannel::map(size_t)
+{
+  return false;
+}
+
+
+bool SharedMemoryChannel::write(const void *, size_t, uint8_t, uint16_t)
+{
+  return false;
+}
+
+
+const uint8_t* SharedMemoryChannel::peek(size_t &, uint8_t &, uint16_t &)
+{
+  return nullptr;
+}
+
+
+void SharedMemoryChannel::pop()
+{
+
+}
+
+
+bool SharedMemoryChannel::wait(const std::vector<SharedMemoryChannel*> &, ENetSocket socket, int timeout)
+{
+  enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+
+  return enet_socket_wait(socket, &condition, timeout) == 0 && (condition & ENET_SOCKET_WAIT_RECEIVE);
+}
+
+
+bool SharedMemoryChannel::begin_wait()
+{
+  return false;
+}
+
+
+void SharedMemoryChannel::end_wait()
+{
+
+}
+
+#endif
+
+
+const std::string& SharedMemoryChannel::get_offer() const
+{
+  return offer_;
+}
+
+
+SharedMemoryChannel::State SharedMemoryChannel::get_state() const
+{
+  return state_;
+}
+
+
+size_t SharedMemoryChannel::get_max_message_size() const
+{
+  // Any record can then be written once the ring is empty, even after a wrap
+  return outgoing_.size > 0 ? outgoing_.size / 2 - sizeof(RecordHeader) : 0;
+}
+
+
+}  // namespace net
@@ -0,0 +1,168 @@
+/**
+ * @file
+ *
+ * \brief  Shared-memory channel between two processes of the same machine (Linux only)
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * A channel is a pair of single-producer single-consumer rings of messages, one
+ * per direction, in a memory file shared by both processes. Writing or reading a
+ * message takes no system call. While the reader waits for messages (see wait),
+ * the writer signals new messages with an eventfd.
+ *
+ * The channel is negotiated as follows, without blocking either side:
+ *   - the creator makes the memory file, the eventfds and a listening Unix socket
+ *     (abstract namespace), and sends the offer (socket name and a random nonce)
+ *     to the other side through an existing connection
+ *   - the other side connects to the socket (which only succeeds on the same
+ *     machine), and the creator sends the file descriptors over it (SCM_RIGHTS)
+ *   - the other side maps the memory once it checked that it holds the nonce, and
+ *     that its size is sealed (so that the creator cannot shrink it under the mapping)
+ */
+
+#ifndef NET__SHM_CHANNEL_HPP
+#define NET__SHM_CHANNEL_HPP
+
+#include "enet/enet.h"
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace net
+{
+
+/// Pair of shared-memory rings between two processes
+class SharedMemoryChannel
+{
+  public:
+    /// State of the negotiation
+    enum class State
+    {
+      NEGOTIATING,  ///< Waiting for the other side
+      READY,        ///< Both rings can be used
+      FAILED        ///< The channel cannot be used
+    };
+
+    /// Default size of each ring (in bytes)
+    static constexpr size_t DEFAULT_RING_SIZE = 1 << 20;
+
+    ~SharedMemoryChannel();
+
+    SharedMemoryChannel(const SharedMemoryChannel&) = delete;
+    SharedMemoryChannel& operator=(const SharedMemoryChannel&) = delete;
+
+    /// Returns whether an address belongs to this machine
+    static bool is_local(const ENetAddress &address);
+
+    /**
+     * \brief  Creates a channel and its offer, to be sent to the other side
+     *
+     * \param ring_size  Size of each ring (in bytes)
+     * \return  The channel, or nullptr if it could not be created
+     */
+    static std::unique_ptr<SharedMemoryChannel> create(size_t ring_size = DEFAULT_RING_SIZE);
+
+    /**
+     * \brief  Attaches to a channel offered by the other side
+     *
+     * \param offer  Offer received from the creator of the channel
+     * \return  The channel, or nullptr if the creator cannot be reached
+     */
+    static std::unique_ptr<SharedMemoryChannel> attach(const std::string &offer);
+
+    /// Returns the offer of a created channel
+    const std::string& get_offer() const;
+
+    /// Advances the negotiation without blocking, and returns its state
+    State update();
+
+    /// Returns the state of the negotiation
+    State get_state() const;
+
+    /// Returns the maximal size of a message
+    size_t get_max_message_size() const;
+
+    /**
+     * \brief  Writes a message to the outgoing ring
+     *
+     * \param data        Data of the message
+     * \param length      Length of the message
+     * \param channel_id  ENet channel of the message
+     * \param flags       ENet flags of the message
+     * \return  Whether the message could be written (false if the ring is full)
+     */
+    bool write(const void *data, size_t length, uint8_t channel_id, uint16_t flags);
+
+    /**
+     * \brief  Returns the next message of the incoming ring, without removing it
+     *
+     * \param[out] length      Length of the message
+     * \param[out] channel_id  ENet channel of the message
+     * \param[out] flags       ENet flags of the message
+     * \return  Data of the message, valid until pop is called (nullptr if none)
+     */
+    const uint8_t* peek(size_t &length, uint8_t &channel_id, uint16_t &flags);
+
+    /// Removes the message returned by peek
+    void pop();
+
+    /**
+     * \brief  Waits for a message on any of several channels, or for a datagram on a socket
+     *
+     * The writers of the channels signal their eventfd during the wait only.
+     *
+     * \param channels  Channels to wait for, in the READY state
+     * \param socket    Socket to wait for
+     * \param timeout   Maximal duration to wait (in ms)
+     * \return  Whether a message or a datagram is available
+     */
+    static bool wait(const std::vector<SharedMemoryChannel*> &channels, ENetSocket socket, int timeout);
+
+  private:
+    /// Header of the shared memory
+    struct Header;
+
+    /// Indices of a ring, each on its own cache line
+    struct RingControl;
+
+    /// View of one ring in the shared memory
+    struct Ring
+    {
+      RingControl *control;  ///< Indices of the ring
+      uint8_t *data;         ///< Messages
+      size_t size;           ///< Size of the data (in bytes)
+      uint64_t cached_index; ///< Index of the other side, as last read (head for the writer, tail for the reader)
+      int event_fd;          ///< Signalled when a message is written while the reader waits
+    };
+
+    State state_;             ///< State of the negotiation
+    bool creator_;            ///< Whether this side created the channel
+    std::string offer_;       ///< Offer sent to the other side (creator only)
+    uint64_t nonce_;          ///< Random value identifying the channel
+    int socket_;              ///< Listening (creator) or connected socket, -1 once negotiated
+    int connection_;          ///< Accepted connection (creator only), -1 once negotiated
+    int memory_fd_;           ///< Shared memory file
+    int event_fds_[2];        ///< eventfd of each ring
+    uint8_t *memory_;         ///< Mapped shared memory
+    size_t memory_size_;      ///< Size of the mapped memory
+    Ring outgoing_;           ///< Ring written by this side
+    Ring incoming_;           ///< Ring read by this side
+
+    SharedMemoryChannel();
+
+    /// Maps the memory and sets the rings up, returns whether successful
+    bool map(size_t memory_size);
+
+    /// Asks the writer to signal the eventfd, returns whether a message is already available
+    bool begin_wait();
+
+    /// Stops signalling the eventfd, and clears it
+    void end_wait();
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ * @file
+ *
+ * \brief  Fixed-tick scheduler with bounded network servicing
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "tick_scheduler.hpp"
+#include "base.hpp"
+#include "enet/enet.h"
+#include <functional>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+
+namespace net
+{
+
+TickScheduler::TickScheduler(NetBase &net, double tick_rate):
+  net_(net),
+  period_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(1.0 / tick_rate)
+  )),
+  max_events_(std::numeric_limits<size_t>::max()),
+  max_duration_(period_ / 2),
+  running_(false),
+  last_tick_time_(std::chrono::steady_clock::now())
+{
+
+}
+
+
+void TickScheduler::set_budget(size_t max_events, double max_duration)
+{
+  max_events_ = max_events;
+  max_duration_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(max_duration)
+  );
+}
+
+
+void TickScheduler::add_tick_callback(const TickCallback &callback)
+{
+  tick_callbacks_.push_back(callback);
+}
+
+
+void TickScheduler::set_overrun_callback(const std::function<void(const Stats&)> &callback)
+{
+  overrun_callback_ = callback;
+}
+
+
+void TickScheduler::run_tick()
+{
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> dt = start - last_tick_time_;
+  last_tick_time_ = start;
+
+  // Service the network within the budget
+  size_t event_count = net_.service(max_events_, max_duration_);
+  stats_.events += event_count;
+  stats_.backlog = net_.get_backlog();
+
+  if (event_count >= max_events_ || stats_.backlog > 0)
+    stats_.exhausted_budgets++;
+
+  // Timeouts of the peers, hand-over...
+  net_.update();
+
+  // Run the game logic
+  for (auto &callback: tick_callbacks_)
+    callback(stats_.ticks, dt.count());
+
+  // Send all the traffic queued during the tick at once
+  enet_host_flush(net_.get_host());
+
+  std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+  stats_.ticks++;
+  stats_.last_duration = duration.count();
+  stats_.max_duration = std::max(stats_.max_duration, duration.count());
+
+  if (duration > period_) {
+    stats_.overruns++;
+
+    if (overrun_callback_)
+      overrun_callback_(stats_);
+  }
+}
+
+
+void TickScheduler::run()
+{
+  running_ = true;
+  auto next_tick = std::chrono::steady_clock::now();
+
+  while (running_) {
+    run_tick();
+    next_tick += period_;
+
+    // Do not try to catch up on missed ticks, it would only make things worse
+    auto now = std::chrono::steady_clock::now();
+
+    if (now > next_tick)
+      next_tick = now;
+    else
+      std::this_thread::sleep_until(next_tick);
+  }
+}
+
+
+void TickScheduler::stop()
+{
+  running_ = false;
+}
+
+
+const TickScheduler::Stats& TickScheduler::get_stats() const
+{
+  return stats_;
+}
+
+
+}  // namespace net
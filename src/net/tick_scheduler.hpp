@@ -0,0 +1,100 @@
+/**
+ * @file
+ *
+ * \brief  Fixed-tick scheduler with bounded network servicing
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__TICK_SCHEDULER_HPP
+#define NET__TICK_SCHEDULER_HPP
+
+#include "base.hpp"
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+
+namespace net
+{
+
+/**
+ * \brief  Runs a host at a fixed tick rate
+ *
+ * Each tick services the network within a budget (number of events and duration),
+ * does the periodic work of the host (see NetBase::update), then runs the tick
+ * callbacks, and finally flushes all the outbound traffic once.
+ * Events left over when the budget is exhausted are carried over to the next tick,
+ * so that a flood of packets cannot starve the tick callbacks.
+ */
+class TickScheduler
+{
+  public:
+    /**
+     * \brief  Called at each tick
+     *
+     * \param tick  Index of the tick
+     * \param dt    Duration since the previous tick (in s)
+     */
+    using TickCallback = std::function<void(uint64_t tick, double dt)>;
+
+    /// Statistics about the ticks
+    struct Stats
+    {
+      uint64_t ticks = 0;             ///< Number of ticks run
+      uint64_t overruns = 0;          ///< Number of ticks which took longer than the tick period
+      uint64_t exhausted_budgets = 0; ///< Number of ticks which did not handle all the events
+      uint64_t events = 0;            ///< Total number of events handled
+      size_t backlog = 0;             ///< Events carried over at the end of the last tick
+      double last_duration = 0.0;     ///< Duration of the last tick (in s)
+      double max_duration = 0.0;      ///< Longest tick duration (in s)
+    };
+
+    /**
+     * \param net        Host to run
+     * \param tick_rate  Number of ticks per second
+     */
+    TickScheduler(NetBase &net, double tick_rate);
+
+    /**
+     * \brief  Sets the budget given to the network at each tick
+     *
+     * \param max_events    Maximal number of events handled per tick
+     * \param max_duration  Maximal duration spent handling events per tick (in s)
+     */
+    void set_budget(size_t max_events, double max_duration);
+
+    /// Adds a callback run at each tick, after servicing the network
+    void add_tick_callback(const TickCallback &callback);
+
+    /// Sets a callback called whenever a tick takes longer than the tick period
+    void set_overrun_callback(const std::function<void(const Stats&)> &callback);
+
+    /// Runs a single tick, without waiting
+    void run_tick();
+
+    /// Runs ticks at the tick rate until stop() is called
+    void run();
+
+    /// Makes run() return after the current tick
+    void stop();
+
+    /// Returns statistics about the ticks
+    const Stats& get_stats() const;
+
+  private:
+    NetBase &net_;            ///< Host to run
+    const std::chrono::steady_clock::duration period_;  ///< Duration of a tick
+    size_t max_events_;       ///< Maximal number of events handled per tick
+    std::chrono::steady_clock::duration max_duration_;  ///< Maximal duration spent handling events per tick
+    std::vector<TickCallback> tick_callbacks_;           ///< Callbacks run at each tick
+    std::function<void(const Stats&)> overrun_callback_; ///< Called when a tick overruns
+    Stats stats_;             ///< Statistics about the ticks
+    bool running_;            ///< Whether run() should keep going
+    std::chrono::steady_clock::time_point last_tick_time_;  ///< When the last tick started
+};
+
+}  // namespace net
+
+#endif
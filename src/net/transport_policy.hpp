@@ -0,0 +1,562 @@
+/**
+ * @file
+ *
+ * \brief  Transport policies of BasicNetHost, through ENet or shared memory
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Transport policies can carry the messages of some peers instead of ENet, the
+ * ENet connection being kept for the handshake and to detect disconnections.
+ * `send` returns whether the policy took the packet over, and `receive` whether
+ * the received packet was one of its control messages.
+ */
+
+#ifndef NET__TRANSPORT_POLICY_HPP
+#define NET__TRANSPORT_POLICY_HPP
+
+#include "policy.hpp"
+#include "packet.hpp"
+#include "shm_channel.hpp"
+#include "buffer_pool.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+
+namespace net
+{
+
+namespace policy
+{
+
+/// All messages go through ENet
+struct NetworkTransport
+{
+  using kind = transport_kind;
+
+  template <typename Host>
+  bool offer(Host &, ENetPeer *)
+  {
+    return false;
+  }
+
+  template <typename Host>
+  bool receive(Host &, ENetEvent &)
+  {
+    return false;
+  }
+
+  bool send(ENetPeer *, int, ENetPacket *)
+  {
+    return false;
+  }
+
+  template <typename Host, typename Dispatch>
+  size_t poll(Host &, size_t, Dispatch)
+  {
+    return 0;
+  }
+
+  bool wait(ENetHost *host, int timeout)
+  {
+    enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+
+    return enet_socket_wait(host->socket, &condition, timeout) == 0
+      && (condition & ENET_SOCKET_WAIT_RECEIVE);
+  }
+
+  template <typename Host, typename Dispatch>
+  void disconnect(Host &, ENetPeer *, Dispatch)
+  {
+
+  }
+
+  void reset(ENetPeer *)
+  {
+
+  }
+};
+
+
+/**
+ * \brief  Messages to peers of the same machine go through shared memory
+ *
+ * The connecting host offers a SharedMemoryChannel once it is validated. If the
+ * peer is on the same machine and accepts it, each side marks the end of the
+ * messages it sent through ENet by a SHM_SWITCH packet on every channel, and then
+ * writes its messages to the shared memory (the offering side only once it
+ * received the first SHM_SWITCH of the other side, which proves that it could
+ * map the memory). The messages read from the shared
+ * memory are only dispatched once the SHM_SWITCH of their channel has been
+ * received, so that the messages of each channel keep their order. Messages
+ * larger than a record of the ring are written as several records, put back
+ * together before being dispatched.
+ *
+ * If a channel fails once either side switched to it, the messages left in its
+ * rings cannot be recovered nor reordered with ENet: the peer is disconnected
+ * rather than losing messages silently, and the loss is counted (see get_stats).
+ */
+class SharedMemoryTransport
+{
+  public:
+    using kind = transport_kind;
+
+    /// Set on the records of a message continued by the next record
+    static constexpr uint16_t FRAGMENT_FLAG = 1 << 15;
+
+    /// Number of failed channels, and of messages lost with them
+    struct Stats
+    {
+      uint64_t links_failed = 0;        ///< Channels which failed, or could not be negotiated in time
+      uint64_t messages_dropped = 0;    ///< Messages known to be lost with a failed channel
+      uint64_t peers_disconnected = 0;  ///< Peers disconnected because their channel failed after switching
+    };
+
+    SharedMemoryTransport():
+      enabled_(true),
+      ring_size_(SharedMemoryChannel::DEFAULT_RING_SIZE),
+      timeout_(std::chrono::seconds(5))
+    {
+
+    }
+
+    /// Sets whether channels are offered to and accepted from the peers
+    void set_enabled(bool enabled)
+    {
+      enabled_ = enabled;
+    }
+
+    /// Sets the size of each ring of the channels offered to the peers (in bytes)
+    void set_ring_size(size_t ring_size)
+    {
+      ring_size_ = ring_size;
+    }
+
+    /// Returns the number of failed channels, and of messages lost with them
+    const Stats& get_stats() const
+    {
+      return stats_;
+    }
+
+    /// Returns whether the messages sent to a peer go through shared memory
+    bool is_active(const ENetPeer *peer) const
+    {
+      const Link *link = get_link(peer);
+      return link != nullptr && link->sending;
+    }
+
+    /// Offers a channel to a peer of the same machine, returns whether it was offered
+    template <typename Host>
+    bool offer(Host &host, ENetPeer *peer)
+    {
+      if (!enabled_ || !SharedMemoryChannel::is_local(peer->address))
+        return false;
+
+      std::unique_ptr<SharedMemoryChannel> channel = SharedMemoryChannel::create(ring_size_);
+
+      if (channel == nullptr)
+        return false;
+
+      std::string offer = channel->get_offer();
+      add_link(peer, std::move(channel)).offered = true;
+      host.send_packet(peer, Packet(Packet::Type::SHM_OFFER, offer), 0);
+
+      return true;
+    }
+
+    /// Handles the control messages, returns whether the packet has been consumed
+    template <typename Host>
+    bool receive(Host &host, ENetEvent &event)
+    {
+      Packet::Type type;
+
+      if (!Packet::peek_type(event.packet->data, event.packet->dataLength, type))
+        return false;
+
+      if (type == Packet::Type::SHM_SWITCH) {
+        Link *link = get_link(event.peer);
+
+        if (link != nullptr && event.channelID < link->switched.size())
+          link->switched[event.channelID] = true;
+
+        return true;
+      }
+
+      if (type != Packet::Type::SHM_OFFER)
+        return false;
+
+      if (!enabled_ || !host.accepts_shared_memory(event.peer)
+        || !SharedMemoryChannel::is_local(event.peer->address)
+      ) {
+        return true;
+      }
+
+      Packet packet;
+      packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
+      std::unique_ptr<SharedMemoryChannel> channel = SharedMemoryChannel::attach(packet.get_data());
+
+      if (channel == nullptr) {
+        host.template log<LogLevel::INFO>("Could not attach to the shared memory of the peer\n");
+        return true;
+      }
+
+      add_link(event.peer, std::move(channel));
+
+      return true;
+    }
+
+    /**
+     * \brief  Sends a packet through shared memory
+     *
+     * \return  Whether the packet has been taken over
+     */
+    bool send(ENetPeer *peer, int channel_id, ENetPacket *packet)
+    {
+      Link *link = get_link(peer);
+
+      if (link == nullptr || !link->sending)
+        return false;
+
+      QueuedPacket queued = {packet, channel_id, 0};
+
+      if (link->backlog.empty() && write(*link, queued)) {
+        if (packet->referenceCount == 0)
+          enet_packet_destroy(packet);
+
+        return true;
+      }
+
+      // Queued when the ring is full, until the peer reads it
+      packet->referenceCount++;
+      link->backlog.push_back(queued);
+
+      return true;
+    }
+
+    /**
+     * \brief  Advances the negotiations, and dispatches the messages read from shared memory
+     *
+     * \param host        Host sending the control messages
+     * \param max_events  Maximal number of messages to dispatch
+     * \param dispatch    Called with a receive event for each message, taking ownership of its packet
+     * \return  Number of messages dispatched
+     */
+    template <typename Host, typename Dispatch>
+    size_t poll(Host &host, size_t max_events, Dispatch dispatch)
+    {
+      const auto now = std::chrono::steady_clock::now();
+      size_t event_count = 0;
+
+      for (size_t index = 0; index < links_.size(); index++) {
+        Link *link = links_[index].get();
+
+        if (link == nullptr)
+          continue;
+
+        SharedMemoryChannel::State state = link->channel->update();
+
+        if (state == SharedMemoryChannel::State::FAILED
+          || (state == SharedMemoryChannel::State::NEGOTIATING && now - link->start_time > timeout_)
+        ) {
+          fail_link(host, index);
+          continue;
+        }
+
+        if (state != SharedMemoryChannel::State::READY)
+          continue;
+
+        // The side which offered the channel waits for the other one to have mapped it
+        if (!link->sending && link->offered
+          && std::find(link->switched.begin(), link->switched.end(), true) == link->switched.end()
+        ) {
+          continue;
+        }
+
+        if (!link->sending) {
+          ENetPeer *peer = link->peer;
+
+          for (size_t channel_id = 0; channel_id < link->switched.size(); channel_id++)
+            host.send_packet(peer, Packet(Packet::Type::SHM_SWITCH, ""), channel_id);
+
+          link->sending = true;
+          host.template log<LogLevel::INFO>("Switched to shared memory with the peer\n");
+        }
+
+        // Backlog of a full ring
+        while (!link->backlog.empty()) {
+          if (!write(*link, link->backlog.front()))
+            break;
+
+          release(link->backlog.front().packet);
+          link->backlog.pop_front();
+        }
+
+        event_count += dispatch_messages(host, index, max_events - event_count, dispatch);
+      }
+
+      return event_count;
+    }
+
+    /**
+     * \brief  Waits for a datagram on the socket of the host, or for a message from shared memory
+     *
+     * \param host     Host whose socket to wait for
+     * \param timeout  Maximal duration to wait (in ms)
+     * \return  Whether a datagram or a message is available
+     */
+    bool wait(ENetHost *host, int timeout)
+    {
+      waiting_channels_.clear();
+
+      for (const auto &link: links_) {
+        if (link != nullptr && link->channel->get_state() == SharedMemoryChannel::State::READY)
+          waiting_channels_.push_back(link->channel.get());
+      }
+
+      return SharedMemoryChannel::wait(waiting_channels_, host->socket, timeout);
+    }
+
+    /**
+     * \brief  Stops using shared memory with a disconnected peer
+     *
+     * The messages written by the peer before disconnecting are dispatched first.
+     */
+    template <typename Host, typename Dispatch>
+    void disconnect(Host &host, ENetPeer *peer, Dispatch dispatch)
+    {
+      if (get_link(peer) == nullptr)
+        return;
+
+      dispatch_messages(host, peer->incomingPeerID, SIZE_MAX, dispatch);
+      drop_link(peer->incomingPeerID);
+    }
+
+    /// Stops using shared memory with a peer, for instance when a new peer uses its slot
+    void reset(ENetPeer *peer)
+    {
+      if (peer->incomingPeerID < links_.size())
+        drop_link(peer->incomingPeerID);
+    }
+
+  private:
+    /// Packet waiting for room in the ring
+    struct QueuedPacket
+    {
+      ENetPacket *packet;  ///< Packet to write
+      int channel_id;      ///< ENet channel of the packet
+      size_t offset;       ///< Length of the data already written
+    };
+
+    /// Shared memory with a peer
+    struct Link
+    {
+      ENetPeer *peer;  ///< Peer at the other side
+      std::unique_ptr<SharedMemoryChannel> channel;  ///< Shared memory with the peer
+      std::chrono::steady_clock::time_point start_time;  ///< When the negotiation started
+      bool offered;    ///< Whether this side offered the channel
+      bool sending;    ///< Whether the messages to the peer are written to the shared memory
+      std::vector<bool> switched;  ///< Whether the peer switched to shared memory, for each channel
+      std::deque<QueuedPacket> backlog;  ///< Packets waiting for room in the ring
+      std::vector<uint8_t> fragments;    ///< Records of the message being read, until its last one
+    };
+
+    bool enabled_;      ///< Whether channels are offered and accepted
+    size_t ring_size_;  ///< Size of each ring of the offered channels (in bytes)
+    Stats stats_;       ///< Number of failed channels, and of messages lost with them
+    std::chrono::steady_clock::duration timeout_;  ///< Maximal duration of a negotiation
+    std::vector<std::unique_ptr<Link>> links_;     ///< Shared memory with each peer, indexed by incomingPeerID
+    std::vector<SharedMemoryChannel*> waiting_channels_;  ///< Channels waited for by wait
+
+    const Link* get_link(const ENetPeer *peer) const
+    {
+      return peer->incomingPeerID < links_.size() ? links_[peer->incomingPeerID].get() : nullptr;
+    }
+
+    Link* get_link(const ENetPeer *peer)
+    {
+      return peer->incomingPeerID < links_.size() ? links_[peer->incomingPeerID].get() : nullptr;
+    }
+
+    Link& add_link(ENetPeer *peer, std::unique_ptr<SharedMemoryChannel> channel)
+    {
+      if (peer->incomingPeerID >= links_.size())
+        links_.resize(peer->incomingPeerID + 1);
+
+      drop_link(peer->incomingPeerID);
+
+      auto link = std::make_unique<Link>();
+      link->peer = peer;
+      link->channel = std::move(channel);
+      link->start_time = std::chrono::steady_clock::now();
+      link->offered = false;
+      link->sending = false;
+      link->switched.resize(peer->channelCount, false);
+      links_[peer->incomingPeerID] = std::move(link);
+
+      return *links_[peer->incomingPeerID];
+    }
+
+    void drop_link(size_t index)
+    {
+      if (links_[index] == nullptr)
+        return;
+
+      for (auto &queued: links_[index]->backlog)
+        release(queued.packet);
+
+      links_[index].reset();
+    }
+
+    /**
+     * \brief  Stops using a channel which failed
+     *
+     * Before either side switched, the messages keep going through ENet. After,
+     * the messages waiting for room in the ring, the one being put together and
+     * those the peer left in its ring are lost: the peer is disconnected.
+     */
+    template <typename Host>
+    void fail_link(Host &host, size_t index)
+    {
+      Link *link = links_[index].get();
+      const bool switched = std::find(link->switched.begin(), link->switched.end(), true) != link->switched.end();
+      stats_.links_failed++;
+
+      if (!link->sending && !switched) {
+        host.template log<LogLevel::INFO>("Shared memory with the peer failed, using ENet\n");
+        drop_link(index);
+        return;
+      }
+
+      stats_.messages_dropped += link->backlog.size() + (link->fragments.empty() ? 0 : 1);
+      stats_.peers_disconnected++;
+      host.template log<LogLevel::ERROR>("Shared memory with the peer failed, messages lost: disconnecting\n");
+      enet_peer_disconnect(link->peer, 0);
+      drop_link(index);
+    }
+
+    /**
+     * \brief  Writes the rest of a packet to the ring, as several records if it is larger than one
+     *
+     * \return  Whether the packet has been written entirely
+     */
+    static bool write(Link &link, QueuedPacket &queued)
+    {
+      const ENetPacket *packet = queued.packet;
+      const size_t max_length = link.channel->get_max_message_size();
+
+      do {
+        const size_t length = std::min(max_length, packet->dataLength - queued.offset);
+        const bool last = queued.offset + length == packet->dataLength;
+        const uint16_t flags = (packet->flags & ~FRAGMENT_FLAG) | (last ? 0 : FRAGMENT_FLAG);
+
+        if (!link.channel->write(packet->data + queued.offset, length, queued.channel_id, flags))
+          return false;
+
+        queued.offset += length;
+      } while (queued.offset < packet->dataLength);
+
+      return true;
+    }
+
+    /**
+     * \brief  Dispatches the messages read from the shared memory with a peer
+     *
+     * The peer can still write to the memory of a record, which is therefore
+     * copied (to a buffer of the pool of the host if it fits) before being dispatched.
+     *
+     * \return  Number of messages dispatched
+     */
+    template <typename Host, typename Dispatch>
+    size_t dispatch_messages(Host &host, size_t index, size_t max_events, Dispatch &dispatch)
+    {
+      Link *link = links_[index].get();
+
+      if (link == nullptr || link->channel->get_state() != SharedMemoryChannel::State::READY)
+        return 0;
+
+      ENetEvent event;
+      event.type = ENET_EVENT_TYPE_RECEIVE;
+      event.peer = link->peer;
+      event.data = 0;
+
+      size_t event_count = 0;
+      size_t length;
+      uint8_t channel_id;
+      uint16_t flags;
+
+      while (event_count < max_events) {
+        const uint8_t *data = link->channel->peek(length, channel_id, flags);
+
+        // Waits for the end of the messages sent through ENet on the channel
+        if (data == nullptr || channel_id >= link->switched.size() || !link->switched[channel_id])
+          break;
+
+        // Records of a larger message are put together until the last one
+        if ((flags & FRAGMENT_FLAG) || !link->fragments.empty()) {
+          if (link->fragments.size() + length > host.get_host()->maximumPacketSize) {
+            stats_.messages_dropped++;
+            link->fragments.clear();
+            fail_link(host, index);
+            break;
+          }
+
+          link->fragments.insert(link->fragments.end(), data, data + length);
+
+          if (flags & FRAGMENT_FLAG) {
+            link->channel->pop();
+            continue;
+          }
+        }
+
+        event.channelID = channel_id;
+        flags &= ~(FRAGMENT_FLAG | ENET_PACKET_FLAG_NO_ALLOCATE);
+
+        BufferPool &buffer_pool = host.get_buffer_pool();
+
+        if (link->fragments.empty() && length <= buffer_pool.get_buffer_size()) {
+          uint8_t *buffer = buffer_pool.acquire();
+          memcpy(buffer, data, length);
+          event.packet = buffer_pool.create_packet(buffer, length, flags);
+        } else if (link->fragments.empty()) {
+          event.packet = enet_packet_create(data, length, flags);
+        } else {
+          event.packet = enet_packet_create(link->fragments.data(), link->fragments.size(), flags);
+          link->fragments.clear();
+        }
+
+        if (event.packet == nullptr)
+          break;
+
+        dispatch(event);
+        event_count++;
+
+        // The callbacks may have reset the link
+        if (links_[index].get() != link)
+          break;
+
+        link->channel->pop();
+      }
+
+      return event_count;
+    }
+
+    /// Releases the reference of the backlog to a packet, as ENet does once a packet is sent
+    static void release(ENetPacket *packet)
+    {
+      if (--packet->referenceCount == 0)
+        enet_packet_destroy(packet);
+    }
+};
+
+}  // namespace policy
+}  // namespace net
+
+#endif
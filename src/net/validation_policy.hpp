@@ -0,0 +1,388 @@
+/**
+ * @file
+ *
+ * \brief  Validation policies of BasicNetHost
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Validation policies are called by the host before the callbacks of the derived
+ * class. `receive` returns whether the packet has been consumed, in which case
+ * it is not handed over to the derived class.
+ */
+
+#ifndef NET__VALIDATION_POLICY_HPP
+#define NET__VALIDATION_POLICY_HPP
+
+#include "policy.hpp"
+#include "packet.hpp"
+#include "enet/enet.h"
+#include <random>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include <stdio.h>
+
+
+namespace net
+{
+
+/// Solves the puzzle used to validate a new peer
+inline std::string solve_validation_puzzle(const std::string &validation_str, const std::string &salt)
+{
+  std::string solution;
+  auto n = validation_str.size();
+  auto m = salt.size();
+  solution.reserve(n);
+
+  std::string chrs = "0123456789"
+    "abcdefghijklmnopqrstuvwxyz"
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+  for (int k = 0; k < (int)n; k++) {
+    int index = (validation_str[k] << 3) ^ (validation_str[k] | salt[k % m]);
+    solution += chrs[index % (int)chrs.size()];
+  }
+
+  return solution;
+}
+
+
+/**
+ * \brief  Generates a random string used for validation of a peer
+ *
+ * Based on https://stackoverflow.com/a/24586587
+ */
+inline std::string generate_validation_str(int length)
+{
+  static auto& chrs = "0123456789"
+        "abcdefghijklmnopqrstuvwxyz"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+  thread_local static std::mt19937 rg{std::random_device{}()};
+  thread_local static std::uniform_int_distribution<int> pick(0, sizeof(chrs) - 2);
+
+  std::string validation_str;
+  validation_str.reserve(length);
+
+  while (length--)
+    validation_str += chrs[pick(rg)];
+
+  return validation_str;
+}
+
+
+namespace policy
+{
+
+/// All peers are considered validated as soon as they are connected
+class NoValidation
+{
+  public:
+    using kind = validation_kind;
+
+    /// Returns whether the peer is already validated
+    template <typename Host>
+    bool connect(Host &, ENetPeer *)
+    {
+      return true;
+    }
+
+    /// Returns whether the received packet has been consumed
+    template <typename Host>
+    bool receive(Host &, ENetEvent &)
+    {
+      return false;
+    }
+
+    void disconnect(ENetPeer *)
+    {
+
+    }
+
+    bool is_validated(const ENetPeer *) const
+    {
+      return true;
+    }
+};
+
+
+/**
+ * \brief  Validation by a puzzle based on a salt shared by all peers
+ *
+ * Same protocol as NetServer and NetClient: the listening host sends a random
+ * string, and the connecting host answers with the solved puzzle.
+ */
+class PuzzleValidation
+{
+  public:
+    using kind = validation_kind;
+
+    PuzzleValidation():
+      validation_str_size_(128)
+    {
+
+    }
+
+    /**
+     * \param salt                 Used to scramble the validation string, should be common to all peers
+     * \param validation_str_size  Length of the validation string to generate
+     */
+    void configure(const std::string &salt, int validation_str_size)
+    {
+      salt_ = salt;
+      validation_str_size_ = validation_str_size;
+    }
+
+    /// Sends the puzzle to new peers, returns whether the peer is already validated
+    template <typename Host>
+    bool connect(Host &host, ENetPeer *peer)
+    {
+      State &state = get_state(peer);
+      state.validated = false;
+      state.expected_answer.clear();
+
+      if (!host.is_listening())
+        return false;
+
+      std::string validation_str = generate_validation_str(validation_str_size_);
+      state.expected_answer = solve_validation_puzzle(validation_str, salt_);
+      host.send_packet(peer, Packet(Packet::Type::VALIDATION_STR, validation_str), 0);
+
+      return false;
+    }
+
+    template <typename Host>
+    bool receive(Host &host, ENetEvent &event)
+    {
+      State &state = get_state(event.peer);
+      Packet::Type type;
+
+      if (!Packet::peek_type(event.packet->data, event.packet->dataLength, type))
+        return host.is_listening() && !state.validated;
+
+      if (host.is_listening()) {
+        if (type != Packet::Type::VALIDATIION_ANSWER) {
+          if (state.validated)
+            return false;
+
+          host.template log<LogLevel::ERROR>(
+            "Received message from unauthorised peer! Disconnecting\n"
+          );
+          enet_peer_disconnect(event.peer, 0);
+          return true;
+        }
+
+        Packet packet;
+        packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
+
+        if (!state.validated && !state.expected_answer.empty()
+          && packet.get_data() == state.expected_answer
+        ) {
+          state.validated = true;
+          state.expected_answer.clear();
+          host.on_validated(event.peer);
+        } else if (!state.validated) {
+          host.template log<LogLevel::ERROR>(
+            "Peer failed validation puzzle. Disconnecting\n"
+          );
+          enet_peer_disconnect(event.peer, 0);
+        }
+
+        return true;
+      }
+
+      if (type != Packet::Type::VALIDATION_STR)
+        return false;
+
+      Packet packet;
+      packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
+      Packet answer(
+        Packet::Type::VALIDATIION_ANSWER,
+        solve_validation_puzzle(packet.get_data(), salt_)
+      );
+      host.send_packet(event.peer, answer, 0);
+
+      if (!state.validated) {
+        state.validated = true;
+        host.on_validated(event.peer);
+      }
+
+      return true;
+    }
+
+    void disconnect(ENetPeer *peer)
+    {
+      State &state = get_state(peer);
+      state.validated = false;
+      state.expected_answer.clear();
+    }
+
+    bool is_validated(const ENetPeer *peer) const
+    {
+      return peer->incomingPeerID < states_.size() && states_[peer->incomingPeerID].validated;
+    }
+
+  private:
+    /// Validation state of a peer
+    struct State
+    {
+      bool validated = false;       ///< Whether the peer has been validated
+      std::string expected_answer;  ///< Answer expected from the peer (listening host only)
+    };
+
+    std::string salt_;         ///< Used to scramble the validation string
+    int validation_str_size_;  ///< Length of the validation string to generate
+    std::vector<State> states_;  ///< Validation state of each peer, indexed by incomingPeerID
+
+    State& get_state(const ENetPeer *peer)
+    {
+      if (peer->incomingPeerID >= states_.size())
+        states_.resize(peer->incomingPeerID + 1);
+
+      return states_[peer->incomingPeerID];
+    }
+};
+
+
+/**
+ * \brief  Validation by a stateless cookie
+ *
+ * The listening host sends a cookie derived from a secret and from the address
+ * and connection identifier of the peer, which the peer must send back. The
+ * listening host only needs to recompute the cookie to check the answer, and
+ * stores nothing but a validated flag per peer. The cookie proves that the peer
+ * receives the traffic sent to its address. It is not a cryptographic MAC.
+ */
+class CookieValidation
+{
+  public:
+    using kind = validation_kind;
+
+    CookieValidation():
+      secret_((uint64_t(std::random_device{}()) << 32) | std::random_device{}())
+    {
+
+    }
+
+    /// Sets the secret used to derive the cookies (random by default)
+    void configure(uint64_t secret)
+    {
+      secret_ = secret;
+    }
+
+    /// Sends the cookie to new peers, returns whether the peer is already validated
+    template <typename Host>
+    bool connect(Host &host, ENetPeer *peer)
+    {
+      set_validated(peer, false);
+
+      if (host.is_listening())
+        host.send_packet(peer, Packet(Packet::Type::VALIDATION_STR, compute_cookie(peer)), 0);
+
+      return false;
+    }
+
+    template <typename Host>
+    bool receive(Host &host, ENetEvent &event)
+    {
+      bool validated = is_validated(event.peer);
+      Packet::Type type;
+
+      if (!Packet::peek_type(event.packet->data, event.packet->dataLength, type))
+        return host.is_listening() && !validated;
+
+      if (host.is_listening()) {
+        if (type != Packet::Type::VALIDATIION_ANSWER) {
+          if (validated)
+            return false;
+
+          host.template log<LogLevel::ERROR>(
+            "Received message from unauthorised peer! Disconnecting\n"
+          );
+          enet_peer_disconnect(event.peer, 0);
+          return true;
+        }
+
+        Packet packet;
+        packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
+
+        if (!validated && packet.get_data() == compute_cookie(event.peer)) {
+          set_validated(event.peer, true);
+          host.on_validated(event.peer);
+        } else if (!validated) {
+          host.template log<LogLevel::ERROR>(
+            "Peer sent an invalid cookie. Disconnecting\n"
+          );
+          enet_peer_disconnect(event.peer, 0);
+        }
+
+        return true;
+      }
+
+      if (type != Packet::Type::VALIDATION_STR)
+        return false;
+
+      // Echo the cookie back
+      Packet packet;
+      packet.load_serialised((char*)event.packet->data, event.packet->dataLength);
+      host.send_packet(event.peer, Packet(Packet::Type::VALIDATIION_ANSWER, packet.get_data()), 0);
+
+      if (!validated) {
+        set_validated(event.peer, true);
+        host.on_validated(event.peer);
+      }
+
+      return true;
+    }
+
+    void disconnect(ENetPeer *peer)
+    {
+      set_validated(peer, false);
+    }
+
+    bool is_validated(const ENetPeer *peer) const
+    {
+      return peer->incomingPeerID < validated_.size() && validated_[peer->incomingPeerID];
+    }
+
+  private:
+    uint64_t secret_;  ///< Secret used to derive the cookies
+    std::vector<uint8_t> validated_;  ///< Whether each peer is validated, indexed by incomingPeerID
+
+    void set_validated(const ENetPeer *peer, bool validated)
+    {
+      if (peer->incomingPeerID >= validated_.size())
+        validated_.resize(peer->incomingPeerID + 1, 0);
+
+      validated_[peer->incomingPeerID] = validated;
+    }
+
+    /// Derives the cookie of a peer from the secret
+    std::string compute_cookie(const ENetPeer *peer) const
+    {
+      uint64_t h = secret_;
+
+      for (uint64_t value: {
+        uint64_t(peer->address.host),
+        uint64_t(peer->address.port),
+        uint64_t(peer->connectID)
+      }) {
+        // splitmix64 finaliser
+        h += value + 0x9E3779B97F4A7C15ull;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+        h ^= h >> 31;
+      }
+
+      char cookie[17];
+      snprintf(cookie, sizeof(cookie), "%016llx", (unsigned long long)h);
+
+      return cookie;
+    }
+};
+
+}  // namespace policy
+}  // namespace net
+
+#endif
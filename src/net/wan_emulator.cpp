@@ -0,0 +1,273 @@
+/**
+ * @file
+ *
+ * \brief  Emulation of wide area network conditions between clients and a server
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "wan_emulator.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include <stdio.h>
+
+
+namespace net
+{
+
+/// Returns a key identifying an address
+static uint64_t address_key(const ENetAddress &address)
+{
+  return (static_cast<uint64_t>(address.host) << 16) | address.port;
+}
+
+
+/// Creates a non-blocking UDP socket, bound to the given port if not null
+static ENetSocket create_socket(const ENetAddress *address)
+{
+  ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+
+  if (socket == ENET_SOCKET_NULL)
+    return socket;
+
+  if (address != nullptr && enet_socket_bind(socket, address) < 0) {
+    enet_socket_destroy(socket);
+    return ENET_SOCKET_NULL;
+  }
+
+  enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+  enet_socket_set_option(socket, ENET_SOCKOPT_RCVBUF, 1 << 20);
+  enet_socket_set_option(socket, ENET_SOCKOPT_SNDBUF, 1 << 20);
+
+  return socket;
+}
+
+
+WanEmulator::WanEmulator():
+  socket_(ENET_SOCKET_NULL),
+  sequence_(0),
+  rng_(std::random_device{}()),
+  start_time_(std::chrono::steady_clock::now())
+{
+
+}
+
+
+WanEmulator::~WanEmulator()
+{
+  for (auto &flow: flows_)
+    enet_socket_destroy(flow->socket);
+
+  if (socket_ != ENET_SOCKET_NULL)
+    enet_socket_destroy(socket_);
+}
+
+
+bool WanEmulator::init(int port, const std::string &server_host, int server_port)
+{
+  if (enet_address_set_host(&server_address_, server_host.c_str()) < 0) {
+    fprintf(stderr, "Could not resolve %s\n", server_host.c_str());
+    return false;
+  }
+  server_address_.port = server_port;
+
+  ENetAddress address;
+  address.host = ENET_HOST_ANY;
+  address.port = port;
+  socket_ = create_socket(&address);
+
+  if (socket_ == ENET_SOCKET_NULL) {
+    fprintf(stderr, "Could not create the emulator socket on port %d\n", port);
+    return false;
+  }
+
+  return true;
+}
+
+
+void WanEmulator::set_conditions(Direction direction, const LinkConditions &conditions)
+{
+  conditions_[static_cast<int>(direction)] = conditions;
+}
+
+
+void WanEmulator::set_peer_conditions(
+  const ENetAddress &client,
+  Direction direction,
+  const LinkConditions &conditions
+)
+{
+  peer_conditions_[static_cast<int>(direction)][address_key(client)] = conditions;
+}
+
+
+void WanEmulator::service()
+{
+  if (socket_ == ENET_SOCKET_NULL)
+    return;
+
+  receive(socket_, nullptr, Direction::UPSTREAM);
+
+  for (auto &flow: flows_)
+    receive(flow->socket, flow.get(), Direction::DOWNSTREAM);
+
+  // Forward the datagrams that are due
+  double t = now();
+
+  while (!queue_.empty() && queue_.top().release_time <= t) {
+    const Datagram &datagram = queue_.top();
+    ENetBuffer buffer;
+    buffer.data = (void*)datagram.data.data();
+    buffer.dataLength = datagram.data.size();
+
+    if (datagram.direction == Direction::UPSTREAM)
+      enet_socket_send(datagram.flow->socket, &server_address_, &buffer, 1);
+    else
+      enet_socket_send(socket_, &datagram.flow->client, &buffer, 1);
+
+    Stats &stats = stats_[static_cast<int>(datagram.direction)];
+    stats.sent++;
+    stats.bytes += datagram.data.size();
+
+    queue_.pop();
+  }
+}
+
+
+const WanEmulator::Stats& WanEmulator::get_stats(Direction direction) const
+{
+  return stats_[static_cast<int>(direction)];
+}
+
+
+double WanEmulator::now() const
+{
+  std::chrono::duration<double> t = std::chrono::steady_clock::now() - start_time_;
+  return t.count();
+}
+
+
+WanEmulator::Flow* WanEmulator::get_flow(const ENetAddress &client)
+{
+  auto it = flows_by_address_.find(address_key(client));
+
+  if (it != flows_by_address_.end())
+    return it->second;
+
+  ENetSocket socket = create_socket(nullptr);
+
+  if (socket == ENET_SOCKET_NULL)
+    return nullptr;
+
+  auto flow = std::make_unique<Flow>();
+  flow->client = client;
+  flow->socket = socket;
+  flow->link_free_time[0] = 0.0;
+  flow->link_free_time[1] = 0.0;
+
+  Flow *flow_ptr = flow.get();
+  flows_.push_back(std::move(flow));
+  flows_by_address_[address_key(client)] = flow_ptr;
+
+  return flow_ptr;
+}
+
+
+const LinkConditions& WanEmulator::get_conditions(const Flow *flow, Direction direction) const
+{
+  const auto &overrides = peer_conditions_[static_cast<int>(direction)];
+  auto it = overrides.find(address_key(flow->client));
+
+  if (it != overrides.end())
+    return it->second;
+
+  return conditions_[static_cast<int>(direction)];
+}
+
+
+void WanEmulator::schedule(Flow *flow, Direction direction, const uint8_t *data, size_t length)
+{
+  const LinkConditions &conditions = get_conditions(flow, direction);
+  Stats &stats = stats_[static_cast<int>(direction)];
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  stats.received++;
+
+  if (conditions.mtu > 0 && length > conditions.mtu) {
+    stats.too_large++;
+    return;
+  }
+
+  if (uniform(rng_) < conditions.loss) {
+    stats.dropped++;
+    return;
+  }
+
+  int copies = 1;
+
+  if (uniform(rng_) < conditions.duplication) {
+    stats.duplicated++;
+    copies = 2;
+  }
+
+  for (int k = 0; k < copies; k++) {
+    // The bandwidth cap serialises the datagrams on the link
+    double t = now();
+    double &link_free_time = flow->link_free_time[static_cast<int>(direction)];
+
+    if (conditions.bandwidth > 0.0) {
+      link_free_time = std::max(link_free_time, t) + length / conditions.bandwidth;
+      t = link_free_time;
+    }
+
+    double delay = conditions.latency;
+
+    if (conditions.jitter > 0.0)
+      delay += conditions.jitter * (2.0 * uniform(rng_) - 1.0);
+
+    if (uniform(rng_) < conditions.reordering) {
+      stats.reordered++;
+      delay += conditions.reorder_delay;
+    }
+
+    Datagram datagram;
+    datagram.release_time = t + std::max(delay, 0.0);
+    datagram.sequence = sequence_++;
+    datagram.direction = direction;
+    datagram.flow = flow;
+    datagram.data.assign(data, data + length);
+
+    queue_.push(std::move(datagram));
+  }
+}
+
+
+void WanEmulator::receive(ENetSocket socket, Flow *flow, Direction direction)
+{
+  uint8_t data[ENET_PROTOCOL_MAXIMUM_MTU];
+  ENetBuffer buffer;
+  buffer.data = data;
+  buffer.dataLength = sizeof(data);
+
+  ENetAddress address;
+  int length;
+
+  while ((length = enet_socket_receive(socket, &address, &buffer, 1)) > 0) {
+    if (direction == Direction::UPSTREAM) {
+      Flow *client_flow = get_flow(address);
+
+      if (client_flow != nullptr)
+        schedule(client_flow, direction, data, length);
+    } else {
+      schedule(flow, direction, data, length);
+    }
+  }
+}
+
+
+}  // namespace net
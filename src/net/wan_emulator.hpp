@@ -0,0 +1,163 @@
+/**
+ * @file
+ *
+ * \brief  Emulation of wide area network conditions between clients and a server
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#ifndef NET__WAN_EMULATOR_HPP
+#define NET__WAN_EMULATOR_HPP
+
+#include "enet/enet.h"
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cstdint>
+
+
+namespace net
+{
+
+/// Conditions applied to the datagrams going in one direction of a link
+struct LinkConditions
+{
+  double latency = 0.0;        ///< One-way delay (in s)
+  double jitter = 0.0;         ///< Maximal random deviation from the latency (in s)
+  double loss = 0.0;           ///< Probability of dropping a datagram
+  double duplication = 0.0;    ///< Probability of sending a datagram twice
+  double reordering = 0.0;     ///< Probability of holding a datagram back so that it is overtaken
+  double reorder_delay = 0.01; ///< Additional delay of the datagrams held back (in s)
+  double bandwidth = 0.0;      ///< Maximal throughput (in bytes/s), 0 for unlimited
+  size_t mtu = 0;              ///< Largest datagram carried (in bytes), larger ones are dropped, 0 for unlimited
+};
+
+
+/**
+ * \brief  UDP relay degrading the traffic between clients and a server
+ *
+ * Clients connect to the emulator instead of the server. Each client is given its
+ * own socket towards the server, so that the server still sees one address per
+ * client. Conditions can be set for each direction, and overridden for each client.
+ */
+class WanEmulator
+{
+  public:
+    /// Direction of the traffic
+    enum class Direction
+    {
+      UPSTREAM,   ///< From the clients to the server
+      DOWNSTREAM  ///< From the server to the clients
+    };
+
+    /// Statistics about the traffic in one direction
+    struct Stats
+    {
+      uint64_t received = 0;    ///< Number of datagrams received
+      uint64_t sent = 0;        ///< Number of datagrams forwarded (including duplicates)
+      uint64_t dropped = 0;     ///< Number of datagrams lost on purpose
+      uint64_t too_large = 0;   ///< Number of datagrams dropped for being larger than the MTU
+      uint64_t duplicated = 0;  ///< Number of datagrams duplicated
+      uint64_t reordered = 0;   ///< Number of datagrams held back
+      uint64_t bytes = 0;       ///< Number of bytes forwarded
+    };
+
+    WanEmulator();
+    ~WanEmulator();
+
+    WanEmulator(const WanEmulator&) = delete;
+    WanEmulator& operator=(const WanEmulator&) = delete;
+
+    /**
+     * \brief  Starts listening for clients
+     *
+     * \param port         Port on which the clients should connect
+     * \param server_host  Hostname or IP address of the server
+     * \param server_port  Port of the server
+     * \return  Whether the emulator could be started
+     */
+    bool init(int port, const std::string &server_host, int server_port);
+
+    /// Sets the conditions applied to all clients in a direction
+    void set_conditions(Direction direction, const LinkConditions &conditions);
+
+    /**
+     * \brief  Overrides the conditions applied to one client in a direction
+     *
+     * \param client      Address of the client, as seen by the emulator
+     * \param direction   Direction of the traffic to degrade
+     * \param conditions  Conditions to apply
+     */
+    void set_peer_conditions(
+      const ENetAddress &client,
+      Direction direction,
+      const LinkConditions &conditions
+    );
+
+    /// Forwards the datagrams that are due, without blocking
+    void service();
+
+    /// Returns statistics about the traffic in a direction
+    const Stats& get_stats(Direction direction) const;
+
+  private:
+    /// Traffic between one client and the server
+    struct Flow
+    {
+      ENetAddress client;       ///< Address of the client
+      ENetSocket socket;        ///< Socket used to talk to the server on behalf of the client
+      double link_free_time[2]; ///< When the link will be free again in each direction (in s)
+    };
+
+    /// Datagram waiting to be forwarded
+    struct Datagram
+    {
+      double release_time;        ///< When the datagram should be forwarded (in s)
+      uint64_t sequence;          ///< Order of scheduling, to break ties
+      Direction direction;        ///< Where the datagram is going
+      Flow *flow;                 ///< Flow of the datagram
+      std::vector<uint8_t> data;  ///< Content of the datagram
+
+      bool operator>(const Datagram &other) const
+      {
+        if (release_time != other.release_time)
+          return release_time > other.release_time;
+        return sequence > other.sequence;
+      }
+    };
+
+    ENetSocket socket_;          ///< Socket on which the clients connect
+    ENetAddress server_address_; ///< Address of the server
+    std::vector<std::unique_ptr<Flow>> flows_;             ///< All flows, one per client
+    std::unordered_map<uint64_t, Flow*> flows_by_address_; ///< Flows indexed by client address
+    std::priority_queue<Datagram, std::vector<Datagram>, std::greater<Datagram>> queue_;  ///< Datagrams waiting to be forwarded
+    LinkConditions conditions_[2];  ///< Conditions applied to all clients, per direction
+    std::unordered_map<uint64_t, LinkConditions> peer_conditions_[2];  ///< Overrides per client and direction
+    Stats stats_[2];             ///< Statistics per direction
+    uint64_t sequence_;          ///< Number of datagrams scheduled so far
+    std::mt19937 rng_;           ///< Random generator for the conditions
+    std::chrono::steady_clock::time_point start_time_;  ///< Origin of the emulator clock
+
+    /// Returns the current time of the emulator clock (in s)
+    double now() const;
+
+    /// Returns the flow of a client, creating it if needed (nullptr on failure)
+    Flow* get_flow(const ENetAddress &client);
+
+    /// Returns the conditions applying to a flow in a direction
+    const LinkConditions& get_conditions(const Flow *flow, Direction direction) const;
+
+    /// Applies the conditions to a received datagram, and schedules its forwarding
+    void schedule(Flow *flow, Direction direction, const uint8_t *data, size_t length);
+
+    /// Receives all pending datagrams from a socket
+    void receive(ENetSocket socket, Flow *flow, Direction direction);
+};
+
+}  // namespace net
+
+#endif
@@ -0,0 +1,41 @@
+/**
+ * @file
+ *
+ * \brief  Example server
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ */
+
+#include "net/server.hpp"
+#include "net/recorder.hpp"
+#include <string>
+#include <chrono>
+#include <thread>
+
+#include <cstring>
+
+
+int main(int argc, char **argv)
+{
+  const int port = 1234;
+  const int validation_str_size = 128;
+  const std::string validation_salt = "Blektr!";
+
+  net::NetServer server(port, validation_str_size, validation_salt);
+  server.init();
+
+  // Optionally record all the traffic for offline replay
+  net::EventRecorder recorder;
+
+  if (argc >= 3 && strcmp(argv[1], "--record") == 0) {
+    if (recorder.open(argv[2]))
+      server.set_recorder(&recorder);
+  }
+
+  while (true) {
+    server.handle_events();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  }
+
+  return 0;
+}
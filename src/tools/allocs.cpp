@@ -0,0 +1,460 @@
+/**
+ * @file
+ *
+ * \brief  Counts the memory allocations of the message path in steady state
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Usage: allocs [--messages <n>] [--warmup <n>] [--size <bytes>] [--max-allocs <n>]
+ *
+ * A client and a server echoing its messages run in the same thread over
+ * loopback. After the warm-up messages, every allocation made through operator
+ * new, malloc, calloc or realloc is counted, per thread and per call site, while
+ * the client sends its messages one by one and waits for their echo. The tool
+ * fails (exit status 1) if more than --max-allocs allocations were made per
+ * message, so that it can be run by continuous integration.
+ *
+ * The server and the client are a plain NetServer and NetClient, so that the
+ * allocations of their defaults are measured (net::EnetAllocator included,
+ * installed by init).
+ */
+
+#include "net/server.hpp"
+#include "net/client.hpp"
+#include "net/packet.hpp"
+#include "enet/enet.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#include <cstring>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <stdio.h>
+
+
+const std::string VALIDATION_SALT = "Blektr!";
+const int VALIDATION_STR_SIZE = 128;
+const int SERVER_PORT = 1236;
+
+
+// =============================================================================
+// Allocation counting
+//
+#ifdef __GLIBC__
+extern "C"
+{
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void *memory, size_t size);
+}
+#endif
+
+namespace
+{
+  /// Number of frames identifying a call site
+  constexpr int SITE_FRAME_COUNT = 4;
+
+  /// Frames of the hooks themselves, skipped
+  constexpr int SKIPPED_FRAME_COUNT = 2;
+
+  /// Maximal number of threads and of call sites per thread
+  constexpr size_t MAX_THREAD_COUNT = 64;
+  constexpr size_t MAX_SITE_COUNT = 1024;
+
+  /// Allocations made from a call site
+  struct Site
+  {
+    void *frames[SITE_FRAME_COUNT];  ///< Return addresses, innermost first
+    uint64_t count;  ///< Number of allocations
+    uint64_t bytes;  ///< Number of bytes allocated
+  };
+
+  /// Allocations made by a thread, only written by the thread itself
+  struct ThreadAllocations
+  {
+    uint64_t count;  ///< Number of allocations
+    uint64_t bytes;  ///< Number of bytes allocated
+    size_t site_count;  ///< Number of call sites used
+    Site sites[MAX_SITE_COUNT];  ///< Call sites, in an open-addressing table
+  };
+
+  // Static storage only, since the hooks cannot allocate
+  ThreadAllocations thread_allocations[MAX_THREAD_COUNT];
+  std::atomic<size_t> thread_count(0);
+  std::atomic<bool> counting(false);
+  thread_local int thread_index = -1;
+  thread_local bool in_hook = false;
+
+  /// Counts an allocation of the calling thread
+  void count_allocation(size_t size)
+  {
+    if (!counting.load(std::memory_order_relaxed) || in_hook)
+      return;
+
+    in_hook = true;
+
+    if (thread_index < 0) {
+      size_t index = thread_count.fetch_add(1);
+      thread_index = index < MAX_THREAD_COUNT ? index : MAX_THREAD_COUNT - 1;
+    }
+
+    ThreadAllocations &allocations = thread_allocations[thread_index];
+    allocations.count++;
+    allocations.bytes += size;
+
+    void *frames[SKIPPED_FRAME_COUNT + SITE_FRAME_COUNT] = {};
+    backtrace(frames, SKIPPED_FRAME_COUNT + SITE_FRAME_COUNT);
+    void **site_frames = frames + SKIPPED_FRAME_COUNT;
+
+    size_t hash = 0;
+
+    for (int k = 0; k < SITE_FRAME_COUNT; k++)
+      hash = hash * 31 + reinterpret_cast<uintptr_t>(site_frames[k]);
+
+    for (size_t probe = 0; probe < MAX_SITE_COUNT; probe++) {
+      Site &site = allocations.sites[(hash + probe) % MAX_SITE_COUNT];
+
+      if (site.count == 0) {
+        memcpy(site.frames, site_frames, sizeof(site.frames));
+        allocations.site_count++;
+      } else if (memcmp(site.frames, site_frames, sizeof(site.frames)) != 0) {
+        continue;
+      }
+
+      site.count++;
+      site.bytes += size;
+      break;
+    }
+
+    in_hook = false;
+  }
+
+  /// Allocates without being counted again by the interposed malloc
+  void* allocate(size_t size)
+  {
+#ifdef __GLIBC__
+    return __libc_malloc(size);
+#else
+    return malloc(size);
+#endif
+  }
+
+  /// Returns the name of the function containing an address
+  std::string get_symbol(void *address)
+  {
+    Dl_info info;
+
+    if (address == nullptr || dladdr(address, &info) == 0 || info.dli_sname == nullptr) {
+      char text[32];
+      snprintf(text, sizeof(text), "%p", address);
+      return text;
+    }
+
+    int status;
+    char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string symbol = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+
+    return symbol;
+  }
+
+  /// Forgets all the allocations counted so far
+  void reset_allocations()
+  {
+    size_t count = std::min(thread_count.load(), MAX_THREAD_COUNT);
+
+    for (size_t k = 0; k < count; k++)
+      memset(&thread_allocations[k], 0, sizeof(ThreadAllocations));
+  }
+
+  /// Prints the allocations of each thread, and their main call sites
+  uint64_t print_allocations(size_t max_site_count)
+  {
+    size_t count = std::min(thread_count.load(), MAX_THREAD_COUNT);
+    uint64_t total = 0;
+
+    for (size_t k = 0; k < count; k++) {
+      const ThreadAllocations &allocations = thread_allocations[k];
+      total += allocations.count;
+
+      if (allocations.count == 0)
+        continue;
+
+      printf(
+        "Thread %zu: %lu allocations, %lu bytes, %zu call sites\n",
+        k, (unsigned long)allocations.count, (unsigned long)allocations.bytes, allocations.site_count
+      );
+
+      std::vector<const Site*> sites;
+
+      for (const Site &site: allocations.sites) {
+        if (site.count > 0)
+          sites.push_back(&site);
+      }
+
+      std::sort(sites.begin(), sites.end(), [](const Site *a, const Site *b) {
+        return a->count > b->count;
+      });
+
+      for (size_t i = 0; i < std::min(sites.size(), max_site_count); i++) {
+        printf("  %lu allocations, %lu bytes\n", (unsigned long)sites[i]->count, (unsigned long)sites[i]->bytes);
+
+        for (void *frame: sites[i]->frames)
+          printf("    %s\n", get_symbol(frame).c_str());
+      }
+    }
+
+    return total;
+  }
+}
+
+
+// Replacements of the global allocation functions
+void* operator new(size_t size)
+{
+  count_allocation(size);
+  void *memory = allocate(size);
+
+  if (memory == nullptr)
+    throw std::bad_alloc();
+
+  return memory;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  count_allocation(size);
+  return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return operator new(size, std::nothrow);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+  count_allocation(size);
+  void *memory = aligned_alloc(
+    static_cast<size_t>(alignment),
+    (size + static_cast<size_t>(alignment) - 1) & ~(static_cast<size_t>(alignment) - 1)
+  );
+
+  if (memory == nullptr)
+    throw std::bad_alloc();
+
+  return memory;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+  return operator new(size, alignment);
+}
+
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete[](void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+void operator delete[](void *memory, size_t) noexcept { free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { free(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { free(memory); }
+void operator delete(void *memory, size_t, std::align_val_t) noexcept { free(memory); }
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept { free(memory); }
+
+
+#ifdef __GLIBC__
+// The C allocation functions of glibc are interposed too (ENet and the C library use them)
+extern "C"
+{
+  void* malloc(size_t size)
+  {
+    count_allocation(size);
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t count, size_t size)
+  {
+    count_allocation(count * size);
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void *memory, size_t size)
+  {
+    count_allocation(size);
+    return __libc_realloc(memory, size);
+  }
+}
+#endif
+
+
+// =============================================================================
+// Loopback scenario
+//
+/// Command line options of the form "--name value"
+class Options
+{
+  public:
+    Options(int argc, char **argv, int first)
+    {
+      for (int k = first; k + 1 < argc; k += 2) {
+        if (strncmp(argv[k], "--", 2) == 0)
+          values_[argv[k] + 2] = argv[k + 1];
+      }
+    }
+
+    double get(const std::string &name, double default_value) const
+    {
+      auto it = values_.find(name);
+      return it == values_.end() ? default_value : atof(it->second.c_str());
+    }
+
+  private:
+    std::map<std::string, std::string> values_;
+};
+
+
+/// Server sending back every message it receives
+class EchoServer: public net::NetServer
+{
+  public:
+    EchoServer(int port):
+      NetServer(port, VALIDATION_STR_SIZE, VALIDATION_SALT)
+    {
+
+    }
+
+  protected:
+    void message_cb(ENetPeer *peer, const net::Packet &packet) override
+    {
+      send_packet(peer, packet, 0);
+    }
+};
+
+
+/// Client sending the same message, and counting its echoes
+class EchoClient: public net::NetClient
+{
+  public:
+    uint64_t echoed = 0;  ///< Number of messages echoed
+
+    EchoClient():
+      NetClient(VALIDATION_SALT)
+    {
+
+    }
+
+  protected:
+    void message_cb(const net::Packet &packet) override
+    {
+      if (packet.get_data().compare(0, 5, "echo:") == 0)
+        echoed++;
+    }
+};
+
+
+/// Sends a message and services both hosts until it is echoed, returns whether it was
+static bool ping(EchoServer &server, EchoClient &client, const net::Packet &message)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  const uint64_t echoed = client.echoed;
+  client.send_packet(message, 0);
+
+  while (client.echoed == echoed) {
+    server.handle_events();
+    client.handle_events();
+
+    if (std::chrono::steady_clock::now() > deadline)
+      return false;
+  }
+
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  Options options(argc, argv, 1);
+  size_t message_count = options.get("messages", 10000);
+  size_t warmup_count = options.get("warmup", 1000);
+  size_t size = options.get("size", 64);
+  double max_allocations = options.get("max-allocs", 0.0);
+
+  // Loads what backtrace needs before counting
+  void *frames[SITE_FRAME_COUNT];
+  backtrace(frames, SITE_FRAME_COUNT);
+
+  EchoServer server(SERVER_PORT);
+  EchoClient client;
+  server.set_verbose(false);
+  client.set_verbose(false);
+
+  if (!server.init() || !client.init())
+    return 1;
+
+  client.connect("127.0.0.1", SERVER_PORT, 5.0);
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+  while (!client.is_validated() || server.get_peers().count_connected() == 0) {
+    server.handle_events();
+    client.handle_events();
+
+    if (std::chrono::steady_clock::now() > deadline) {
+      fprintf(stderr, "Could not connect to the server\n");
+      return 1;
+    }
+  }
+
+  std::string data = "echo:";
+  data.resize(std::max(size, data.size()), 'x');
+  net::Packet message(net::Packet::Type::DATA, data);
+
+  for (size_t k = 0; k < warmup_count; k++) {
+    if (!ping(server, client, message)) {
+      fprintf(stderr, "Message lost during the warm-up\n");
+      return 1;
+    }
+  }
+
+  reset_allocations();
+  counting.store(true);
+  const auto start = std::chrono::steady_clock::now();
+
+  for (size_t k = 0; k < message_count; k++) {
+    if (!ping(server, client, message)) {
+      counting.store(false);
+      fprintf(stderr, "Message lost\n");
+      return 1;
+    }
+  }
+
+  const double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  counting.store(false);
+
+  printf(
+    "Allocations: %zu messages of %zu bytes echoed in %.2f s\n",
+    message_count, size, duration
+  );
+  uint64_t total = print_allocations(10);
+  double per_message = message_count > 0 ? (double)total / message_count : 0.0;
+  printf("Total: %lu allocations, %.3f per message\n", (unsigned long)total, per_message);
+
+  if (per_message > max_allocations) {
+    printf("FAILED: more than %.3f allocations per message\n", max_allocations);
+    return 1;
+  }
+
+  printf("PASSED\n");
+
+  return 0;
+}
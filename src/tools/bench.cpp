@@ -0,0 +1,1823 @@
+/**
+ * @file
+ *
+ * \brief  Benchmark harness for the networking library
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Usage: bench <scenario> [options]
+ *
+ * Scenarios:
+ *   echo  Clients send messages to a server echoing them back, all in the same
+ *         process over loopback, optionally through a WAN emulator.
+ *         Options: --clients <n> --duration <s> --rate <msg/s per client>
+ *                  --size <bytes> --latency <ms> --jitter <ms> --loss <p>
+ *                  --duplication <p> --reordering <p> --bandwidth <bytes/s>
+ *                  --static <0|1> (statically dispatched server, see BasicNetHost)
+ *                  --shm <0|1> (shared memory between the clients and the server)
+ *                  --clock <0|1> (timestamped messages, to measure one-way delays)
+ *                  Both are policies of BasicNetHost, used by the server and
+ *                  clients of the scenario when either is set
+ *                  --record <path> (event log of the server, to replay, see replay)
+ *   socket    Clients flood a server echoing unreliable messages, the server running
+ *             in its own thread so that its throughput and CPU time can be measured.
+ *             Options: --clients <n> --duration <s> --size <bytes> --batched <0|1>
+ *                      --batch-size <n> --gro <0|1> --gso <0|1>
+ *   reactor   Clients flood many servers, all serviced by one thread, either by a
+ *             reactor or by polling them in turn.
+ *             Options: --hosts <n> --duration <s> --size <bytes> --reactor <0|1>
+ *                      --io-uring <0|1>
+ *   ipc       A client pings a server running in another process of the same
+ *             machine, either through shared memory or through ENet over loopback.
+ *             Options: --messages <n> --size <bytes> --shm <0|1>
+ *                      --wait <0|1> (wait on the socket and eventfds instead of polling)
+ *   relay     An origin broadcasts to spectators through a tree of relays, each
+ *             in its own process.
+ *             Options: --relays <n> --fanout <n> --spectators <n> --duration <s>
+ *                      --rate <msg/s> --size <bytes>
+ *   churn     Clients connect to a server, then some of them vanish without
+ *             disconnecting, and the time taken by the server to free their slots
+ *             is measured. Idle clients can also be evicted to a capacity target.
+ *             Options: --clients <n> --vanish <n> --lifecycle <0|1> (default ENet
+ *                      timeouts if 0) --target <n> --idle <ms>
+ *   mtu       A client sends messages to a server echoing them back, through a WAN
+ *             emulator dropping the datagrams larger than the MTU of the path. The
+ *             MTU of the peers is either probed or left to the default of ENet.
+ *             Options: --mtu <bytes> --discovery <0|1> --messages <n>
+ *                      --size <bytes> (0 for the largest message sent unfragmented)
+ *   handover  Clients keep sending messages to a server echoing them back, which
+ *             hands its socket and peers over to a new process half-way. The time
+ *             without service and the longest wait for an echo are measured.
+ *             Options: --clients <n> (at most 32) --rate <msg/s per client>
+ *                      --duration <s>
+ *   encoding  Encodes and decodes typical state messages with the portable
+ *             binary and the bit-packed archives, and compares their size and
+ *             throughput.
+ *             Options: --messages <n>
+ */
+
+#include "net/server.hpp"
+#include "net/basic_host.hpp"
+#include "net/client.hpp"
+#include "net/packet.hpp"
+#include "net/wan_emulator.hpp"
+#include "net/bitpacked_archive.hpp"
+#include "net/reactor.hpp"
+#include "net/relay.hpp"
+#include "net/histogram.hpp"
+#include "net/recorder.hpp"
+#include "enet/enet.h"
+#include "cereal/archives/portable_binary.hpp"
+#include "cereal/types/string.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <sstream>
+#include <random>
+#include <atomic>
+#include <type_traits>
+
+#include <cstring>
+#include <cstdlib>
+#include <stdio.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+const std::string VALIDATION_SALT = "Blektr!";
+const int VALIDATION_STR_SIZE = 128;
+const int SERVER_PORT = 1234;
+const int EMULATOR_PORT = 1235;
+
+
+// =============================================================================
+// Helpers
+//
+/// Returns the current time (in ns)
+static uint64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+
+/// Returns the CPU time used by the calling thread (in ns)
+static uint64_t thread_cpu_ns()
+{
+  timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+
+/// Command line options of the form "--name value"
+class Options
+{
+  public:
+    Options(int argc, char **argv, int first)
+    {
+      for (int k = first; k + 1 < argc; k += 2) {
+        if (strncmp(argv[k], "--", 2) == 0)
+          values_[argv[k] + 2] = argv[k + 1];
+      }
+    }
+
+    double get(const std::string &name, double default_value) const
+    {
+      auto it = values_.find(name);
+      return it == values_.end() ? default_value : atof(it->second.c_str());
+    }
+
+    std::string get_string(const std::string &name, const std::string &default_value) const
+    {
+      auto it = values_.find(name);
+      return it == values_.end() ? default_value : it->second;
+    }
+
+  private:
+    std::map<std::string, std::string> values_;
+};
+
+
+/// Prints percentiles of a list of samples
+static void print_percentiles(const char *name, std::vector<double> samples, const char *unit)
+{
+  if (samples.empty()) {
+    printf("%s: no samples\n", name);
+    return;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&](double p) {
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+  };
+
+  printf(
+    "%s (%s): p50=%.3f p90=%.3f p99=%.3f max=%.3f\n",
+    name, unit, percentile(0.5), percentile(0.9), percentile(0.99), samples.back()
+  );
+}
+
+
+/// Prints the percentiles of a histogram of durations in µs
+static void print_histogram(const char *name, const net::LatencyHistogram &histogram)
+{
+  if (histogram.get_count() == 0) {
+    printf("%s: no samples\n", name);
+    return;
+  }
+
+  printf(
+    "%s (ms): p50=%.3f p90=%.3f p99=%.3f max=%.3f\n",
+    name,
+    histogram.get_percentile(0.5) * 1e-3,
+    histogram.get_percentile(0.9) * 1e-3,
+    histogram.get_percentile(0.99) * 1e-3,
+    histogram.get_max() * 1e-3
+  );
+}
+
+
+// =============================================================================
+// Echo scenario
+//
+/// Server sending back every message it receives
+class EchoServer: public net::NetServer
+{
+  public:
+    EchoServer(int port):
+      NetServer(port, VALIDATION_STR_SIZE, VALIDATION_SALT)
+    {
+
+    }
+
+  protected:
+    void message_cb(ENetPeer *peer, const net::Packet &packet) override
+    {
+      send_packet(peer, packet, 0);
+    }
+};
+
+
+/// Same server, with statically dispatched callbacks and no logging
+class StaticEchoServer: public net::BasicNetHost<StaticEchoServer,
+  net::policy::PuzzleValidation,
+  net::policy::Logging<net::policy::LogLevel::NONE>
+>
+{
+  friend BasicNetHost;
+
+  public:
+    StaticEchoServer(int port):
+      port_(port)
+    {
+      get_validation().configure(VALIDATION_SALT, VALIDATION_STR_SIZE);
+    }
+
+    bool init()
+    {
+      return BasicNetHost::init() && listen(port_, 32, 2);
+    }
+
+  private:
+    const int port_;  ///< Port used by the clients to connect to the server
+
+    void receive_cb(ENetEvent &event)
+    {
+      send(event.peer, event.packet->data, event.packet->dataLength);
+    }
+};
+
+
+/// BasicNetHost of the echo server and client below, with some optional policies
+template <typename Derived, typename... Policies>
+using PolicyEchoHost = net::BasicNetHost<Derived,
+  net::policy::PuzzleValidation,
+  net::policy::Logging<net::policy::LogLevel::NONE>,
+  Policies...
+>;
+
+
+/// Same server, with optional policies which NetServer does not use (shared memory for instance)
+template <typename... Policies>
+class PolicyEchoServer: public PolicyEchoHost<PolicyEchoServer<Policies...>, Policies...>
+{
+  using Host = PolicyEchoHost<PolicyEchoServer, Policies...>;
+  friend Host;
+
+  public:
+    PolicyEchoServer(int port):
+      port_(port)
+    {
+      this->get_validation().configure(VALIDATION_SALT, VALIDATION_STR_SIZE);
+    }
+
+    bool init()
+    {
+      return Host::init() && this->listen(port_, 32, 2);
+    }
+
+    /// Returns the first connected peer (nullptr if none)
+    ENetPeer* get_peer()
+    {
+      ENetHost *host = this->get_host();
+
+      for (size_t k = 0; k < host->peerCount; k++) {
+        if (host->peers[k].state == ENET_PEER_STATE_CONNECTED)
+          return &host->peers[k];
+      }
+
+      return nullptr;
+    }
+
+  private:
+    const int port_;        ///< Port used by the clients to connect to the server
+    net::Packet received_;  ///< Last packet received
+
+    // Decoded and sent again, so that the policies add their own data to the echo
+    void receive_cb(ENetEvent &event)
+    {
+      received_.load_serialised((char*)event.packet->data, event.packet->dataLength);
+      this->send_packet(event.peer, received_, 0);
+    }
+};
+
+
+/// Returns a message stamped with the current time, padded to the given size
+static net::Packet make_echo_message(size_t size)
+{
+  std::string data = "bench:" + std::to_string(now_ns()) + ":";
+
+  if (data.size() < size)
+    data.resize(size, 'x');
+
+  return net::Packet(net::Packet::Type::DATA, data);
+}
+
+
+/// Appends the round trip time of an echoed message (in ms), if the packet is one
+static void record_echo(const net::Packet &packet, std::vector<double> &round_trip_times)
+{
+  std::string data = packet.get_data();
+
+  if (data.compare(0, 6, "bench:") != 0)
+    return;
+
+  uint64_t sent_time = strtoull(data.c_str() + 6, nullptr, 10);
+  round_trip_times.push_back((now_ns() - sent_time) * 1e-6);
+}
+
+
+/// Client measuring the round trip time of its echoed messages
+class EchoClient: public net::NetClient
+{
+  public:
+    std::vector<double> round_trip_times;  ///< Round trip time of each echoed message (in ms)
+    uint64_t sent = 0;                     ///< Number of messages sent
+
+    EchoClient():
+      NetClient(VALIDATION_SALT)
+    {
+
+    }
+
+    /// Sends a message stamped with the current time, padded to the given size
+    void send_message(size_t size)
+    {
+      send_packet(make_echo_message(size), 0);
+      sent++;
+    }
+
+  protected:
+    void message_cb(const net::Packet &packet) override
+    {
+      record_echo(packet, round_trip_times);
+    }
+};
+
+
+/// Same client, with optional policies which NetClient does not use
+template <typename... Policies>
+class PolicyEchoClient: public PolicyEchoHost<PolicyEchoClient<Policies...>, Policies...>
+{
+  using Host = PolicyEchoHost<PolicyEchoClient, Policies...>;
+  friend Host;
+
+  public:
+    std::vector<double> round_trip_times;  ///< Round trip time of each echoed message (in ms)
+    uint64_t sent = 0;                     ///< Number of messages sent
+
+    PolicyEchoClient()
+    {
+      this->get_validation().configure(VALIDATION_SALT, VALIDATION_STR_SIZE);
+    }
+
+    /// Initialises networking and initiates the connection, returns whether it was successful
+    bool init(const std::string &host, int port)
+    {
+      if (!Host::init() || !this->open(1, 2))
+        return false;
+
+      peer_ = this->connect(host, port, 2);
+      return peer_ != nullptr;
+    }
+
+    /// Returns the server (nullptr if not connecting)
+    ENetPeer* get_peer() const
+    {
+      return peer_;
+    }
+
+    /// Returns whether the server has been validated
+    bool is_validated() const
+    {
+      return peer_ != nullptr && Host::is_validated(peer_);
+    }
+
+    /// Sends a message stamped with the current time, padded to the given size
+    void send_message(size_t size)
+    {
+      this->send_packet(peer_, make_echo_message(size), 0);
+      sent++;
+    }
+
+  private:
+    ENetPeer *peer_ = nullptr;  ///< Server
+    net::Packet received_;      ///< Last packet received
+
+    // Only used if the transport policy supports it, and the server is on the same machine
+    void validated_cb(ENetPeer *peer)
+    {
+      this->offer_shared_memory(peer);
+    }
+
+    void receive_cb(ENetEvent &event)
+    {
+      received_.load_serialised((char*)event.packet->data, event.packet->dataLength);
+
+      if (received_.get_type() == net::Packet::Type::DATA)
+        record_echo(received_, round_trip_times);
+    }
+};
+
+
+/// Initialises a client and initiates its connection, returns whether it was successful
+static bool start_client(EchoClient &client, int port)
+{
+  client.set_verbose(false);
+  return client.init() && client.connect("127.0.0.1", port, 10.0);
+}
+
+
+template <typename... Policies>
+static bool start_client(PolicyEchoClient<Policies...> &client, int port)
+{
+  return client.init("127.0.0.1", port);
+}
+
+
+/**
+ * \brief  Runs the echo scenario with an initialised server
+ *
+ * \param options           Options of the scenario
+ * \param server            Server, either EchoServer, StaticEchoServer or a PolicyEchoServer
+ * \param configure_client  Called on each client before it connects
+ * \param description       Description of the server, printed with the results
+ */
+template <typename Client, typename Server, typename Configure>
+static int run_echo(const Options &options, Server &server, Configure configure_client, const char *description)
+{
+  int client_count = options.get("clients", 4);
+  double duration = options.get("duration", 5.0);
+  double rate = options.get("rate", 100.0);
+  size_t size = options.get("size", 64);
+
+  net::LinkConditions conditions;
+  conditions.latency = options.get("latency", 0.0) * 1e-3;
+  conditions.jitter = options.get("jitter", 0.0) * 1e-3;
+  conditions.loss = options.get("loss", 0.0);
+  conditions.duplication = options.get("duplication", 0.0);
+  conditions.reordering = options.get("reordering", 0.0);
+  conditions.bandwidth = options.get("bandwidth", 0.0);
+
+  bool emulate = conditions.latency > 0 || conditions.jitter > 0 || conditions.loss > 0
+    || conditions.duplication > 0 || conditions.reordering > 0 || conditions.bandwidth > 0;
+
+  net::WanEmulator emulator;
+
+  if (emulate) {
+    if (!emulator.init(EMULATOR_PORT, "127.0.0.1", SERVER_PORT))
+      return 1;
+
+    emulator.set_conditions(net::WanEmulator::Direction::UPSTREAM, conditions);
+    emulator.set_conditions(net::WanEmulator::Direction::DOWNSTREAM, conditions);
+  }
+
+  std::vector<std::unique_ptr<Client>> clients;
+
+  for (int k = 0; k < client_count; k++) {
+    auto client = std::make_unique<Client>();
+    configure_client(*client);
+
+    if (!start_client(*client, emulate ? EMULATOR_PORT : SERVER_PORT))
+      return 1;
+
+    clients.push_back(std::move(client));
+  }
+
+  const auto send_interval = std::chrono::nanoseconds((uint64_t)(1e9 / rate));
+  const auto start = std::chrono::steady_clock::now();
+  const auto end = start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::duration<double>(duration)
+  );
+  std::vector<std::chrono::steady_clock::time_point> next_send(client_count, start);
+
+  while (std::chrono::steady_clock::now() < end) {
+    server.handle_events();
+
+    if (emulate)
+      emulator.service();
+
+    auto t = std::chrono::steady_clock::now();
+
+    for (int k = 0; k < client_count; k++) {
+      clients[k]->handle_events();
+
+      if (clients[k]->is_validated() && t >= next_send[k]) {
+        clients[k]->send_message(size);
+        next_send[k] = std::max(next_send[k] + send_interval, t - send_interval);
+      }
+    }
+
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  // Results
+  uint64_t sent = 0;
+  std::vector<double> round_trip_times;
+
+  for (auto &client: clients) {
+    sent += client->sent;
+    round_trip_times.insert(
+      round_trip_times.end(),
+      client->round_trip_times.begin(),
+      client->round_trip_times.end()
+    );
+  }
+
+  printf(
+    "Echo: %d clients, %.0f msg/s each, %zu bytes, %.1f s, %s\n",
+    client_count, rate, size, duration, description
+  );
+  printf(
+    "Messages: sent=%lu echoed=%zu (%.1f msg/s)\n",
+    (unsigned long)sent,
+    round_trip_times.size(),
+    round_trip_times.size() / duration
+  );
+  print_percentiles("Round trip time", round_trip_times, "ms");
+
+  // Measured on the messages sent after the clocks were estimated
+  if constexpr (std::is_same_v<typename Server::Clock, net::policy::ClockSync>) {
+    if (options.get("clock", 0) == 0)
+      return 0;
+
+    net::LatencyHistogram upstream, processing, downstream;
+    int64_t max_offset = 0;
+    ENetHost *host = server.get_host();
+
+    for (size_t k = 0; k < host->peerCount; k++) {
+      upstream.merge(server.get_clock().get_one_way_delays(&host->peers[k]));
+      processing.merge(server.get_clock().get_processing_times(&host->peers[k]));
+    }
+
+    for (auto &client: clients) {
+      downstream.merge(client->get_clock().get_one_way_delays(client->get_peer()));
+      max_offset = std::max(max_offset, std::abs(client->get_clock().get_offset(client->get_peer())));
+    }
+
+    print_histogram("Upstream one-way delay", upstream);
+    print_histogram("Server processing time", processing);
+    print_histogram("Downstream one-way delay", downstream);
+    printf("Largest clock offset estimate: %ld us (same clock, should be close to 0)\n", (long)max_offset);
+  }
+
+  if (emulate) {
+    const char *names[2] = {"Upstream", "Downstream"};
+
+    for (int k = 0; k < 2; k++) {
+      const auto &stats = emulator.get_stats(static_cast<net::WanEmulator::Direction>(k));
+      printf(
+        "%s datagrams: received=%lu sent=%lu dropped=%lu duplicated=%lu reordered=%lu bytes=%lu\n",
+        names[k],
+        (unsigned long)stats.received,
+        (unsigned long)stats.sent,
+        (unsigned long)stats.dropped,
+        (unsigned long)stats.duplicated,
+        (unsigned long)stats.reordered,
+        (unsigned long)stats.bytes
+      );
+    }
+  }
+
+  return 0;
+}
+
+
+static int run_echo(const Options &options)
+{
+  bool static_dispatch = options.get("static", 0) != 0;
+  bool shared_memory = options.get("shm", 0) != 0;
+  bool timestamps = options.get("clock", 0) != 0;
+  std::string record_path = options.get_string("record", "");
+
+  if (!record_path.empty() && (static_dispatch || shared_memory || timestamps)) {
+    fprintf(stderr, "Only the virtual server can record its events\n");
+    return 1;
+  }
+
+  // Shared memory and clock synchronisation are policies of BasicNetHost, not used by NetServer and NetClient
+  if (shared_memory || timestamps) {
+    using Client = PolicyEchoClient<net::policy::SharedMemoryTransport, net::policy::ClockSync>;
+    PolicyEchoServer<net::policy::SharedMemoryTransport, net::policy::ClockSync> server(SERVER_PORT);
+    server.get_transport().set_enabled(shared_memory);
+    server.get_clock().set_timestamps(timestamps);
+
+    if (!server.init())
+      return 1;
+
+    return run_echo<Client>(options, server, [&](Client &client) {
+      client.get_transport().set_enabled(shared_memory);
+      client.get_clock().set_timestamps(timestamps);
+    }, shared_memory ? "static dispatch, shared memory" : "static dispatch, timestamped");
+  }
+
+  if (static_dispatch) {
+    StaticEchoServer server(SERVER_PORT);
+
+    if (!server.init())
+      return 1;
+
+    return run_echo<EchoClient>(options, server, [](EchoClient &) {}, "static dispatch");
+  }
+
+  EchoServer server(SERVER_PORT);
+  server.set_verbose(false);
+
+  if (!server.init())
+    return 1;
+
+  net::EventRecorder recorder;
+
+  if (!record_path.empty()) {
+    if (!recorder.open(record_path))
+      return 1;
+
+    server.set_recorder(&recorder);
+  }
+
+  return run_echo<EchoClient>(options, server, [](EchoClient &) {}, "virtual dispatch");
+}
+
+
+// =============================================================================
+// Socket scenario
+//
+/// Server echoing every packet unreliably, without validation nor logging
+class FloodServer: public net::BasicNetHost<FloodServer,
+  net::policy::Logging<net::policy::LogLevel::NONE>,
+  net::policy::Delivery<0, 0>
+>
+{
+  friend BasicNetHost;
+
+  private:
+    void receive_cb(ENetEvent &event)
+    {
+      send(event.peer, event.packet->data, event.packet->dataLength);
+    }
+};
+
+
+/// Client sending unreliable packets as fast as possible
+class FloodClient: public net::BasicNetHost<FloodClient,
+  net::policy::Logging<net::policy::LogLevel::NONE>,
+  net::policy::Delivery<0, 0>
+>
+{
+  friend BasicNetHost;
+
+  public:
+    ENetPeer *peer = nullptr;  ///< Server
+    bool connected = false;    ///< Whether the connection is established
+
+  private:
+    void connect_cb(ENetEvent &)
+    {
+      connected = true;
+    }
+
+    void disconnect_cb(ENetEvent &)
+    {
+      connected = false;
+    }
+};
+
+
+static int run_socket(const Options &options)
+{
+  int client_count = options.get("clients", 32);
+  double duration = options.get("duration", 5.0);
+  size_t size = options.get("size", 64);
+
+  net::SocketOptions socket_options;
+  socket_options.backend = options.get("batched", 1) != 0 ?
+    net::SocketBackend::BATCHED : net::SocketBackend::STOCK;
+  socket_options.batch_size = options.get("batch-size", 64);
+  socket_options.gro = options.get("gro", 0) != 0;
+  socket_options.gso = options.get("gso", 0) != 0;
+
+  FloodServer server;
+  server.set_socket_options(socket_options);
+
+  if (!server.init() || !server.listen(SERVER_PORT, client_count, 2))
+    return 1;
+
+  std::vector<std::unique_ptr<FloodClient>> clients;
+
+  for (int k = 0; k < client_count; k++) {
+    auto client = std::make_unique<FloodClient>();
+
+    if (!client->open(1, 2))
+      return 1;
+
+    client->peer = client->connect("127.0.0.1", SERVER_PORT, 2);
+    clients.push_back(std::move(client));
+  }
+
+  // Connect all the clients before measuring
+  auto connection_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  int connected_count = 0;
+
+  while (connected_count < client_count && std::chrono::steady_clock::now() < connection_deadline) {
+    server.handle_events();
+    connected_count = 0;
+
+    for (auto &client: clients) {
+      client->handle_events();
+      connected_count += client->connected;
+    }
+  }
+
+  // The server runs in its own thread, so that its CPU time can be measured
+  ENetHost *host = server.get_host();
+  host->totalReceivedPackets = 0;
+  host->totalSentPackets = 0;
+
+  std::atomic<bool> running(true);
+  uint64_t server_cpu_time = 0;
+
+  std::thread server_thread([&]() {
+    uint64_t cpu_start = thread_cpu_ns();
+    ENetEvent event;
+
+    while (running) {
+      if (enet_host_service(host, &event, 1) > 0)
+        server.dispatch_event(event);
+    }
+
+    server_cpu_time = thread_cpu_ns() - cpu_start;
+  });
+
+  std::vector<uint8_t> data(size, 'x');
+  const auto start = std::chrono::steady_clock::now();
+  const auto end = start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::duration<double>(duration)
+  );
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (auto &client: clients) {
+      if (client->connected)
+        client->send(client->peer, data.data(), data.size());
+
+      client->handle_events();
+    }
+  }
+
+  running = false;
+  server_thread.join();
+
+  uint64_t received = host->totalReceivedPackets;
+  uint64_t sent = host->totalSentPackets;
+  const net::BatchedSocket *batched_socket = server.get_net_host().get_batched_socket();
+
+  printf(
+    "Socket: %s backend, %d/%d clients connected, %zu bytes, %.1f s\n",
+    batched_socket != nullptr ? "batched" : "stock",
+    connected_count, client_count, size, duration
+  );
+  printf(
+    "Server datagrams: received=%lu (%.0f/s) sent=%lu (%.0f/s)\n",
+    (unsigned long)received, received / duration,
+    (unsigned long)sent, sent / duration
+  );
+  printf(
+    "Server CPU: %.1f%% of a core, %.0f ns per datagram\n",
+    100.0 * server_cpu_time / (duration * 1e9),
+    received + sent > 0 ? (double)server_cpu_time / (received + sent) : 0.0
+  );
+
+  if (batched_socket != nullptr) {
+    const auto &stats = batched_socket->get_stats();
+    printf(
+      "System calls: recvmmsg=%lu (%.1f datagrams each) sendmmsg=%lu (%.1f datagrams each) gso_buffers=%lu send_errors=%lu\n",
+      (unsigned long)stats.receive_calls,
+      stats.receive_calls > 0 ? (double)stats.received / stats.receive_calls : 0.0,
+      (unsigned long)stats.send_calls,
+      stats.send_calls > 0 ? (double)stats.sent / stats.send_calls : 0.0,
+      (unsigned long)stats.gso_buffers,
+      (unsigned long)stats.send_errors
+    );
+  }
+
+  return 0;
+}
+
+
+// =============================================================================
+// Reactor scenario
+//
+static int run_reactor(const Options &options)
+{
+  int host_count = options.get("hosts", 32);
+  double duration = options.get("duration", 5.0);
+  size_t size = options.get("size", 64);
+  bool use_reactor = options.get("reactor", 1) != 0;
+  bool use_io_uring = options.get("io-uring", 1) != 0;
+
+  net::SocketOptions socket_options;
+  socket_options.backend = net::SocketBackend::BATCHED;
+
+  // One client per server
+  std::vector<std::unique_ptr<FloodServer>> servers;
+  std::vector<std::unique_ptr<FloodClient>> clients;
+
+  for (int k = 0; k < host_count; k++) {
+    auto server = std::make_unique<FloodServer>();
+    server->set_socket_options(socket_options);
+
+    if ((k == 0 && !server->init()) || !server->listen(SERVER_PORT + k, 1, 2))
+      return 1;
+
+    auto client = std::make_unique<FloodClient>();
+
+    if (!client->open(1, 2))
+      return 1;
+
+    client->peer = client->connect("127.0.0.1", SERVER_PORT + k, 2);
+    servers.push_back(std::move(server));
+    clients.push_back(std::move(client));
+  }
+
+  auto connection_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  int connected_count = 0;
+
+  while (connected_count < host_count && std::chrono::steady_clock::now() < connection_deadline) {
+    connected_count = 0;
+
+    for (int k = 0; k < host_count; k++) {
+      servers[k]->handle_events();
+      clients[k]->handle_events();
+      connected_count += clients[k]->connected;
+    }
+  }
+
+  // Declared after the servers, so that it releases them first
+  net::Reactor reactor;
+
+  if (use_reactor) {
+    if (!reactor.init(use_io_uring ? net::Reactor::Backend::IO_URING : net::Reactor::Backend::EPOLL))
+      return 1;
+
+    for (auto &server: servers)
+      reactor.add(*server);
+  }
+
+  for (auto &server: servers) {
+    server->get_host()->totalReceivedPackets = 0;
+    server->get_host()->totalSentPackets = 0;
+  }
+
+  std::atomic<bool> running(true);
+  uint64_t server_cpu_time = 0;
+
+  std::thread server_thread([&]() {
+    uint64_t cpu_start = thread_cpu_ns();
+
+    while (running) {
+      if (use_reactor) {
+        reactor.run_once(std::chrono::milliseconds(10));
+      } else {
+        for (auto &server: servers)
+          server->handle_events();
+      }
+    }
+
+    server_cpu_time = thread_cpu_ns() - cpu_start;
+  });
+
+  std::vector<uint8_t> data(size, 'x');
+  const auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::duration<double>(duration)
+  );
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (auto &client: clients) {
+      if (client->connected)
+        client->send(client->peer, data.data(), data.size());
+
+      client->handle_events();
+    }
+  }
+
+  running = false;
+  server_thread.join();
+
+  // System calls of the servers: the ones of the reactor and the ones of the batched sockets
+  uint64_t received = 0;
+  uint64_t sent = 0;
+  uint64_t system_calls = reactor.get_stats().system_calls;
+
+  for (auto &server: servers) {
+    received += server->get_host()->totalReceivedPackets;
+    sent += server->get_host()->totalSentPackets;
+    const net::BatchedSocket *batched_socket = server->get_net_host().get_batched_socket();
+
+    if (batched_socket != nullptr)
+      system_calls += batched_socket->get_stats().receive_calls + batched_socket->get_stats().send_calls;
+  }
+
+  const char *mode = "round-robin polling";
+
+  if (reactor.get_backend() == net::Reactor::Backend::IO_URING)
+    mode = "io_uring reactor";
+  else if (reactor.get_backend() == net::Reactor::Backend::EPOLL)
+    mode = "epoll reactor";
+
+  printf(
+    "Reactor: %s, %d/%d hosts connected, %zu bytes, %.1f s\n",
+    mode, connected_count, host_count, size, duration
+  );
+  printf(
+    "Server datagrams: received=%lu (%.0f/s) sent=%lu (%.0f/s)\n",
+    (unsigned long)received, received / duration,
+    (unsigned long)sent, sent / duration
+  );
+  printf(
+    "Server CPU: %.1f%% of a core, %.0f ns per datagram\n",
+    100.0 * server_cpu_time / (duration * 1e9),
+    received + sent > 0 ? (double)server_cpu_time / (received + sent) : 0.0
+  );
+  printf(
+    "System calls: %lu (%.3f per datagram)\n",
+    (unsigned long)system_calls,
+    received + sent > 0 ? (double)system_calls / (received + sent) : 0.0
+  );
+
+  if (use_reactor) {
+    const auto &stats = reactor.get_stats();
+    printf(
+      "Reactor: iterations=%lu services=%lu timer_completions=%lu send_errors=%lu\n",
+      (unsigned long)stats.iterations,
+      (unsigned long)stats.services,
+      (unsigned long)stats.timer_completions,
+      (unsigned long)stats.send_errors
+    );
+  }
+
+  return 0;
+}
+
+
+// =============================================================================
+// IPC scenario
+//
+static int run_ipc(const Options &options)
+{
+  size_t message_count = options.get("messages", 100000);
+  size_t size = options.get("size", 64);
+  bool shared_memory = options.get("shm", 1) != 0;
+  bool wait = options.get("wait", 0) != 0;
+
+  // Server in its own process, as a sidecar would talk to it
+  pid_t server_pid = fork();
+
+  if (server_pid == 0) {
+    PolicyEchoServer<net::policy::SharedMemoryTransport> server(SERVER_PORT);
+    server.get_transport().set_enabled(shared_memory);
+
+    if (!server.init())
+      _exit(1);
+
+    while (true) {
+      if (wait)
+        server.wait(std::chrono::milliseconds(10));
+
+      server.handle_events();
+    }
+  }
+
+  PolicyEchoClient<net::policy::SharedMemoryTransport> client;
+  client.get_transport().set_enabled(shared_memory);
+
+  if (!client.init("127.0.0.1", SERVER_PORT)) {
+    kill(server_pid, SIGKILL);
+    return 1;
+  }
+
+  // Connect, and let the shared memory be negotiated
+  const auto connection_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+  while (std::chrono::steady_clock::now() < connection_deadline
+    && !(client.is_validated() && (!shared_memory || client.get_transport().is_active(client.get_peer())))
+  ) {
+    client.handle_events();
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+
+  if (!client.is_validated()) {
+    fprintf(stderr, "Could not connect to the server\n");
+    kill(server_pid, SIGKILL);
+    return 1;
+  }
+
+  bool active = client.get_transport().is_active(client.get_peer());
+  client.round_trip_times.reserve(message_count);
+  const uint64_t start = now_ns();
+
+  for (size_t k = 0; k < message_count; k++) {
+    const size_t echoed = client.round_trip_times.size();
+    client.send_message(size);
+    client.handle_events();
+
+    while (client.round_trip_times.size() == echoed && now_ns() - start < 60000000000ull) {
+      if (wait)
+        client.wait(std::chrono::milliseconds(10));
+
+      client.handle_events();
+    }
+  }
+
+  const double duration = (now_ns() - start) * 1e-9;
+  kill(server_pid, SIGKILL);
+  waitpid(server_pid, nullptr, 0);
+
+  printf(
+    "IPC: %zu messages, %zu bytes, %s, %s\n",
+    message_count, size, active ? "shared memory" : "ENet over loopback",
+    wait ? "waiting" : "busy polling"
+  );
+  std::vector<double> round_trip_times;
+
+  for (double round_trip_time: client.round_trip_times)
+    round_trip_times.push_back(round_trip_time * 1e3);
+
+  printf("Messages: %.1f round trips/s\n", round_trip_times.size() / duration);
+  print_percentiles("Round trip time", round_trip_times, "us");
+
+  return 0;
+}
+
+
+// =============================================================================
+// Relay scenario
+//
+/// Origin broadcasting stamped messages, ignoring the messages of its peers
+class BroadcastServer: public net::NetServer
+{
+  public:
+    BroadcastServer(int port, size_t max_peer_count):
+      NetServer(port, VALIDATION_STR_SIZE, VALIDATION_SALT, max_peer_count)
+    {
+
+    }
+
+  protected:
+    void message_cb(ENetPeer *, const net::Packet &) override
+    {
+
+    }
+};
+
+
+/// Client measuring the latency of the broadcast messages
+class Spectator: public net::NetClient
+{
+  public:
+    std::vector<double> latencies;  ///< Latency of each broadcast message (in ms)
+
+    Spectator():
+      NetClient(VALIDATION_SALT)
+    {
+
+    }
+
+  protected:
+    void message_cb(const net::Packet &packet) override
+    {
+      std::string data = packet.get_data();
+
+      if (data.compare(0, 6, "relay:") != 0)
+        return;
+
+      uint64_t sent_time = strtoull(data.c_str() + 6, nullptr, 10);
+      latencies.push_back((now_ns() - sent_time) * 1e-6);
+    }
+};
+
+
+static int run_relay(const Options &options)
+{
+  int relay_count = options.get("relays", 4);
+  size_t fanout = options.get("fanout", 2);
+  int spectator_count = options.get("spectators", 64);
+  double duration = options.get("duration", 5.0);
+  double rate = options.get("rate", 20.0);
+  size_t size = options.get("size", 256);
+  const size_t max_peer_count = spectator_count + relay_count + 1;
+
+  // The relays are placed during the first second, the spectators connect during the next one
+  const auto start = std::chrono::steady_clock::now();
+  const auto broadcast_start = start + std::chrono::seconds(2);
+  const auto end = broadcast_start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::duration<double>(duration)
+  );
+  const auto stop = end + std::chrono::milliseconds(500);
+  std::vector<pid_t> pids;
+
+  // Origin, in its own process
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    BroadcastServer origin(SERVER_PORT, max_peer_count);
+    origin.set_verbose(false);
+    origin.get_relay_tree().set_fanout(fanout);
+
+    if (!origin.init())
+      _exit(1);
+
+    const auto send_interval = std::chrono::nanoseconds((uint64_t)(1e9 / rate));
+    auto next_send = broadcast_start;
+    uint64_t sent = 0;
+
+    while (std::chrono::steady_clock::now() < stop) {
+      origin.handle_events();
+      auto t = std::chrono::steady_clock::now();
+
+      if (t >= next_send && t < end) {
+        std::string data = "relay:" + std::to_string(now_ns()) + ":";
+        data.resize(std::max(size, data.size()), 'x');
+        origin.send_packet_to_all(net::Packet(net::Packet::Type::DATA, data), 0);
+        next_send += send_interval;
+        sent++;
+      }
+
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    ENetHost *host = origin.get_host();
+    printf(
+      "Origin: peers=%zu direct relays=%zu messages=%lu datagrams=%u bytes=%u\n",
+      origin.get_peers().count_connected(),
+      origin.get_relay_tree().get_children().size(),
+      (unsigned long)sent,
+      host->totalSentPackets,
+      host->totalSentData
+    );
+    fflush(stdout);
+    _exit(0);
+  }
+
+  pids.push_back(pid);
+
+  // Relays, each in its own process
+  for (int k = 0; k < relay_count; k++) {
+    pid = fork();
+
+    if (pid == 0) {
+      net::NetRelay relay(SERVER_PORT + 10 + k, VALIDATION_STR_SIZE, VALIDATION_SALT, max_peer_count);
+      relay.set_verbose(false);
+      relay.get_relay_tree().set_fanout(fanout);
+
+      if (!relay.init())
+        _exit(1);
+
+      // Let the origin start
+      std::this_thread::sleep_for(std::chrono::milliseconds(100 + 50 * k));
+      relay.connect("127.0.0.1", SERVER_PORT, 2.0);
+
+      while (std::chrono::steady_clock::now() < stop) {
+        relay.handle_events();
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+
+      const auto &stats = relay.get_stats();
+      ENetHost *host = relay.get_host();
+      printf(
+        "Relay %d: attached=%d peers=%zu redirections=%lu received=%lu forwarded=%lu datagrams=%u bytes=%u\n",
+        k,
+        relay.is_attached() ? 1 : 0,
+        relay.get_peers().count_connected(),
+        (unsigned long)stats.redirections,
+        (unsigned long)stats.received,
+        (unsigned long)stats.forwarded,
+        host->totalSentPackets,
+        host->totalSentData
+      );
+      fflush(stdout);
+      _exit(0);
+    }
+
+    pids.push_back(pid);
+  }
+
+  // Spectators, spread over the relays (or connected to the origin without relays)
+  std::this_thread::sleep_until(start + std::chrono::seconds(1));
+  std::vector<std::unique_ptr<Spectator>> spectators;
+
+  for (int k = 0; k < spectator_count; k++) {
+    auto spectator = std::make_unique<Spectator>();
+    spectator->set_verbose(false);
+
+    if (!spectator->init())
+      break;
+
+    int port = relay_count > 0 ? SERVER_PORT + 10 + k % relay_count : SERVER_PORT;
+    spectator->connect("127.0.0.1", port, 5.0);
+    spectators.push_back(std::move(spectator));
+  }
+
+  while (std::chrono::steady_clock::now() < stop) {
+    for (auto &spectator: spectators)
+      spectator->handle_events();
+
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  for (pid_t child: pids)
+    waitpid(child, nullptr, 0);
+
+  // Results
+  std::vector<double> latencies;
+  size_t complete_count = 0;
+  const size_t expected_count = rate * duration;
+
+  for (auto &spectator: spectators) {
+    latencies.insert(latencies.end(), spectator->latencies.begin(), spectator->latencies.end());
+
+    if (spectator->latencies.size() + 1 >= expected_count)
+      complete_count++;
+  }
+
+  printf(
+    "Relay: %d relays (fanout %zu), %d spectators, %.0f msg/s, %zu bytes, %.1f s\n",
+    relay_count, fanout, spectator_count, rate, size, duration
+  );
+  printf(
+    "Messages: delivered=%zu (%.1f%% of %zu), spectators with all messages=%zu\n",
+    latencies.size(),
+    100.0 * latencies.size() / std::max<size_t>(expected_count * spectators.size(), 1),
+    expected_count * spectators.size(),
+    complete_count
+  );
+  print_percentiles("Latency", latencies, "ms");
+
+  return 0;
+}
+
+
+// =============================================================================
+// Churn scenario
+//
+static int run_churn(const Options &options)
+{
+  int client_count = options.get("clients", 32);
+  int vanish_count = std::min<int>(options.get("vanish", client_count / 2), client_count);
+  bool lifecycle = options.get("lifecycle", 1) != 0;
+  int target = options.get("target", -1);
+  double idle_timeout = options.get("idle", 1000);
+
+  net::NetServer server(SERVER_PORT, VALIDATION_STR_SIZE, VALIDATION_SALT, client_count);
+  server.set_verbose(false);
+
+  net::PeerLifecycle::Config config;
+
+  if (lifecycle) {
+    config.idle_timeout = idle_timeout;
+
+    if (target >= 0)
+      config.capacity_target = target;
+  } else {
+    // Defaults of ENet, and no checks
+    config.validating = {500, 32, 5000, 30000};
+    config.validated = {500, 32, 5000, 30000};
+    config.silence_timeout = 0;
+    config.validation_timeout = 0;
+    config.idle_timeout = UINT32_MAX;
+  }
+
+  server.get_peer_lifecycle().set_config(config);
+
+  if (!server.init())
+    return 1;
+
+  std::vector<std::unique_ptr<EchoClient>> clients;
+
+  for (int k = 0; k < client_count; k++) {
+    auto client = std::make_unique<EchoClient>();
+    client->set_verbose(false);
+
+    if (!client->init())
+      return 1;
+
+    client->connect("127.0.0.1", SERVER_PORT, 10.0);
+    clients.push_back(std::move(client));
+  }
+
+  // Services the server and the remaining clients until a condition holds, returns the time taken (in s)
+  auto run_until = [&](auto condition, double timeout) {
+    const auto start = std::chrono::steady_clock::now();
+
+    while (!condition()) {
+      server.handle_events();
+
+      for (auto &client: clients)
+        client->handle_events();
+
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      if (elapsed > timeout)
+        return -1.0;
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  double connection_time = run_until([&]() {
+    return server.get_peers().count_connected() == (size_t)client_count;
+  }, 10.0);
+
+  if (connection_time < 0) {
+    fprintf(stderr, "Clients could not connect\n");
+    return 1;
+  }
+
+  // The hosts of the vanishing clients are destroyed without disconnecting
+  clients.resize(client_count - vanish_count);
+
+  double reclaim_time = run_until([&]() {
+    return server.get_peers().count_connected() <= (size_t)(client_count - vanish_count);
+  }, 60.0);
+
+  printf(
+    "Churn: %d clients, %d vanishing, %s\n",
+    client_count, vanish_count, lifecycle ? "peer lifecycle" : "ENet timeouts"
+  );
+  printf("Connection of all clients: %.3f s\n", connection_time);
+
+  if (reclaim_time < 0)
+    printf("Slots of the vanished clients not reclaimed after 60 s\n");
+  else
+    printf("Slots of the vanished clients reclaimed in %.3f s\n", reclaim_time);
+
+  if (lifecycle && target >= 0 && target < client_count - vanish_count) {
+    double eviction_time = run_until([&]() {
+      return server.get_peers().count_connected() <= (size_t)target;
+    }, 60.0 + idle_timeout * 1e-3);
+
+    printf("Idle clients evicted down to %d in %.3f s\n", target, eviction_time);
+  }
+
+  const auto &stats = server.get_peer_lifecycle().get_stats();
+  printf(
+    "Lifecycle: disconnected=%lu half_open=%lu unvalidated=%lu evicted=%lu\n",
+    (unsigned long)stats.disconnected,
+    (unsigned long)stats.half_open,
+    (unsigned long)stats.unvalidated,
+    (unsigned long)stats.evicted
+  );
+
+  return 0;
+}
+
+
+// =============================================================================
+// MTU scenario
+//
+static int run_mtu(const Options &options)
+{
+  size_t path_mtu = options.get("mtu", 1200);
+  bool discovery = options.get("discovery", 1) != 0;
+  int message_count = options.get("messages", 1000);
+  size_t size = options.get("size", 0);
+
+  PolicyEchoServer<net::policy::MtuDiscovery> server(SERVER_PORT);
+  server.get_mtu().set_enabled(discovery);
+
+  if (!server.init())
+    return 1;
+
+  net::WanEmulator emulator;
+
+  if (!emulator.init(EMULATOR_PORT, "127.0.0.1", SERVER_PORT))
+    return 1;
+
+  net::LinkConditions conditions;
+  conditions.mtu = path_mtu;
+  emulator.set_conditions(net::WanEmulator::Direction::UPSTREAM, conditions);
+  emulator.set_conditions(net::WanEmulator::Direction::DOWNSTREAM, conditions);
+
+  PolicyEchoClient<net::policy::MtuDiscovery> client;
+  client.get_mtu().set_enabled(discovery);
+
+  if (!client.init("127.0.0.1", EMULATOR_PORT))
+    return 1;
+
+  // Services the server, the emulator and the client until a condition holds, returns the time taken (in s)
+  auto run_until = [&](auto condition, double timeout) {
+    const auto start = std::chrono::steady_clock::now();
+
+    while (!condition()) {
+      server.handle_events();
+      emulator.service();
+      client.handle_events();
+
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      if (elapsed > timeout)
+        return -1.0;
+
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  double search_time = run_until([&]() {
+    ENetPeer *server_peer = server.get_peer();
+
+    return client.is_validated() && server_peer != nullptr
+      && !client.get_mtu().is_searching(client.get_peer())
+      && !server.get_mtu().is_searching(server_peer);
+  }, 30.0);
+
+  if (search_time < 0) {
+    fprintf(stderr, "Client could not connect\n");
+    return 1;
+  }
+
+  ENetPeer *server_peer = server.get_peer();
+  const size_t max_payload = std::min(
+    client.get_max_payload(client.get_peer()),
+    server.get_max_payload(server_peer)
+  );
+
+  // Largest message whose encoding fits in a single datagram
+  if (size == 0) {
+    std::string empty;
+    net::Packet(net::Packet::Type::DATA, "").serialise(empty);
+    size = max_payload > empty.size() + 1 ? max_payload - empty.size() - 1 : 1;
+  }
+
+  client.round_trip_times.clear();
+  client.sent = 0;
+
+  double transfer_time = run_until([&]() {
+    for (int k = 0; k < 16 && client.sent < (uint64_t)message_count; k++)
+      client.send_message(size);
+
+    return client.round_trip_times.size() >= (size_t)message_count;
+  }, 10.0);
+
+  printf("MTU: path of %zu bytes, %s\n", path_mtu, discovery ? "probed" : "ENet default");
+  printf(
+    "Peer MTU: client=%u server=%u (max payload %zu bytes), found in %.3f s\n",
+    (unsigned int)client.get_peer()->mtu,
+    (unsigned int)server_peer->mtu,
+    max_payload,
+    search_time
+  );
+  printf(
+    "Messages: size=%zu sent=%lu echoed=%zu",
+    size,
+    (unsigned long)client.sent,
+    client.round_trip_times.size()
+  );
+
+  if (transfer_time < 0)
+    printf(" (not all echoed after 10 s)\n");
+  else
+    printf(" in %.3f s\n", transfer_time);
+
+  print_percentiles("Round trip time", client.round_trip_times, "ms");
+
+  const char *names[2] = {"Client", "Server"};
+  const net::PathMtuProber *probers[2] = {&client.get_mtu(), &server.get_mtu()};
+
+  for (int k = 0; k < 2; k++) {
+    const auto &stats = probers[k]->get_stats();
+    printf(
+      "%s: packets=%lu fragmented=%lu (%.1f %%) fragments=%lu probes sent=%lu acknowledged=%lu lost=%lu\n",
+      names[k],
+      (unsigned long)stats.packets_sent,
+      (unsigned long)stats.packets_fragmented,
+      100.0 * probers[k]->get_fragmentation_rate(),
+      (unsigned long)stats.fragments_sent,
+      (unsigned long)stats.probes_sent,
+      (unsigned long)stats.probes_acknowledged,
+      (unsigned long)stats.probes_lost
+    );
+  }
+
+  printf(
+    "Datagrams larger than the path: upstream=%lu downstream=%lu\n",
+    (unsigned long)emulator.get_stats(net::WanEmulator::Direction::UPSTREAM).too_large,
+    (unsigned long)emulator.get_stats(net::WanEmulator::Direction::DOWNSTREAM).too_large
+  );
+
+  return 0;
+}
+
+
+// =============================================================================
+// Hand-over scenario
+//
+/// Name shared by the generations of servers
+const std::string HANDOVER_NAME = "bench";
+
+
+/**
+ * \brief  Runs a generation of the echo server in its own process
+ *
+ * The first generation creates the host, the next one takes it over. Either one
+ * hands over to the next generation, and then exits.
+ *
+ * \return  The process of the server
+ */
+static pid_t spawn_generation(bool successor)
+{
+  pid_t pid = fork();
+
+  if (pid != 0)
+    return pid;
+
+  EchoServer server(SERVER_PORT);
+  server.set_verbose(false);
+
+  bool success = successor
+    ? server.take_over(HANDOVER_NAME, std::chrono::seconds(5))
+    : server.init();
+
+  if (!success || !server.listen_for_successor(HANDOVER_NAME))
+    _exit(1);
+
+  if (successor) {
+    server.handle_events();
+    const auto &stats = server.get_handover_stats();
+
+    printf(
+      "Successor: %zu peers carried on, %zu dropped, snapshot of %zu bytes, no service during %.2f ms\n",
+      stats.peers_handed_over, stats.peers_dropped, stats.snapshot_size, stats.gap * 1e-3
+    );
+    fflush(stdout);
+  }
+
+  while (!server.is_handed_over()) {
+    server.wait(std::chrono::milliseconds(1));
+    server.handle_events();
+  }
+
+  const auto &stats = server.get_handover_stats();
+  printf(
+    "Predecessor: peers drained in %.2f ms, %zu handed over, %zu dropped\n",
+    stats.drain_time * 1e-3, stats.peers_handed_over, stats.peers_dropped
+  );
+  fflush(stdout);
+  _exit(0);
+}
+
+
+static int run_handover(const Options &options)
+{
+  int client_count = std::min<int>(options.get("clients", 8), 32);
+  double rate = options.get("rate", 100);
+  double duration = options.get("duration", 2.0);
+
+  pid_t predecessor_pid = spawn_generation(false);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::vector<std::unique_ptr<EchoClient>> clients;
+
+  for (int k = 0; k < client_count; k++) {
+    auto client = std::make_unique<EchoClient>();
+    client->set_verbose(false);
+
+    if (!client->init())
+      return 1;
+
+    client->connect("127.0.0.1", SERVER_PORT, 10.0);
+    clients.push_back(std::move(client));
+  }
+
+  auto all_validated = [&]() {
+    return std::all_of(clients.begin(), clients.end(), [](auto &client) { return client->is_validated(); });
+  };
+
+  const auto connection_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+  while (!all_validated() && std::chrono::steady_clock::now() < connection_deadline) {
+    for (auto &client: clients)
+      client->handle_events();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (!all_validated()) {
+    fprintf(stderr, "Clients could not connect\n");
+    kill(predecessor_pid, SIGKILL);
+    waitpid(predecessor_pid, nullptr, 0);
+    return 1;
+  }
+
+  // Messages are sent all along, the successor starting half-way
+  const uint64_t period = 1e9 / std::max(rate, 1.0);
+  const uint64_t start = now_ns();
+  uint64_t next_send = start;
+  pid_t successor_pid = -1;
+
+  std::vector<uint64_t> last_echo(clients.size(), start);
+  std::vector<size_t> echo_count(clients.size(), 0);
+  double longest_silence = 0;  // in ms
+
+  while (now_ns() - start < duration * 1e9) {
+    const uint64_t time = now_ns();
+
+    if (successor_pid < 0 && time - start >= duration * 0.5e9)
+      successor_pid = spawn_generation(true);
+
+    if (time >= next_send) {
+      for (auto &client: clients)
+        client->send_message(64);
+
+      next_send += period;
+    }
+
+    for (size_t k = 0; k < clients.size(); k++) {
+      clients[k]->handle_events();
+
+      if (clients[k]->round_trip_times.size() != echo_count[k]) {
+        const uint64_t echo_time = now_ns();
+        longest_silence = std::max(longest_silence, (echo_time - last_echo[k]) * 1e-6);
+        last_echo[k] = echo_time;
+        echo_count[k] = clients[k]->round_trip_times.size();
+      }
+    }
+
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+
+  int disconnected = 0;
+  uint64_t sent = 0;
+  std::vector<double> round_trip_times;
+
+  for (auto &client: clients) {
+    disconnected += !client->is_validated();
+    sent += client->sent;
+    round_trip_times.insert(round_trip_times.end(), client->round_trip_times.begin(), client->round_trip_times.end());
+  }
+
+  for (pid_t pid: {predecessor_pid, successor_pid}) {
+    if (pid > 0) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+  }
+
+  printf("Hand-over: %d clients, %.0f msg/s per client\n", client_count, rate);
+  printf(
+    "Messages: %zu echoed out of %lu, %d clients disconnected\n",
+    round_trip_times.size(), (unsigned long)sent, disconnected
+  );
+  printf("Longest time without an echo for a client: %.2f ms\n", longest_silence);
+  print_percentiles("Round trip time", round_trip_times, "ms");
+
+  return 0;
+}
+
+
+// =============================================================================
+// Encoding scenario
+//
+/// Typical state message of a game entity
+struct EntityState
+{
+  uint32_t id;
+  float position[3];
+  float velocity[3];
+  float yaw;
+  uint8_t health;
+  uint16_t ammo;
+  bool alive;
+  bool crouching;
+  bool firing;
+  std::string name;
+
+  template <class Archive>
+  void serialize(Archive &ar)
+  {
+    ar(
+      net::varint(id),
+      net::quantized(position, -4096.0, 4096.0, 20),
+      net::quantized(velocity, -64.0, 64.0, 12),
+      net::quantized(yaw, -3.1416, 3.1416, 10),
+      net::ranged(health, 0, 100),
+      net::ranged(ammo, 0, 999),
+      alive, crouching, firing,
+      name
+    );
+  }
+};
+
+
+/// Measures the size and throughput of an archive on the given messages
+template <class OutputArchive, class InputArchive>
+static void bench_archive(const char *name, std::vector<EntityState> &states)
+{
+  std::vector<std::string> encoded(states.size());
+  size_t total_size = 0;
+
+  auto t0 = std::chrono::steady_clock::now();
+
+  for (size_t k = 0; k < states.size(); k++) {
+    std::ostringstream os;
+
+    {
+      OutputArchive oarchive(os);
+      oarchive(states[k]);
+    }
+
+    encoded[k] = os.str();
+    total_size += encoded[k].size();
+  }
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  for (size_t k = 0; k < states.size(); k++) {
+    std::istringstream is(encoded[k]);
+    InputArchive iarchive(is);
+    iarchive(states[k]);
+  }
+
+  auto t2 = std::chrono::steady_clock::now();
+  std::chrono::duration<double> encode_duration = t1 - t0;
+  std::chrono::duration<double> decode_duration = t2 - t1;
+
+  printf(
+    "%-16s %8.1f bytes/msg %12.0f enc/s %12.0f dec/s\n",
+    name,
+    (double)total_size / states.size(),
+    states.size() / encode_duration.count(),
+    states.size() / decode_duration.count()
+  );
+}
+
+
+static int run_encoding(const Options &options)
+{
+  size_t message_count = options.get("messages", 100000);
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> position(-4000.0f, 4000.0f);
+  std::uniform_real_distribution<float> velocity(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> yaw(-3.14f, 3.14f);
+  std::uniform_int_distribution<int> health(0, 100);
+  std::uniform_int_distribution<int> ammo(0, 999);
+  std::bernoulli_distribution flag(0.5);
+
+  std::vector<EntityState> states(message_count);
+
+  for (size_t k = 0; k < message_count; k++) {
+    EntityState &state = states[k];
+    state.id = k;
+
+    for (int i = 0; i < 3; i++) {
+      state.position[i] = position(rng);
+      state.velocity[i] = velocity(rng);
+    }
+
+    state.yaw = yaw(rng);
+    state.health = health(rng);
+    state.ammo = ammo(rng);
+    state.alive = flag(rng);
+    state.crouching = flag(rng);
+    state.firing = flag(rng);
+    state.name = "player" + std::to_string(k % 1000);
+  }
+
+  printf("Encoding: %zu entity state messages\n", message_count);
+  bench_archive<cereal::PortableBinaryOutputArchive, cereal::PortableBinaryInputArchive>(
+    "portable binary", states
+  );
+  bench_archive<net::BitPackedOutputArchive, net::BitPackedInputArchive>(
+    "bit-packed", states
+  );
+
+  return 0;
+}
+
+
+// =============================================================================
+// Main
+//
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <scenario> [options]\n", argv[0]);
+    return 1;
+  }
+
+  Options options(argc, argv, 2);
+  std::string scenario = argv[1];
+
+  if (scenario == "echo")
+    return run_echo(options);
+  else if (scenario == "socket")
+    return run_socket(options);
+  else if (scenario == "reactor")
+    return run_reactor(options);
+  else if (scenario == "ipc")
+    return run_ipc(options);
+  else if (scenario == "relay")
+    return run_relay(options);
+  else if (scenario == "churn")
+    return run_churn(options);
+  else if (scenario == "mtu")
+    return run_mtu(options);
+  else if (scenario == "handover")
+    return run_handover(options);
+  else if (scenario == "encoding")
+    return run_encoding(options);
+
+  fprintf(stderr, "Unknown scenario: %s\n", scenario.c_str());
+  return 1;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file
+ *
+ * \brief  Replays a recorded event log into a server, without any network
+ * \author Corentin Chauvin-Hameau
+ * \date   2023
+ *
+ * Usage: replay <log> [--fast] [--speed <factor>] [--loops <n>]
+ *
+ * By default the events are replayed with their recorded timing. With --fast,
+ * they are fed to the server as fast as possible, which is meant to profile and
+ * benchmark the handlers against real traffic.
+ */
+
+#include "net/server.hpp"
+#include "net/recorder.hpp"
+#include "net/packet.hpp"
+#include "enet/enet.h"
+#include "cereal/cereal.hpp"
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
+#include <thread>
+
+#include <cstring>
+#include <cstdlib>
+#include <stdio.h>
+
+
+/// Fake peers standing for the recorded ones, indexed by ENet peer index
+class ReplayPeers
+{
+  public:
+    /// Returns the fake peer corresponding to a record, resetting it on connection
+    ENetPeer* get(const net::EventRecord &record)
+    {
+      std::unique_ptr<ENetPeer> &peer = peers_[record.peer_id];
+
+      if (peer == nullptr || record.type == ENET_EVENT_TYPE_CONNECT) {
+        if (peer == nullptr)
+          peer = std::make_unique<ENetPeer>();
+
+        // A disconnected peer is never sent anything by ENet, so that the
+        // server handlers can run without any actual connection
+        memset(peer.get(), 0, sizeof(ENetPeer));
+        peer->state = ENET_PEER_STATE_DISCONNECTED;
+        peer->incomingPeerID = record.peer_id;
+        peer->address.host = record.peer_host;
+        peer->address.port = record.peer_port;
+      }
+
+      return peer.get();
+    }
+
+  private:
+    std::unordered_map<uint32_t, std::unique_ptr<ENetPeer>> peers_;
+};
+
+
+int main(int argc, char **argv)
+{
+  const int port = 1234;
+  const int validation_str_size = 128;
+  const std::string validation_salt = "Blektr!";
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <log> [--fast] [--speed <factor>] [--loops <n>]\n", argv[0]);
+    return 1;
+  }
+
+  bool fast = false;
+  double speed = 1.0;
+  int loops = 1;
+
+  for (int k = 2; k < argc; k++) {
+    if (strcmp(argv[k], "--fast") == 0)
+      fast = true;
+    else if (strcmp(argv[k], "--speed") == 0 && k + 1 < argc)
+      speed = atof(argv[++k]);
+    else if (strcmp(argv[k], "--loops") == 0 && k + 1 < argc)
+      loops = atoi(argv[++k]);
+  }
+
+  net::EventLogReader log;
+
+  if (!log.open(argv[1]))
+    return 1;
+
+  // The server host is never created, the events only go through its handlers
+  net::NetServer server(port, validation_str_size, validation_salt);
+
+  if (!server.init_offline())
+    return 1;
+
+  ReplayPeers peers;
+  size_t event_count = 0;
+  size_t skipped_count = 0;
+  std::chrono::duration<double> handler_duration(0);
+  auto replay_start = std::chrono::steady_clock::now();
+
+  for (int loop = 0; loop < loops; loop++) {
+    auto loop_start = std::chrono::steady_clock::now();
+    log.rewind();
+
+    net::EventRecord record;
+    const uint8_t *payload;
+
+    while (log.next(record, payload)) {
+      ENetPeer *peer = peers.get(record);
+
+      // Outbound packets are not replayed, but the validation strings that were
+      // sent must be restored so that the recorded answers are accepted
+      if (record.flags & net::EventRecord::FLAG_OUTBOUND) {
+        net::Packet packet;
+
+        try {
+          packet.load_serialised((const char*)payload, record.length);
+        } catch (const cereal::Exception &exception) {
+          fprintf(stderr, "Skipping an undecodable outbound packet: %s\n", exception.what());
+          skipped_count++;
+          continue;
+        }
+
+        if (packet.get_type() == net::Packet::Type::VALIDATION_STR) {
+          net::ServerPeers::Context *context = server.get_peers().get_context(peer);
+
+          if (context != nullptr)
+            context->validation_str = packet.get_data();
+        }
+
+        continue;
+      }
+
+      if (!fast) {
+        auto timestamp = std::chrono::nanoseconds(record.timestamp);
+        std::this_thread::sleep_until(
+          loop_start + std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp / speed)
+        );
+      }
+
+      ENetEvent event;
+      event.type = static_cast<ENetEventType>(record.type);
+      event.peer = peer;
+      event.channelID = record.channel_id;
+      event.data = record.data;
+      event.packet = nullptr;
+
+      if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+        enet_uint32 flags = record.flags
+          & (ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_UNSEQUENCED | ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT);
+        event.packet = enet_packet_create(payload, record.length, flags);
+      }
+
+      auto t0 = std::chrono::steady_clock::now();
+
+      try {
+        server.dispatch_event(event);
+      } catch (const cereal::Exception &exception) {
+        // The packet is only destroyed once handled
+        if (event.packet != nullptr)
+          enet_packet_destroy(event.packet);
+
+        fprintf(stderr, "Skipping an undecodable packet: %s\n", exception.what());
+        skipped_count++;
+        continue;
+      }
+
+      handler_duration += std::chrono::steady_clock::now() - t0;
+      event_count++;
+    }
+  }
+
+  std::chrono::duration<double> total_duration = std::chrono::steady_clock::now() - replay_start;
+
+  fprintf(stderr,
+    "Replayed %zu events in %.3f s (%.0f events/s, %.3f us per event in handlers)\n",
+    event_count,
+    total_duration.count(),
+    event_count / total_duration.count(),
+    event_count > 0 ? 1e6 * handler_duration.count() / event_count : 0.0
+  );
+
+  if (skipped_count > 0)
+    fprintf(stderr, "Skipped %zu corrupt records\n", skipped_count);
+
+  return 0;
+}